@@ -31,4 +31,212 @@ ALWAYS_INLINE static void _Write(Memory *, Reg &reg,
   reg.aword = val;
 }
 
+// Native vector types. The `*v*_t` types in `Types.h` are structures that
+// wrap arrays, so operating on their `elems` lowers to one scalar operation
+// per element. Operating on these types instead lets clang emit LLVM vector
+// IR (e.g. `add <16 x i8>`) directly.
+template <typename T>
+struct NativeVectorType;
+
+#define MAKE_NATIVE_VECTOR(base_type, prefix, nelems, uprefix) \
+    typedef base_type prefix ## v ## nelems ## _native_t \
+        __attribute__((vector_size(sizeof(base_type) * nelems))); \
+    \
+    template <> \
+    struct NativeVectorType<prefix ## v ## nelems ## _t> { \
+      typedef prefix ## v ## nelems ## _native_t T; \
+      typedef uprefix ## v ## nelems ## _t UV; \
+    };
+
+MAKE_NATIVE_VECTOR(uint8_t, uint8, 8, uint8)
+MAKE_NATIVE_VECTOR(uint8_t, uint8, 16, uint8)
+MAKE_NATIVE_VECTOR(uint16_t, uint16, 4, uint16)
+MAKE_NATIVE_VECTOR(uint16_t, uint16, 8, uint16)
+MAKE_NATIVE_VECTOR(uint32_t, uint32, 2, uint32)
+MAKE_NATIVE_VECTOR(uint32_t, uint32, 4, uint32)
+MAKE_NATIVE_VECTOR(uint64_t, uint64, 1, uint64)
+MAKE_NATIVE_VECTOR(uint64_t, uint64, 2, uint64)
+
+MAKE_NATIVE_VECTOR(int8_t, int8, 8, uint8)
+MAKE_NATIVE_VECTOR(int8_t, int8, 16, uint8)
+MAKE_NATIVE_VECTOR(int16_t, int16, 4, uint16)
+MAKE_NATIVE_VECTOR(int16_t, int16, 8, uint16)
+MAKE_NATIVE_VECTOR(int32_t, int32, 2, uint32)
+MAKE_NATIVE_VECTOR(int32_t, int32, 4, uint32)
+MAKE_NATIVE_VECTOR(int64_t, int64, 1, uint64)
+MAKE_NATIVE_VECTOR(int64_t, int64, 2, uint64)
+
+MAKE_NATIVE_VECTOR(float32_t, float32, 2, uint32)
+MAKE_NATIVE_VECTOR(float32_t, float32, 4, uint32)
+MAKE_NATIVE_VECTOR(float64_t, float64, 1, uint64)
+MAKE_NATIVE_VECTOR(float64_t, float64, 2, uint64)
+
+#undef MAKE_NATIVE_VECTOR
+
+// Convert an aggregate vector into its native vector equivalent. The copy
+// is folded away by SROA.
+template <typename V>
+ALWAYS_INLINE static
+typename NativeVectorType<V>::T NativeVec(const V &vec) {
+  typename NativeVectorType<V>::T nvec;
+  static_assert(sizeof(nvec) == sizeof(vec),
+                "Native and aggregate vector sizes don't match.");
+  __builtin_memcpy(&nvec, &vec, sizeof(nvec));
+  return nvec;
+}
+
+// Convert a native vector back into an aggregate vector of type `V`.
+template <typename V, typename N>
+ALWAYS_INLINE static V FromNativeVec(const N &nvec) {
+  V vec;
+  static_assert(sizeof(nvec) == sizeof(vec),
+                "Native and aggregate vector sizes don't match.");
+  __builtin_memcpy(&vec, &nvec, sizeof(vec));
+  return vec;
+}
+
+// Element-wise select between two native vectors, where `mask` is the
+// all-ones/all-zeros result of a native vector comparison.
+template <typename N, typename M>
+ALWAYS_INLINE static N NativeSelect(M mask, N if_true, N if_false) {
+  auto true_bits = (M) if_true;
+  auto false_bits = (M) if_false;
+  return (N) ((true_bits & mask) | (false_bits & ~mask));
+}
+
+#define MAKE_NATIVE_BINOP(name, op) \
+    template <typename V> \
+    ALWAYS_INLINE static V name(const V &lhs, const V &rhs) { \
+      return FromNativeVec<V>(NativeVec(lhs) op NativeVec(rhs)); \
+    }
+
+MAKE_NATIVE_BINOP(VAdd, +)
+MAKE_NATIVE_BINOP(VSub, -)
+MAKE_NATIVE_BINOP(VMul, *)
+MAKE_NATIVE_BINOP(VAnd, &)
+MAKE_NATIVE_BINOP(VOr, |)
+MAKE_NATIVE_BINOP(VXor, ^)
+
+#undef MAKE_NATIVE_BINOP
+
+template <typename V>
+ALWAYS_INLINE static V VNot(const V &vec) {
+  return FromNativeVec<V>(~NativeVec(vec));
+}
+
+// Comparisons produce an unsigned vector whose elements are all ones if the
+// comparison is true, and all zeroes otherwise. This matches the `CM*`
+// family of instructions.
+#define MAKE_NATIVE_CMP(name, op) \
+    template <typename V> \
+    ALWAYS_INLINE static \
+    typename NativeVectorType<V>::UV name(const V &lhs, const V &rhs) { \
+      return FromNativeVec<typename NativeVectorType<V>::UV>( \
+          NativeVec(lhs) op NativeVec(rhs)); \
+    }
+
+MAKE_NATIVE_CMP(VCmpEq, ==)
+MAKE_NATIVE_CMP(VCmpNeq, !=)
+MAKE_NATIVE_CMP(VCmpLt, <)
+MAKE_NATIVE_CMP(VCmpLte, <=)
+MAKE_NATIVE_CMP(VCmpGt, >)
+MAKE_NATIVE_CMP(VCmpGte, >=)
+
+#undef MAKE_NATIVE_CMP
+
+template <typename V>
+ALWAYS_INLINE static
+typename NativeVectorType<V>::UV VCmpTst(const V &lhs, const V &rhs) {
+  return FromNativeVec<typename NativeVectorType<V>::UV>(
+      (NativeVec(lhs) & NativeVec(rhs)) != 0);
+}
+
+template <typename V>
+ALWAYS_INLINE static V VMin(const V &lhs, const V &rhs) {
+  auto l = NativeVec(lhs);
+  auto r = NativeVec(rhs);
+  return FromNativeVec<V>(NativeSelect(l < r, l, r));
+}
+
+template <typename V>
+ALWAYS_INLINE static V VMax(const V &lhs, const V &rhs) {
+  auto l = NativeVec(lhs);
+  auto r = NativeVec(rhs);
+  return FromNativeVec<V>(NativeSelect(l < r, r, l));
+}
+
+// Floating point minimum/maximum, where an unordered comparison of two
+// elements produces a `NAN` element.
+template <typename V>
+ALWAYS_INLINE static V VFMin(const V &lhs, const V &rhs) {
+  auto l = NativeVec(lhs);
+  auto r = NativeVec(rhs);
+  decltype(l) nan = {};
+  auto res = NativeSelect(l < r, l, r);
+  return FromNativeVec<V>(NativeSelect((l != l) | (r != r), nan + NAN, res));
+}
+
+template <typename V>
+ALWAYS_INLINE static V VFMax(const V &lhs, const V &rhs) {
+  auto l = NativeVec(lhs);
+  auto r = NativeVec(rhs);
+  decltype(l) nan = {};
+  auto res = NativeSelect(l > r, l, r);
+  return FromNativeVec<V>(NativeSelect((l != l) | (r != r), nan + NAN, res));
+}
+
+// Broadcast `val` into every element of a vector.
+template <typename V>
+ALWAYS_INLINE static V VSplat(typename VectorType<V>::BT val) {
+  typename NativeVectorType<V>::T nvec = {};
+  return FromNativeVec<V>(nvec + val);
+}
+
+// Split the concatenation of `lhs` and `rhs` into its even- and odd-indexed
+// elements. The element accesses are in terms of the native vectors, and so
+// LLVM folds them into a pair of `shufflevector`s.
+template <typename V>
+ALWAYS_INLINE static void VUnzip(const V &lhs, const V &rhs,
+                                 V &evens, V &odds) {
+  enum : size_t {
+    kHalf = VectorType<V>::kNumElems / 2
+  };
+  auto l = NativeVec(lhs);
+  auto r = NativeVec(rhs);
+  decltype(l) e = {};
+  decltype(l) o = {};
+  _Pragma("unroll")
+  for (size_t i = 0; i < kHalf; ++i) {
+    e[i] = l[2 * i];
+    o[i] = l[2 * i + 1];
+    e[kHalf + i] = r[2 * i];
+    o[kHalf + i] = r[2 * i + 1];
+  }
+  evens = FromNativeVec<V>(e);
+  odds = FromNativeVec<V>(o);
+}
+
+// Pairwise operations (e.g. `ADDP`) combine adjacent elements of the
+// concatenation of `lhs` and `rhs`.
+template <typename V, typename B>
+ALWAYS_INLINE static V VPairwise(const V &lhs, const V &rhs, B binop) {
+  V evens;
+  V odds;
+  VUnzip(lhs, rhs, evens, odds);
+  return binop(evens, odds);
+}
+
+// Reduce a vector to a single element by repeatedly applying `binop`
+// pairwise. This associates elements the same way as a balanced tree of
+// scalar operations, i.e. `(v0 op v1) op (v2 op v3)`.
+template <typename V, typename B>
+ALWAYS_INLINE static
+typename VectorType<V>::BT VReduce(V vec, B binop) {
+  _Pragma("unroll")
+  for (size_t n = VectorType<V>::kNumElems; n > 1; n /= 2) {
+    vec = VPairwise(vec, vec, binop);
+  }
+  return vec.elems[0];
+}
+
 }  // namespace
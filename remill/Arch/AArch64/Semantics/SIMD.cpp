@@ -18,19 +18,19 @@ namespace {
 
 template <typename S>
 DEF_SEM(ORR_Vec, V128W dst, S src1, S src2) {
-  UWriteV64(dst, UOrV64(UReadV64(src1), UReadV64(src2)));
+  UWriteV64(dst, VOr(UReadV64(src1), UReadV64(src2)));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(AND_Vec, V128W dst, S src1, S src2) {
-  UWriteV64(dst, UAndV64(UReadV64(src1), UReadV64(src2)));
+  UWriteV64(dst, VAnd(UReadV64(src1), UReadV64(src2)));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(BIC_Vec, V128W dst, S src1, S src2) {
-  UWriteV64(dst, UAndV64(UReadV64(src1), UNotV64(UReadV64(src2))));
+  UWriteV64(dst, VAnd(UReadV64(src1), VNot(UReadV64(src2))));
   return memory;
 }
 
@@ -39,9 +39,9 @@ DEF_SEM(EOR_Vec, V128W dst, S src1, S src2) {
   auto operand4 = UReadV64(src1);
   auto operand1 = UReadV64(src2);
   auto operand2 = UClearV64(operand4);
-  auto operand3 = UNotV64(operand2);
-  UWriteV64(dst, UXorV64(
-      operand1, UAndV64(UXorV64(operand2, operand4), operand3)));
+  auto operand3 = VNot(operand2);
+  UWriteV64(dst, VXor(
+      operand1, VAnd(VXor(operand2, operand4), operand3)));
   return memory;
 }
 
@@ -50,8 +50,8 @@ DEF_SEM(BIT_Vec, V128W dst, S dst_src, S src1, S src2) {
   auto operand4 = UReadV64(src1);
   auto operand1 = UReadV64(dst_src);
   auto operand3 = UReadV64(src2);
-  UWriteV64(dst, UXorV64(
-      operand1, UAndV64(UXorV64(operand1, operand4), operand3)));
+  UWriteV64(dst, VXor(
+      operand1, VAnd(VXor(operand1, operand4), operand3)));
   return memory;
 }
 
@@ -59,9 +59,9 @@ template <typename S>
 DEF_SEM(BIF_Vec, V128W dst, S dst_src, S src1, S src2) {
   auto operand4 = UReadV64(src1);
   auto operand1 = UReadV64(dst_src);
-  auto operand3 = UNotV64(UReadV64(src2));
-  UWriteV64(dst, UXorV64(
-      operand1, UAndV64(UXorV64(operand1, operand4), operand3)));
+  auto operand3 = VNot(UReadV64(src2));
+  UWriteV64(dst, VXor(
+      operand1, VAnd(VXor(operand1, operand4), operand3)));
   return memory;
 }
 
@@ -70,8 +70,8 @@ DEF_SEM(BSL_Vec, V128W dst, S dst_src, S src1, S src2) {
   auto operand4 = UReadV64(src1);
   auto operand1 = UReadV64(src2);
   auto operand3 = UReadV64(dst_src);
-  UWriteV64(dst, UXorV64(
-      operand1, UAndV64(UXorV64(operand1, operand4), operand3)));
+  UWriteV64(dst, VXor(
+      operand1, VAnd(VXor(operand1, operand4), operand3)));
   return memory;
 }
 
@@ -125,12 +125,7 @@ namespace {
     template <typename V> \
     DEF_SEM(DUP_ ## size, V128W dst, R64 src) { \
       auto val = TruncTo<uint ## size ## _t>(Read(src)); \
-      V vec = {}; \
-      _Pragma("unroll") \
-      for (auto &element : vec.elems) { \
-        element = val; \
-      } \
-      UWriteV ## size(dst, vec); \
+      UWriteV ## size(dst, VSplat<V>(val)); \
       return memory; \
     }
 
@@ -153,30 +148,12 @@ DEF_ISEL(DUP_ASIMDINS_DR_R_2D) = DUP_64<uint64v2_t>;
 
 namespace {
 
-template <typename T>
-ALWAYS_INLINE static T UMin(T lhs, T rhs) {
-  return lhs < rhs ? lhs : rhs;
-}
-
-template <typename T>
-ALWAYS_INLINE static T UMax(T lhs, T rhs) {
-  return lhs < rhs ? rhs : lhs;
-}
-
-#define SMin UMin
-#define SMax UMax
-
 #define MAKE_BROADCAST(op, prefix, binop, size) \
     template <typename S, typename V> \
     DEF_SEM(op ## _ ## size, V128W dst, S src1, S src2) { \
       auto vec1 = prefix ## ReadV ## size (src1); \
       auto vec2 = prefix ## ReadV ## size (src2); \
-      V sum = {}; \
-      _Pragma("unroll") \
-      for (size_t i = 0, max_i = NumVectorElems(sum); i < max_i; ++i) { \
-        sum.elems[i] = prefix ## binop(prefix ## ExtractV ## size(vec1, i), \
-                                       prefix ## ExtractV ## size(vec2, i)); \
-      } \
+      V sum = V ## binop(vec1, vec2); \
       prefix ## WriteV ## size(dst, sum); \
       return memory; \
     }
@@ -261,18 +238,9 @@ namespace {
     template <typename S, typename V> \
     DEF_SEM(op ## _ ## size, V128W dst, S src1, I ## size imm) { \
       auto vec1 = prefix ## ReadV ## size (src1); \
-      auto ucmp_val = Read(imm); \
-      auto cmp_val = Signed(ucmp_val); \
-      decltype(ucmp_val) zeros = 0; \
-      decltype(ucmp_val) ones = ~zeros; \
-      V res = {}; \
-      _Pragma("unroll") \
-      for (size_t i = 0, max_i = NumVectorElems(res); i < max_i; ++i) { \
-        res.elems[i] = Select( \
-            prefix ## binop(prefix ## ExtractV ## size(vec1, i), cmp_val), \
-            ones, \
-            zeros); \
-      } \
+      auto cmp_val = Signed(Read(imm)); \
+      auto vec2 = VSplat<decltype(vec1)>(cmp_val); \
+      V res = V ## binop(vec1, vec2); \
       UWriteV ## size(dst, res); \
       return memory; \
     }
@@ -361,26 +329,11 @@ namespace {
     DEF_SEM(op ## _ ## size, V128W dst, S src1, S src2) { \
       auto vec1 = prefix ## ReadV ## size (src1); \
       auto vec2 = prefix ## ReadV ## size (src2); \
-      uint ## size ## _t zeros = 0; \
-      uint ## size ## _t ones = ~zeros; \
-      V res = {}; \
-      _Pragma("unroll") \
-      for (size_t i = 0, max_i = NumVectorElems(res); i < max_i; ++i) { \
-        res.elems[i] = Select( \
-            prefix ## binop(prefix ## ExtractV ## size(vec1, i), \
-                            prefix ## ExtractV ## size(vec2, i)), \
-            ones, \
-            zeros); \
-      } \
+      V res = V ## binop(vec1, vec2); \
       UWriteV ## size(dst, res); \
       return memory; \
     }
 
-template <typename T>
-ALWAYS_INLINE static bool UCmpTst(T lhs, T rhs) {
-  return UCmpNeq(UAnd(lhs, rhs), T(0));
-}
-
 MAKE_CMP_BROADCAST(CMPEQ, S, CmpEq, 8)
 MAKE_CMP_BROADCAST(CMPEQ, S, CmpEq, 16)
 MAKE_CMP_BROADCAST(CMPEQ, S, CmpEq, 32)
@@ -447,21 +400,7 @@ namespace {
     DEF_SEM(op ## _ ## size, V128W dst, S src1, S src2) { \
       auto vec1 = prefix ## ReadV ## size (src1); \
       auto vec2 = prefix ## ReadV ## size (src2); \
-      V res = {}; \
-      size_t max_i = NumVectorElems(res); \
-      size_t j = 0; \
-      _Pragma("unroll") \
-      for (size_t i = 0; i < max_i; i += 2) { \
-        res.elems[j++] = prefix ## binop( \
-            prefix ## ExtractV ## size(vec1, i), \
-            prefix ## ExtractV ## size(vec1, i + 1)); \
-      } \
-      _Pragma("unroll") \
-      for (size_t i = 0; i < max_i; i += 2) { \
-        res.elems[j++] = prefix ## binop( \
-            prefix ## ExtractV ## size(vec2, i), \
-            prefix ## ExtractV ## size(vec2, i + 1)); \
-      } \
+      V res = VPairwise(vec1, vec2, V ## binop<V>); \
       prefix ## WriteV ## size(dst, res); \
       return memory; \
     }
@@ -529,213 +468,110 @@ DEF_ISEL(SMAXP_ASIMDSAME_ONLY_4S) = SMAXP_32<V128, int32v4_t>;
 
 namespace {
 
-template <typename V, typename B>
-ALWAYS_INLINE static auto Reduce2(const V &vec, B binop, size_t base=0)
-    -> decltype(binop(vec.elems[0], vec.elems[1])) {
-  return binop(vec.elems[base + 0], vec.elems[base + 1]);
-}
-
-template <typename V, typename B>
-ALWAYS_INLINE static auto Reduce4(const V &vec, B binop, size_t base=0)
-    -> decltype(binop(vec.elems[0], vec.elems[1])) {
-  auto lo = Reduce2(vec, binop, base + 0);
-  auto hi = Reduce2(vec, binop, base + 2);
-  return binop(lo, hi);
-}
-
-template <typename V, typename B>
-ALWAYS_INLINE static auto Reduce8(const V &vec, B binop, size_t base=0)
-    -> decltype(binop(vec.elems[0], vec.elems[1])) {
-  auto lo = Reduce4(vec, binop, base + 0);
-  auto hi = Reduce4(vec, binop, base + 4);
-  return binop(lo, hi);
-}
-
-template <typename V, typename B>
-ALWAYS_INLINE static auto Reduce16(const V &vec, B binop, size_t base=0)
-    -> decltype(binop(vec.elems[0], vec.elems[1])) {
-  auto lo = Reduce8(vec, binop, base + 0);
-  auto hi = Reduce8(vec, binop, base + 8);
-  return binop(lo, hi);
-}
-
-template <typename V, typename B>
-ALWAYS_INLINE static auto Reduce(const V &vec, B binop)
-    -> decltype(Reduce2(vec, binop)) {
-  switch (NumVectorElems(vec)) {
-    case 2: return Reduce2(vec, binop);
-    case 4: return Reduce4(vec, binop);
-    case 8: return Reduce8(vec, binop);
-    case 16: return Reduce16(vec, binop);
-    default: __builtin_unreachable();
-  }
-}
-
 template <typename S>
 DEF_SEM(ADDV_8_Reduce, V128W dst, S src) {
-  auto vec = SReadV8(src);
-  UWriteV8(dst, Unsigned(Reduce(vec, SAdd8)));
+  auto vec = UReadV8(src);
+  UWriteV8(dst, VReduce(vec, VAdd<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(ADDV_16_Reduce, V128W dst, S src) {
-  auto vec = SReadV16(src);
-  UWriteV16(dst, Unsigned(Reduce(vec, SAdd16)));
+  auto vec = UReadV16(src);
+  UWriteV16(dst, VReduce(vec, VAdd<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(ADDV_32_Reduce, V128W dst, S src) {
-  auto vec = SReadV32(src);
-  UWriteV32(dst, Unsigned(Reduce(vec, SAdd32)));
+  auto vec = UReadV32(src);
+  UWriteV32(dst, VReduce(vec, VAdd<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(UMINV_8, V128W dst, S src) {
   auto vec = UReadV8(src);
-  auto val = std::numeric_limits<uint8_t>::max();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = UMin(elem, val);
-  }
-  UWriteV8(dst, val);
+  UWriteV8(dst, VReduce(vec, VMin<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(UMINV_16, V128W dst, S src) {
   auto vec = UReadV16(src);
-  auto val = std::numeric_limits<uint16_t>::max();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = UMin(elem, val);
-  }
-  UWriteV16(dst, val);
+  UWriteV16(dst, VReduce(vec, VMin<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(UMINV_32, V128W dst, S src) {
   auto vec = UReadV32(src);
-  auto val = std::numeric_limits<uint32_t>::max();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = UMin(elem, val);
-  }
-  UWriteV32(dst, val);
+  UWriteV32(dst, VReduce(vec, VMin<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(SMINV_8, V128W dst, S src) {
   auto vec = SReadV8(src);
-  auto val = std::numeric_limits<int8_t>::max();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = SMin(elem, val);
-  }
-  SWriteV8(dst, val);
+  SWriteV8(dst, VReduce(vec, VMin<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(SMINV_16, V128W dst, S src) {
   auto vec = SReadV16(src);
-  auto val = std::numeric_limits<int16_t>::max();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = SMin(elem, val);
-  }
-  SWriteV16(dst, val);
+  SWriteV16(dst, VReduce(vec, VMin<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(SMINV_32, V128W dst, S src) {
   auto vec = SReadV32(src);
-  auto val = std::numeric_limits<int32_t>::max();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = SMin(elem, val);
-  }
-  SWriteV32(dst, val);
+  SWriteV32(dst, VReduce(vec, VMin<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(UMAXV_8, V128W dst, S src) {
   auto vec = UReadV8(src);
-  auto val = std::numeric_limits<uint8_t>::min();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = UMax(elem, val);
-  }
-  UWriteV8(dst, val);
+  UWriteV8(dst, VReduce(vec, VMax<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(UMAXV_16, V128W dst, S src) {
   auto vec = UReadV16(src);
-  auto val = std::numeric_limits<uint16_t>::min();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = UMax(elem, val);
-  }
-  UWriteV16(dst, val);
+  UWriteV16(dst, VReduce(vec, VMax<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(UMAXV_32, V128W dst, S src) {
   auto vec = UReadV32(src);
-  auto val = std::numeric_limits<uint32_t>::min();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = UMax(elem, val);
-  }
-  UWriteV32(dst, val);
+  UWriteV32(dst, VReduce(vec, VMax<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(SMAXV_8, V128W dst, S src) {
   auto vec = SReadV8(src);
-  auto val = std::numeric_limits<int8_t>::min();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = SMax(elem, val);
-  }
-  SWriteV8(dst, val);
+  SWriteV8(dst, VReduce(vec, VMax<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(SMAXV_16, V128W dst, S src) {
   auto vec = SReadV16(src);
-  auto val = std::numeric_limits<int16_t>::min();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = SMax(elem, val);
-  }
-  SWriteV16(dst, val);
+  SWriteV16(dst, VReduce(vec, VMax<decltype(vec)>));
   return memory;
 }
 
 template <typename S>
 DEF_SEM(SMAXV_32, V128W dst, S src) {
   auto vec = SReadV32(src);
-  auto val = std::numeric_limits<int32_t>::min();
-  _Pragma("unroll")
-  for (auto elem : vec.elems) {
-    val = SMax(elem, val);
-  }
-  SWriteV32(dst, val);
+  SWriteV32(dst, VReduce(vec, VMax<decltype(vec)>));
   return memory;
 }
-
 }  // namespace
 
 DEF_ISEL(ADDV_ASIMDALL_ONLY_8B) = ADDV_8_Reduce<V64>;
@@ -770,68 +606,16 @@ DEF_ISEL(SMAXV_ASIMDALL_ONLY_4S) = SMAXV_32<V128>;
 
 namespace {
 
-template <typename T, typename I>
-ALWAYS_INLINE static T FloatMin(T lhs, T rhs) {
-  if (__builtin_isunordered(lhs, rhs)) {
-    return NAN;
-  } else if (__builtin_isless(lhs, rhs)) {
-    return lhs;
-  } else {
-    return rhs;
-  }
-
-//  if (lhs < rhs) {
-//    return lhs;
-//
-//  } else if (lhs > rhs) {
-//    return rhs;
-//
-//  // Use integer comparisons; we need to return the "most negative" value
-//  // (e.g. in the case of +0 and -0).
-//  } else {
-//    auto a = reinterpret_cast<I &>(lhs);
-//    auto b = reinterpret_cast<I &>(rhs);
-//    auto res = SMin(a, b);
-//    return reinterpret_cast<T &>(res);
-//  }
-}
-
-template <typename T, typename I>
-ALWAYS_INLINE static T FloatMax(T lhs, T rhs) {
-  if (__builtin_isunordered(lhs, rhs)) {
-    return NAN;
-  } else if (__builtin_isgreater(lhs, rhs)) {
-    return lhs;
-  } else {
-    return rhs;
-  }
-//
-//  if (lhs < rhs) {
-//    return rhs;
-//
-//  } else if (lhs > rhs) {
-//    return lhs;
-//
-//  // Use integer comparisons; we need to return the "most negative" value
-//  // (e.g. in the case of +0 and -0).
-//  } else {
-//    auto a = reinterpret_cast<I &>(lhs);
-//    auto b = reinterpret_cast<I &>(rhs);
-//    auto res = SMax(a, b);
-//    return reinterpret_cast<T &>(res);
-//  }
-}
-
 // NOTE(pag): These aren't quite right w.r.t. NaN propagation.
 DEF_SEM(FMINV_32_Reduce, V128W dst, V128 src) {
   auto vec = FReadV32(src);
-  FWriteV32(dst, Reduce4(vec, FloatMin<float32_t, int32_t>));
+  FWriteV32(dst, VReduce(vec, VFMin<float32v4_t>));
   return memory;
 }
 
 DEF_SEM(FMAXV_32_Reduce, V128W dst, V128 src) {
   auto vec = FReadV32(src);
-  FWriteV32(dst, Reduce4(vec, FloatMax<float32_t, int32_t>));
+  FWriteV32(dst, VReduce(vec, VFMax<float32v4_t>));
   return memory;
 }
 
@@ -845,7 +629,7 @@ namespace {
 template <typename S>
 DEF_SEM(NOT_8, V128W dst, S src) {
   auto vec = UReadV8(src);
-  auto res = UNotV8(vec);
+  auto res = VNot(vec);
   UWriteV8(dst, res);
   return memory;
 }
@@ -857,21 +641,22 @@ DEF_ISEL(NOT_ASIMDMISC_R_16B) = NOT_8<V128>;
 
 namespace {
 
+// Extract `count` bytes from the concatenation of `src2:src1`, starting at
+// byte `src3` of `src1`. The element accesses are in terms of native vectors,
+// and the index is a constant once lifted, so LLVM folds them into a single
+// `shufflevector`.
 template <typename T, size_t count>
 DEF_SEM(EXT, V128W dst, T src1, T src2, I32 src3) {
   auto lsb = Read(src3);
-  auto vn = UReadV8(src1);
-  auto vm = UReadV8(src2);
-  uint8v16_t result = {};
-  _Pragma("unroll")
-  for (size_t i = 0, max_i = count; i+lsb < max_i; ++i) {
-    result.elems[count-1-i] = UExtractV8(vm, i+lsb);
-  }
+  auto vn = NativeVec(UReadV8(src1));
+  auto vm = NativeVec(UReadV8(src2));
+  uint8v16_native_t result = {};
   _Pragma("unroll")
-  for (size_t i = lsb; i < count; ++i) {
-    result.elems[count-1-i] = UExtractV8(vn, i-lsb);
+  for (size_t i = 0; i < count; ++i) {
+    auto index = i + lsb;
+    result[i] = index < count ? vn[index] : vm[index - count];
   }
-  UWriteV8(dst, result);
+  UWriteV8(dst, FromNativeVec<uint8v16_t>(result));
   return memory;
 }
 
@@ -107,6 +107,9 @@ extern "C" void __remill_intrinsics(void) {
   USED(__remill_async_hyper_call);
   USED(__remill_sync_hyper_call);
 
+  USED(__remill_shadow_stack_push);
+  USED(__remill_shadow_stack_pop);
+
   USED(__remill_undefined_8);
   USED(__remill_undefined_16);
   USED(__remill_undefined_32);
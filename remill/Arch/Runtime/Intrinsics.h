@@ -107,6 +107,22 @@ extern Memory *__remill_missing_block(State &, addr_t addr, Memory *);
 [[gnu::used]]
 extern Memory *__remill_async_hyper_call(State &, addr_t ret_addr, Memory *);
 
+// Shadow return stack. Lifted code that assumes that function calls return
+// to the instruction following the call pushes the return address before
+// each call. At each return, it pops the address being returned to, and
+// only returns to its caller if that address was at the top of the stack.
+// Otherwise, e.g. after a `longjmp`, it jumps to the address being returned
+// to through `__remill_jump`, and the stack is left unchanged, so that each
+// address on the stack still belongs to a lifted caller that is waiting for
+// its callee to return.
+[[gnu::used]]
+extern Memory *__remill_shadow_stack_push(State &, addr_t ret_addr, Memory *);
+
+// Returns `true`, and pops the stack, if `ret_addr` is at the top of the
+// stack.
+[[gnu::used]]
+extern bool __remill_shadow_stack_pop(State &, addr_t ret_addr, Memory *);
+
 [[gnu::used]]
 extern Memory *__remill_sync_hyper_call(State &, Memory *, SyncHyperCall::Name);
 
@@ -96,12 +96,21 @@
 # define REG_XBX REG_EBX
 #endif  // 64 == ADDRESS_SIZE_BITS
 
-#define FLAG_CF state.aflag.cf
-#define FLAG_PF state.aflag.pf
-#define FLAG_AF state.aflag.af
-#define FLAG_ZF state.aflag.zf
-#define FLAG_SF state.aflag.sf
-#define FLAG_OF state.aflag.of
+#if LAZY_ARITH_FLAGS
+# define FLAG_CF (MaterializeFlags(state), state.aflag.cf)
+# define FLAG_PF (MaterializeFlags(state), state.aflag.pf)
+# define FLAG_AF (MaterializeFlags(state), state.aflag.af)
+# define FLAG_ZF (MaterializeFlags(state), state.aflag.zf)
+# define FLAG_SF (MaterializeFlags(state), state.aflag.sf)
+# define FLAG_OF (MaterializeFlags(state), state.aflag.of)
+#else
+# define FLAG_CF state.aflag.cf
+# define FLAG_PF state.aflag.pf
+# define FLAG_AF state.aflag.af
+# define FLAG_ZF state.aflag.zf
+# define FLAG_SF state.aflag.sf
+# define FLAG_OF state.aflag.of
+#endif  // LAZY_ARITH_FLAGS
 #define FLAG_DF state.aflag.df
 
 #define X87_ST0 state.st.elems[0].val
@@ -163,6 +172,18 @@ DEF_HELPER(PopFromStack) -> T {
 }  // namespace
 
 #include "remill/Arch/X86/Semantics/FLAGS.cpp"
+
+#if LAZY_ARITH_FLAGS
+// Computes any deferred arithmetic flags into `State::aflag`. The trace lifter
+// calls this before every call from a lifted trace to a runtime intrinsic,
+// e.g. `__remill_function_return`, so that the flags in the `State` are
+// up-to-date whenever control leaves the lifted code. Code outside of the
+// lifted bitcode that sets `State::flag_thunk` must call this itself.
+extern "C" [[gnu::used]] void __remill_materialize_flags(State &state) {
+  MaterializeFlags(state);
+}
+#endif  // LAZY_ARITH_FLAGS
+
 #include "remill/Arch/X86/Semantics/AVX.cpp"
 #include "remill/Arch/X86/Semantics/BINARY.cpp"
 #include "remill/Arch/X86/Semantics/BITBYTE.cpp"
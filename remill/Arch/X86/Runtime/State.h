@@ -45,6 +45,13 @@
 # define HAS_FEATURE_AVX512 1
 #endif
 
+// When enabled, arithmetic instructions record their operands into
+// `State::flag_thunk` instead of computing the arithmetic flags, and the
+// flags are only computed when something reads them.
+#ifndef LAZY_ARITH_FLAGS
+# define LAZY_ARITH_FLAGS 0
+#endif
+
 #if HAS_FEATURE_AVX
 # define IF_AVX(...) __VA_ARGS__
 # define IF_AVX_ELSE(a, b) a
@@ -421,6 +428,20 @@ struct alignas(8) ArithFlags final {
 
 static_assert(16 == sizeof(ArithFlags), "Invalid packing of `ArithFlags`.");
 
+// Deferred arithmetic flags computation. If `kind` is non-zero, then the
+// values in `ArithFlags` (except for `df`) are stale, and the real flags are
+// computed from the operation described by `kind` and its operands. See
+// `MaterializeFlags` in `Semantics/FLAGS.cpp`.
+struct alignas(8) FlagThunk final {
+  uint64_t lhs;
+  uint64_t rhs;
+  uint64_t res;
+  uint32_t kind;
+  uint32_t _0;
+} __attribute__((packed));
+
+static_assert(32 == sizeof(FlagThunk), "Invalid packing of `FlagThunk`.");
+
 union XCR0 {
   uint64_t flat;
 
@@ -759,10 +780,18 @@ struct alignas(16) State final : public ArchState {
   XCR0 xcr0;  // 8 bytes.
   FPU x87;  // 512 bytes
   SegmentCaches seg_caches; // 96 bytes
+#if LAZY_ARITH_FLAGS
+  FlagThunk flag_thunk;  // 32 bytes.
+#endif  // LAZY_ARITH_FLAGS
 } __attribute__((packed));
 
+#if LAZY_ARITH_FLAGS
+static_assert((96 + 3264 + 16 + 32) == sizeof(State),
+              "Invalid packing of `struct State`");
+#else
 static_assert((96 + 3264 + 16) == sizeof(State),
               "Invalid packing of `struct State`");
+#endif  // LAZY_ARITH_FLAGS
 
 using X86State = State;
 
@@ -81,6 +81,7 @@ DEF_SEM(IRETD) {
   Write(REG_PC, new_eip);
   Write(REG_CS.flat, new_cs);
   state.rflag = f;
+  DiscardFlags(state);
   state.aflag.af = f.af;
   state.aflag.cf = f.cf;
   state.aflag.df = f.df;
@@ -104,6 +105,7 @@ DEF_SEM(IRETQ) {
   Write(REG_PC, new_rip);
   Write(REG_CS.flat, new_cs);
   state.rflag = f;
+  DiscardFlags(state);
   state.aflag.af = f.af;
   state.aflag.cf = f.cf;
   state.aflag.df = f.df;
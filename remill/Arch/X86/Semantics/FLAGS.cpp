@@ -188,10 +188,172 @@ struct Carry<tag_sub> {
   }
 };
 
+// Computes the arithmetic flags of an `INC` or `DEC`. These leave `CF`
+// untouched.
+template <typename Tag, typename T>
+ALWAYS_INLINE static void ComputeFlagsIncDec(
+    ArithFlags &aflag, T lhs, T rhs, T res) {
+  aflag.pf = ParityFlag(res);
+  aflag.af = AuxCarryFlag(lhs, rhs, res);
+  aflag.zf = ZeroFlag(res);
+  aflag.sf = SignFlag(res);
+  aflag.of = Overflow<Tag>::Flag(lhs, rhs, res);
+}
+
+template <typename Tag, typename T>
+ALWAYS_INLINE static void ComputeFlagsAddSub(
+    ArithFlags &aflag, T lhs, T rhs, T res) {
+  aflag.cf = Carry<Tag>::Flag(lhs, rhs, res);
+  ComputeFlagsIncDec<Tag>(aflag, lhs, rhs, res);
+}
+
+template <typename T>
+ALWAYS_INLINE static void ComputeFlagsLogical(ArithFlags &aflag, T res) {
+  aflag.cf = false;
+  aflag.pf = ParityFlag(res);
+  aflag.zf = ZeroFlag(res);
+  aflag.sf = SignFlag(res);
+  aflag.of = false;
+  aflag.af = false;  // Undefined, but ends up being `0`.
+}
+
+#if LAZY_ARITH_FLAGS
+// The kinds of operations whose flags can be deferred into a `FlagThunk`.
+// The thunk's `kind` is `(op << 8) | sizeof(operand)`, and a `kind` of zero
+// means that the flags in `State::aflag` are up-to-date.
+enum FlagThunkOp : uint32_t {
+  kFlagThunkOpAdd = 1,
+  kFlagThunkOpSub,
+  kFlagThunkOpInc,
+  kFlagThunkOpDec,
+  kFlagThunkOpLogical
+};
+
+#define FLAG_THUNK_KIND(op, type) ((op << 8U) | sizeof(type))
+
+template <typename Tag>
+struct FlagThunkOps;
+
+template <>
+struct FlagThunkOps<tag_add> {
+  enum : uint32_t {
+    kAddSub = kFlagThunkOpAdd,
+    kIncDec = kFlagThunkOpInc
+  };
+};
+
+template <>
+struct FlagThunkOps<tag_sub> {
+  enum : uint32_t {
+    kAddSub = kFlagThunkOpSub,
+    kIncDec = kFlagThunkOpDec
+  };
+};
+
+template <uint32_t kOp, typename T>
+ALWAYS_INLINE static void DeferFlags(State &state, T lhs, T rhs, T res) {
+  state.flag_thunk.kind = FLAG_THUNK_KIND(kOp, T);
+  state.flag_thunk.lhs = static_cast<uint64_t>(lhs);
+  state.flag_thunk.rhs = static_cast<uint64_t>(rhs);
+  state.flag_thunk.res = static_cast<uint64_t>(res);
+}
+
+template <typename T>
+ALWAYS_INLINE static void MaterializeFlags(State &state, uint32_t op) {
+  auto lhs = static_cast<T>(state.flag_thunk.lhs);
+  auto rhs = static_cast<T>(state.flag_thunk.rhs);
+  auto res = static_cast<T>(state.flag_thunk.res);
+  switch (op) {
+    case kFlagThunkOpAdd:
+      ComputeFlagsAddSub<tag_add>(state.aflag, lhs, rhs, res);
+      break;
+    case kFlagThunkOpSub:
+      ComputeFlagsAddSub<tag_sub>(state.aflag, lhs, rhs, res);
+      break;
+    case kFlagThunkOpInc:
+      ComputeFlagsIncDec<tag_add>(state.aflag, lhs, rhs, res);
+      break;
+    case kFlagThunkOpDec:
+      ComputeFlagsIncDec<tag_sub>(state.aflag, lhs, rhs, res);
+      break;
+    case kFlagThunkOpLogical:
+      ComputeFlagsLogical(state.aflag, res);
+      break;
+    default:
+      __builtin_unreachable();
+  }
+}
+#endif  // LAZY_ARITH_FLAGS
+
+// Computes any deferred arithmetic flags into `State::aflag`. This is invoked
+// by every read or write of an individual flag (see `FLAG_CF` and friends).
+// When the last flag-producing instruction is in the same block as the reader,
+// the `kind` is a known constant after store-to-load forwarding, and so this
+// whole function folds down to just the computation of the needed flags.
+ALWAYS_INLINE static void MaterializeFlags(State &state) {
+#if LAZY_ARITH_FLAGS
+  const auto kind = state.flag_thunk.kind;
+  if (!kind) {
+    return;
+  }
+  const auto op = kind >> 8U;
+  switch (kind & 0xFFU) {
+    case 1: MaterializeFlags<uint8_t>(state, op); break;
+    case 2: MaterializeFlags<uint16_t>(state, op); break;
+    case 4: MaterializeFlags<uint32_t>(state, op); break;
+    case 8: MaterializeFlags<uint64_t>(state, op); break;
+    default: __builtin_unreachable();
+  }
+  state.flag_thunk.kind = 0;
+#endif  // LAZY_ARITH_FLAGS
+}
+
+// Drops any deferred arithmetic flags computation. This is used when all of
+// the arithmetic flags are about to be overwritten.
+ALWAYS_INLINE static void DiscardFlags(State &state) {
+#if LAZY_ARITH_FLAGS
+  state.flag_thunk.kind = 0;
+#endif  // LAZY_ARITH_FLAGS
+}
+
+// Records or computes the arithmetic flags of an `INC` or `DEC`.
+template <typename Tag, typename T>
+ALWAYS_INLINE static void WriteFlagsIncDec(State &state, T lhs, T rhs, T res) {
+#if LAZY_ARITH_FLAGS
+  MaterializeFlags(state);  // Make sure that `CF` is up-to-date.
+  DeferFlags<FlagThunkOps<Tag>::kIncDec>(state, lhs, rhs, res);
+#else
+  ComputeFlagsIncDec<Tag>(state.aflag, lhs, rhs, res);
+#endif  // LAZY_ARITH_FLAGS
+}
+
+// Records or computes the arithmetic flags of an addition or subtraction.
+template <typename Tag, typename T>
+ALWAYS_INLINE static void WriteFlagsAddSub(State &state, T lhs, T rhs, T res) {
+#if LAZY_ARITH_FLAGS
+  DeferFlags<FlagThunkOps<Tag>::kAddSub>(state, lhs, rhs, res);
+#else
+  ComputeFlagsAddSub<Tag>(state.aflag, lhs, rhs, res);
+#endif  // LAZY_ARITH_FLAGS
+}
+
+// Records or computes the arithmetic flags of a logical operation.
+template <typename T>
+ALWAYS_INLINE static void WriteFlagsLogical(State &state, T lhs, T rhs, T res) {
+#if LAZY_ARITH_FLAGS
+  DeferFlags<kFlagThunkOpLogical>(state, lhs, rhs, res);
+#else
+  ComputeFlagsLogical(state.aflag, res);
+#endif  // LAZY_ARITH_FLAGS
+}
+
+#undef FLAG_THUNK_KIND
+
 }  // namespace
 
 #define ClearArithFlags() \
     do { \
+      DiscardFlags(state); \
       state.aflag.cf = __remill_undefined_8(); \
       state.aflag.pf = __remill_undefined_8(); \
       state.aflag.af = __remill_undefined_8(); \
@@ -18,23 +18,13 @@
 
 namespace {
 
-template <typename T>
-ALWAYS_INLINE void SetFlagsLogical(State &state, T lhs, T rhs, T res) {
-  state.aflag.cf = false;
-  state.aflag.pf = ParityFlag(res);
-  state.aflag.zf = ZeroFlag(res);
-  state.aflag.sf = SignFlag(res);
-  state.aflag.of = false;
-  state.aflag.af = false;  // Undefined, but ends up being `0`.
-}
-
 template <typename D, typename S1, typename S2>
 DEF_SEM(AND, D dst, S1 src1, S2 src2) {
   auto lhs = Read(src1);
   auto rhs = Read(src2);
   auto res = UAnd(lhs, rhs);
   WriteZExt(dst, res);
-  SetFlagsLogical(state, lhs, rhs, res);
+  WriteFlagsLogical(state, lhs, rhs, res);
   return memory;
 }
 
@@ -44,7 +34,7 @@ DEF_SEM(OR, D dst, S1 src1, S2 src2) {
   auto rhs = Read(src2);
   auto res = UOr(lhs, rhs);
   WriteZExt(dst, res);
-  SetFlagsLogical(state, lhs, rhs, res);
+  WriteFlagsLogical(state, lhs, rhs, res);
   return memory;
 }
 
@@ -54,7 +44,7 @@ DEF_SEM(XOR, D dst, S1 src1, S2 src2) {
   auto rhs = Read(src2);
   auto res = UXor(lhs, rhs);
   WriteZExt(dst, res);
-  SetFlagsLogical(state, lhs, rhs, res);
+  WriteFlagsLogical(state, lhs, rhs, res);
   return memory;
 }
 
@@ -69,7 +59,7 @@ DEF_SEM(TEST, S1 src1, S2 src2) {
   auto lhs = Read(src1);
   auto rhs = Read(src2);
   auto res = UAnd(lhs, rhs);
-  SetFlagsLogical(state, lhs, rhs, res);
+  WriteFlagsLogical(state, lhs, rhs, res);
   return memory;
 }
 
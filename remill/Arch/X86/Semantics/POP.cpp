@@ -62,6 +62,7 @@ DEF_SEM(DoPOPAD) {
 DEF_SEM(DoPOPFD) {
   Flags f;
   f.flat = ZExt(PopFromStack<uint32_t>(memory, state));
+  DiscardFlags(state);
   state.aflag.af = f.af;
   state.aflag.cf = f.cf;
   state.aflag.df = f.df;
@@ -82,6 +83,7 @@ DEF_SEM(DoPOPFD) {
 DEF_SEM(DoPOPFQ) {
   Flags f;
   f.flat = PopFromStack<uint64_t>(memory, state);
+  DiscardFlags(state);
   state.aflag.af = f.af;
   state.aflag.cf = f.cf;
   state.aflag.df = f.df;
@@ -102,6 +104,7 @@ DEF_SEM(DoPOPFQ) {
 DEF_SEM(DoPOPF) {
   Flags f;
   f.flat = ZExt(ZExt(PopFromStack<uint16_t>(memory, state)));
+  DiscardFlags(state);
   state.aflag.af = f.af;
   state.aflag.cf = f.cf;
   state.aflag.df = f.df;
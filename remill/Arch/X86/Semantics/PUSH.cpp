@@ -19,6 +19,7 @@
 namespace {
 
 static void SerializeFlags(State &state) {
+  MaterializeFlags(state);
   state.rflag.cf = state.aflag.cf;
   //state.rflag.must_be_1 = 1;
   state.rflag.pf = state.aflag.pf;
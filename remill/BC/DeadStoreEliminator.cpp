@@ -17,20 +17,34 @@
 // #include <glog/logging.h>
 // #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/InstVisitor.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Transforms/Utils/Local.h>
 
@@ -56,13 +70,109 @@ bool FLAGS_disable_dead_store_elimination = false;
 //             "to eliminate dead instructions more aggressively.");
 bool FLAGS_enable_register_forwarding = false;
 
+// DEFINE_uint32(dead_store_elimination_threads, 0,
+//               "Number of threads used to run the alias analysis of dead "
+//               "store elimination. Zero means one thread per hardware "
+//               "thread.");
+uint32_t FLAGS_dead_store_elimination_threads = 0;
+
 namespace remill {
 namespace {
 
-using ValueToOffset = std::unordered_map<llvm::Value *, uint64_t>;
-using InstToOffset = std::unordered_map<llvm::Instruction *, uint64_t>;
-using LiveSet = std::bitset<256>;
-using InstToLiveSet = std::unordered_map<llvm::Instruction *, LiveSet>;
+// These maps have one entry per analyzed value, so they are flat,
+// open-addressed hash tables rather than node-based ones.
+using ValueToOffset = llvm::DenseMap<llvm::Value *, uint64_t>;
+using ValueSet = llvm::DenseSet<llvm::Value *>;
+
+// One bit per slot of the `State` structure. Live sets are sized by
+// `NumLiveSetSlots`, and so scale with the size of the `State` structure.
+using LiveSet = llvm::BitVector;
+
+// Numbers the instructions of the analyzed functions, so that what we learn
+// about each instruction can be kept in flat vectors. The numbering is built
+// before, and only read during, the parallel alias analysis.
+class InstructionNumbering {
+ public:
+  static constexpr unsigned kNotNumbered = ~0U;
+
+  void AddFunction(llvm::Function *func) {
+    for (auto &inst : llvm::instructions(func)) {
+      numbers.insert({&inst, static_cast<unsigned>(numbers.size())});
+    }
+  }
+
+  unsigned Number(const llvm::Instruction *inst) const {
+    auto number_it = numbers.find(inst);
+    if (number_it == numbers.end()) {
+      return kNotNumbered;
+    } else {
+      return number_it->second;
+    }
+  }
+
+  size_t Size(void) const {
+    return numbers.size();
+  }
+
+ private:
+  llvm::DenseMap<const llvm::Instruction *, unsigned> numbers;
+};
+
+// Maps numbered instructions to values. Instructions that were created after
+// numbering, e.g. by forwarding, are never in the map. Distinct instructions
+// can be added from different threads.
+template <typename T>
+class InstMap {
+ public:
+  explicit InstMap(const InstructionNumbering &numbering_)
+      : numbering(numbering_),
+        values(numbering.Size()),
+        present(numbering.Size(), 0) {}
+
+  const T *find(const llvm::Instruction *inst) const {
+    const auto number = numbering.Number(inst);
+    if (InstructionNumbering::kNotNumbered == number || !present[number]) {
+      return nullptr;
+    }
+    return &(values[number]);
+  }
+
+  bool count(const llvm::Instruction *inst) const {
+    return nullptr != find(inst);
+  }
+
+  const T &at(const llvm::Instruction *inst) const {
+    auto val = find(inst);
+    assert(val != nullptr);
+    // CHECK(val != nullptr)
+    //     << "Missing instruction " << LLVMThingToString(inst);
+    return *val;
+  }
+
+  T &operator[](const llvm::Instruction *inst) {
+    const auto number = numbering.Number(inst);
+    assert(InstructionNumbering::kNotNumbered != number);
+    // CHECK(InstructionNumbering::kNotNumbered != number)
+    //     << "Unnumbered instruction " << LLVMThingToString(inst);
+    present[number] = 1;
+    return values[number];
+  }
+
+  // Add `val` for `inst`, unless `inst` already has a value.
+  void insert(const llvm::Instruction *inst, T val) {
+    if (!count(inst)) {
+      (*this)[inst] = std::move(val);
+    }
+  }
+
+ private:
+  const InstructionNumbering &numbering;
+  std::vector<T> values;
+  std::vector<uint8_t> present;  // `std::vector<bool>` isn't thread-safe.
+};
+
+using InstToOffset = InstMap<uint64_t>;
+using InstToLiveSet = InstMap<LiveSet>;
 
 // Struct to keep track of how murderous the dead store eliminator is.
 struct KillCounter {
@@ -79,6 +189,106 @@ struct KillCounter {
   uint64_t fwd_failed;
 };
 
+// Results of analyzing a single lifted function, from the last time that dead
+// store elimination was run on its module.
+struct FunctionSummary {
+  // Hash of the function's code after dead stores were removed. If this
+  // doesn't match the function's code, then the function has been changed
+  // since its last analysis, e.g. by an optimization pass.
+  size_t fingerprint;
+
+  // Slots that are live on entry to the function.
+  LiveSet live_on_entry;
+};
+
+// Function summaries, by function name.
+using FunctionSummaries = std::unordered_map<std::string, FunctionSummary>;
+
+// Per-module function summaries, used to make repeated dead store elimination
+// on the same module incremental. Module identifiers aren't unique, e.g. every
+// module loaded from the same semantics file has the same one, so these are
+// keyed by module. A module that is deleted without calling
+// `ForgetDeadStoreSummaries` leaves its summaries behind until a new module is
+// allocated at the same address, but they are only used for functions with
+// the same names and fingerprints.
+static std::mutex gSummariesLock;
+static std::unordered_map<const llvm::Module *, FunctionSummaries> gSummaries;
+
+// Results of the alias analysis of a single lifted function.
+struct FunctionAliases {
+  llvm::Function *func;
+  ValueToOffset state_offset;
+  bool analyzed;
+};
+
+// Returns the number of bits needed in a `LiveSet`.
+static size_t NumLiveSetSlots(const std::vector<StateSlot> &state_slots) {
+  return state_slots.empty() ? 0 : state_slots.back().index + 1;
+}
+
+static void HashCombine(size_t &hash, uint64_t val) {
+  hash ^= std::hash<uint64_t>()(val) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+}
+
+static void HashType(size_t &hash, llvm::Type *type) {
+  HashCombine(hash, type->getTypeID());
+  if (type->isIntegerTy()) {
+    HashCombine(hash, type->getIntegerBitWidth());
+  }
+}
+
+// Hashes the linkage and the body of `func`. Instructions and arguments are
+// hashed by their position in `func`, so the hash doesn't depend on value
+// names, and the metadata attached to `func` and its instructions, e.g. the
+// live sets that we attach, is ignored. The linkage matters because it
+// decides whether we know all of the callers of `func`.
+static size_t Fingerprint(llvm::Function *func) {
+  size_t hash = 0;
+  HashCombine(hash, func->getLinkage());
+
+  std::unordered_map<llvm::Value *, uint64_t> ids;
+  for (auto &arg : func->args()) {
+    ids.emplace(&arg, ids.size());
+  }
+  for (auto &block : *func) {
+    ids.emplace(&block, ids.size());
+    for (auto &inst : block) {
+      ids.emplace(&inst, ids.size());
+    }
+  }
+
+  for (auto &block : *func) {
+    HashCombine(hash, ids[&block]);
+    for (auto &inst : block) {
+      HashCombine(hash, inst.getOpcode());
+      HashType(hash, inst.getType());
+      if (auto cmp = llvm::dyn_cast<llvm::CmpInst>(&inst)) {
+        HashCombine(hash, cmp->getPredicate());
+      } else if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
+        HashType(hash, alloca->getAllocatedType());
+      }
+
+      HashCombine(hash, inst.getNumOperands());
+      for (auto &op : inst.operands()) {
+        auto val = op.get();
+        auto id_it = ids.find(val);
+        if (id_it != ids.end()) {
+          HashCombine(hash, id_it->second);
+        } else if (auto global = llvm::dyn_cast<llvm::GlobalValue>(val)) {
+          const auto name = global->getName().str();
+          HashCombine(hash, std::hash<std::string>()(name));
+        } else if (auto const_int = llvm::dyn_cast<llvm::ConstantInt>(val)) {
+          HashCombine(hash, const_int->getLimitedValue());
+        } else {
+          HashCombine(hash, val->getValueID());
+        }
+        HashType(hash, val->getType());
+      }
+    }
+  }
+  return hash;
+}
+
 // Return true if the given function is a lifted function
 // (and not the `__remill_basic_block`).
 static bool IsLiftedFunction(llvm::Function *func,
@@ -88,6 +298,45 @@ static bool IsLiftedFunction(llvm::Function *func,
            func->getFunctionType() != bb_func->getFunctionType());
 }
 
+// Return true if `func` has at least one caller, and every use of `func` is a
+// direct call from a lifted function, i.e. if we know all the places to which
+// `func` can return. A function without callers in the module is called from
+// somewhere else, e.g. from a runtime that looks it up by name.
+static bool HasOnlyKnownCallers(llvm::Function *func,
+                                const llvm::Function *bb_func) {
+  if (!func->hasLocalLinkage() || func->use_empty()) {
+    return false;
+  }
+  for (auto user : func->users()) {
+    llvm::Function *called_func = nullptr;
+    llvm::Function *caller = nullptr;
+    if (auto call_inst = llvm::dyn_cast<llvm::CallInst>(user)) {
+      called_func = call_inst->getCalledFunction();
+      caller = call_inst->getParent()->getParent();
+    } else if (auto invoke_inst = llvm::dyn_cast<llvm::InvokeInst>(user)) {
+      called_func = invoke_inst->getCalledFunction();
+      caller = invoke_inst->getParent()->getParent();
+    }
+    if (called_func != func || !IsLiftedFunction(caller, bb_func)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Return true if `inst` is a call that is immediately followed by a
+// `return`, i.e. if the callee will return to our caller.
+static bool IsTailCall(llvm::Instruction *inst) {
+  auto next_inst = inst->getNextNode();
+  return next_inst && llvm::isa<llvm::ReturnInst>(next_inst);
+}
+
+// Return true if `func` is the intrinsic used to return from a lifted
+// function to its caller.
+static bool IsFunctionReturn(llvm::Function *func) {
+  return func->getName() == "__remill_function_return";
+}
+
 // Recursive visitor of the `State` structure that assigns slots of ranges of
 // bytes.
 class StateVisitor {
@@ -251,28 +500,50 @@ static bool TryCombineOffsets(uint64_t lhs_offset, OpType op_type,
   return (*out_offset) < max_offset;
 }
 
-static LiveSet GetLiveSetFromArgs(llvm::Function *func,
+// Returns the number of bytes of `State` that may be accessed through the
+// pointer `ptr`, or `0` if we don't know.
+static uint64_t PointeeSize(const llvm::DataLayout &dl, llvm::Value *ptr) {
+  auto ptr_type = llvm::dyn_cast<llvm::PointerType>(ptr->getType());
+  if (!ptr_type) {
+    return 0;
+  }
+  auto elem_type = ptr_type->getElementType();
+  if (!elem_type->isSized()) {
+    return 0;
+  }
+  return dl.getTypeAllocSize(elem_type);
+}
+
+static LiveSet GetLiveSetFromArgs(const llvm::DataLayout &dl,
                                   llvm::iterator_range<llvm::Use *> args,
                                   const ValueToOffset &val_to_offset,
                                   const std::vector<StateSlot> &state_slots) {
-  LiveSet live;
+  LiveSet live(NumLiveSetSlots(state_slots));
   for (auto &arg_it : args) {
     auto arg = arg_it->stripPointerCasts();
     const auto offset_it = val_to_offset.find(arg);
     if (offset_it != val_to_offset.end()) {
       const auto offset = offset_it->second;
 
-      // If we access a single non-zero offset, mark just that offset.
-      if (offset != 0) {
-        live.set(state_slots[offset].index);
-
       // If we access offset `0`, then maybe we're actually passing
       // a state pointer, in which anything can be changed, so we want
       // to treat everything as live, OR maybe we're passing a pointer
       // to the first thing in the `State` structure, which would be
       // rare and unusual.
-      } else {
+      if (!offset) {
         live.set();
+        continue;
+      }
+
+      // A register can span several slots, e.g. a vector register that is
+      // passed by pointer to a semantics function, so mark every slot that
+      // the pointed-to object covers. The argument may have been cast from
+      // a pointer to a bigger type, so take the bigger of the two sizes.
+      const auto size = std::max<uint64_t>(
+          1, std::max(PointeeSize(dl, arg_it.get()), PointeeSize(dl, arg)));
+      const auto end = std::min<uint64_t>(offset + size, state_slots.size());
+      for (auto i = offset; i < end; ++i) {
+        live.set(state_slots[i].index);
       }
     }
   }
@@ -318,17 +589,21 @@ struct ForwardAliasVisitor
 
  public:
 
-  const llvm::DataLayout dl;
+  const llvm::DataLayout &dl;
   const std::vector<StateSlot> &offset_to_slot;
   ValueToOffset state_offset;
   InstToOffset &state_access_offset;
   InstToLiveSet &live_args;
-  std::unordered_set<llvm::Value *> exclude;
-  std::unordered_set<llvm::Value *> missing;
+  ValueSet exclude;
+  ValueSet missing;
   std::vector<llvm::Instruction *> curr_wl;
   std::vector<llvm::Instruction *> pending_wl;
   std::vector<llvm::Instruction *> calls;
   llvm::Value *state_ptr;
+  const size_t num_slots;
+
+  // Whether or not every instruction was resolved by the last analysis.
+  bool is_complete;
 };
 
 // Stream a slot of the DOT digraph.
@@ -420,7 +695,7 @@ void ForwardAliasVisitor::CreateDOTDigraph(llvm::Function *func,
         dot << "<td>" << offset << "</td><td> </td>";
 
       } else if (state_access_offset.count(&inst)) {
-        auto offset = state_access_offset[&inst];
+        auto offset = state_access_offset.at(&inst);
         const auto &slot = offset_to_slot[offset];
         auto inst_size = 0;
         if (llvm::isa<llvm::LoadInst>(&inst)) {
@@ -498,12 +773,12 @@ ForwardAliasVisitor::ForwardAliasVisitor(
       offset_to_slot(offset_to_slot_),
       state_access_offset(state_access_offset_),
       live_args(live_args_),
-      state_ptr(nullptr) {}
+      state_ptr(nullptr),
+      num_slots(NumLiveSetSlots(offset_to_slot_)),
+      is_complete(false) {}
 
 void ForwardAliasVisitor::AddInstruction(llvm::Instruction *inst) {
-  if (FLAGS_dot_output_dir.empty()) {
-    inst->setName(llvm::Twine::createNull());
-  } else {
+  if (!FLAGS_dot_output_dir.empty()) {
     static int r = 3;
     if (!inst->getType()->isVoidTy()) {
       inst->setName("r" + std::to_string(r++));
@@ -517,11 +792,11 @@ void ForwardAliasVisitor::AddInstruction(llvm::Instruction *inst) {
     curr_wl.push_back(inst);
 
   } else if (llvm::isa<llvm::AllocaInst>(inst)) {
-    exclude.emplace(inst);
+    exclude.insert(inst);
 
   } else if (llvm::isa<llvm::CallInst>(inst) ||
              llvm::isa<llvm::InvokeInst>(inst)) {
-    exclude.emplace(inst);
+    exclude.insert(inst);
     calls.push_back(inst);
 
   } else {
@@ -554,9 +829,9 @@ bool ForwardAliasVisitor::Analyze(llvm::Function *func) {
     return false;
   }
 
-  state_offset.emplace(state_ptr, 0);
-  exclude.emplace(memory_ptr);
-  exclude.emplace(pc);
+  state_offset.insert({state_ptr, 0});
+  exclude.insert(memory_ptr);
+  exclude.insert(pc);
 
   for (auto &block : *func) {
     for (auto &inst : block) {
@@ -636,6 +911,8 @@ bool ForwardAliasVisitor::Analyze(llvm::Function *func) {
     visit(inst);
   }
 
+  is_complete = pending_wl.empty() && next_wl.empty();
+
   // TODO(tim): This condition is triggered a lot.
   if (!pending_wl.empty()) {
     // DLOG(ERROR)
@@ -671,11 +948,11 @@ VisitResult ForwardAliasVisitor::visitLoadInst(llvm::LoadInst &inst) {
   // this ever comes up, but if it does then we want to treat all `State`
   // structures as aliasing.
   if (inst.getType() == state_ptr->getType()) {
-    state_offset.emplace(&inst, 0);
+    state_offset.insert({&inst, 0});
     return VisitResult::Progress;
 
   } else if (exclude.count(val)) {
-    exclude.emplace(&inst);
+    exclude.insert(&inst);
     return VisitResult::Progress;
 
   } else {
@@ -688,8 +965,8 @@ VisitResult ForwardAliasVisitor::visitLoadInst(llvm::LoadInst &inst) {
     // this could happen where an index into a vector register is stored
     // in another register. We don't handle that yet.
     } else {
-      state_access_offset.emplace(&inst, ptr->second);
-      exclude.emplace(&inst);
+      state_access_offset.insert(&inst, ptr->second);
+      exclude.insert(&inst);
       return VisitResult::Progress;
     }
   }
@@ -717,7 +994,7 @@ VisitResult ForwardAliasVisitor::visitStoreInst(llvm::StoreInst &inst) {
   }
 
   // loads mean we now have an alias to the pointer
-  state_access_offset.emplace(&inst, ptr->second);
+  state_access_offset.insert(&inst, ptr->second);
   return VisitResult::Progress;
 }
 
@@ -755,7 +1032,7 @@ VisitResult ForwardAliasVisitor::visitGetElementPtrInst(
     return VisitResult::Error;
   }
 
-  state_offset.emplace(&inst, offset);
+  state_offset.insert({&inst, offset});
   return VisitResult::Progress;
 }
 
@@ -773,7 +1050,7 @@ VisitResult ForwardAliasVisitor::visitCastInst(llvm::CastInst &inst) {
     return VisitResult::NoProgress;
 
   } else {
-    state_offset.emplace(&inst, ptr->second);
+    state_offset.insert({&inst, ptr->second});
     return VisitResult::Progress;
   }
 }
@@ -814,12 +1091,12 @@ VisitResult ForwardAliasVisitor::visitBinaryOp_(
   // It's a constant that isn't an integer, e.g. a costant expression on a
   // global.
   } else if (llvm::isa<llvm::Constant>(lhs_val)) {
-    exclude.emplace(lhs_val);
+    exclude.insert(lhs_val);
     num_excluded += 1;
 
   } else {
     if (!FLAGS_dot_output_dir.empty()) {
-      missing.emplace(lhs_val);
+      missing.insert(lhs_val);
     }
     ret = VisitResult::Incomplete;
   }
@@ -837,18 +1114,18 @@ VisitResult ForwardAliasVisitor::visitBinaryOp_(
   // It's a constant that isn't an integer, e.g. a costant expression on a
   // global.
   } else if (llvm::isa<llvm::Constant>(rhs_val)) {
-    exclude.emplace(lhs_val);
+    exclude.insert(lhs_val);
     num_excluded += 1;
 
   } else {
     if (!FLAGS_dot_output_dir.empty()) {
-      missing.emplace(rhs_val);
+      missing.insert(rhs_val);
     }
     ret = VisitResult::Incomplete;
   }
 
   if (num_excluded) {
-    exclude.emplace(&inst);
+    exclude.insert(&inst);
     if (2 <= (num_offsets + num_excluded + num_consts)) {
       return VisitResult::Progress;
     } else {
@@ -875,7 +1152,7 @@ VisitResult ForwardAliasVisitor::visitBinaryOp_(
       return VisitResult::Error;
     }
 
-    state_offset.emplace(&inst, offset);
+    state_offset.insert({&inst, offset});
     return VisitResult::Progress;
 
   } else if (2 == (num_offsets + num_excluded)) {
@@ -905,22 +1182,22 @@ VisitResult ForwardAliasVisitor::visitSelect(llvm::SelectInst &inst) {
   } else if (in_state_offset) {
     if (true_ptr == state_offset.end()) {
       if (!FLAGS_dot_output_dir.empty()) {
-        missing.emplace(true_val);
+        missing.insert(true_val);
       }
-      state_offset.emplace(&inst, false_ptr->second);
+      state_offset.insert({&inst, false_ptr->second});
       return VisitResult::Incomplete;  // Wait for the other to be found.
 
     } else if (false_ptr == state_offset.end()) {
       if (!FLAGS_dot_output_dir.empty()) {
-        missing.emplace(false_val);
+        missing.insert(false_val);
       }
-      state_offset.emplace(&inst, true_ptr->second);
+      state_offset.insert({&inst, true_ptr->second});
       return VisitResult::Incomplete;  // Wait for the other to be found.
 
     // Both point into `State`.
     } else {
       if (true_ptr->second == false_ptr->second) {
-        state_offset.emplace(&inst, true_ptr->second);
+        state_offset.insert({&inst, true_ptr->second});
         return VisitResult::Progress;
 
       } else {
@@ -942,7 +1219,7 @@ VisitResult ForwardAliasVisitor::visitSelect(llvm::SelectInst &inst) {
   // One or both values are constant.
   } else if (llvm::isa<llvm::Constant>(true_val) ||
              llvm::isa<llvm::Constant>(false_val)) {
-    exclude.emplace(&inst);
+    exclude.insert(&inst);
     return VisitResult::Progress;
 
   // The status of the values being selected are as-of-yet unknown.
@@ -979,7 +1256,7 @@ VisitResult ForwardAliasVisitor::visitPHINode(llvm::PHINode &inst) {
     // handling this PHI as being complete.
     if (ptr == state_offset.end()) {
       if (!FLAGS_dot_output_dir.empty()) {
-        missing.emplace(operand);
+        missing.insert(operand);
       }
       continue;
     }
@@ -1008,7 +1285,7 @@ VisitResult ForwardAliasVisitor::visitPHINode(llvm::PHINode &inst) {
   // assume that all will match. This lets us have the algorithm progress
   // in the presence of loops.
   } else if (num_in_state_offset) {
-    state_offset.emplace(&inst, offset);
+    state_offset.insert({&inst, offset});
     return (complete ? VisitResult::Progress : VisitResult::Incomplete);
 
   // Similar case to above, but at least one thing is in the exclude set.
@@ -1024,16 +1301,16 @@ VisitResult ForwardAliasVisitor::visitPHINode(llvm::PHINode &inst) {
 VisitResult ForwardAliasVisitor::visitCallInst(llvm::CallInst &inst) {
   auto func = inst.getCalledFunction();
   if (!func) {
-    live_args[&inst].set();
+    live_args[&inst] = LiveSet(num_slots, true);
 
   } else if (func->getName().startswith("__mcsema")) {
-    live_args[&inst].set();
+    live_args[&inst] = LiveSet(num_slots, true);
 
   } else {
     // If we have not seen this instruction before, add it.
     auto args = inst.arg_operands();
-    auto live = GetLiveSetFromArgs(func, args, state_offset, offset_to_slot);
-    live_args.emplace(&inst, std::move(live));
+    auto live = GetLiveSetFromArgs(dl, args, state_offset, offset_to_slot);
+    live_args.insert(&inst, std::move(live));
   }
   return VisitResult::Ignored;
 }
@@ -1041,16 +1318,16 @@ VisitResult ForwardAliasVisitor::visitCallInst(llvm::CallInst &inst) {
 VisitResult ForwardAliasVisitor::visitInvokeInst(llvm::InvokeInst &inst) {
   auto func = inst.getCalledFunction();
   if (!inst.getCalledFunction()) {
-    live_args[&inst].set();
+    live_args[&inst] = LiveSet(num_slots, true);
 
   } else if (func->getName().startswith("__mcsema")) {
-    live_args[&inst].set();
+    live_args[&inst] = LiveSet(num_slots, true);
 
   } else {
     // If we have not seen this instruction before, add it.
     auto args = inst.arg_operands();
-    auto live = GetLiveSetFromArgs(func, args, state_offset, offset_to_slot);
-    live_args.emplace(&inst, std::move(live));
+    auto live = GetLiveSetFromArgs(dl, args, state_offset, offset_to_slot);
+    live_args.insert(&inst, std::move(live));
   }
   return VisitResult::Ignored;
 }
@@ -1058,21 +1335,26 @@ VisitResult ForwardAliasVisitor::visitInvokeInst(llvm::InvokeInst &inst) {
 class LiveSetBlockVisitor {
  public:
   llvm::Module &module;
-  InstToLiveSet debug_live_args_at_call;
+  llvm::DenseMap<llvm::Instruction *, LiveSet> debug_live_args_at_call;
   const InstToLiveSet &live_args;
   const InstToOffset &state_access_offset;
   const std::vector<StateSlot> &offset_to_slot;
   std::vector<llvm::BasicBlock *> curr_wl;
-  std::unordered_map<llvm::BasicBlock *, LiveSet> block_map;
+  std::vector<LiveSet> block_live;
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> block_index;
   std::vector<llvm::Instruction *> to_remove;
   const llvm::Function *bb_func;
+  const std::unordered_set<llvm::Function *> &funcs;
 
   LiveSetBlockVisitor(llvm::Module &module_,
                       const InstToLiveSet &live_args_,
                       const InstToOffset &state_access_offset_,
                       const std::vector<StateSlot> &state_slots_,
                       const llvm::Function *bb_func_,
-                      const llvm::DataLayout *dl_);
+                      const llvm::DataLayout *dl_,
+                      const std::unordered_set<llvm::Function *> &funcs_,
+                      const FunctionSummaries &summaries,
+                      bool dead_on_return=false);
 
   void FindLiveInsts(KillCounter &stats);
   void CollectDeadInsts(KillCounter &stats);
@@ -1080,9 +1362,30 @@ class LiveSetBlockVisitor {
   bool DeleteDeadInsts(KillCounter &stats);
   void CreateDOTDigraph(llvm::Function *func, const char *extensions);
 
+  // Returns the live set on entry to `block`, numbering `block` if this is
+  // the first time we've seen it.
+  LiveSet &BlockLiveSet(llvm::BasicBlock *block);
+
+  // Returns the live set at the points where `func` returns to its caller.
+  const LiveSet &LiveOutSet(llvm::Function *func);
+
  private:
+  // Add `live` into the slots that are live when `func` returns, and
+  // schedule `func`'s exit blocks to be revisited if that changes anything.
+  void AddLiveOut(llvm::Function *func, const LiveSet &live);
+
   bool on_remove_pass;
   const llvm::DataLayout *dl;
+  const size_t num_slots;
+
+  // The slots that are live when a function returns to its caller. This is
+  // the union of what is live after each call to the function. Functions
+  // whose callers we don't fully know return with all slots live.
+  llvm::DenseMap<llvm::Function *, LiveSet> live_out;
+  const LiveSet all_live;
+
+  // Exit blocks of functions whose live out sets have grown.
+  std::vector<llvm::BasicBlock *> exits_wl;
 };
 
 LiveSetBlockVisitor::LiveSetBlockVisitor(
@@ -1091,19 +1394,43 @@ LiveSetBlockVisitor::LiveSetBlockVisitor(
     const InstToOffset &state_access_offset_,
     const std::vector<StateSlot> &state_slots_,
     const llvm::Function *bb_func_,
-    const llvm::DataLayout *dl_)
+    const llvm::DataLayout *dl_,
+    const std::unordered_set<llvm::Function *> &funcs_,
+    const FunctionSummaries &summaries,
+    bool dead_on_return)
     : module(module_),
       live_args(live_args_),
       state_access_offset(state_access_offset_),
       offset_to_slot(state_slots_),
       curr_wl(),
-      block_map(),
+      block_live(),
+      block_index(),
       to_remove(),
       bb_func(bb_func_),
+      funcs(funcs_),
       on_remove_pass(false),
-      dl(dl_) {
-  for (auto &func : module) {
-    for (auto &block : func) {
+      dl(dl_),
+      num_slots(NumLiveSetSlots(state_slots_)),
+      all_live(static_cast<unsigned>(num_slots), true) {
+
+  // Functions that aren't being re-analyzed contribute their live sets from
+  // the last analysis.
+  for (const auto &entry : summaries) {
+    auto func = module.getFunction(entry.first);
+    if (func && !funcs.count(func)) {
+      BlockLiveSet(&(func->getEntryBlock())) = entry.second.live_on_entry;
+    }
+  }
+
+  // If `dead_on_return` is `true`, then nothing is live when an analyzed
+  // function returns to an unknown caller, and so the live set on entry to
+  // a function is what the function itself, or the code it calls, reads.
+  for (auto func : funcs) {
+    live_out[func] = LiveSet(static_cast<unsigned>(num_slots),
+                             !dead_on_return &&
+                             !HasOnlyKnownCallers(func, bb_func));
+    for (auto &block : *func) {
+      BlockLiveSet(&block);
       auto succ_begin_it = llvm::succ_begin(&block);
       auto succ_end_it = llvm::succ_end(&block);
       if (succ_begin_it == succ_end_it) {
@@ -1113,7 +1440,49 @@ LiveSetBlockVisitor::LiveSetBlockVisitor(
   }
 }
 
-// Visit the basic blocks in the worklist and update the block_map.
+LiveSet &LiveSetBlockVisitor::BlockLiveSet(llvm::BasicBlock *block) {
+  auto index_it = block_index.find(block);
+  if (index_it != block_index.end()) {
+    return block_live[index_it->second];
+  }
+  const auto index = static_cast<unsigned>(block_live.size());
+  block_index[block] = index;
+  block_live.emplace_back(num_slots);
+  return block_live.back();
+}
+
+const LiveSet &LiveSetBlockVisitor::LiveOutSet(llvm::Function *func) {
+  auto live_out_it = live_out.find(func);
+  if (live_out_it != live_out.end()) {
+    return live_out_it->second;
+  } else {
+    return all_live;
+  }
+}
+
+void LiveSetBlockVisitor::AddLiveOut(llvm::Function *func,
+                                     const LiveSet &live) {
+  auto live_out_it = live_out.find(func);
+  if (live_out_it == live_out.end()) {
+    return;  // Not being analyzed, so it returns with everything live.
+  }
+
+  auto &func_live_out = live_out_it->second;
+  auto new_live_out = func_live_out;
+  new_live_out |= live;
+  if (new_live_out == func_live_out) {
+    return;
+  }
+
+  func_live_out = std::move(new_live_out);
+  for (auto &block : *func) {
+    if (llvm::succ_begin(&block) == llvm::succ_end(&block)) {
+      exits_wl.push_back(&block);
+    }
+  }
+}
+
+// Visit the basic blocks in the worklist and update the live sets.
 void LiveSetBlockVisitor::FindLiveInsts(KillCounter &stats) {
   std::vector<llvm::BasicBlock *> next_wl;
   while (!curr_wl.empty()) {
@@ -1121,7 +1490,14 @@ void LiveSetBlockVisitor::FindLiveInsts(KillCounter &stats) {
 
       // If we change the live slots state of the block, then add the
       // block's predecessors to the next work list.
-      if (VisitBlock(block, stats)) {
+      const auto changed = VisitBlock(block, stats);
+
+      // If we've changed what a function returns to, then revisit the
+      // function's exit blocks.
+      next_wl.insert(next_wl.end(), exits_wl.begin(), exits_wl.end());
+      exits_wl.clear();
+
+      if (changed) {
         int num_preds = 0;
         auto pred_it = llvm::pred_begin(block);
         auto pred_end = llvm::pred_end(block);
@@ -1137,8 +1513,9 @@ void LiveSetBlockVisitor::FindLiveInsts(KillCounter &stats) {
           auto func = block->getParent();
           for (auto user : func->users()) {
             if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) {
-              if (llvm::isa<llvm::CallInst>(inst) ||
-                  llvm::isa<llvm::InvokeInst>(inst)) {
+              if ((llvm::isa<llvm::CallInst>(inst) ||
+                   llvm::isa<llvm::InvokeInst>(inst)) &&
+                  funcs.count(inst->getParent()->getParent())) {
                 next_wl.push_back(inst->getParent());
               }
             }
@@ -1154,7 +1531,7 @@ void LiveSetBlockVisitor::FindLiveInsts(KillCounter &stats) {
 
 bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
                                      KillCounter &stats) {
-  LiveSet live;
+  LiveSet live(num_slots);
 
   for (auto inst_it = block->rbegin(); inst_it != block->rend(); ++inst_it) {
     auto inst = &*inst_it;
@@ -1185,7 +1562,7 @@ bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
       auto succ_end = llvm::succ_end(block);
       for (; succ_it != succ_end; succ_it++) {
         auto succ = *succ_it;
-        live |= block_map[succ];
+        live |= BlockLiveSet(succ);
       }
 
     // This could be a call to another lifted function or control-flow
@@ -1211,32 +1588,45 @@ bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
         live.set();
 
       // We're calling another lifted function; add a trigger relation between
-      // this block and the called function's entry block.
+      // this block and the called function's entry block. Whatever is live
+      // after the call is live when the called function returns. If this is a
+      // tail-call, then the called function returns to our caller.
       } else if (IsLiftedFunction(func, bb_func)) {
+        if (IsTailCall(inst)) {
+          const auto caller_live_out = LiveOutSet(block->getParent());
+          AddLiveOut(func, caller_live_out);
+        } else {
+          AddLiveOut(func, live);
+        }
+
         auto entry_block = &*func->begin();
-        live = block_map[entry_block];
+        live = BlockLiveSet(entry_block);
 
         if (!FLAGS_dot_output_dir.empty()) {
           debug_live_args_at_call[inst] = live;
         }
 
+      // We're returning to our caller.
+      } else if (IsFunctionReturn(func)) {
+        live = LiveOutSet(block->getParent());
+
       // We're calling something for which we lack the code, so just use prior
       // information about the arguments.
       } else {
-        auto arg_live_it = live_args.find(inst);
+        auto arg_live_ptr = live_args.find(inst);
 
         // Likely due to a more general failure to analyze this particular
         // function.
-        if (arg_live_it == live_args.end()) {
+        if (!arg_live_ptr) {
           live.set();
         } else {
-          live |= arg_live_it->second;
+          live |= *arg_live_ptr;
         }
       }
 
     } else if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(inst)) {
       auto offset_ptr = state_access_offset.find(inst);
-      if (offset_ptr == state_access_offset.end()) {
+      if (!offset_ptr) {
         continue;
       }
 
@@ -1246,7 +1636,7 @@ bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
 
       auto val = store_inst->getOperand(0);
       auto val_size = dl->getTypeAllocSize(val->getType());
-      const auto &state_slot = offset_to_slot[offset_ptr->second];
+      const auto &state_slot = offset_to_slot[*offset_ptr];
       auto slot_num = state_slot.index;
 
       if (!live.test(slot_num)) {
@@ -1263,14 +1653,14 @@ bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
     // Loads from slots revive the slots.
     } else if (llvm::isa<llvm::LoadInst>(inst)) {
       auto offset_ptr = state_access_offset.find(inst);
-      if (offset_ptr != state_access_offset.end()) {
-        auto slot_num = offset_to_slot[offset_ptr->second].index;
+      if (offset_ptr) {
+        auto slot_num = offset_to_slot[*offset_ptr].index;
         live.set(slot_num);
       }
     }
   }
 
-  auto &old_live_on_entry = block_map[block];
+  auto &old_live_on_entry = BlockLiveSet(block);
   if (old_live_on_entry != live) {
     old_live_on_entry = live;
     return true;
@@ -1281,8 +1671,8 @@ bool LiveSetBlockVisitor::VisitBlock(llvm::BasicBlock *block,
 
 void LiveSetBlockVisitor::CollectDeadInsts(KillCounter &stats) {
   on_remove_pass = true;
-  for (auto &func : module) {
-    for (auto &block : func) {
+  for (auto func : funcs) {
+    for (auto &block : *func) {
       VisitBlock(&block, stats);
     }
   }
@@ -1333,43 +1723,43 @@ void LiveSetBlockVisitor::CreateDOTDigraph(llvm::Function *func,
       << "node [shape=none margin=0 nojustify=false labeljust=l]"
       << std::endl;
 
+  // Make a vector so that we can go from slot index to slot.
+  std::vector<const StateSlot *> slots;
+  slots.resize(num_slots);
+  for (auto &slot : offset_to_slot) {
+    slots[slot.index] = &slot;
+  }
+
   // Figure out relevant load/stores to print.
-  LiveSet used;
+  LiveSet used(num_slots);
   for (auto &block : *func) {
     for (auto &inst : block) {
       auto offset_ptr = state_access_offset.find(&inst);
-      if (offset_ptr != state_access_offset.end()) {
-        const auto &slot = offset_to_slot[offset_ptr->second];
+      if (offset_ptr) {
+        const auto &slot = offset_to_slot[*offset_ptr];
         used.set(slot.index);
       }
     }
   }
 
-  // Make a vector so that we can go from slot index to slot.
-  std::vector<const StateSlot *> slots;
-  slots.resize(offset_to_slot.back().index + 1);
-  for (auto &slot : offset_to_slot) {
-    slots[slot.index] = &slot;
-  }
-
   // Stream node information for each block.
   for (auto &block_ref : *func) {
-    auto block_live_ptr = block_map.find(&block_ref);
-    if (block_live_ptr == block_map.end()) {
+    auto block_index_ptr = block_index.find(&block_ref);
+    if (block_index_ptr == block_index.end()) {
       continue;
     }
 
     auto block = &block_ref;
-    const auto &blive = block_live_ptr->second;
+    const auto blive = block_live[block_index_ptr->second];
 
     // Figure out the live set on exit from the block.
-    LiveSet exit_live;
+    LiveSet exit_live(num_slots);
     int num_succs = 0;
     auto succ_it = llvm::succ_begin(block);
     auto succ_end = llvm::succ_end(block);
     for (; succ_it != succ_end; succ_it++) {
       auto succ = *succ_it;
-      exit_live |= block_map[succ];
+      exit_live |= BlockLiveSet(succ);
       num_succs++;
       dot << "b" << reinterpret_cast<uintptr_t>(block) << " -> b"
           << reinterpret_cast<uintptr_t>(succ) << std::endl;
@@ -1414,8 +1804,8 @@ void LiveSetBlockVisitor::CreateDOTDigraph(llvm::Function *func,
       dot << "<tr><td align=\"left\">";
 
       auto offset_ptr = state_access_offset.find(&inst);
-      if (offset_ptr != state_access_offset.end()) {
-        const auto &slot = offset_to_slot[offset_ptr->second];
+      if (offset_ptr) {
+        const auto &slot = offset_to_slot[*offset_ptr];
         auto inst_size = 0;
         if (llvm::isa<llvm::LoadInst>(&inst)) {
           inst_size = dl->getTypeAllocSize(inst.getType());
@@ -1618,14 +2008,14 @@ void ForwardingBlockVisitor::VisitBlock(llvm::BasicBlock *block,
     // Try to do store-to-load forwarding.
     } else if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(inst)) {
       auto offset_ptr = state_access_offset.find(inst);
-      if (offset_ptr == state_access_offset.end()) {
+      if (!offset_ptr) {
         continue;
       }
 
       const auto val = store_inst->getOperand(0);
       const auto val_type = val->getType();
       const auto val_size = dl->getTypeAllocSize(val_type);
-      const auto &state_slot = state_slots[offset_ptr->second];
+      const auto &state_slot = state_slots[*offset_ptr];
       if (!slot_to_load.count(state_slot.index)) {
         continue;
       }
@@ -1694,11 +2084,11 @@ void ForwardingBlockVisitor::VisitBlock(llvm::BasicBlock *block,
     // Try to do load-to-load forwarding.
     } else if (auto load_inst = llvm::dyn_cast<llvm::LoadInst>(inst)) {
       auto offset_ptr = state_access_offset.find(inst);
-      if (offset_ptr == state_access_offset.end()) {
+      if (!offset_ptr) {
         continue;
       }
 
-      const auto &state_slot = state_slots[offset_ptr->second];
+      const auto &state_slot = state_slots[*offset_ptr];
       auto &load_ref = slot_to_load[state_slot.index];
 
       // Get the next load, and update the slot with the current load.
@@ -1783,6 +2173,496 @@ void ForwardingBlockVisitor::VisitBlock(llvm::BasicBlock *block,
   }
 }
 
+// How a single slot of the `State` structure is accessed within a function.
+struct SlotAccesses {
+  const StateSlot *slot;
+
+  // Type of the whole slot, as seen by full-sized loads and stores.
+  llvm::Type *type;
+
+  // Loads and stores of this slot.
+  std::vector<llvm::Instruction *> accesses;
+
+  // Set if some access prevents us from caching the slot.
+  bool is_blocked;
+};
+
+// Return `true` if `inst` calls something that might access the `State`
+// structure, and fill `slots` with the indices of the slots that it might
+// access.
+static bool IsStateBarrier(llvm::Instruction *inst,
+                           const InstToLiveSet &live_args,
+                           LiveSet &live) {
+  auto live_ptr = live_args.find(inst);
+  if (!live_ptr) {
+    live.set();
+  } else {
+    live = *live_ptr;
+  }
+  return live.any();
+}
+
+// Cache the slots of the `State` structure accessed by `func` in allocas, so
+// that later optimizations can promote them to SSA values. The cached values
+// are written back to the `State` structure before calls that might read it,
+// and before returning, and reloaded from it after calls that might write to
+// it.
+static bool PromoteStateSlots(llvm::Function *func,
+                              const InstToOffset &state_access_offset,
+                              const InstToLiveSet &live_args,
+                              const std::vector<StateSlot> &slots,
+                              const llvm::DataLayout &dl) {
+  std::map<uint64_t, SlotAccesses> slot_accesses;
+  std::vector<llvm::Instruction *> calls;
+  std::vector<llvm::Instruction *> returns;
+
+  for (auto &inst : llvm::instructions(func)) {
+    if (llvm::isa<llvm::InvokeInst>(&inst)) {
+      return false;
+    } else if (llvm::isa<llvm::CallInst>(&inst)) {
+      calls.push_back(&inst);
+      continue;
+    } else if (llvm::isa<llvm::ReturnInst>(&inst)) {
+      returns.push_back(&inst);
+      continue;
+    }
+
+    auto offset_ptr = state_access_offset.find(&inst);
+    if (!offset_ptr) {
+      continue;
+    }
+
+    const auto offset = *offset_ptr;
+    const auto &slot = slots[offset];
+    auto &info = slot_accesses[slot.index];
+    info.slot = &slot;
+    info.accesses.push_back(&inst);
+
+    llvm::Type *type = nullptr;
+    auto is_simple = false;
+    auto is_load = false;
+    if (auto load_inst = llvm::dyn_cast<llvm::LoadInst>(&inst)) {
+      type = load_inst->getType();
+      is_simple = load_inst->isSimple();
+      is_load = true;
+    } else if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+      type = store_inst->getValueOperand()->getType();
+      is_simple = store_inst->isSimple();
+    }
+
+    const auto size = dl.getTypeAllocSize(type);
+    if (!is_simple) {
+      info.is_blocked = true;
+
+    // Full-sized access; all of these need to agree on the type of the slot.
+    } else if (offset == slot.offset && size == slot.size) {
+      if (!info.type) {
+        info.type = type;
+      } else if (info.type != type) {
+        info.is_blocked = true;
+      }
+
+    // Partial loads of integer slots can be extracted from the cached value.
+    } else if (!is_load || !type->isIntegerTy() ||
+               (offset - slot.offset + size) > slot.size) {
+      info.is_blocked = true;
+    }
+  }
+
+  auto &context = func->getContext();
+  auto state_ptr = LoadStatePointer(func);
+  auto entry_block = &(func->getEntryBlock());
+  llvm::IRBuilder<> ir(entry_block, entry_block->getFirstInsertionPt());
+  auto byte_ptr = ir.CreateBitCast(
+      state_ptr, llvm::Type::getInt8PtrTy(context));
+
+  // Index of slot to `State` pointer and cache for that slot.
+  std::map<uint64_t, std::pair<llvm::Value *, llvm::AllocaInst *>> caches;
+
+  for (auto &entry : slot_accesses) {
+    auto &info = entry.second;
+    const auto &slot = *(info.slot);
+    const auto slot_bits = slot.size * 8;
+
+    if (info.is_blocked) {
+      continue;
+    } else if (!info.type) {
+      info.type = llvm::Type::getIntNTy(context,
+                                        static_cast<unsigned>(slot_bits));
+    }
+
+    // Partial loads need an integer slot.
+    auto has_partial = false;
+    for (auto inst : info.accesses) {
+      auto type = inst->getType();
+      if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(inst)) {
+        type = store_inst->getValueOperand()->getType();
+      }
+      has_partial = has_partial || type != info.type;
+    }
+    if (has_partial && !info.type->isIntegerTy()) {
+      continue;
+    }
+
+    auto slot_ptr = ir.CreateBitCast(
+        ir.CreateConstInBoundsGEP1_64(byte_ptr, slot.offset),
+        llvm::PointerType::get(info.type, 0));
+    auto cache = ir.CreateAlloca(info.type);
+    ir.CreateStore(ir.CreateLoad(slot_ptr), cache);
+    caches[entry.first] = {slot_ptr, cache};
+
+    for (auto inst : info.accesses) {
+      llvm::IRBuilder<> inst_ir(inst);
+      if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(inst)) {
+        inst_ir.CreateStore(store_inst->getValueOperand(), cache);
+
+      } else {
+        llvm::Value *val = inst_ir.CreateLoad(cache);
+        if (inst->getType() != info.type) {
+          const auto shift = state_access_offset.at(inst) - slot.offset;
+          if (shift) {
+            val = inst_ir.CreateLShr(val, shift * 8);
+          }
+          val = inst_ir.CreateTrunc(val, inst->getType());
+        }
+        inst->replaceAllUsesWith(val);
+      }
+      inst->eraseFromParent();
+    }
+  }
+
+  if (caches.empty()) {
+    return false;
+  }
+
+  auto write_back = [&caches] (llvm::Instruction *before,
+                               const LiveSet &live) {
+    llvm::IRBuilder<> before_ir(before);
+    for (const auto &cache : caches) {
+      if (live.test(static_cast<unsigned>(cache.first))) {
+        before_ir.CreateStore(before_ir.CreateLoad(cache.second.second),
+                              cache.second.first);
+      }
+    }
+  };
+
+  auto reload = [&caches] (llvm::Instruction *before, const LiveSet &live) {
+    llvm::IRBuilder<> before_ir(before);
+    for (const auto &cache : caches) {
+      if (live.test(static_cast<unsigned>(cache.first))) {
+        before_ir.CreateStore(before_ir.CreateLoad(cache.second.first),
+                              cache.second.second);
+      }
+    }
+  };
+
+  const LiveSet all_live(static_cast<unsigned>(NumLiveSetSlots(slots)), true);
+  LiveSet live(static_cast<unsigned>(NumLiveSetSlots(slots)));
+
+  for (auto call : calls) {
+    if (!IsStateBarrier(call, live_args, live)) {
+      continue;
+    }
+
+    // Tail-calls leave the function, so everything needs to be written back,
+    // and nothing needs to be reloaded.
+    auto next_inst = call->getNextNode();
+    if (llvm::isa<llvm::ReturnInst>(next_inst)) {
+      write_back(call, all_live);
+      returns.erase(std::remove(returns.begin(), returns.end(), next_inst),
+                    returns.end());
+
+    } else {
+      write_back(call, live);
+      reload(next_inst, live);
+    }
+  }
+
+  for (auto ret : returns) {
+    write_back(ret, all_live);
+  }
+
+  return true;
+}
+
+// Return `true` if the code starting at `inst` returns from the function
+// without doing anything else. With a shadow return stack, a return pops the
+// shadow stack, and then either returns or, if the popped address doesn't
+// match, jumps to the address being returned to.
+static bool IsReturn(llvm::Instruction *inst, bool after_pop,
+                     bool may_branch) {
+  for (; inst; inst = inst->getNextNode()) {
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(inst)) {
+      auto callee = call->getCalledFunction();
+      if (!after_pop && callee &&
+          callee->getName() == "__remill_shadow_stack_pop") {
+        after_pop = true;
+        continue;
+      }
+      return callee && IsTailCall(call) &&
+             (IsFunctionReturn(callee) ||
+              callee->getName() == "__remill_error" ||
+              (after_pop && callee->getName() == "__remill_jump"));
+
+    } else if (auto br = llvm::dyn_cast<llvm::BranchInst>(inst)) {
+      if (!after_pop || !may_branch) {
+        return false;
+      }
+      for (auto i = 0U; i < br->getNumSuccessors(); ++i) {
+        if (!IsReturn(&(br->getSuccessor(i)->front()), true, false)) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Return `true` if `store` writes a value back into the `State` structure
+// just before the function returns to its caller, i.e. after which the
+// function's stack frame is dead.
+static bool IsReturnWriteBack(llvm::StoreInst *store) {
+  return IsReturn(store->getNextNode(), false, true);
+}
+
+// Returns the name of the stack pointer register of the target architecture.
+static const char *StackPointerName(const Arch *arch) {
+  if (arch->IsAMD64()) {
+    return "RSP";
+  } else if (arch->IsX86()) {
+    return "ESP";
+  } else {
+    return nullptr;
+  }
+}
+
+// Replace the accesses to guest memory that provably fall inside the stack
+// frame of `func` (below the stack pointer on entry) with loads and stores
+// to an `alloca`. The stack pointer is tracked as a constant displacement
+// from its value on entry to the function. This is only done if no pointer
+// into the frame can escape before the function returns, i.e. if nothing
+// else could ever access the frame, so in practice this covers leaf
+// functions whose `State` slots have been promoted to SSA values.
+static bool RecoverStackFrame(llvm::Function *func,
+                              const InstToOffset &state_access_offset,
+                              const std::vector<StateSlot> &slots,
+                              const Register *sp_reg,
+                              const llvm::DataLayout &dl) {
+  auto &entry_block = func->getEntryBlock();
+
+  // Values that are the stack pointer on entry plus some displacement.
+  std::unordered_map<llvm::Value *, int64_t> sp_delta;
+  std::vector<llvm::Value *> wl;
+
+  // The stack pointer on entry is whatever is loaded from its slot in the
+  // entry block before anything could change it.
+  for (auto &inst : entry_block) {
+    if (llvm::isa<llvm::CallInst>(&inst)) {
+      break;
+    }
+    auto offset_ptr = state_access_offset.find(&inst);
+    if (!offset_ptr ||
+        slots[*offset_ptr].index != slots[sp_reg->offset].index) {
+      continue;
+    } else if (llvm::isa<llvm::StoreInst>(&inst)) {
+      break;
+    } else if (*offset_ptr == sp_reg->offset &&
+               inst.getType() == sp_reg->type) {
+      sp_delta[&inst] = 0;
+      wl.push_back(&inst);
+    }
+  }
+
+  if (wl.empty()) {
+    return false;
+  }
+
+  struct StackAccess {
+    llvm::CallInst *call;
+    int64_t delta;
+    unsigned size;
+    bool is_write;
+  };
+
+  std::vector<StackAccess> accesses;
+  std::vector<llvm::Instruction *> merges;
+
+  auto add_delta = [&sp_delta, &wl] (llvm::Value *val, int64_t delta) {
+    auto delta_it = sp_delta.find(val);
+    if (delta_it == sp_delta.end()) {
+      sp_delta[val] = delta;
+      wl.push_back(val);
+      return true;
+    }
+    return delta_it->second == delta;
+  };
+
+  // Find all the uses of the stack pointer. Anything that we don't
+  // understand might let a pointer into the frame escape.
+  while (!wl.empty()) {
+    auto val = wl.back();
+    wl.pop_back();
+    const auto delta = sp_delta[val];
+
+    for (auto &use : val->uses()) {
+      auto user = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+      if (!user) {
+        return false;
+      }
+
+      if (auto op = llvm::dyn_cast<llvm::BinaryOperator>(user)) {
+        auto disp = llvm::dyn_cast<llvm::ConstantInt>(
+            op->getOperand(1 - use.getOperandNo()));
+        if (!disp) {
+          return false;
+        } else if (op->getOpcode() == llvm::Instruction::Add) {
+          if (!add_delta(op, delta + disp->getSExtValue())) {
+            return false;
+          }
+        } else if (op->getOpcode() == llvm::Instruction::Sub &&
+                   use.getOperandNo() == 0) {
+          if (!add_delta(op, delta - disp->getSExtValue())) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+
+      } else if (llvm::isa<llvm::PHINode>(user) ||
+                 (llvm::isa<llvm::SelectInst>(user) &&
+                  use.getOperandNo() != 0)) {
+        if (!add_delta(user, delta)) {
+          return false;
+        }
+        merges.push_back(user);
+
+      } else if (llvm::isa<llvm::ICmpInst>(user)) {
+        continue;
+
+      } else if (auto call = llvm::dyn_cast<llvm::CallInst>(user)) {
+        auto callee = call->getCalledFunction();
+        auto is_write = false;
+        auto size = MemoryAccessSize(callee, false);
+        if (!size) {
+          is_write = true;
+          size = MemoryAccessSize(callee, true);
+        }
+        if (!size || use.getOperandNo() != 1) {
+          return false;
+        }
+        auto val_type = is_write ? call->getArgOperand(2)->getType() :
+                                   call->getType();
+        if (dl.getTypeStoreSize(val_type) != size) {
+          return false;
+        }
+        accesses.push_back({call, delta, size, is_write});
+
+      // The only pointer into the frame that may be written back into the
+      // `State` structure is the stack pointer on return, once it has popped
+      // the whole frame. Anything else, e.g. a pointer returned in `RAX`, or
+      // a stack pointer that still points into the frame, lets the frame
+      // outlive the function.
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+        auto offset_ptr = state_access_offset.find(store);
+        if (use.getOperandNo() != 0 || !offset_ptr ||
+            *offset_ptr != sp_reg->offset || delta < 0 ||
+            !IsReturnWriteBack(store)) {
+          return false;
+        }
+
+      } else {
+        return false;
+      }
+    }
+  }
+
+  // Every value flowing into a merge of stack pointers must be the same
+  // displacement from the entry stack pointer.
+  for (auto merge : merges) {
+    const auto delta = sp_delta[merge];
+    const auto first_op = llvm::isa<llvm::SelectInst>(merge) ? 1U : 0U;
+    for (auto i = first_op; i < merge->getNumOperands(); ++i) {
+      auto delta_it = sp_delta.find(merge->getOperand(i));
+      if (delta_it == sp_delta.end() || delta_it->second != delta) {
+        return false;
+      }
+    }
+  }
+
+  // Accesses at or above the entry stack pointer go to the caller's frame
+  // (e.g. the return address, or stack-passed arguments), and are left alone.
+  int64_t frame_size = 0;
+  for (const auto &access : accesses) {
+    if (access.delta < 0) {
+      if ((access.delta + access.size) > 0) {
+        return false;  // Straddles the boundary.
+      }
+      frame_size = std::max<int64_t>(frame_size, -access.delta);
+    }
+  }
+
+  if (!frame_size) {
+    return false;
+  }
+
+  auto &context = func->getContext();
+  auto byte_type = llvm::Type::getInt8Ty(context);
+  llvm::IRBuilder<> ir(&entry_block, entry_block.getFirstInsertionPt());
+  auto frame = ir.CreateAlloca(
+      llvm::ArrayType::get(byte_type, static_cast<uint64_t>(frame_size)));
+  frame->setAlignment(16);
+  auto frame_ptr = ir.CreateBitCast(frame, llvm::Type::getInt8PtrTy(context));
+
+  for (const auto &access : accesses) {
+    if (access.delta >= 0) {
+      continue;
+    }
+
+    auto call = access.call;
+    llvm::IRBuilder<> call_ir(call);
+    auto val_type = access.is_write ? call->getArgOperand(2)->getType() :
+                                      call->getType();
+    auto ptr = call_ir.CreateBitCast(
+        call_ir.CreateConstInBoundsGEP1_64(
+            frame_ptr, static_cast<uint64_t>(frame_size + access.delta)),
+        llvm::PointerType::get(val_type, 0));
+
+    if (access.is_write) {
+      call_ir.CreateStore(call->getArgOperand(2), ptr);
+      call->replaceAllUsesWith(call->getArgOperand(0));
+    } else {
+      call->replaceAllUsesWith(call_ir.CreateLoad(ptr));
+    }
+    call->eraseFromParent();
+  }
+
+  return true;
+}
+
+// Attach a live set to `func` as metadata, as a list of the byte offsets of
+// the live slots in the `State` structure.
+static void AnnotateLiveSet(llvm::Function *func, const char *kind,
+                            const LiveSet &live,
+                            const std::vector<StateSlot> &slots) {
+#if LLVM_VERSION_NUMBER >= LLVM_VERSION(3, 9)
+  auto &context = func->getContext();
+  auto i64_type = llvm::Type::getInt64Ty(context);
+  std::vector<llvm::Metadata *> offsets;
+  for (uint64_t i = 0; i < slots.size(); ++i) {
+    const auto &slot = slots[i];
+    if (slot.offset != i) {
+      continue;  // Only the first byte of each slot.
+    }
+    if (live.test(static_cast<unsigned>(slot.index))) {
+      offsets.push_back(llvm::ConstantAsMetadata::get(
+          llvm::ConstantInt::get(i64_type, slot.offset)));
+    }
+  }
+  func->setMetadata(kind, llvm::MDNode::get(context, offsets));
+#endif
+}
+
 }  // namespace
 
 // Returns a covering vector of `StateSlots` for the module's `State` type.
@@ -1825,51 +2705,191 @@ void RemoveDeadStores(llvm::Module *module,
   KillCounter stats = {};
   const llvm::DataLayout dl(module);
 
-  InstToLiveSet live_args;
-  InstToOffset state_access_offset;
+  // The summaries are taken out of `gSummaries` for the duration of the
+  // analysis, so that other modules can be analyzed at the same time.
+  FunctionSummaries old_summaries;
+  {
+    std::lock_guard<std::mutex> locker(gSummariesLock);
+    auto summaries_it = gSummaries.find(module);
+    if (summaries_it != gSummaries.end()) {
+      old_summaries.swap(summaries_it->second);
+      gSummaries.erase(summaries_it);
+    }
+  }
+
+  FunctionSummaries summaries;
 
+  // Find the lifted functions that are new or that have changed since the
+  // last time this module was analyzed. Functions that have been removed
+  // from the module are forgotten.
+  std::unordered_set<llvm::Function *> funcs;
+  std::vector<llvm::Function *> wl;
   for (auto &func : *module) {
     if (!IsLiftedFunction(&func, bb_func)) {
       continue;
     }
+    auto summary_it = old_summaries.find(func.getName().str());
+    if (summary_it == old_summaries.end() ||
+        summary_it->second.fingerprint != Fingerprint(&func)) {
+      funcs.insert(&func);
+      wl.push_back(&func);
+    } else {
+      summaries.emplace(func.getName().str(), summary_it->second);
+    }
+  }
 
-    ForwardAliasVisitor fav(dl, slots, live_args, state_access_offset);
+  // The live set on entry to a function depends on the live sets on entry to
+  // its callees, so re-analyze the transitive callers of new and changed
+  // functions. If we know all the callers of a function, then what is live
+  // when it returns depends on its callers, so re-analyze those callees too.
+  while (!wl.empty()) {
+    auto func = wl.back();
+    wl.pop_back();
+    for (auto &inst : llvm::instructions(func)) {
+      llvm::Function *callee = nullptr;
+      if (auto call_inst = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+        callee = call_inst->getCalledFunction();
+      } else if (auto invoke_inst = llvm::dyn_cast<llvm::InvokeInst>(&inst)) {
+        callee = invoke_inst->getCalledFunction();
+      }
+      if (callee && IsLiftedFunction(callee, bb_func) &&
+          HasOnlyKnownCallers(callee, bb_func) &&
+          funcs.insert(callee).second) {
+        summaries.erase(callee->getName().str());
+        wl.push_back(callee);
+      }
+    }
+    for (auto user : func->users()) {
+      if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) {
+        auto caller = inst->getParent()->getParent();
+        if ((llvm::isa<llvm::CallInst>(inst) ||
+             llvm::isa<llvm::InvokeInst>(inst)) &&
+            IsLiftedFunction(caller, bb_func) &&
+            funcs.insert(caller).second) {
+          summaries.erase(caller->getName().str());
+          wl.push_back(caller);
+        }
+      }
+    }
+  }
+
+  old_summaries.clear();
+  if (funcs.empty()) {
+    std::lock_guard<std::mutex> locker(gSummariesLock);
+    gSummaries[module].swap(summaries);
+    return;
+  }
+
+  // Run the alias analysis of each function on a pool of threads. The
+  // analysis of a function only reads other functions. Logging DOT digraphs
+  // is not thread-safe.
+  std::vector<FunctionAliases> aliases(funcs.size());
+  InstructionNumbering numbering;
+  auto i = 0UL;
+  for (auto func : funcs) {
+    aliases[i++].func = func;
+    numbering.AddFunction(func);
+  }
+
+  // Each thread fills in the entries for the instructions of the functions
+  // that it analyzes.
+  InstToLiveSet live_args(numbering);
+  InstToOffset state_access_offset(numbering);
+
+  // Each thread gets its own data layout, because a data layout lazily
+  // caches struct layouts, and so isn't safe to share across threads.
+  std::atomic<size_t> next_func(0);
+  auto analyze_funcs = [&aliases, &next_func, &live_args,
+                        &state_access_offset, module, &slots] (void) {
+    const llvm::DataLayout thread_dl(module);
+    for (size_t index = next_func++; index < aliases.size();
+         index = next_func++) {
+      auto &func_aliases = aliases[index];
+      ForwardAliasVisitor fav(thread_dl, slots, live_args,
+                              state_access_offset);
+      func_aliases.analyzed = fav.Analyze(func_aliases.func);
+      func_aliases.state_offset.swap(fav.state_offset);
+    }
+  };
+
+  size_t num_threads = FLAGS_dead_store_elimination_threads;
+  if (!num_threads) {
+    num_threads = std::thread::hardware_concurrency();
+  }
+  if (!FLAGS_dot_output_dir.empty()) {
+    num_threads = 1;
+  }
+  num_threads = std::max<size_t>(1, std::min(num_threads, aliases.size()));
+
+  std::vector<std::thread> pool;
+  for (i = 1; i < num_threads; ++i) {
+    pool.emplace_back(analyze_funcs);
+  }
+  analyze_funcs();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+
+  for (auto &func_aliases : aliases) {
 
     // If the analysis succeeds for this function, then do store-to-load
     // and load-to-load forwarding.
-    if (fav.Analyze(&func)) {
-      if (FLAGS_enable_register_forwarding) {
-        ForwardingBlockVisitor fbv(func, state_access_offset, slots, &dl);
-        fbv.Visit(fav.state_offset, stats);
-      }
+    if (func_aliases.analyzed && FLAGS_enable_register_forwarding) {
+      ForwardingBlockVisitor fbv(*func_aliases.func,
+                                 state_access_offset, slots, &dl);
+      fbv.Visit(func_aliases.state_offset, stats);
     }
   }
 
   // Perform live set analysis
   LiveSetBlockVisitor visitor(*module, live_args, state_access_offset,
-                              slots, bb_func, &dl);
+                              slots, bb_func, &dl, funcs, summaries);
 
   visitor.FindLiveInsts(stats);
   visitor.CollectDeadInsts(stats);
 
   if (!FLAGS_dot_output_dir.empty()) {
-    for (auto &func : *module) {
-      if (IsLiftedFunction(&func, bb_func)) {
-        visitor.CreateDOTDigraph(&func, ".dot");
-      }
+    for (auto func : funcs) {
+      visitor.CreateDOTDigraph(func, ".dot");
     }
   }
 
   visitor.DeleteDeadInsts(stats);
 
   if (!FLAGS_dot_output_dir.empty()) {
-    for (auto &func : *module) {
-      if (IsLiftedFunction(&func, bb_func)) {
-        visitor.CreateDOTDigraph(&func, ".post.dot");
-      }
+    for (auto func : funcs) {
+      visitor.CreateDOTDigraph(func, ".post.dot");
     }
   }
 
+  // Find which slots the functions read on entry, as opposed to the slots
+  // that are only live because a caller might read them after the function
+  // returns.
+  LiveSetBlockVisitor reads_visitor(*module, live_args, state_access_offset,
+                                    slots, bb_func, &dl, funcs, summaries,
+                                    true);
+  reads_visitor.FindLiveInsts(stats);
+
+  // Remember what we learned about the re-analyzed functions for the next
+  // time that this module is analyzed, and tell everyone else too.
+  for (auto func : funcs) {
+    AnnotateLiveSet(func, "remill.live_in",
+                    visitor.BlockLiveSet(&(func->getEntryBlock())), slots);
+    AnnotateLiveSet(func, "remill.live_out", visitor.LiveOutSet(func), slots);
+    AnnotateLiveSet(func, "remill.read_on_entry",
+                    reads_visitor.BlockLiveSet(&(func->getEntryBlock())),
+                    slots);
+
+    auto &summary = summaries[func->getName().str()];
+    summary.fingerprint = Fingerprint(func);
+    summary.live_on_entry = visitor.BlockLiveSet(&(func->getEntryBlock()));
+  }
+
+  {
+    std::lock_guard<std::mutex> locker(gSummariesLock);
+    gSummaries[module].swap(summaries);
+  }
+
 //  LOG(INFO)
 //      << "Candidate stores: " << stats.num_stores << "; "
 //      << "Dead stores: " << stats.dead_stores << "; "
@@ -1884,4 +2904,65 @@ void RemoveDeadStores(llvm::Module *module,
 //      << "Unanalyzed functions: " << stats.failed_funcs;
 }
 
+void ForgetDeadStoreSummaries(const llvm::Module *module) {
+  std::lock_guard<std::mutex> locker(gSummariesLock);
+  gSummaries.erase(module);
+}
+
+// Cache the `State` slots used by each lifted function in allocas, so that
+// later optimizations can promote them to SSA values.
+void PromoteStateToSSA(llvm::Module *module, llvm::Function *bb_func,
+                       const std::vector<StateSlot> &slots) {
+  const llvm::DataLayout dl(module);
+  for (auto &func : *module) {
+    if (!IsLiftedFunction(&func, bb_func)) {
+      continue;
+    }
+
+    // We can only cache slots if we know where every pointer into the
+    // `State` structure points.
+    InstructionNumbering numbering;
+    numbering.AddFunction(&func);
+    InstToLiveSet live_args(numbering);
+    InstToOffset state_access_offset(numbering);
+    ForwardAliasVisitor fav(dl, slots, live_args, state_access_offset);
+    if (fav.Analyze(&func) && fav.is_complete) {
+      PromoteStateSlots(&func, state_access_offset, live_args, slots, dl);
+    }
+  }
+}
+
+// Replace guest memory accesses that provably stay within the stack frame of
+// each lifted function with accesses to a native stack frame.
+void RecoverStackFrames(llvm::Module *module, llvm::Function *bb_func,
+                        const std::vector<StateSlot> &slots) {
+  auto arch = GetTargetArch();
+  auto sp_name = StackPointerName(arch);
+  if (!sp_name) {
+    return;
+  }
+  auto sp_reg = arch->RegisterByName(sp_name);
+  if (!sp_reg) {
+    return;
+  }
+
+  const llvm::DataLayout dl(module);
+  for (auto &func : *module) {
+    if (!IsLiftedFunction(&func, bb_func)) {
+      continue;
+    }
+
+    // We can only track the stack pointer through the `State` structure if
+    // we know where every pointer into it points.
+    InstructionNumbering numbering;
+    numbering.AddFunction(&func);
+    InstToLiveSet live_args(numbering);
+    InstToOffset state_access_offset(numbering);
+    ForwardAliasVisitor fav(dl, slots, live_args, state_access_offset);
+    if (fav.Analyze(&func) && fav.is_complete) {
+      RecoverStackFrame(&func, state_access_offset, slots, sp_reg, dl);
+    }
+  }
+}
+
 }  // namespace remill
@@ -48,8 +48,30 @@ class StateSlot {
 std::vector<StateSlot> StateSlots(llvm::Module *module);
 
 // Analyze a module, discover aliasing loads and stores, and remove dead
-// stores into the `State` structure.
+// stores into the `State` structure. Each analyzed function is annotated with
+// the byte offsets of the slots that are live on entry (`remill.live_in`),
+// that are live when it returns (`remill.live_out`), and that it reads on
+// entry, regardless of its callers (`remill.read_on_entry`).
 void RemoveDeadStores(llvm::Module *module, llvm::Function *bb_func,
                       const std::vector<StateSlot> &slots);
 
+// Forget what `RemoveDeadStores` learned about the functions of `module`, so
+// that the next call analyzes all of them. This should be called before
+// deleting a module on which `RemoveDeadStores` was run.
+void ForgetDeadStoreSummaries(const llvm::Module *module);
+
+// Cache the values of `State` slots in allocas for the duration of each
+// lifted function, so that later optimizations can promote them into SSA
+// values. Cached values are written back to the `State` structure before
+// calls, tail-calls, and returns, and reloaded after calls.
+void PromoteStateToSSA(llvm::Module *module, llvm::Function *bb_func,
+                       const std::vector<StateSlot> &slots);
+
+// Replace reads and writes of guest memory that provably fall within the
+// stack frame of a lifted function with loads and stores to an `alloca`.
+// This works best after `PromoteStateToSSA`, as the stack pointer must be
+// tracked as a constant displacement from its value on entry.
+void RecoverStackFrames(llvm::Module *module, llvm::Function *bb_func,
+                        const std::vector<StateSlot> &slots);
+
 }  // namespace remill
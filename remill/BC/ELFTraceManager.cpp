@@ -0,0 +1,787 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #include <glog/logging.h>
+
+#include <cstring>
+#include <sstream>
+#include <unordered_set>
+#include <utility>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "remill/Arch/Instruction.h"
+#include "remill/BC/ELFTraceManager.h"
+#include "remill/BC/Util.h"
+
+namespace remill {
+namespace {
+
+// Subset of the ELF constants that we need. We don't use `<elf.h>` because
+// it isn't available everywhere.
+enum : uint32_t {
+  kELFClass32 = 1,
+  kELFClass64 = 2,
+  kELFDataLittleEndian = 1,
+
+  kELFTypeExecutable = 2,
+  kELFTypeShared = 3,
+
+  kELFMachine386 = 3,
+  kELFMachineX86_64 = 62,
+  kELFMachineAArch64 = 183,
+
+  kSegmentLoad = 1,
+  kSegmentDynamic = 2,
+  kSegmentGNURelRO = 0x6474e552,
+
+  kSegmentExecutable = 1,
+  kSegmentWritable = 2,
+
+  kSectionSymTab = 2,
+  kSectionDynSym = 11,
+
+  kSymbolTypeFunc = 2,
+  kSymbolTypeGNUIFunc = 10,
+  kSymbolBindLocal = 0,
+  kSymbolVisibilityDefault = 0,
+  kSymbolSectionUndef = 0,
+  kSymbolSectionReserved = 0xff00,
+
+  kDynamicNull = 0,
+  kDynamicPLTRelSize = 2,
+  kDynamicPLTGOT = 3,
+  kDynamicStrTab = 5,
+  kDynamicSymTab = 6,
+  kDynamicRela = 7,
+  kDynamicRelaSize = 8,
+  kDynamicRel = 17,
+  kDynamicRelSize = 18,
+  kDynamicPLTRel = 20,
+  kDynamicJmpRel = 23,
+  kDynamicFlags1 = 0x6ffffffb,
+
+  kDynamicFlags1PIE = 0x08000000,
+
+  // Relocation types. x86 and amd64 share these numbers.
+  kRelocX86GlobDat = 6,
+  kRelocX86JumpSlot = 7,
+  kRelocX86Relative = 8,
+  kRelocAArch64GlobDat = 1025,
+  kRelocAArch64JumpSlot = 1026,
+  kRelocAArch64Relative = 1027
+};
+
+// Read a little-endian integer of `size` bytes out of `data`.
+static uint64_t ReadLE(const uint8_t *data, uint64_t offset, unsigned size) {
+  uint64_t val = 0;
+  for (auto i = 0U; i < size; ++i) {
+    val |= static_cast<uint64_t>(data[offset + i]) << (i * 8);
+  }
+  return val;
+}
+
+}  // namespace
+
+ELFTraceManager::~ELFTraceManager(void) {}
+
+ELFTraceManager::ELFTraceManager(llvm::Module *module_,
+                                 std::unique_ptr<llvm::MemoryBuffer> buffer_,
+                                 uint64_t base_)
+    : module(module_),
+      buffer(std::move(buffer_)),
+      image(reinterpret_cast<const uint8_t *>(buffer->getBufferStart())),
+      image_size(buffer->getBufferSize()),
+      base(base_),
+      entry(0),
+      pltgot(0),
+      word_size(0),
+      machine(0),
+      is_executable_type(false),
+      relro_begin(0),
+      relro_end(0),
+      last_segment(nullptr) {}
+
+// Load the ELF file at `path`. The file is memory-mapped (unless it is small),
+// and we don't need a null terminator, as that would force a copy.
+std::unique_ptr<ELFTraceManager> ELFTraceManager::Open(
+    llvm::Module *module, const std::string &path, uint64_t base) {
+  auto maybe_buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+  if (!maybe_buffer) {
+    // LOG(ERROR)
+    //     << "Could not open ELF file " << path << ": "
+    //     << maybe_buffer.getError().message();
+    return nullptr;
+  }
+
+  std::unique_ptr<ELFTraceManager> manager(
+      new ELFTraceManager(module, std::move(maybe_buffer.get()), base));
+  if (!manager->Parse()) {
+    // LOG(ERROR)
+    //     << "Could not parse ELF file " << path;
+    return nullptr;
+  }
+  return manager;
+}
+
+uint64_t ELFTraceManager::EntryAddress(void) const {
+  return entry;
+}
+
+const std::map<uint64_t, std::string> &ELFTraceManager::Functions(
+    void) const {
+  return functions;
+}
+
+// Parse the ELF header and the program headers. We only look at segments,
+// and not at sections, because section headers can be stripped. The only
+// use of sections is to find symbol tables.
+bool ELFTraceManager::Parse(void) {
+  if (image_size < 52 || 0x7f != image[0] || 'E' != image[1] ||
+      'L' != image[2] || 'F' != image[3] ||
+      kELFDataLittleEndian != image[5]) {
+    return false;
+  }
+
+  const auto elf_class = image[4];
+  if (kELFClass64 == elf_class) {
+    word_size = 8;
+  } else if (kELFClass32 == elf_class) {
+    word_size = 4;
+  } else {
+    return false;
+  }
+
+  const auto header_size = 8 == word_size ? 64ULL : 52ULL;
+  if (image_size < header_size) {
+    return false;
+  }
+
+  is_executable_type = kELFTypeExecutable == ReadLE(image, 16, 2);
+  machine = static_cast<unsigned>(ReadLE(image, 18, 2));
+  if (kELFTypeShared != ReadLE(image, 16, 2)) {
+    base = 0;
+  }
+
+  entry = base + ReadLE(image, 24, word_size);
+  const auto phoff = ReadLE(image, 24 + word_size, word_size);
+  const auto phentsize = ReadLE(image, 42 + 3 * (word_size - 4), 2);
+  const auto phnum = ReadLE(image, 44 + 3 * (word_size - 4), 2);
+  const auto min_phentsize = 8 == word_size ? 56U : 32U;
+
+  // The program headers must be at least as big as we expect, and must all
+  // be inside the file.
+  if (phentsize < min_phentsize || phoff > image_size ||
+      phnum > ((image_size - phoff) / phentsize)) {
+    return false;
+  }
+
+  uint64_t dynamic_addr = 0;
+  uint64_t dynamic_size = 0;
+
+  for (uint64_t i = 0; i < phnum; ++i) {
+    const auto ph = phoff + i * phentsize;
+
+    Segment seg = {};
+    uint32_t seg_type = static_cast<uint32_t>(ReadLE(image, ph, 4));
+    uint32_t flags = 0;
+    if (8 == word_size) {
+      flags = static_cast<uint32_t>(ReadLE(image, ph + 4, 4));
+      seg.file_offset = ReadLE(image, ph + 8, 8);
+      seg.addr = ReadLE(image, ph + 16, 8);
+      seg.file_size = ReadLE(image, ph + 32, 8);
+      seg.size = ReadLE(image, ph + 40, 8);
+    } else {
+      seg.file_offset = ReadLE(image, ph + 4, 4);
+      seg.addr = ReadLE(image, ph + 8, 4);
+      seg.file_size = ReadLE(image, ph + 16, 4);
+      seg.size = ReadLE(image, ph + 20, 4);
+      flags = static_cast<uint32_t>(ReadLE(image, ph + 24, 4));
+    }
+    seg.addr += base;
+    if (seg.size > (~0ULL - seg.addr)) {
+      return false;  // Wraps around the address space.
+    }
+    seg.is_executable = 0 != (flags & kSegmentExecutable);
+    seg.is_writable = 0 != (flags & kSegmentWritable);
+
+    if (kSegmentLoad == seg_type) {
+      if (seg.file_offset > image_size ||
+          seg.file_size > (image_size - seg.file_offset) ||
+          seg.file_size > seg.size) {
+        return false;
+      }
+      if (seg.size) {
+        segments[seg.addr + seg.size] = seg;
+      }
+    } else if (kSegmentDynamic == seg_type) {
+      dynamic_addr = seg.addr;
+      dynamic_size = seg.size;
+    } else if (kSegmentGNURelRO == seg_type) {
+      relro_begin = seg.addr;
+      relro_end = seg.addr + seg.size;
+    }
+  }
+
+  if (segments.empty()) {
+    return false;
+  }
+
+  // Statically linked executables have no dynamic section.
+  if (dynamic_addr && !ParseDynamicSection(dynamic_addr, dynamic_size)) {
+    return false;
+  }
+
+  ParseSymbols();
+  return true;
+}
+
+// Find the relocation tables, and the dynamic symbol and string tables, via
+// the dynamic section.
+bool ELFTraceManager::ParseDynamicSection(uint64_t addr, uint64_t size) {
+  std::unordered_map<uint64_t, uint64_t> tags;
+  for (uint64_t i = 0; (i + 2 * word_size) <= size; i += 2 * word_size) {
+    uint64_t tag = 0;
+    uint64_t val = 0;
+    if (!TryReadImageWord(addr + i, word_size, &tag) ||
+        !TryReadImageWord(addr + i + word_size, word_size, &val)) {
+      return false;
+    } else if (kDynamicNull == tag) {
+      break;
+    }
+    tags[tag] = val;
+  }
+
+  // Position-independent executables are also the main program.
+  if (tags[kDynamicFlags1] & kDynamicFlags1PIE) {
+    is_executable_type = true;
+  }
+
+  const auto symtab = base + tags[kDynamicSymTab];
+  const auto strtab = base + tags[kDynamicStrTab];
+  pltgot = tags.count(kDynamicPLTGOT) ? base + tags[kDynamicPLTGOT] : 0;
+
+  if (tags.count(kDynamicRela)) {
+    ParseRelocations(base + tags[kDynamicRela], tags[kDynamicRelaSize], true,
+                     symtab, strtab);
+  }
+  if (tags.count(kDynamicRel)) {
+    ParseRelocations(base + tags[kDynamicRel], tags[kDynamicRelSize], false,
+                     symtab, strtab);
+  }
+  if (tags.count(kDynamicJmpRel)) {
+    ParseRelocations(base + tags[kDynamicJmpRel], tags[kDynamicPLTRelSize],
+                     kDynamicRela == tags[kDynamicPLTRel], symtab, strtab);
+  }
+  return true;
+}
+
+// Record what the dynamic loader will write into each relocated word.
+void ELFTraceManager::ParseRelocations(uint64_t addr, uint64_t size,
+                                       bool has_addend, uint64_t symtab,
+                                       uint64_t strtab) {
+  const auto entry_size = word_size * (has_addend ? 3U : 2U);
+  const auto sym_size = 8 == word_size ? 24U : 16U;
+
+  for (uint64_t i = 0; (i + entry_size) <= size; i += entry_size) {
+    uint64_t offset = 0;
+    uint64_t info = 0;
+    uint64_t addend = 0;
+    if (!TryReadImageWord(addr + i, word_size, &offset) ||
+        !TryReadImageWord(addr + i + word_size, word_size, &info)) {
+      return;
+    }
+
+    const auto slot_addr = base + offset;
+    if (has_addend) {
+      TryReadImageWord(addr + i + 2 * word_size, word_size, &addend);
+    } else {
+      TryReadImageWord(slot_addr, word_size, &addend);  // Implicit addend.
+    }
+
+    const auto sym_index = 8 == word_size ? (info >> 32) : (info >> 8);
+    const auto type = 8 == word_size ? (info & 0xffffffffULL) : (info & 0xff);
+
+    auto is_relative = false;
+    auto is_symbolic = false;
+    if (kELFMachineX86_64 == machine || kELFMachine386 == machine) {
+      is_relative = kRelocX86Relative == type;
+      is_symbolic = kRelocX86GlobDat == type || kRelocX86JumpSlot == type;
+    } else if (kELFMachineAArch64 == machine) {
+      is_relative = kRelocAArch64Relative == type;
+      is_symbolic = kRelocAArch64GlobDat == type ||
+                    kRelocAArch64JumpSlot == type;
+    }
+
+    Slot slot = {};
+    auto is_known = false;
+    if (is_relative) {
+      slot.target = base + addend;
+      is_known = true;
+
+    } else if (is_symbolic && sym_index) {
+      const auto sym = symtab + sym_index * sym_size;
+      uint64_t name = 0;
+      uint64_t value = 0;
+      uint64_t section = 0;
+      uint64_t info = 0;
+      uint64_t other = 0;
+      TryReadImageWord(sym, 4, &name);
+      if (8 == word_size) {
+        TryReadImageWord(sym + 4, 1, &info);
+        TryReadImageWord(sym + 5, 1, &other);
+        TryReadImageWord(sym + 6, 2, &section);
+        TryReadImageWord(sym + 8, 8, &value);
+      } else {
+        TryReadImageWord(sym + 4, 4, &value);
+        TryReadImageWord(sym + 12, 1, &info);
+        TryReadImageWord(sym + 13, 1, &other);
+        TryReadImageWord(sym + 14, 2, &section);
+      }
+      slot.symbol = ReadString(strtab + name);
+
+      // A symbol defined by a shared object can be preempted by a definition
+      // in another module, e.g. with `LD_PRELOAD`, unless it is local or not
+      // visible outside of the shared object. The GOT slot of an IFUNC gets
+      // whatever its resolver returns, and not the resolver itself.
+      const auto is_preemptible =
+          !is_executable_type &&
+          kSymbolBindLocal != (info >> 4) &&
+          kSymbolVisibilityDefault == (other & 0x3);
+      if (section && value && !is_preemptible &&
+          kSymbolTypeGNUIFunc != (info & 0xf)) {
+        slot.target = base + value;
+        is_known = true;
+      }
+    }
+
+    if (is_relative || is_symbolic) {
+      slots[slot_addr] = slot;
+    }
+
+    // Remember which bytes will be changed by the dynamic loader, so that
+    // we don't fold them into constants.
+    for (auto b = 0U; b < word_size; ++b) {
+      relocated_bytes[slot_addr + b] = {
+          is_known, static_cast<uint8_t>(slot.target >> (b * 8))};
+    }
+  }
+}
+
+// Find the functions in the symbol tables, and decide which of their names we
+// can use for traces. We prefer `.symtab` over `.dynsym` because it is a
+// superset, but only `.dynsym` survives stripping.
+void ELFTraceManager::ParseSymbols(void) {
+  const auto shoff = ReadLE(image, 24 + 2 * word_size, word_size);
+  const auto shentsize = ReadLE(image, 46 + 3 * (word_size - 4), 2);
+  const auto shnum = ReadLE(image, 48 + 3 * (word_size - 4), 2);
+  const auto min_shentsize = 8 == word_size ? 64U : 40U;
+
+  if (!shoff || shentsize < min_shentsize || shoff > image_size ||
+      shnum > ((image_size - shoff) / shentsize)) {
+    return;
+  }
+
+  // Returns the file offset, size, link and entry size of a section.
+  auto read_section = [=] (uint64_t i, uint64_t *offset, uint64_t *size,
+                           uint64_t *link, uint64_t *entry_size) {
+    const auto sh = shoff + i * shentsize;
+    if (8 == word_size) {
+      *offset = ReadLE(image, sh + 24, 8);
+      *size = ReadLE(image, sh + 32, 8);
+      *link = ReadLE(image, sh + 40, 4);
+      *entry_size = ReadLE(image, sh + 56, 8);
+    } else {
+      *offset = ReadLE(image, sh + 16, 4);
+      *size = ReadLE(image, sh + 20, 4);
+      *link = ReadLE(image, sh + 24, 4);
+      *entry_size = ReadLE(image, sh + 36, 4);
+    }
+    return static_cast<uint32_t>(ReadLE(image, sh + 4, 4));
+  };
+
+  for (auto wanted_type : {kSectionSymTab, kSectionDynSym}) {
+    for (uint64_t i = 0; i < shnum; ++i) {
+      uint64_t offset = 0, size = 0, link = 0, entry_size = 0;
+      if (wanted_type != read_section(i, &offset, &size, &link, &entry_size) ||
+          link >= shnum) {
+        continue;
+      }
+      uint64_t strtab_offset = 0, strtab_size = 0, unused = 0;
+      read_section(link, &strtab_offset, &strtab_size, &unused, &unused);
+      ParseSymbolTable(offset, size, entry_size, strtab_offset, strtab_size);
+    }
+  }
+
+  // Names of imported functions are taken by the external functions.
+  std::unordered_set<std::string> used_names;
+  for (const auto &slot : slots) {
+    if (!slot.second.target) {
+      used_names.insert(slot.second.symbol);
+    }
+  }
+
+  // Only the first of several aliases of a function names the trace.
+  for (const auto &func : functions) {
+    const auto &name = func.second;
+    if (!used_names.count(name) && !module->getFunction(name)) {
+      used_names.insert(name);
+      trace_names[func.first] = name;
+    }
+  }
+}
+
+// Record the defined functions in a symbol table that are in executable
+// segments.
+void ELFTraceManager::ParseSymbolTable(
+    uint64_t offset, uint64_t size, uint64_t entry_size,
+    uint64_t strtab_offset, uint64_t strtab_size) {
+  const auto min_entry_size = 8 == word_size ? 24U : 16U;
+  if (entry_size < min_entry_size || offset > image_size ||
+      size > (image_size - offset) || strtab_offset > image_size ||
+      strtab_size > (image_size - strtab_offset)) {
+    return;
+  }
+
+  for (uint64_t sym = offset; (sym + entry_size) <= (offset + size);
+       sym += entry_size) {
+    const auto name = ReadLE(image, sym, 4);
+    uint64_t info = 0;
+    uint64_t section = 0;
+    uint64_t value = 0;
+    uint64_t func_size = 0;
+    if (8 == word_size) {
+      info = image[sym + 4];
+      section = ReadLE(image, sym + 6, 2);
+      value = ReadLE(image, sym + 8, 8);
+      func_size = ReadLE(image, sym + 16, 8);
+    } else {
+      value = ReadLE(image, sym + 4, 4);
+      func_size = ReadLE(image, sym + 8, 4);
+      info = image[sym + 12];
+      section = ReadLE(image, sym + 14, 2);
+    }
+
+    if (kSymbolTypeFunc != (info & 0xf) || kSymbolSectionUndef == section ||
+        kSymbolSectionReserved <= section || name >= strtab_size) {
+      continue;
+    }
+
+    const auto addr = base + value;
+    auto seg = FindSegment(addr);
+    if (!seg || !seg->is_executable || functions.count(addr)) {
+      continue;
+    }
+
+    const auto str = reinterpret_cast<const char *>(
+        &(image[strtab_offset + name]));
+    const auto max_len = strtab_size - name;
+    std::string func_name(str, strnlen(str, max_len));
+    if (!func_name.empty()) {
+      functions[addr] = func_name;
+      if (func_size) {
+        function_ends[addr] = addr + func_size;
+      }
+    }
+  }
+}
+
+// Find the segment containing `addr`. This is a binary search over the
+// segments, except when `addr` is in the same segment as the last lookup.
+const ELFTraceManager::Segment *ELFTraceManager::FindSegment(
+    uint64_t addr) const {
+  if (last_segment && last_segment->addr <= addr &&
+      addr < (last_segment->addr + last_segment->size)) {
+    return last_segment;
+  }
+  auto seg_it = segments.upper_bound(addr);
+  if (seg_it == segments.end() || addr < seg_it->second.addr) {
+    return nullptr;
+  }
+  last_segment = &(seg_it->second);
+  return last_segment;
+}
+
+// Read a byte from the loaded image, as it is before relocation.
+bool ELFTraceManager::TryReadImageByte(uint64_t addr, uint8_t *byte,
+                                       const Segment **seg) const {
+  *seg = FindSegment(addr);
+  if (!*seg) {
+    return false;
+  }
+  const auto offset = addr - (*seg)->addr;
+  if (offset < (*seg)->file_size) {
+    *byte = image[(*seg)->file_offset + offset];
+  } else {
+    *byte = 0;  // E.g. `.bss`.
+  }
+  return true;
+}
+
+bool ELFTraceManager::TryReadImageWord(uint64_t addr, unsigned size,
+                                       uint64_t *val) const {
+  *val = 0;
+  for (auto i = 0U; i < size; ++i) {
+    uint8_t byte = 0;
+    const Segment *seg = nullptr;
+    if (!TryReadImageByte(addr + i, &byte, &seg)) {
+      return false;
+    }
+    *val |= static_cast<uint64_t>(byte) << (i * 8);
+  }
+  return true;
+}
+
+std::string ELFTraceManager::ReadString(uint64_t addr) const {
+  std::stringstream ss;
+  for (uint8_t byte = 0; ; ++addr) {
+    const Segment *seg = nullptr;
+    if (!TryReadImageByte(addr, &byte, &seg) || !byte) {
+      break;
+    }
+    ss << static_cast<char>(byte);
+  }
+  return ss.str();
+}
+
+// Recognize the PLT stubs that jump through a GOT slot, i.e.
+//
+//      amd64:  [endbr64] [bnd] jmp qword [rip + disp32]
+//      x86:    jmp dword [abs32]
+//      x86:    jmp dword [ebx + disp32]    (position-independent)
+bool ELFTraceManager::TryGetPLTSlot(uint64_t addr, uint64_t *slot_addr) const {
+  uint8_t bytes[11] = {};
+  for (auto i = 0U; i < sizeof(bytes); ++i) {
+    const Segment *seg = nullptr;
+    if (!TryReadImageByte(addr + i, &(bytes[i]), &seg) ||
+        !seg->is_executable) {
+      break;
+    }
+  }
+
+  unsigned i = 0;
+  if (0xf3 == bytes[0] && 0x0f == bytes[1] && 0x1e == bytes[2] &&
+      (0xfa == bytes[3] || 0xfb == bytes[3])) {
+    i = 4;  // `endbr64` or `endbr32`.
+  }
+  if (0xf2 == bytes[i]) {
+    i += 1;  // `bnd` prefix.
+  }
+  if (i + 6 > sizeof(bytes) || 0xff != bytes[i]) {
+    return false;
+  }
+
+  const auto disp = static_cast<int32_t>(
+      static_cast<uint32_t>(bytes[i + 2]) |
+      (static_cast<uint32_t>(bytes[i + 3]) << 8) |
+      (static_cast<uint32_t>(bytes[i + 4]) << 16) |
+      (static_cast<uint32_t>(bytes[i + 5]) << 24));
+
+  if (0x25 == bytes[i + 1] && kELFMachineX86_64 == machine) {
+    *slot_addr = addr + i + 6 + static_cast<uint64_t>(
+        static_cast<int64_t>(disp));
+  } else if (0x25 == bytes[i + 1] && kELFMachine386 == machine) {
+    *slot_addr = static_cast<uint32_t>(disp);
+  } else if (0xa3 == bytes[i + 1] && kELFMachine386 == machine && pltgot) {
+    *slot_addr = (pltgot + static_cast<uint64_t>(
+        static_cast<int64_t>(disp))) & 0xffffffffULL;
+  } else {
+    return false;
+  }
+  return 0 != slots.count(*slot_addr);
+}
+
+// Declare the external function named `name`. We don't devirtualize calls to
+// functions whose names clash with something else in the module.
+llvm::Function *ELFTraceManager::DeclareExternalFunction(
+    const std::string &name) {
+  if (name.empty()) {
+    return nullptr;
+  }
+  auto func = module->getFunction(name);
+  if (func) {
+    return func->getFunctionType() == LiftedFunctionType(module) ?
+           func : nullptr;
+  }
+  func = DeclareLiftedFunction(module, name);
+  func->setLinkage(llvm::GlobalValue::ExternalLinkage);
+  return func;
+}
+
+// A call to a PLT stub of an external function is a call to the external
+// function. Stubs of functions defined in this ELF are lifted as traces,
+// and their jumps are resolved by `TryResolveIndirectTarget`.
+llvm::Function *ELFTraceManager::GetExternalFunction(uint64_t addr) {
+  uint64_t slot_addr = 0;
+  if (TryGetPLTSlot(addr, &slot_addr)) {
+    const auto &slot = slots[slot_addr];
+    if (!slot.target) {
+      return DeclareExternalFunction(slot.symbol);
+    }
+  }
+  return nullptr;
+}
+
+std::string ELFTraceManager::TraceName(uint64_t addr) {
+  auto name_it = trace_names.find(addr);
+  if (name_it != trace_names.end()) {
+    return name_it->second;
+  } else {
+    return TraceManager::TraceName(addr);
+  }
+}
+
+void ELFTraceManager::SetLiftedTraceDefinition(
+    uint64_t addr, llvm::Function *lifted_func) {
+  traces[addr] = lifted_func;
+}
+
+llvm::Function *ELFTraceManager::GetLiftedTraceDeclaration(uint64_t addr) {
+  auto trace_it = traces.find(addr);
+  if (trace_it != traces.end()) {
+    return trace_it->second;
+  }
+
+  if (auto external_func = GetExternalFunction(addr)) {
+    return external_func;
+  }
+
+  // Declare the traces of known functions. The lifter will lift them when
+  // it reaches them, but won't let other traces run into them.
+  if (functions.count(addr)) {
+    auto func = DeclareLiftedFunction(module, TraceName(addr));
+    if (func->isDeclaration()) {
+      func->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+    return func;
+  }
+  return nullptr;
+}
+
+llvm::Function *ELFTraceManager::GetLiftedTraceDefinition(uint64_t addr) {
+  auto trace_it = traces.find(addr);
+  if (trace_it != traces.end()) {
+    return trace_it->second;
+  } else {
+    return GetExternalFunction(addr);
+  }
+}
+
+// Resolve `call [slot]` and `jmp [slot]`, where `slot` is the address of a
+// GOT slot, either absolute or relative to the program counter. On x86,
+// position-independent code addresses the GOT relative to `EBX`, which holds
+// the address of `.got.plt` (see the i386 psABI).
+bool ELFTraceManager::TryResolveIndirectTarget(
+    const Instruction &inst, uint64_t *target_pc,
+    llvm::Function **external_func) {
+  for (const auto &op : inst.operands) {
+    if (Operand::kTypeAddress != op.type ||
+        Operand::Address::kMemoryRead != op.addr.kind ||
+        !op.addr.index_reg.name.empty()) {
+      continue;
+    }
+
+    // The x86 decoder names the implicit `DS` or `SS` segment of 32-bit
+    // memory operands. Those segments are flat, but the others (e.g. `FS`
+    // and `GS`, which are used for thread-local storage) aren't.
+    const auto &seg_name = op.addr.segment_base_reg.name;
+    if (!seg_name.empty() && "DS_BASE" != seg_name && "SS_BASE" != seg_name) {
+      continue;
+    }
+
+    auto slot_addr = static_cast<uint64_t>(op.addr.displacement);
+    const auto &base_name = op.addr.base_reg.name;
+    if ("PC" == base_name) {
+      slot_addr += inst.pc;
+    } else if ("EBX" == base_name && kELFMachine386 == machine && pltgot) {
+      slot_addr += pltgot;
+    } else if (!base_name.empty()) {
+      continue;
+    }
+    if (4 == word_size) {
+      slot_addr &= 0xffffffffULL;
+    }
+
+    auto slot_it = slots.find(slot_addr);
+    if (slot_it == slots.end()) {
+      return false;
+    }
+
+    const auto &slot = slot_it->second;
+    if (slot.target) {
+      *target_pc = slot.target;
+      return true;
+    }
+
+    *external_func = DeclareExternalFunction(slot.symbol);
+    return nullptr != *external_func;
+  }
+  return false;
+}
+
+bool ELFTraceManager::TryGetFunctionBounds(uint64_t addr, uint64_t *begin,
+                                           uint64_t *end) {
+  auto func_it = function_ends.upper_bound(addr);
+  if (func_it == function_ends.begin()) {
+    return false;
+  }
+  --func_it;
+  if (addr >= func_it->second) {
+    return false;
+  }
+  *begin = func_it->first;
+  *end = func_it->second;
+  return true;
+}
+
+bool ELFTraceManager::TryReadExecutableByte(uint64_t addr, uint8_t *byte) {
+  const Segment *seg = nullptr;
+  return TryReadImageByte(addr, byte, &seg) && seg->is_executable;
+}
+
+bool ELFTraceManager::TryReadDataByte(uint64_t addr, uint8_t *byte) {
+  const Segment *seg = nullptr;
+  if (!TryReadImageByte(addr, byte, &seg)) {
+    return false;
+  }
+  auto reloc_it = relocated_bytes.find(addr);
+  if (reloc_it != relocated_bytes.end()) {
+    *byte = reloc_it->second.second;
+    return reloc_it->second.first;
+  }
+  return true;
+}
+
+bool ELFTraceManager::TryReadReadOnlyByte(uint64_t addr, uint8_t *byte) {
+  const Segment *seg = nullptr;
+  if (!TryReadImageByte(addr, byte, &seg)) {
+    return false;
+  }
+  if (seg->is_writable && !(relro_begin <= addr && addr < relro_end)) {
+    return false;
+  }
+  auto reloc_it = relocated_bytes.find(addr);
+  if (reloc_it != relocated_bytes.end()) {
+    *byte = reloc_it->second.second;
+    return reloc_it->second.first;
+  }
+  return true;
+}
+
+}  // namespace remill
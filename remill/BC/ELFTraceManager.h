@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "remill/BC/Lifter.h"
+
+namespace llvm {
+class Function;
+class MemoryBuffer;
+class Module;
+}  // namespace llvm
+namespace remill {
+
+// A trace manager that gets its code and data from the loadable segments of
+// an ELF executable or shared library, and that uses the ELF's dynamic
+// relocations and symbols to devirtualize calls through the PLT and GOT.
+//
+// The ELF file is memory-mapped, and bytes are read straight out of the
+// mapping. Traces that start at functions in the ELF's symbol tables are
+// pre-declared, and are named after those functions.
+//
+// Calls to external functions, i.e. functions whose GOT slots are filled by
+// the dynamic loader with the address of a symbol that is not defined by the
+// ELF, become direct calls to declarations of lifted functions with the same
+// names as the symbols. It is up to the user of the lifted code to provide
+// implementations of these functions.
+class ELFTraceManager : public TraceManager {
+ public:
+  virtual ~ELFTraceManager(void);
+
+  // Load the ELF file at `path`. Shared objects and position-independent
+  // executables are loaded at address `base`. Returns `nullptr` if the file
+  // is not a little-endian ELF that we can understand.
+  static std::unique_ptr<ELFTraceManager> Open(
+      llvm::Module *module, const std::string &path, uint64_t base=0);
+
+  // Address of the ELF's entrypoint.
+  uint64_t EntryAddress(void) const;
+
+  // Addresses and names of the functions in the ELF's symbol tables.
+  const std::map<uint64_t, std::string> &Functions(void) const;
+
+  // Lifted traces, by address.
+  std::unordered_map<uint64_t, llvm::Function *> traces;
+
+ protected:
+  ELFTraceManager(llvm::Module *module_,
+                  std::unique_ptr<llvm::MemoryBuffer> buffer_,
+                  uint64_t base_);
+
+  // Traces at known functions are named after those functions, unless the
+  // names clash with something else.
+  std::string TraceName(uint64_t addr) override;
+
+  void SetLiftedTraceDefinition(
+      uint64_t addr, llvm::Function *lifted_func) override;
+
+  // Calls to PLT stubs of external functions are calls to the external
+  // functions themselves. Known functions are declared ahead of time.
+  llvm::Function *GetLiftedTraceDeclaration(uint64_t addr) override;
+
+  // External functions are "defined", in that there is nothing to lift.
+  llvm::Function *GetLiftedTraceDefinition(uint64_t addr) override;
+
+  // Calls and jumps through GOT slots go to the functions in those slots.
+  bool TryResolveIndirectTarget(const Instruction &inst, uint64_t *target_pc,
+                                llvm::Function **external_func) override;
+
+  // Functions with sizes in the symbol tables are lifted as a whole.
+  bool TryGetFunctionBounds(uint64_t addr, uint64_t *begin,
+                            uint64_t *end) override;
+
+  bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override;
+
+  bool TryReadDataByte(uint64_t addr, uint8_t *byte) override;
+
+  // Bytes in non-writable segments, or in the `PT_GNU_RELRO` region, are
+  // read-only, unless they are relocated to something that we don't know.
+  bool TryReadReadOnlyByte(uint64_t addr, uint8_t *byte) override;
+
+ private:
+  ELFTraceManager(void) = delete;
+
+  // A loadable segment of the ELF.
+  struct Segment {
+    uint64_t addr;
+    uint64_t size;
+    uint64_t file_offset;
+    uint64_t file_size;
+    bool is_executable;
+    bool is_writable;
+  };
+
+  // What the dynamic loader puts into a GOT slot.
+  struct Slot {
+    std::string symbol;  // Empty for relative relocations.
+    uint64_t target;  // Non-zero if `symbol` is always this ELF's definition.
+  };
+
+  bool Parse(void);
+  bool ParseDynamicSection(uint64_t addr, uint64_t size);
+  void ParseSymbols(void);
+  void ParseSymbolTable(uint64_t offset, uint64_t size, uint64_t entry_size,
+                        uint64_t strtab_offset, uint64_t strtab_size);
+  void ParseRelocations(uint64_t addr, uint64_t size, bool has_addend,
+                        uint64_t symtab, uint64_t strtab);
+
+  const Segment *FindSegment(uint64_t addr) const;
+  bool TryReadImageByte(uint64_t addr, uint8_t *byte,
+                        const Segment **seg) const;
+  bool TryReadImageWord(uint64_t addr, unsigned size, uint64_t *val) const;
+  std::string ReadString(uint64_t addr) const;
+
+  // Return the GOT slot that the PLT stub at `addr` jumps through.
+  bool TryGetPLTSlot(uint64_t addr, uint64_t *slot_addr) const;
+
+  // Declare the external function named `name`.
+  llvm::Function *DeclareExternalFunction(const std::string &name);
+
+  // Return the external function that the PLT stub at `addr` jumps to.
+  llvm::Function *GetExternalFunction(uint64_t addr);
+
+  llvm::Module * const module;
+  const std::unique_ptr<llvm::MemoryBuffer> buffer;
+  const uint8_t * const image;
+  const uint64_t image_size;
+  uint64_t base;
+  uint64_t entry;
+  uint64_t pltgot;
+  unsigned word_size;
+  unsigned machine;
+
+  // Is this the main program, i.e. an `ET_EXEC` or a position-independent
+  // executable? The symbols defined by the main program can't be preempted
+  // by other modules.
+  bool is_executable_type;
+  uint64_t relro_begin;
+  uint64_t relro_end;
+
+  // Loadable segments, by their (biased) end addresses.
+  std::map<uint64_t, Segment> segments;
+
+  // The segment found by the last lookup. Instructions are read byte by
+  // byte, so this usually saves us a search.
+  mutable const Segment *last_segment;
+
+  // Functions from the symbol tables, and the subset of their names that
+  // we can give to lifted traces.
+  std::map<uint64_t, std::string> functions;
+  std::unordered_map<uint64_t, std::string> trace_names;
+
+  // End addresses of the functions whose sizes are known.
+  std::map<uint64_t, uint64_t> function_ends;
+
+  // Contents of GOT slots, and other relocated words, by their addresses.
+  std::unordered_map<uint64_t, Slot> slots;
+
+  // Bytes covered by relocations, and their values if they are known.
+  std::unordered_map<uint64_t, std::pair<bool, uint8_t>> relocated_bytes;
+};
+
+}  // namespace remill
@@ -81,6 +81,11 @@ IntrinsicTable::IntrinsicTable(llvm::Module *module)
       async_hyper_call(FindIntrinsic(
           module, "__remill_async_hyper_call")),
 
+      // Shadow return stack.
+      shadow_stack_push(FindIntrinsic(
+          module, "__remill_shadow_stack_push")),
+      shadow_stack_pop(FindIntrinsic(module, "__remill_shadow_stack_pop")),
+
       // Memory access.
       read_memory_8(FindPureIntrinsic(module, "__remill_read_memory_8")),
       read_memory_16(FindPureIntrinsic(module, "__remill_read_memory_16")),
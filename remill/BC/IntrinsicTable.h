@@ -44,6 +44,10 @@ class IntrinsicTable {
   // OS interaction.
   llvm::Function * const async_hyper_call;
 
+  // Shadow return stack.
+  llvm::Function * const shadow_stack_push;
+  llvm::Function * const shadow_stack_pop;
+
   // Memory read intrinsics.
   llvm::Function * const read_memory_8;
   llvm::Function * const read_memory_16;
@@ -16,12 +16,16 @@
 
 // #include <glog/logging.h>
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <ios>
+#include <map>
 #include <set>
 #include <string>
 #include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -44,6 +48,7 @@
 
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
 
 #include "remill/Arch/Arch.h"
@@ -57,6 +62,43 @@
 
 #include "remill/OS/OS.h"
 
+// DEFINE_bool(fuse_compare_and_branch, false,
+//             "Lift an x86 `CMP`, `SUB`, or `TEST` that is immediately "
+//             "followed by a conditional branch, `SETcc`, or `CMOVcc` as a "
+//             "single integer comparison and branch, set, or select.");
+bool FLAGS_fuse_compare_and_branch = false;
+
+// DEFINE_bool(lazy_program_counter, false,
+//             "Only store the program counter into the `State` structure "
+//             "before instructions that may observe it, instead of before "
+//             "every instruction.");
+bool FLAGS_lazy_program_counter = false;
+
+// DEFINE_bool(precise_memory_exceptions, false,
+//             "Treat memory accesses as observers of the program counter "
+//             "when lifting with --lazy_program_counter, so that the runtime "
+//             "sees the precise program counter of a faulting access.");
+bool FLAGS_precise_memory_exceptions = false;
+
+// DEFINE_bool(recover_jump_tables, false,
+//             "Recover the targets of x86 indirect jumps through jump tables, "
+//             "and lift those jumps as switches over the recovered targets. "
+//             "Indirect jumps of other architectures are lifted as usual.");
+bool FLAGS_recover_jump_tables = false;
+
+// DEFINE_bool(assume_well_behaved_returns, false,
+//             "Assume that function calls return to the instruction following "
+//             "the call, instead of checking the program counter after each "
+//             "call.");
+bool FLAGS_assume_well_behaved_returns = false;
+
+// DEFINE_bool(shadow_return_stack, false,
+//             "Push return addresses onto a shadow stack maintained by the "
+//             "runtime at function calls, and check them against the "
+//             "addresses returned to at function returns. Meant to be used "
+//             "with --assume_well_behaved_returns.");
+bool FLAGS_shadow_return_stack = false;
+
 namespace remill {
 namespace {
 
@@ -84,6 +126,96 @@ llvm::Function *GetInstructionFunction(llvm::Module *module,
   return llvm::dyn_cast_or_null<llvm::Function>(sem);
 }
 
+static bool StartsWith(const std::string &str, const char *prefix) {
+  return 0 == str.compare(0, std::strlen(prefix), prefix);
+}
+
+// Returns `true` if `func`, or anything that it calls, might read the
+// program counter out of the `State` structure. Intrinsics like the hyper
+// calls and control-flow intrinsics are passed the `State`, so we assume
+// that they observe the program counter.
+static bool MayObserveProgramCounter(
+    llvm::Function *func, std::unordered_map<llvm::Function *, bool> &cache) {
+
+  auto it = cache.find(func);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  cache[func] = false;  // Break recursion.
+  auto observes = false;
+
+  for (auto &block : *func) {
+    for (auto &inst : block) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (!call) {
+        continue;
+      }
+
+      auto callee = call->getCalledFunction();
+      if (!callee) {
+        observes = true;
+      } else if (callee->isIntrinsic()) {
+        continue;
+      } else if (!callee->isDeclaration()) {
+        observes = MayObserveProgramCounter(callee, cache);
+      } else {
+        const auto name = callee->getName().str();
+        if (!StartsWith(name, "__remill_")) {
+          continue;  // E.g. `libm` functions.
+
+        } else if (StartsWith(name, "__remill_read_memory_") ||
+                   StartsWith(name, "__remill_write_memory_") ||
+                   StartsWith(name, "__remill_compare_exchange_memory_") ||
+                   StartsWith(name, "__remill_fetch_and_")) {
+          observes = FLAGS_precise_memory_exceptions;
+
+        } else {
+          observes = !StartsWith(name, "__remill_undefined_") &&
+                     !StartsWith(name, "__remill_barrier_") &&
+                     !StartsWith(name, "__remill_atomic_") &&
+                     name != "__remill_fpu_exception_test_and_clear";
+        }
+      }
+
+      if (observes) {
+        cache[func] = true;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// With lazy arithmetic flags, the flags in the `State` structure are stale
+// while a flags computation is deferred. Lifted code computes them on demand,
+// but the runtime's control-flow intrinsics and hyper calls read the `State`
+// directly, so compute the flags before every call from `func` to one of them.
+// Calls to other lifted traces don't need this.
+static void MaterializeFlagsAtExits(llvm::Function *func,
+                                    llvm::Function *materialize_flags) {
+  std::vector<llvm::CallInst *> exits;
+  for (auto &block : *func) {
+    for (auto &inst : block) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (!call) {
+        continue;
+      }
+      auto callee = call->getCalledFunction();
+      if (callee && callee->getFunctionType() == func->getFunctionType() &&
+          StartsWith(callee->getName().str(), "__remill_")) {
+        exits.push_back(call);
+      }
+    }
+  }
+
+  for (auto call : exits) {
+    llvm::CallInst::Create(
+        materialize_flags, call->getArgOperand(kStatePointerArgNum), "", call);
+  }
+}
+
 }  // namespace
 
 InstructionLifter::~InstructionLifter(void) {}
@@ -184,11 +316,26 @@ LiftStatus InstructionLifter::LiftIntoBlock(
 
   // Update the current program counter. Control-flow instructions may update
   // the program counter in the semantics code.
-  ir.CreateStore(
-      ir.CreateAdd(
-          ir.CreateLoad(pc_ptr),
-          llvm::ConstantInt::get(word_type, arch_inst.NumBytes())),
-      pc_ptr);
+  if (!FLAGS_lazy_program_counter) {
+    ir.CreateStore(
+        ir.CreateAdd(
+            ir.CreateLoad(pc_ptr),
+            llvm::ConstantInt::get(word_type, arch_inst.NumBytes())),
+        pc_ptr);
+
+  // In lazy mode, the program counter at the beginning of `arch_inst` is
+  // known to be `arch_inst.pc`, so `PC`-relative operands are constants, and
+  // the `State` structure is only updated if something might observe it.
+  // The `TraceLifter` takes care of updating the program counter before
+  // leaving the trace.
+  } else if (kLiftedInstruction != status ||
+             (Instruction::kCategoryNormal != arch_inst.category &&
+              Instruction::kCategoryNoOp != arch_inst.category) ||
+             MayObserveProgramCounter(isel_func, isel_observes_pc)) {
+    ir.CreateStore(
+        llvm::ConstantInt::get(word_type, arch_inst.pc + arch_inst.NumBytes()),
+        pc_ptr);
+  }
 
   // Pass in current value of the memory pointer.
   args[0] = ir.CreateLoad(mem_ptr);
@@ -465,6 +612,10 @@ llvm::Value *InstructionLifter::LiftRegisterOperand(
     auto val = LoadRegAddress(block, arch_reg.name);
     return ConvertToIntendedType(inst, op, block, val, real_arg_type);
 
+  } else if (FLAGS_lazy_program_counter && "PC" == arch_reg.name &&
+             arg_type->isIntegerTy()) {
+    return llvm::ConstantInt::get(real_arg_type, inst.pc);
+
   } else {
     assert(arg_type->isIntegerTy() || arg_type->isFloatingPointTy());
     // CHECK(arg_type->isIntegerTy() || arg_type->isFloatingPointTy())
@@ -587,7 +738,13 @@ llvm::Value *InstructionLifter::LiftAddressOperand(
   //     << "for instruction at " << std::hex << inst.pc
   //     << " is wider than the machine word size.";
 
-  auto addr = LoadWordRegValOrZero(block, arch_addr.base_reg.name, zero);
+  llvm::Value *addr = nullptr;
+  if (FLAGS_lazy_program_counter && "PC" == arch_addr.base_reg.name) {
+    addr = llvm::ConstantInt::get(word_type, inst.pc);
+  } else {
+    addr = LoadWordRegValOrZero(block, arch_addr.base_reg.name, zero);
+  }
+
   auto index = LoadWordRegValOrZero(block, arch_addr.index_reg.name, zero);
   auto scale = llvm::ConstantInt::get(
       word_type, static_cast<uint64_t>(arch_addr.scale), true);
@@ -706,6 +863,31 @@ void TraceManager::ForEachDevirtualizedTarget(
   // Must be extended.
 }
 
+// Try to resolve the only target of an indirect call or jump. By default, we
+// know nothing about indirect targets.
+bool TraceManager::TryResolveIndirectTarget(const Instruction &, uint64_t *,
+                                            llvm::Function **) {
+  return false;
+}
+
+// Try to get the bounds of the function containing `addr`. By default, we
+// know nothing about functions.
+bool TraceManager::TryGetFunctionBounds(uint64_t, uint64_t *, uint64_t *) {
+  return false;
+}
+
+// Try to read a byte of data. By default, data is assumed to be mapped
+// alongside the code.
+bool TraceManager::TryReadDataByte(uint64_t addr, uint8_t *byte) {
+  return TryReadExecutableByte(addr, byte);
+}
+
+// Try to read a byte of read-only memory. By default, we know nothing about
+// what memory is read-only.
+bool TraceManager::TryReadReadOnlyByte(uint64_t, uint8_t *) {
+  return false;
+}
+
 // Figure out the name for the trace starting at address `addr`.
 std::string TraceManager::TraceName(uint64_t addr) {
   std::stringstream ss;
@@ -721,11 +903,28 @@ TraceLifter::TraceLifter(InstructionLifter *inst_lifter_,
       context(inst_lifter.word_type->getContext()),
       module(inst_lifter.intrinsics->async_hyper_call->getParent()),
       addr_mask(~0ULL >> inst_lifter.word_type->getScalarSizeInBits()),
-      manager(*manager_) {}
+      manager(*manager_),
+      num_lifted_insts(0),
+      num_unique_insts(0) {}
+
+// Fraction of the lifted instructions that are copies of other lifted
+// instructions.
+double TraceLifter::DuplicatedInstructionRatio(void) const {
+  if (!num_lifted_insts) {
+    return 0.0;
+  }
+  return static_cast<double>(num_lifted_insts - num_unique_insts) /
+         static_cast<double>(num_lifted_insts);
+}
 
 // Return an already lifted trace starting with the code at address
 // `addr`.
 llvm::Function *TraceLifter::GetLiftedTraceDeclaration(uint64_t addr) {
+  auto pending_it = pending_traces.find(addr);
+  if (pending_it != pending_traces.end()) {
+    return pending_it->second;
+  }
+
   auto func = manager.GetLiftedTraceDeclaration(addr);
   if (!func || func->getParent() == module) {
     return func;
@@ -737,6 +936,11 @@ llvm::Function *TraceLifter::GetLiftedTraceDeclaration(uint64_t addr) {
 // Return an already lifted trace starting with the code at address
 // `addr`.
 llvm::Function *TraceLifter::GetLiftedTraceDefinition(uint64_t addr) {
+  auto pending_it = pending_traces.find(addr);
+  if (pending_it != pending_traces.end()) {
+    return pending_it->second;
+  }
+
   auto func = manager.GetLiftedTraceDefinition(addr);
   if (!func || func->getParent() == module) {
     return func;
@@ -755,8 +959,505 @@ llvm::Function *TraceLifter::GetLiftedTraceDefinition(uint64_t addr) {
 
 namespace {
 
+enum class FlagProducerKind {
+  kInvalid,
+  kCompare,
+  kTest
+};
+
+enum class FlagConsumerKind {
+  kInvalid,
+  kBranch,
+  kSet,
+  kMove
+};
+
+static bool IsRegisterOrImmediate(const Operand &op) {
+  return Operand::kTypeRegister == op.type ||
+         Operand::kTypeImmediate == op.type;
+}
+
+// Figure out if `inst` is an x86 `CMP`, `SUB`, or `TEST` of registers and
+// immediates, and if so, which of its operands are compared. A `SUB` sets
+// the flags the same way as a `CMP` of its source operands.
+static FlagProducerKind GetFlagProducerKind(const Arch *arch,
+                                            const Instruction &inst,
+                                            const Operand **lhs,
+                                            const Operand **rhs) {
+  if (!arch->IsX86() && !arch->IsAMD64()) {
+    return FlagProducerKind::kInvalid;
+  }
+
+  auto kind = FlagProducerKind::kInvalid;
+  if (0 == inst.function.find("CMP_") && 2 == inst.operands.size()) {
+    kind = FlagProducerKind::kCompare;
+    *lhs = &(inst.operands[0]);
+    *rhs = &(inst.operands[1]);
+
+  } else if (0 == inst.function.find("TEST_") && 2 == inst.operands.size()) {
+    kind = FlagProducerKind::kTest;
+    *lhs = &(inst.operands[0]);
+    *rhs = &(inst.operands[1]);
+
+  } else if (0 == inst.function.find("SUB_") && 3 == inst.operands.size() &&
+             Operand::kTypeRegister == inst.operands[0].type) {
+    kind = FlagProducerKind::kCompare;
+    *lhs = &(inst.operands[1]);
+    *rhs = &(inst.operands[2]);
+
+  } else {
+    return FlagProducerKind::kInvalid;
+  }
+
+  if (Operand::kTypeRegister != (*lhs)->type ||
+      !IsRegisterOrImmediate(**rhs)) {
+    return FlagProducerKind::kInvalid;
+  }
+
+  return kind;
+}
+
+// Figure out if `inst` is an x86 conditional branch, or a `SETcc` or `CMOVcc`
+// of registers, and if so, what its condition code is, e.g. `NZ`.
+static FlagConsumerKind GetFlagConsumerKind(const Instruction &inst,
+                                            std::string &cc) {
+  const auto &func = inst.function;
+  const auto cc_end = func.find('_');
+  if (std::string::npos == cc_end) {
+    return FlagConsumerKind::kInvalid;
+  }
+
+  if (Instruction::kCategoryConditionalBranch == inst.category &&
+      0 == func.find("J")) {
+    cc = func.substr(1, cc_end - 1);
+    return FlagConsumerKind::kBranch;
+
+  } else if (Instruction::kCategoryNormal != inst.category) {
+    return FlagConsumerKind::kInvalid;
+
+  } else if (0 == func.find("SET") && 1 == inst.operands.size() &&
+             Operand::kTypeRegister == inst.operands[0].type) {
+    cc = func.substr(3, cc_end - 3);
+    return FlagConsumerKind::kSet;
+
+  } else if (0 == func.find("CMOV") && 2 == inst.operands.size() &&
+             Operand::kTypeRegister == inst.operands[0].type &&
+             Operand::kTypeRegister == inst.operands[1].type) {
+    cc = func.substr(4, cc_end - 4);
+    return FlagConsumerKind::kMove;
+
+  } else {
+    return FlagConsumerKind::kInvalid;
+  }
+}
+
+// Compute the x86 condition `cc` directly from the operands of the preceding
+// flag producer, instead of from the flags. Returns `nullptr` if the
+// condition can't be computed this way.
+static llvm::Value *FusedCondition(llvm::IRBuilder<> &ir,
+                                   FlagProducerKind kind,
+                                   const std::string &cc,
+                                   llvm::Value *lhs,
+                                   llvm::Value *rhs) {
+  auto zero = llvm::ConstantInt::get(lhs->getType(), 0);
+
+  if (FlagProducerKind::kCompare == kind) {
+    if ("Z" == cc) {
+      return ir.CreateICmpEQ(lhs, rhs);
+    } else if ("NZ" == cc) {
+      return ir.CreateICmpNE(lhs, rhs);
+    } else if ("B" == cc) {
+      return ir.CreateICmpULT(lhs, rhs);
+    } else if ("NB" == cc) {
+      return ir.CreateICmpUGE(lhs, rhs);
+    } else if ("BE" == cc) {
+      return ir.CreateICmpULE(lhs, rhs);
+    } else if ("NBE" == cc) {
+      return ir.CreateICmpUGT(lhs, rhs);
+    } else if ("L" == cc) {
+      return ir.CreateICmpSLT(lhs, rhs);
+    } else if ("NL" == cc) {
+      return ir.CreateICmpSGE(lhs, rhs);
+    } else if ("LE" == cc) {
+      return ir.CreateICmpSLE(lhs, rhs);
+    } else if ("NLE" == cc) {
+      return ir.CreateICmpSGT(lhs, rhs);
+    } else if ("S" == cc) {
+      return ir.CreateICmpSLT(ir.CreateSub(lhs, rhs), zero);
+    } else if ("NS" == cc) {
+      return ir.CreateICmpSGE(ir.CreateSub(lhs, rhs), zero);
+    }
+
+  // `TEST` clears `CF` and `OF`.
+  } else if (FlagProducerKind::kTest == kind) {
+    auto res = ir.CreateAnd(lhs, rhs);
+    if ("Z" == cc || "BE" == cc) {
+      return ir.CreateICmpEQ(res, zero);
+    } else if ("NZ" == cc || "NBE" == cc) {
+      return ir.CreateICmpNE(res, zero);
+    } else if ("S" == cc || "L" == cc) {
+      return ir.CreateICmpSLT(res, zero);
+    } else if ("NS" == cc || "NL" == cc) {
+      return ir.CreateICmpSGE(res, zero);
+    } else if ("LE" == cc) {
+      return ir.CreateICmpSLE(res, zero);
+    } else if ("NLE" == cc) {
+      return ir.CreateICmpSGT(res, zero);
+    } else if ("B" == cc) {
+      return ir.getFalse();
+    } else if ("NB" == cc) {
+      return ir.getTrue();
+    }
+  }
+
+  return nullptr;
+}
+
+// Read the current value of a register or immediate operand of a flag
+// producer. Returns `nullptr` if the operand isn't `type`-sized.
+static llvm::Value *LoadFlagProducerOperand(llvm::BasicBlock *block,
+                                            const Operand &op,
+                                            llvm::IntegerType *type) {
+  if (Operand::kTypeImmediate == op.type) {
+    return llvm::ConstantInt::get(type, op.imm.val, op.imm.is_signed);
+  }
+
+  auto reg_ptr = FindVarInFunction(block, op.reg.name, true);
+  if (!reg_ptr) {
+    return nullptr;
+  }
+
+  auto reg = new llvm::LoadInst(reg_ptr, "", block);
+  if (reg->getType() != type) {
+    reg->eraseFromParent();
+    return nullptr;
+  }
+  return reg;
+}
+
+// Returns the integer type of the register named `reg_name`, or `nullptr`.
+static llvm::IntegerType *GetIntegerRegisterType(llvm::BasicBlock *block,
+                                                 const std::string &reg_name) {
+  auto reg_ptr = FindVarInFunction(block, reg_name, true);
+  if (!reg_ptr) {
+    return nullptr;
+  }
+  return llvm::dyn_cast<llvm::IntegerType>(
+      reg_ptr->getType()->getPointerElementType());
+}
+
 using DecoderWorkList = std::set<uint64_t>;
 
+// Instructions decoded in a trace. The predecessors of each address are
+// counted as instructions are added, so that looking backward from an
+// instruction doesn't scan all of the decoded instructions at every step.
+class DecodedInstructions {
+ public:
+  // Add `inst`, unless an instruction at its address was already added.
+  void Add(const Instruction &inst) {
+    auto inserted = insts.emplace(inst.pc, inst);
+    if (!inserted.second) {
+      return;
+    }
+    const auto &added = inserted.first->second;
+    switch (added.category) {
+      case Instruction::kCategoryNormal:
+      case Instruction::kCategoryNoOp:
+        AddFlow(added, added.next_pc, false);
+        break;
+      case Instruction::kCategoryDirectJump:
+        AddFlow(added, added.branch_taken_pc, false);
+        break;
+      case Instruction::kCategoryConditionalBranch:
+        AddFlow(added, added.branch_taken_pc, true);
+        if (added.branch_not_taken_pc != added.branch_taken_pc) {
+          AddFlow(added, added.branch_not_taken_pc, false);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Find the only decoded instruction whose control flows to `pc`.
+  // `is_taken` is set if that is a conditional branch, and it flows to `pc`
+  // when taken.
+  const Instruction *UniquePredecessor(uint64_t pc, bool *is_taken) const {
+    auto preds_it = preds.find(pc);
+    if (preds_it == preds.end() || 1 != preds_it->second.count) {
+      return nullptr;
+    }
+    *is_taken = preds_it->second.is_taken;
+    return preds_it->second.inst;
+  }
+
+  void Clear(void) {
+    insts.clear();
+    preds.clear();
+  }
+
+ private:
+  struct Predecessors {
+    unsigned count;
+    const Instruction *inst;  // The first predecessor.
+    bool is_taken;
+  };
+
+  void AddFlow(const Instruction &pred, uint64_t pc, bool is_taken) {
+    auto &pc_preds = preds[pc];
+    if (!pc_preds.count++) {
+      pc_preds.inst = &pred;
+      pc_preds.is_taken = is_taken;
+    }
+  }
+
+  // Elements of an `std::unordered_map` aren't moved by insertions, so
+  // `preds` can point into `insts`.
+  std::unordered_map<uint64_t, Instruction> insts;
+  std::unordered_map<uint64_t, Predecessors> preds;
+};
+
+// Upper bound on the number of entries that we will read from a jump table.
+static constexpr uint64_t kMaxJumpTableEntries = 1024;
+
+// Maximum number of instructions to look backward from an indirect jump when
+// looking for its jump table and the bound on its index.
+static constexpr unsigned kMaxJumpTableSearchDepth = 16;
+
+// A jump table that was recovered from the instructions leading up to an
+// indirect jump.
+struct JumpTable {
+  uint64_t table_addr;
+  uint64_t num_entries;
+  uint64_t entry_size;  // In bytes.
+
+  // Entries are signed 32-bit displacements from `table_addr`, rather than
+  // absolute addresses.
+  bool is_relative;
+};
+
+static bool HasPrefix(const Instruction *inst, const char *prefix) {
+  return !inst->function.compare(0, strlen(prefix), prefix);
+}
+
+// Returns the name of the largest register enclosing the register `name`,
+// e.g. `RAX` for `EAX`.
+static std::string RegisterClass(const Arch *arch, const std::string &name) {
+  if (auto reg = arch->RegisterByName(name)) {
+    return reg->EnclosingRegister()->name;
+  }
+  return name;
+}
+
+// Returns `true` if `inst` explicitly writes to a register in the class
+// `reg_class`.
+static bool WritesRegister(const Arch *arch, const Instruction *inst,
+                           const std::string &reg_class) {
+  for (const auto &op : inst->operands) {
+    if (Operand::kActionWrite == op.action &&
+        Operand::kTypeRegister == op.type &&
+        RegisterClass(arch, op.reg.name) == reg_class) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the register read by `inst` that isn't in the class `skip_class`.
+static std::string ReadRegisterClass(const Arch *arch, const Instruction *inst,
+                                     const std::string &skip_class) {
+  for (const auto &op : inst->operands) {
+    if (Operand::kActionRead == op.action &&
+        Operand::kTypeRegister == op.type) {
+      auto reg_class = RegisterClass(arch, op.reg.name);
+      if (reg_class != skip_class) {
+        return reg_class;
+      }
+    }
+  }
+  return "";
+}
+
+static const Operand *FindOperand(const Instruction *inst, Operand::Type type,
+                                  Operand::Action action) {
+  for (const auto &op : inst->operands) {
+    if (op.type == type && op.action == action) {
+      return &op;
+    }
+  }
+  return nullptr;
+}
+
+// Look for the x86 jump table that the indirect jump `jump` reads from.
+// This recognizes absolute tables, e.g.
+//
+//      cmp   eax, N
+//      ja    default
+//      jmp   [table + rax * 8]
+//
+// and position-independent tables of 32-bit displacements, e.g.
+//
+//      cmp   eax, N
+//      ja    default
+//      lea   rdx, [rip + table]
+//      movsxd rax, dword [rdx + rax * 4]
+//      add   rax, rdx
+//      jmp   rax
+//
+// The bounds check can be separated from the jump by other instructions, and
+// the index can be copied between registers in the meantime. Only x86 and
+// amd64 code is recognized; no tables are found for other architectures.
+static bool FindJumpTable(const Arch *arch, const DecodedInstructions &decoded,
+                          const Instruction &jump, JumpTable *table) {
+  if (!arch->IsX86() && !arch->IsAMD64()) {
+    return false;
+  }
+
+  const auto addr_mask = ~0ULL >> (64 - arch->address_size);
+  const auto word_size = arch->address_size / 8;
+  std::string index_class;
+  std::string target_class;
+  std::string base_class;
+  auto found_table = false;
+  auto found_entry = false;
+
+  if (HasPrefix(&jump, "JMP_MEMv")) {
+    auto mem = FindOperand(&jump, Operand::kTypeAddress,
+                           Operand::kActionRead);
+    if (!mem || !mem->addr.base_reg.name.empty() ||
+        !mem->addr.segment_base_reg.name.empty() ||
+        mem->addr.index_reg.name.empty() ||
+        static_cast<uint64_t>(mem->addr.scale) != word_size) {
+      return false;
+    }
+    table->table_addr = static_cast<uint64_t>(mem->addr.displacement) &
+                        addr_mask;
+    table->entry_size = word_size;
+    table->is_relative = false;
+    index_class = RegisterClass(arch, mem->addr.index_reg.name);
+    found_table = true;
+    found_entry = true;
+
+  } else if (HasPrefix(&jump, "JMP_GPRv")) {
+    auto reg = FindOperand(&jump, Operand::kTypeRegister,
+                           Operand::kActionRead);
+    if (!reg) {
+      return false;
+    }
+    target_class = RegisterClass(arch, reg->reg.name);
+    table->entry_size = 4;
+    table->is_relative = true;
+
+  } else {
+    return false;
+  }
+
+  auto inst = &jump;
+  auto is_taken = false;
+  for (auto depth = 0U; depth < kMaxJumpTableSearchDepth; ++depth) {
+    inst = decoded.UniquePredecessor(inst->pc, &is_taken);
+    if (!inst) {
+      return false;
+    }
+
+    // Look for the bounds check on the index.
+    if (Instruction::kCategoryConditionalBranch == inst->category) {
+      if (!found_table || !found_entry) {
+        return false;
+      }
+
+      auto inclusive = false;
+      if ((HasPrefix(inst, "JNBE_") && !is_taken) ||
+          (HasPrefix(inst, "JBE_") && is_taken)) {
+        inclusive = true;
+      } else if (!(HasPrefix(inst, "JNB_") && !is_taken) &&
+                 !(HasPrefix(inst, "JB_") && is_taken)) {
+        return false;
+      }
+
+      auto cmp = decoded.UniquePredecessor(inst->pc, &is_taken);
+      if (!cmp || !HasPrefix(cmp, "CMP_")) {
+        return false;
+      }
+      auto cmp_reg = FindOperand(cmp, Operand::kTypeRegister,
+                                 Operand::kActionRead);
+      auto cmp_imm = FindOperand(cmp, Operand::kTypeImmediate,
+                                 Operand::kActionRead);
+      if (!cmp_reg || !cmp_imm ||
+          RegisterClass(arch, cmp_reg->reg.name) != index_class) {
+        return false;
+      }
+
+      table->num_entries = cmp_imm->imm.val + (inclusive ? 1 : 0);
+      return 0 < table->num_entries &&
+             kMaxJumpTableEntries >= table->num_entries;
+    }
+
+    if (Instruction::kCategoryNormal != inst->category &&
+        Instruction::kCategoryNoOp != inst->category) {
+      return false;
+    }
+
+    // `add target, base`, where `base` is the address of the table.
+    if (!target_class.empty() && WritesRegister(arch, inst, target_class)) {
+      if (HasPrefix(inst, "ADD_GPRv_GPRv") && base_class.empty()) {
+        base_class = ReadRegisterClass(arch, inst, target_class);
+        if (base_class.empty()) {
+          return false;
+        }
+
+      // `movsxd target, dword [base + index * 4]`
+      } else if (HasPrefix(inst, "MOVSXD_GPRv_MEMd") && !base_class.empty() &&
+                 !found_entry) {
+        auto mem = FindOperand(inst, Operand::kTypeAddress,
+                               Operand::kActionRead);
+        if (!mem || mem->addr.index_reg.name.empty() ||
+            4 != mem->addr.scale || 0 != mem->addr.displacement ||
+            RegisterClass(arch, mem->addr.base_reg.name) != base_class) {
+          return false;
+        }
+        index_class = RegisterClass(arch, mem->addr.index_reg.name);
+        target_class.clear();
+        found_entry = true;
+      } else {
+        return false;
+      }
+      continue;
+    }
+
+    // `lea base, [rip + table]`
+    if (!base_class.empty() && WritesRegister(arch, inst, base_class)) {
+      auto mem = FindOperand(inst, Operand::kTypeAddress,
+                             Operand::kActionRead);
+      if (found_table || !HasPrefix(inst, "LEA_GPRv_AGEN") || !mem ||
+          "PC" != mem->addr.base_reg.name ||
+          !mem->addr.index_reg.name.empty()) {
+        return false;
+      }
+      table->table_addr = static_cast<uint64_t>(
+          static_cast<int64_t>(inst->pc) + mem->addr.displacement) &
+          addr_mask;
+      found_table = true;
+      continue;
+    }
+
+    // Follow copies of the index, e.g. `mov eax, edi` or `movsxd rax, edi`.
+    if (!index_class.empty() && WritesRegister(arch, inst, index_class)) {
+      if (!HasPrefix(inst, "MOV_GPRv_GPRv") &&
+          !HasPrefix(inst, "MOVSXD_GPRv_GPR32") &&
+          !HasPrefix(inst, "MOVZX_GPRv_GPR")) {
+        return false;
+      }
+      index_class = ReadRegisterClass(arch, inst, "");
+      if (index_class.empty()) {
+        return false;
+      }
+    }
+  }
+
+  return false;
+}
+
 // Manage decoding and lifting state.
 //
 // This is pretty ugly, it's like a big bag of poorly structured state. The
@@ -769,6 +1470,8 @@ struct TraceLifterState {
         func(nullptr),
         block(nullptr),
         switch_inst(nullptr),
+        func_begin(0),
+        func_end(0),
         max_inst_bytes(arch->MaxInstructionSize()) {
 
     inst_bytes.reserve(max_inst_bytes);
@@ -804,6 +1507,11 @@ struct TraceLifterState {
     return trace_addr;
   }
 
+  // Returns `true` if `pc` is in the function being lifted as a whole.
+  bool IsInFunction(uint64_t pc) const {
+    return func_begin <= pc && pc < func_end;
+  }
+
   uint64_t PopInstructionAddress(void) {
     auto inst_it = inst_work_list.begin();
     const auto inst_addr = *inst_it;
@@ -816,18 +1524,184 @@ struct TraceLifterState {
   llvm::Function *func;
   llvm::BasicBlock *block;
   llvm::SwitchInst *switch_inst;
+  uint64_t func_begin;
+  uint64_t func_end;
   const size_t max_inst_bytes;
   std::string inst_bytes;
   Instruction inst;
+  Instruction fused_inst;
   DecoderWorkList trace_work_list;
   DecoderWorkList inst_work_list;
   std::map<uint64_t, llvm::BasicBlock *> blocks;
+
+  // Instructions decoded in the current trace. Used to look backward from
+  // indirect jumps for jump tables.
+  DecodedInstructions decoded;
+
+  // Addresses of the instructions lifted into the current trace, and of the
+  // blocks into which they were lifted. A fused pair of instructions shares
+  // the block of the first instruction.
+  std::vector<std::pair<uint64_t, uint64_t>> lifted_pcs;
 };
 
 }  // namespace
 
 void TraceLifter::NullCallback(uint64_t, llvm::Function *) {}
 
+// Read up to `max_bytes` executable bytes starting at `addr` into `bytes`.
+void TraceLifter::ReadInstructionBytes(uint64_t addr, size_t max_bytes,
+                                       std::string &bytes) {
+  bytes.clear();
+  for (size_t i = 0; i < max_bytes; ++i) {
+    const auto byte_addr = (addr + i) & addr_mask;
+    if (byte_addr < addr) {
+      break;  // 32- or 64-bit address overflow.
+    }
+    uint8_t byte = 0;
+    if (!manager.TryReadExecutableByte(byte_addr, &byte)) {
+      // DLOG(WARNING)
+      //     << "Couldn't read executable byte at "
+      //     << std::hex << byte_addr << std::dec;
+      break;
+    }
+    bytes.push_back(static_cast<char>(byte));
+  }
+}
+
+// Try to lift the flag producing instruction `inst`, along with the
+// instruction that immediately follows it, if that is a conditional branch,
+// `SETcc`, or `CMOVcc`, into `block`. The condition is computed directly from
+// the operands of `inst`. If successful, then `consumer` is the decoded second
+// instruction, and `cond` is the branch condition, or `nullptr` if `consumer`
+// isn't a branch. Otherwise, nothing is added to `block`.
+bool TraceLifter::TryLiftFusedFlags(
+    Instruction &inst, llvm::BasicBlock *block,
+    Instruction &consumer, llvm::Value **cond) {
+
+  *cond = nullptr;
+  if (Instruction::kCategoryNormal != inst.category) {
+    return false;
+  }
+
+  const Operand *lhs_op = nullptr;
+  const Operand *rhs_op = nullptr;
+  const auto kind = GetFlagProducerKind(arch, inst, &lhs_op, &rhs_op);
+  if (FlagProducerKind::kInvalid == kind) {
+    return false;
+  }
+
+  // The consumer heads its own trace, so we want to tail-call to it.
+  if (GetLiftedTraceDeclaration(inst.next_pc)) {
+    return false;
+  }
+
+  std::string bytes;
+  ReadInstructionBytes(inst.next_pc, arch->MaxInstructionSize(), bytes);
+  if (bytes.empty()) {
+    return false;
+  }
+
+  consumer.Reset();
+  std::string cc;
+  if (!arch->DecodeInstruction(inst.next_pc, bytes, consumer) ||
+      !consumer.IsValid() ||
+      !GetInstructionFunction(module, consumer.function)) {
+    return false;
+  }
+
+  const auto consumer_kind = GetFlagConsumerKind(consumer, cc);
+  if (FlagConsumerKind::kInvalid == consumer_kind) {
+    return false;
+  }
+
+  auto lhs_type = GetIntegerRegisterType(block, lhs_op->reg.name);
+  if (!lhs_type) {
+    return false;
+  }
+
+  // Lift into a scratch block, so that nothing is left behind if the pair
+  // can't be fused, and the caller lifts `inst` on its own.
+  auto scratch = llvm::BasicBlock::Create(
+      block->getContext(), "", block->getParent());
+
+  auto fail = [scratch] (void) {
+    scratch->eraseFromParent();
+    return false;
+  };
+
+  // The operands are read before `inst` executes, because a `SUB` overwrites
+  // one of them.
+  auto lhs = LoadFlagProducerOperand(scratch, *lhs_op, lhs_type);
+  auto rhs = LoadFlagProducerOperand(scratch, *rhs_op, lhs_type);
+  if (!lhs || !rhs) {
+    return fail();
+  }
+
+  if (kLiftedInstruction != inst_lifter.LiftIntoBlock(inst, scratch)) {
+    return fail();
+  }
+
+  // The registers of a `CMOVcc` are read after `inst` executes, because
+  // `inst` may have written to them.
+  llvm::Value *dest_ptr = nullptr;
+  llvm::Value *old_dest = nullptr;
+  llvm::Value *src = nullptr;
+  if (FlagConsumerKind::kSet == consumer_kind) {
+    dest_ptr = FindVarInFunction(block, consumer.operands[0].reg.name, true);
+    if (!dest_ptr) {
+      return fail();
+    }
+
+  } else if (FlagConsumerKind::kMove == consumer_kind) {
+    dest_ptr = FindVarInFunction(block, consumer.operands[0].reg.name, true);
+    auto src_ptr = FindVarInFunction(
+        block, consumer.operands[1].reg.name, true);
+    if (!dest_ptr || !src_ptr) {
+      return fail();
+    }
+    old_dest = new llvm::LoadInst(dest_ptr, "", scratch);
+    src = new llvm::LoadInst(src_ptr, "", scratch);
+    if (!old_dest->getType()->isIntegerTy() ||
+        !src->getType()->isIntegerTy() ||
+        old_dest->getType()->getPrimitiveSizeInBits() <
+            src->getType()->getPrimitiveSizeInBits()) {
+      return fail();
+    }
+  }
+
+  // Both instructions' semantics are still called, so the flags and the
+  // consumer's effects remain correct if the fused condition goes unused.
+  if (kLiftedInstruction != inst_lifter.LiftIntoBlock(consumer, scratch)) {
+    return fail();
+  }
+
+  llvm::IRBuilder<> ir(scratch);
+  auto fused_cond = FusedCondition(ir, kind, cc, lhs, rhs);
+  if (!fused_cond) {
+    return fail();
+  }
+
+  // Overwrite the consumer's result with one computed from `fused_cond`, so
+  // that the flags computation is dead if nothing else reads the flags.
+  if (FlagConsumerKind::kSet == consumer_kind) {
+    auto dest_type = dest_ptr->getType()->getPointerElementType();
+    ir.CreateStore(ir.CreateZExt(fused_cond, dest_type), dest_ptr);
+
+  } else if (FlagConsumerKind::kMove == consumer_kind) {
+    auto dest_type = old_dest->getType();
+    auto old_val = ir.CreateTrunc(old_dest, src->getType());
+    auto new_val = ir.CreateSelect(fused_cond, src, old_val);
+    ir.CreateStore(ir.CreateZExt(new_val, dest_type), dest_ptr);
+
+  } else {
+    *cond = fused_cond;
+  }
+
+  block->getInstList().splice(block->end(), scratch->getInstList());
+  scratch->eraseFromParent();
+  return true;
+}
+
 // Lift one or more traces starting from `addr`.
 bool TraceLifter::Lift(uint64_t addr_,
                        std::function<void(uint64_t,llvm::Function *)> callback) {
@@ -840,6 +1714,138 @@ bool TraceLifter::Lift(uint64_t addr_,
 
   TraceLifterState state(arch, module);
 
+  // Count the instructions lifted into the current trace, and remember where
+  // they are, in case a later trace starts at one of them.
+  auto record_trace_blocks = [this, &state] (uint64_t trace_addr) {
+    auto &pcs = owned_pcs[state.func];
+    owner_addrs[state.func] = trace_addr;
+    for (const auto &lifted_pc : state.lifted_pcs) {
+      const auto pc = lifted_pc.first;
+      const auto block_pc = lifted_pc.second;
+      const auto block = state.blocks[block_pc];
+      block_owners[pc].push_back({state.func, block, block_pc});
+      pcs.emplace_back(pc, block);
+      if (!num_inst_copies[pc]++) {
+        num_unique_insts++;
+      }
+      num_lifted_insts++;
+    }
+  };
+
+  // Traces that were handed out by earlier calls to `Lift`, and then split.
+  std::map<uint64_t, llvm::Function *> resplit_traces;
+
+  // The trace at `trace_addr` starts in the middle of traces that we lifted
+  // earlier. Make those traces tail-call the new trace instead, and delete
+  // the code that is now unreachable in them, so that it isn't duplicated.
+  auto split_traces = [this, &state, &resplit_traces] (
+      uint64_t trace_addr) {
+    auto owners_it = block_owners.find(trace_addr);
+    if (owners_it == block_owners.end()) {
+      return;
+    }
+    const auto owners = std::move(owners_it->second);
+    block_owners.erase(owners_it);
+
+    for (const auto &owner : owners) {
+      const auto owner_func = owner.func;
+      const auto owner_block = owner.block;
+      const auto owner_addr = owner_addrs[owner_func];
+      if (!pending_traces.count(owner_addr)) {
+        resplit_traces[owner_addr] = owner_func;
+      }
+      while (!owner_block->empty()) {
+        auto &inst = owner_block->back();
+        inst.replaceAllUsesWith(llvm::UndefValue::get(inst.getType()));
+        inst.eraseFromParent();
+      }
+
+      // The instruction at `trace_addr` was fused with the flag-producing
+      // instruction before it. Lift the producer again, on its own, so that
+      // the owner still executes it before calling into the new trace.
+      auto target_func = state.func;
+      if (owner.block_pc != trace_addr) {
+        ReadInstructionBytes(owner.block_pc, state.max_inst_bytes,
+                             state.inst_bytes);
+        state.inst.Reset();
+        if (!arch->DecodeInstruction(owner.block_pc, state.inst_bytes,
+                                     state.inst) ||
+            kLiftedInstruction != inst_lifter.LiftIntoBlock(state.inst,
+                                                            owner_block)) {
+          target_func = intrinsics->error;
+        }
+      }
+
+      if (FLAGS_lazy_program_counter) {
+        StoreProgramCounter(owner_block, trace_addr);
+      }
+      AddTerminatingTailCall(owner_block, target_func);
+      llvm::removeUnreachableBlocks(*owner_func);
+
+      std::unordered_set<llvm::BasicBlock *> live_blocks;
+      for (auto &block : *owner_func) {
+        live_blocks.insert(&block);
+      }
+
+      // Forget about the instructions whose blocks were deleted.
+      auto &pcs = owned_pcs[owner_func];
+      std::vector<std::pair<uint64_t, llvm::BasicBlock *>> live_pcs;
+      for (const auto &owned_pc : pcs) {
+        const auto pc = owned_pc.first;
+        const auto pc_block = owned_pc.second;
+        auto &pc_owners = block_owners[pc];
+        auto pc_owner_it = std::find_if(
+            pc_owners.begin(), pc_owners.end(),
+            [=] (const BlockOwner &o) {
+              return o.func == owner_func && o.block == pc_block;
+            });
+        if (pc_owner_it != pc_owners.end() && live_blocks.count(pc_block)) {
+          live_pcs.push_back(owned_pc);
+          continue;
+        }
+        if (pc_owner_it != pc_owners.end()) {
+          pc_owners.erase(pc_owner_it);
+        }
+        if (!--num_inst_copies[pc]) {
+          num_unique_insts--;
+        }
+        num_lifted_insts--;
+      }
+      pcs.swap(live_pcs);
+    }
+  };
+
+  // Get or declare the trace starting at `target_pc`. Traces that the trace
+  // manager has only pre-declared, and not yet defined, are lifted too.
+  auto get_or_declare_trace = [this, &state] (uint64_t target_pc) {
+    auto target_trace = GetLiftedTraceDeclaration(target_pc);
+    if (!target_trace) {
+      state.trace_work_list.insert(target_pc);
+      target_trace = DeclareLiftedFunction(
+          module, manager.TraceName(target_pc));
+    } else if (target_trace->isDeclaration() &&
+               !GetLiftedTraceDefinition(target_pc)) {
+      state.trace_work_list.insert(target_pc);
+    }
+    return target_trace;
+  };
+
+  // Ask the trace manager for the only target of an indirect call or jump.
+  // Targets within the binary are lifted as traces.
+  auto resolve_indirect_target = [this, &state, &get_or_declare_trace] (
+      void) -> llvm::Function * {
+    uint64_t target_pc = 0;
+    llvm::Function *target_func = nullptr;
+    if (!manager.TryResolveIndirectTarget(
+        state.inst, &target_pc, &target_func)) {
+      return nullptr;
+    } else if (target_func) {
+      return target_func->getParent() == module ? target_func : nullptr;
+    }
+
+    return get_or_declare_trace(target_pc & addr_mask);
+  };
+
   state.trace_work_list.insert(addr);
   while (!state.trace_work_list.empty()) {
     const auto trace_addr = state.PopTraceAddress();
@@ -855,6 +1861,16 @@ bool TraceLifter::Lift(uint64_t addr_,
 
     state.func = GetLiftedTraceDeclaration(trace_addr);
     state.blocks.clear();
+    state.decoded.Clear();
+    state.lifted_pcs.clear();
+
+    // Lift all of a function into the trace at its beginning.
+    if (!manager.TryGetFunctionBounds(
+            trace_addr, &(state.func_begin), &(state.func_end)) ||
+        state.func_begin != trace_addr) {
+      state.func_begin = 0;
+      state.func_end = 0;
+    }
 
     if (!state.func) {
       const auto trace_name = manager.TraceName(trace_addr);
@@ -871,6 +1887,8 @@ bool TraceLifter::Lift(uint64_t addr_,
     llvm::BranchInst::Create(state.GetOrCreateBlock(trace_addr),
                              &(state.func->front()));
 
+    split_traces(trace_addr);
+
     // CHECK(state.inst_work_list.empty());
     assert(state.inst_work_list.empty());
     state.inst_work_list.insert(trace_addr);
@@ -891,33 +1909,26 @@ bool TraceLifter::Lift(uint64_t addr_,
 
       // Check to see if this instruction corresponds with an existing
       // trace head, and if so, tail-call into that trace directly without
-      // decoding or lifting the instruction.
-      if (inst_addr != trace_addr) {
+      // decoding or lifting the instruction. Instructions in the function
+      // being lifted are always lifted.
+      if (inst_addr != trace_addr && !state.IsInFunction(inst_addr)) {
         if (auto inst_as_trace = GetLiftedTraceDeclaration(inst_addr)) {
+          if (FLAGS_lazy_program_counter) {
+            StoreProgramCounter(state.block, inst_addr);
+          }
           AddTerminatingTailCall(state.block, inst_as_trace);
           continue;
         }
       }
 
       // Read instruction bytes.
-      state.inst_bytes.clear();
-      for (size_t i = 0; i < state.max_inst_bytes; ++i) {
-        const auto byte_addr = (inst_addr + i) & addr_mask;
-        if (byte_addr < inst_addr) {
-          break;  // 32- or 64-bit address overflow.
-        }
-        uint8_t byte = 0;
-        if (!manager.TryReadExecutableByte(byte_addr, &byte)) {
-          // DLOG(WARNING)
-          //     << "Couldn't read executable byte at "
-          //     << std::hex << byte_addr << std::dec;
-          break;
-        }
-        state.inst_bytes.push_back(static_cast<char>(byte));
-      }
+      ReadInstructionBytes(inst_addr, state.max_inst_bytes, state.inst_bytes);
 
       // No executable bytes here.
       if (state.inst_bytes.empty()) {
+        if (FLAGS_lazy_program_counter) {
+          StoreProgramCounter(state.block, inst_addr);
+        }
         AddTerminatingTailCall(state.block, intrinsics->missing_block);
         continue;
       }
@@ -926,12 +1937,53 @@ bool TraceLifter::Lift(uint64_t addr_,
 
       (void) arch->DecodeInstruction(inst_addr, state.inst_bytes, state.inst);
 
+      // A `CMP`, `SUB`, or `TEST` followed by a conditional branch, `SETcc`,
+      // or `CMOVcc` can be lifted as a unit, where the condition is computed
+      // directly from the compared values. The second instruction's block is
+      // still lifted on its own if something else targets it.
+      llvm::Value *fused_cond = nullptr;
+      if (FLAGS_fuse_compare_and_branch &&
+          TryLiftFusedFlags(state.inst, state.block, state.fused_inst,
+                            &fused_cond)) {
+        if (FLAGS_recover_jump_tables) {
+          state.decoded.Add(state.inst);
+          state.decoded.Add(state.fused_inst);
+        }
+
+        state.lifted_pcs.emplace_back(inst_addr, inst_addr);
+        state.lifted_pcs.emplace_back(state.fused_inst.pc, inst_addr);
+
+        if (fused_cond) {
+          const auto taken_pc = state.fused_inst.branch_taken_pc;
+          const auto not_taken_pc = state.fused_inst.branch_not_taken_pc;
+          state.inst_work_list.insert(taken_pc);
+          state.inst_work_list.insert(not_taken_pc);
+          llvm::BranchInst::Create(
+              state.GetOrCreateBlock(taken_pc),
+              state.GetOrCreateBlock(not_taken_pc),
+              fused_cond,
+              state.block);
+        } else {
+          const auto next_pc = state.fused_inst.next_pc;
+          state.inst_work_list.insert(next_pc);
+          llvm::BranchInst::Create(state.GetOrCreateBlock(next_pc),
+                                   state.block);
+        }
+        continue;
+      }
+
       auto lift_status = inst_lifter.LiftIntoBlock(state.inst, state.block);
       if (kLiftedInstruction != lift_status) {
         AddTerminatingTailCall(state.block, intrinsics->error);
         continue;
       }
 
+      if (FLAGS_recover_jump_tables) {
+        state.decoded.Add(state.inst);
+      }
+
+      state.lifted_pcs.emplace_back(inst_addr, inst_addr);
+
       // Connect together the basic blocks.
       switch (state.inst.category) {
         case Instruction::kCategoryInvalid:
@@ -940,6 +1992,10 @@ bool TraceLifter::Lift(uint64_t addr_,
           break;
 
         case Instruction::kCategoryNormal:
+          llvm::BranchInst::Create(state.GetOrCreateNextBlock(),
+                                   state.block);
+          break;
+
         case Instruction::kCategoryNoOp:
           llvm::BranchInst::Create(state.GetOrCreateNextBlock(),
                                    state.block);
@@ -956,18 +2012,97 @@ bool TraceLifter::Lift(uint64_t addr_,
                                    state.block);
           break;
 
-        case Instruction::kCategoryIndirectJump:
-          // TODO(pag): Handle target devirtualization.
-          AddTerminatingTailCall(state.block, intrinsics->jump);
+        // Indirect jumps with known targets, e.g. through jump tables, are
+        // lifted as switches over the target program counter. The default
+        // case still goes through `__remill_jump`, so nothing is lost if some
+        // targets are missing.
+        case Instruction::kCategoryIndirectJump: {
+          if (auto target_func = resolve_indirect_target()) {
+            AddTerminatingTailCall(state.block, target_func);
+            break;
+          }
+
+          std::map<uint64_t, llvm::BasicBlock *> targets;
+          manager.ForEachDevirtualizedTarget(
+              state.inst,
+              [this, &state, &targets, &get_or_declare_trace] (
+                  uint64_t target_pc, DevirtualizedTargetKind kind) {
+                target_pc &= addr_mask;
+                if (DevirtualizedTargetKind::kTraceHead == kind &&
+                    !state.IsInFunction(target_pc)) {
+                  auto target_trace = get_or_declare_trace(target_pc);
+                  auto block = llvm::BasicBlock::Create(
+                      context, "", state.func);
+                  AddTerminatingTailCall(block, target_trace);
+                  targets[target_pc] = block;
+                } else {
+                  state.inst_work_list.insert(target_pc);
+                  targets[target_pc] = state.GetOrCreateBlock(target_pc);
+                }
+              });
+
+          JumpTable table = {};
+          if (FLAGS_recover_jump_tables &&
+              FindJumpTable(arch, state.decoded, state.inst, &table)) {
+            for (uint64_t i = 0; i < table.num_entries; ++i) {
+              uint64_t entry = 0;
+              const auto entry_addr = table.table_addr + i * table.entry_size;
+              auto read_all = true;
+              for (uint64_t b = 0; b < table.entry_size && read_all; ++b) {
+                uint8_t byte = 0;
+                read_all = manager.TryReadDataByte(
+                    (entry_addr + b) & addr_mask, &byte);
+                entry |= static_cast<uint64_t>(byte) << (b * 8);
+              }
+              if (!read_all) {
+                break;
+              }
+
+              auto target_pc = entry;
+              if (table.is_relative) {
+                target_pc = table.table_addr + static_cast<uint64_t>(
+                    static_cast<int64_t>(static_cast<int32_t>(entry)));
+              }
+              target_pc &= addr_mask;
+
+              uint8_t byte = 0;
+              if (!targets.count(target_pc) &&
+                  manager.TryReadExecutableByte(target_pc, &byte)) {
+                state.inst_work_list.insert(target_pc);
+                targets[target_pc] = state.GetOrCreateBlock(target_pc);
+              }
+            }
+          }
+
+          if (targets.empty()) {
+            AddTerminatingTailCall(state.block, intrinsics->jump);
+            break;
+          }
+
+          auto default_block = llvm::BasicBlock::Create(
+              context, "", state.func);
+          AddTerminatingTailCall(default_block, intrinsics->jump);
+
+          state.switch_inst = llvm::SwitchInst::Create(
+              LoadProgramCounter(state.block), default_block,
+              static_cast<unsigned>(targets.size()), state.block);
+          for (const auto &target : targets) {
+            state.switch_inst->addCase(
+                llvm::ConstantInt::get(inst_lifter.word_type, target.first),
+                target.second);
+          }
           break;
+        }
 
         case Instruction::kCategoryAsyncHyperCall:
           target_trace = intrinsics->async_hyper_call;
           goto check_call_return;
 
         case Instruction::kCategoryIndirectFunctionCall:
-          // TODO(pag): Handle target devirtualization.
-          target_trace = intrinsics->function_call;
+          target_trace = resolve_indirect_target();
+          if (!target_trace) {
+            target_trace = intrinsics->function_call;
+          }
           goto check_call_return;
 
         // In the case of a direct function call, we try to handle the
@@ -985,15 +2120,7 @@ bool TraceLifter::Lift(uint64_t addr_,
             continue;
           }
 
-          target_trace = GetLiftedTraceDeclaration(
-              state.inst.branch_taken_pc);
-
-          if (!target_trace) {
-            state.trace_work_list.insert(state.inst.branch_taken_pc);
-            const auto target_trace_name = manager.TraceName(
-                state.inst.branch_taken_pc);
-            target_trace = DeclareLiftedFunction(module, target_trace_name);
-          }
+          target_trace = get_or_declare_trace(state.inst.branch_taken_pc);
 
           goto check_call_return;
 
@@ -1017,8 +2144,26 @@ bool TraceLifter::Lift(uint64_t addr_,
         }
 
         check_call_return: {
+          const auto is_call = state.inst.IsFunctionCall();
+          if (is_call && FLAGS_shadow_return_stack) {
+            auto args = LiftedFunctionArgs(state.block);
+            args[kPCArgNum] = llvm::ConstantInt::get(
+                inst_lifter.word_type, state.inst.next_pc);
+            llvm::IRBuilder<> ir(state.block);
+            ir.CreateStore(
+                ir.CreateCall(intrinsics->shadow_stack_push, args),
+                LoadMemoryPointerRef(state.block));
+          }
+
           AddCall(state.block, target_trace);
 
+          // The callee returns to `next_pc`, or the shadow stack catches it.
+          if (is_call && FLAGS_assume_well_behaved_returns) {
+            llvm::BranchInst::Create(state.GetOrCreateNextBlock(),
+                                     state.block);
+            break;
+          }
+
           auto pc = LoadProgramCounter(state.block);
           auto ret_pc = llvm::ConstantInt::get(
               inst_lifter.word_type, state.inst.next_pc);
@@ -1032,7 +2177,24 @@ bool TraceLifter::Lift(uint64_t addr_,
           break;
         }
 
+        // If the address being returned to isn't the one that was pushed
+        // onto the shadow stack, then our caller would continue at the wrong
+        // place, so jump to the address being returned to instead.
         case Instruction::kCategoryFunctionReturn:
+          if (FLAGS_shadow_return_stack) {
+            auto matched = AddCall(state.block, intrinsics->shadow_stack_pop);
+            auto do_return = llvm::BasicBlock::Create(
+                context, "", state.func);
+            auto redirect = llvm::BasicBlock::Create(context, "", state.func);
+            llvm::IRBuilder<> ir(state.block);
+            ir.CreateCondBr(
+                ir.CreateICmpNE(
+                    matched, llvm::Constant::getNullValue(matched->getType())),
+                do_return, redirect);
+            AddTerminatingTailCall(redirect, intrinsics->jump);
+            AddTerminatingTailCall(do_return, intrinsics->function_return);
+            break;
+          }
           AddTerminatingTailCall(state.block, intrinsics->function_return);
           break;
 
@@ -1046,14 +2208,54 @@ bool TraceLifter::Lift(uint64_t addr_,
       }
     }
 
+    // In lazy mode, the program counter in the `State` structure might be
+    // stale upon entry to an instruction's block.
+    if (FLAGS_lazy_program_counter) {
+      for (auto &entry : state.blocks) {
+        auto block = entry.second;
+        if (!block->getTerminator()) {
+          StoreProgramCounter(block, entry.first);
+          AddTerminatingTailCall(block, intrinsics->missing_block);
+        }
+      }
+    }
+
     for (auto &block : *state.func) {
       if (!block.getTerminator()) {
         AddTerminatingTailCall(&block, intrinsics->missing_block);
       }
     }
 
-    callback(trace_addr, state.func);
-    manager.SetLiftedTraceDefinition(trace_addr, state.func);
+    // Only defined by semantics built with lazy arithmetic flags.
+    if (auto materialize_flags = module->getFunction(
+            "__remill_materialize_flags")) {
+      MaterializeFlagsAtExits(state.func, materialize_flags);
+    }
+
+    // Whole functions own their code, and aren't split.
+    if (!state.func_end) {
+      record_trace_blocks(trace_addr);
+    }
+
+    pending_traces[trace_addr] = state.func;
+    pending_trace_addrs.push_back(trace_addr);
+  }
+
+  // Nothing is split anymore, so the traces can be handed out.
+  std::vector<uint64_t> trace_addrs;
+  trace_addrs.swap(pending_trace_addrs);
+  for (auto trace_addr : trace_addrs) {
+    auto trace = pending_traces[trace_addr];
+    pending_traces.erase(trace_addr);
+    callback(trace_addr, trace);
+    manager.SetLiftedTraceDefinition(trace_addr, trace);
+  }
+
+  // Hand out the traces of earlier calls again, now that they're split.
+  for (const auto &resplit_trace : resplit_traces) {
+    callback(resplit_trace.first, resplit_trace.second);
+    manager.SetLiftedTraceDefinition(resplit_trace.first,
+                                     resplit_trace.second);
   }
 
   return true;
@@ -20,6 +20,8 @@
 #include <functional>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace llvm {
 class Argument;
@@ -103,6 +105,10 @@ class InstructionLifter {
                                           Operand &mem);
 
  private:
+  // Caches whether or not a semantics function might observe the program
+  // counter. Used when lifting with lazy program counter updates.
+  std::unordered_map<llvm::Function *, bool> isel_observes_pc;
+
   InstructionLifter(void) = delete;
 };
 
@@ -135,7 +141,8 @@ class TraceManager {
   // class might have additional global info available to them that lets
   // them declare traces ahead of time. In order to distinguish between
   // stuff we've lifted, and stuff we haven't lifted, we allow the lifter
-  // to access "defined" vs. "declared" traces.
+  // to access "defined" vs. "declared" traces. Declared traces that aren't
+  // defined are lifted when the lifter reaches them.
   //
   // NOTE: This is permitted to return a function from an arbitrary module.
   virtual llvm::Function *GetLiftedTraceDeclaration(uint64_t addr);
@@ -154,10 +161,46 @@ class TraceManager {
       const Instruction &inst,
       std::function<void(uint64_t, DevirtualizedTargetKind)> func);
 
+  // Try to resolve the one target of the indirect call or jump `inst`, e.g.
+  // when it goes through a GOT slot that the dynamic loader always fills in
+  // with the same function. On success, either `target_pc` is updated with
+  // the address of the targeted code, or `external_func` is updated with
+  // the declaration of an external function, in the lifter's module, that
+  // has the same type as lifted functions.
+  virtual bool TryResolveIndirectTarget(const Instruction &inst,
+                                        uint64_t *target_pc,
+                                        llvm::Function **external_func);
+
+  // Try to get the bounds `[*begin, *end)` of the function containing the
+  // code at address `addr`. A trace that starts at the beginning of a
+  // function is lifted as the whole function, i.e. jumps to code within the
+  // function go to blocks of the same LLVM function, instead of tail-calling
+  // other traces. Calls remain calls.
+  //
+  // By default, function bounds are unknown.
+  virtual bool TryGetFunctionBounds(uint64_t addr, uint64_t *begin,
+                                    uint64_t *end);
+
   // Try to read an executable byte of memory. Returns `true` of the byte
   // at address `addr` is executable and readable, and updates the byte
   // pointed to by `byte` with the read value.
   virtual bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) = 0;
+
+  // Try to read a byte of data, e.g. an entry of a jump table. Returns `true`
+  // if the byte at address `addr` is readable, and updates the byte pointed
+  // to by `byte` with the read value.
+  //
+  // By default, this reads executable bytes.
+  virtual bool TryReadDataByte(uint64_t addr, uint8_t *byte);
+
+  // Try to read a byte of memory that can never change while the program
+  // runs, e.g. from `.rodata`, or from a relocated GOT entry. Returns `true`
+  // if the byte at address `addr` is read-only, and updates the byte pointed
+  // to by `byte` with its value. Reads of read-only memory can be folded
+  // into constants by the optimizer.
+  //
+  // By default, no memory is read-only.
+  virtual bool TryReadReadOnlyByte(uint64_t addr, uint8_t *byte);
 };
 
 // Implements a recursive decoder that lifts a trace of instructions to bitcode.
@@ -173,11 +216,22 @@ class TraceLifter {
   static void NullCallback(uint64_t, llvm::Function *);
 
   // Lift one or more traces starting from `addr`. Calls `callback` with each
-  // lifted trace.
+  // lifted trace. Traces are only handed to `callback` and to the trace
+  // manager once all of them are lifted, because lifting a trace can split
+  // the traces that were lifted before it.
+  //
+  // Traces lifted by earlier calls can be split too, in which case they are
+  // handed to `callback` and to the trace manager again. Lifted traces must
+  // not be modified or deleted while the trace lifter is in use.
   bool Lift(
       uint64_t addr,
       std::function<void(uint64_t,llvm::Function *)> callback=NullCallback);
 
+  // Fraction of the instructions lifted so far that are copies of
+  // instructions lifted into other traces, e.g. because the code after a
+  // trace head is reachable from several traces.
+  double DuplicatedInstructionRatio(void) const;
+
  private:
   TraceLifter(void) = delete;
 
@@ -195,6 +249,15 @@ class TraceLifter {
   //       within `module`.
   llvm::Function *GetLiftedTraceDefinition(uint64_t addr);
 
+  // Read up to `max_bytes` executable bytes starting at `addr` into `bytes`.
+  void ReadInstructionBytes(uint64_t addr, size_t max_bytes,
+                            std::string &bytes);
+
+  // Try to lift a flag-producing instruction and its successor, if that is
+  // a conditional branch, `SETcc`, or `CMOVcc`, into the same block.
+  bool TryLiftFusedFlags(Instruction &inst, llvm::BasicBlock *block,
+                         Instruction &consumer, llvm::Value **cond);
+
   const Arch * const arch;
   InstructionLifter &inst_lifter;
   const remill::IntrinsicTable *intrinsics;
@@ -202,6 +265,34 @@ class TraceLifter {
   llvm::Module * const module;
   const uint64_t addr_mask;
   TraceManager &manager;
+
+  // Number of lifted copies of each instruction, across all calls to
+  // `Lift`, and their totals.
+  std::unordered_map<uint64_t, unsigned> num_inst_copies;
+  uint64_t num_lifted_insts;
+  uint64_t num_unique_insts;
+
+  // Traces lifted by the current call to `Lift`, which haven't been given to
+  // the trace manager yet, in the order in which they were lifted.
+  std::unordered_map<uint64_t, llvm::Function *> pending_traces;
+  std::vector<uint64_t> pending_trace_addrs;
+
+  // A block of a trace into which an instruction has been lifted. The block
+  // starts at `block_pc`, which is the address of the flag-producing
+  // instruction if the instruction was fused with it.
+  struct BlockOwner {
+    llvm::Function *func;
+    llvm::BasicBlock *block;
+    uint64_t block_pc;
+  };
+
+  // The traces and blocks into which each instruction has been lifted, the
+  // instructions lifted into each trace and their blocks, and the address of
+  // each trace, across all calls to `Lift`.
+  std::unordered_map<uint64_t, std::vector<BlockOwner>> block_owners;
+  std::unordered_map<llvm::Function *, std::vector<
+      std::pair<uint64_t, llvm::BasicBlock *>>> owned_pcs;
+  std::unordered_map<llvm::Function *, uint64_t> owner_addrs;
 };
 
 }  // namespace remill
@@ -16,18 +16,29 @@
 
 // #include <glog/logging.h>
 
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
 #include <llvm/ADT/Triple.h>
 
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InlineAsm.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
 #include <llvm/IR/Type.h>
 
 #include <llvm/Transforms/IPO.h>
@@ -39,11 +50,724 @@
 
 #include "remill/BC/Compat/TargetLibraryInfo.h"
 
+#include "remill/BC/ABI.h"
 #include "remill/BC/DeadStoreEliminator.h"
 #include "remill/BC/Optimizer.h"
 #include "remill/BC/Util.h"
 
 namespace remill {
+namespace {
+
+// An integer memory access performed by a call to one of the
+// `__remill_read_memory_N` or `__remill_write_memory_N` intrinsics, where the
+// accessed address is `base + offset`. Constant addresses have a null base.
+struct MemoryAccess {
+  llvm::CallInst *call;
+  llvm::Value *base;
+  int64_t offset;
+  unsigned size;  // In bytes.
+};
+
+// Split an address into a base value plus a constant displacement.
+static MemoryAccess GetMemoryAccess(llvm::CallInst *call, unsigned size) {
+  MemoryAccess access = {call, call->getArgOperand(1), 0, size};
+  while (true) {
+    if (auto const_addr = llvm::dyn_cast<llvm::ConstantInt>(access.base)) {
+      access.offset += const_addr->getSExtValue();
+      access.base = nullptr;
+      break;
+    }
+    auto op = llvm::dyn_cast<llvm::BinaryOperator>(access.base);
+    if (!op || (op->getOpcode() != llvm::Instruction::Add &&
+                op->getOpcode() != llvm::Instruction::Sub)) {
+      break;
+    }
+    auto disp = llvm::dyn_cast<llvm::ConstantInt>(op->getOperand(1));
+    if (!disp) {
+      break;
+    }
+    if (op->getOpcode() == llvm::Instruction::Add) {
+      access.offset += disp->getSExtValue();
+    } else {
+      access.offset -= disp->getSExtValue();
+    }
+    access.base = op->getOperand(0);
+  }
+  return access;
+}
+
+enum class AliasKind {
+  kNoAlias,
+  kMayAlias,
+  kMustAlias  // Same address and size.
+};
+
+// Memory accesses only provably do not alias when their addresses are
+// constant displacements from the same base value (e.g. stack slots at
+// different offsets from the same `RSP` value) and they don't overlap.
+static AliasKind GetAliasKind(const MemoryAccess &a, const MemoryAccess &b) {
+  if (a.base != b.base) {
+    return AliasKind::kMayAlias;
+  } else if (a.offset == b.offset && a.size == b.size) {
+    return AliasKind::kMustAlias;
+  } else if ((a.offset + a.size) <= b.offset ||
+             (b.offset + b.size) <= a.offset) {
+    return AliasKind::kNoAlias;
+  } else {
+    return AliasKind::kMayAlias;
+  }
+}
+
+// Walks up the chain of `Memory *` values, starting from `mem`, looking for
+// the oldest memory pointer that is not clobbered by a write that may alias
+// `read`.
+class MemoryChainWalker {
+ public:
+  explicit MemoryChainWalker(llvm::Function *func)
+      : dom_tree(*func) {}
+
+  // Returns the memory pointer that `read` can use in place of its current
+  // one. If the youngest clobbering write must alias `read`, then
+  // `forwarded_val` is set to the written value.
+  llvm::Value *Walk(const MemoryAccess &read, llvm::Value **forwarded_val) {
+    *forwarded_val = nullptr;
+    phi_mem.clear();
+    return Walk(read, read.call->getArgOperand(0), forwarded_val);
+  }
+
+ private:
+  llvm::Value *Walk(const MemoryAccess &read, llvm::Value *mem,
+                    llvm::Value **forwarded_val) {
+    while (true) {
+      if (auto phi = llvm::dyn_cast<llvm::PHINode>(mem)) {
+        return WalkPHI(read, phi);
+      }
+
+      auto call = llvm::dyn_cast<llvm::CallInst>(mem);
+      if (!call) {
+        return mem;
+      }
+
+      auto size = MemoryAccessSize(call->getCalledFunction(), true);
+      if (!size) {
+        return mem;  // Some other intrinsic, e.g. a barrier, or a call.
+      }
+
+      auto write = GetMemoryAccess(call, size);
+      switch (GetAliasKind(read, write)) {
+        case AliasKind::kNoAlias:
+          mem = call->getArgOperand(0);
+          break;
+        case AliasKind::kMustAlias:
+          if (forwarded_val) {
+            *forwarded_val = call->getArgOperand(2);
+          }
+          return mem;
+        case AliasKind::kMayAlias:
+          return mem;
+      }
+    }
+  }
+
+  // Find the one memory pointer that flows into `phi` along every path that
+  // does not clobber `read`. Paths that lead back to a PHI node that we are
+  // already looking at (i.e. loops) don't contribute any new memory pointers.
+  llvm::Value *WalkPHI(const MemoryAccess &read, llvm::PHINode *phi) {
+    auto it = phi_mem.find(phi);
+    if (it != phi_mem.end()) {
+      return it->second;
+    }
+    phi_mem[phi] = nullptr;  // In progress.
+    auto mem = WalkPHIIncoming(read, phi);
+    phi_mem[phi] = mem;
+    return mem;
+  }
+
+  llvm::Value *WalkPHIIncoming(const MemoryAccess &read, llvm::PHINode *phi) {
+    llvm::Value *common = nullptr;
+    auto header = phi->getParent();
+    for (auto i = 0U; i < phi->getNumIncomingValues(); ++i) {
+      auto mem = phi->getIncomingValue(i);
+
+      // Along a back edge, the writes come from an earlier iteration of the
+      // loop, where the base of `read` may have had a different value, e.g.
+      // if it is a pointer that is bumped on each iteration. Comparing the
+      // bases is then meaningless, so only go around the loop if the base
+      // is the same on every iteration.
+      if (!dom_tree.dominates(header, phi->getIncomingBlock(i)) ||
+          IsLoopInvariant(read.base, header)) {
+        mem = Walk(read, mem, nullptr);
+      }
+      if (!mem || mem == phi) {
+        continue;
+      } else if (!common) {
+        common = mem;
+      } else if (common != mem) {
+        return phi;
+      }
+    }
+
+    if (!common) {
+      return phi;
+    }
+
+    // The common memory pointer needs to be available wherever `phi` is.
+    if (auto inst = llvm::dyn_cast<llvm::Instruction>(common)) {
+      if (!dom_tree.dominates(inst, phi)) {
+        return phi;
+      }
+    }
+    return common;
+  }
+
+  // Returns `true` if `base` has the same value on every iteration of the
+  // loop whose header is `header`, i.e. if it is defined before the loop.
+  bool IsLoopInvariant(llvm::Value *base, llvm::BasicBlock *header) {
+    auto inst = llvm::dyn_cast_or_null<llvm::Instruction>(base);
+    if (!inst) {
+      return true;  // Constant address, or an argument.
+    }
+    auto block = inst->getParent();
+    return block != header && dom_tree.dominates(block, header);
+  }
+
+  llvm::DominatorTree dom_tree;
+  std::unordered_map<llvm::PHINode *, llvm::Value *> phi_mem;
+};
+
+// Move every memory read as far up the `Memory *` chain as possible, skipping
+// over writes that provably don't alias the read, and forward the values of
+// writes that exactly match a read. The reads are `readnone`, so this makes
+// reads of the same address from the same memory pointer redundant, and lets
+// reads whose memory pointer is now loop-invariant be hoisted out of loops.
+// GVN and LICM take care of both.
+static bool DisambiguateMemoryAccesses(llvm::Function *func) {
+  std::vector<std::pair<llvm::CallInst *, unsigned>> reads;
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+      if (auto size = MemoryAccessSize(call->getCalledFunction(), false)) {
+        reads.push_back({call, size});
+      }
+    }
+  }
+
+  if (reads.empty()) {
+    return false;
+  }
+
+  auto changed = false;
+  MemoryChainWalker walker(func);
+  for (auto &read_call : reads) {
+
+    // The address of this read might depend on an earlier read that has
+    // since been replaced, so only split it up now.
+    const auto read = GetMemoryAccess(read_call.first, read_call.second);
+    llvm::Value *val = nullptr;
+    auto mem = walker.Walk(read, &val);
+    auto read_type = read.call->getType();
+    if (val && val->getType() != read_type) {
+      if (llvm::CastInst::isBitCastable(val->getType(), read_type)) {
+        llvm::IRBuilder<> ir(read.call);
+        val = ir.CreateBitCast(val, read_type);
+      } else {
+        val = nullptr;
+      }
+    }
+
+    if (val) {
+      read.call->replaceAllUsesWith(val);
+      read.call->eraseFromParent();
+      changed = true;
+    } else if (mem != read.call->getArgOperand(0)) {
+      read.call->setArgOperand(0, mem);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Find the longest prefix of `accesses` (sorted by offset) that exactly tiles
+// a 2, 4, or 8 byte range, and return the number of accesses in it.
+static size_t FindTile(const std::vector<MemoryAccess *> &accesses,
+                       size_t begin, unsigned *tile_size) {
+  auto best = 0UL;
+  auto end_offset = accesses[begin]->offset;
+  for (auto i = begin; i < accesses.size(); ++i) {
+    if (accesses[i]->offset != end_offset) {
+      break;
+    }
+    end_offset += accesses[i]->size;
+    const auto size = end_offset - accesses[begin]->offset;
+    if (size > 8) {
+      break;
+    } else if (i > begin && (size == 2 || size == 4 || size == 8)) {
+      best = i - begin + 1;
+      *tile_size = static_cast<unsigned>(size);
+    }
+  }
+  return best;
+}
+
+static llvm::Value *TileAddress(llvm::IRBuilder<> &ir, llvm::Type *addr_type,
+                                const MemoryAccess &first) {
+  auto disp = llvm::ConstantInt::get(
+      addr_type, static_cast<uint64_t>(first.offset), true);
+  return first.base ? ir.CreateAdd(first.base, disp) : disp;
+}
+
+// Merge runs of adjacent integer reads from the same memory pointer, within a
+// block, into a single wider read, and then split up the wider value.
+static bool CoalesceReads(
+    llvm::BasicBlock &block,
+    std::unordered_map<llvm::Instruction *, size_t> &order) {
+  auto module = block.getParent()->getParent();
+  std::map<std::pair<llvm::Value *, llvm::Value *>,
+           std::vector<MemoryAccess>> groups;
+
+  for (auto &inst : block) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    if (!call) {
+      continue;
+    }
+    auto size = IntegerMemoryAccessSize(call->getCalledFunction(), false);
+    if (size) {
+      auto access = GetMemoryAccess(call, size);
+      groups[{call->getArgOperand(0), access.base}].push_back(access);
+    }
+  }
+
+  auto changed = false;
+  for (auto &group : groups) {
+    auto &accesses = group.second;
+    if (accesses.size() < 2) {
+      continue;
+    }
+
+    // Reads of the same address with the same memory pointer are the same;
+    // one of them represents all of them in the tiling.
+    std::map<int64_t, std::vector<MemoryAccess *>> by_offset;
+    for (auto &access : accesses) {
+      by_offset[access.offset].push_back(&access);
+    }
+    std::vector<MemoryAccess *> sorted;
+    for (auto &entry : by_offset) {
+      const auto size = entry.second.front()->size;
+      auto same_size = true;
+      for (auto access : entry.second) {
+        same_size = same_size && access->size == size;
+      }
+      if (same_size) {
+        sorted.push_back(entry.second.front());
+      }
+    }
+
+    for (size_t i = 0; i < sorted.size(); ) {
+      unsigned tile_size = 0;
+      const auto num_in_tile = FindTile(sorted, i, &tile_size);
+      if (!num_in_tile) {
+        ++i;
+        continue;
+      }
+
+      // Read the whole tile before the first of the reads being merged.
+      std::vector<MemoryAccess *> merged;
+      llvm::CallInst *first_call = nullptr;
+      for (auto j = i; j < i + num_in_tile; ++j) {
+        for (auto access : by_offset[sorted[j]->offset]) {
+          merged.push_back(access);
+          if (!first_call || order[access->call] < order[first_call]) {
+            first_call = access->call;
+          }
+        }
+      }
+
+      // The base address might have been the result of a read that we have
+      // already merged, so re-derive it.
+      const auto tile_begin = GetMemoryAccess(sorted[i]->call, sorted[i]->size);
+
+      llvm::IRBuilder<> ir(first_call);
+      auto read_func = module->getFunction(
+          "__remill_read_memory_" + std::to_string(tile_size * 8));
+      auto addr = TileAddress(ir, first_call->getArgOperand(1)->getType(),
+                              tile_begin);
+      auto wide = ir.CreateCall(
+          read_func, {first_call->getArgOperand(0), addr});
+      order[wide] = order[first_call];
+
+      for (auto access : merged) {
+        const auto shift = static_cast<uint64_t>(
+            access->offset - sorted[i]->offset) * 8;
+        llvm::Value *val = wide;
+        if (shift) {
+          val = ir.CreateLShr(val, shift);
+        }
+        val = ir.CreateTrunc(val, access->call->getType());
+        access->call->replaceAllUsesWith(val);
+        access->call->eraseFromParent();
+      }
+
+      changed = true;
+      i += num_in_tile;
+    }
+  }
+
+  return changed;
+}
+
+// Merge chains of adjacent integer writes, where each write's memory pointer
+// is only used by the next write, into a single wider write.
+static bool CoalesceWrites(llvm::BasicBlock &block) {
+  auto module = block.getParent()->getParent();
+
+  // Find the chains of writes.
+  std::vector<std::vector<MemoryAccess>> chains;
+  std::unordered_set<llvm::Instruction *> seen;
+  for (auto &inst : block) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    if (!call || seen.count(call)) {
+      continue;
+    }
+    std::vector<MemoryAccess> chain;
+    while (call) {
+      auto size = IntegerMemoryAccessSize(call->getCalledFunction(), true);
+      if (!size) {
+        break;
+      }
+      seen.insert(call);
+      chain.push_back(GetMemoryAccess(call, size));
+      if (!call->hasOneUse()) {
+        break;
+      }
+      call = llvm::dyn_cast<llvm::CallInst>(*call->user_begin());
+      if (call && call->getParent() != &block) {
+        break;
+      }
+    }
+    if (chain.size() >= 2) {
+      chains.push_back(std::move(chain));
+    }
+  }
+
+  auto changed = false;
+  for (auto &chain : chains) {
+    for (size_t i = 0; i < chain.size(); ) {
+
+      // Find the longest window of writes in the chain that have the same
+      // base address and that exactly tile a range.
+      size_t window = 0;
+      unsigned tile_size = 0;
+      std::vector<MemoryAccess *> sorted;
+      for (auto j = i; j < chain.size() && j < i + 8; ++j) {
+        if (chain[j].base != chain[i].base) {
+          break;
+        }
+        sorted.push_back(&(chain[j]));
+        auto tile = sorted;
+        std::sort(tile.begin(), tile.end(),
+                  [] (MemoryAccess *a, MemoryAccess *b) {
+                    return a->offset < b->offset;
+                  });
+        unsigned size = 0;
+        if (tile.size() >= 2 && FindTile(tile, 0, &size) == tile.size()) {
+          window = tile.size();
+          tile_size = size;
+        }
+      }
+
+      if (!window) {
+        ++i;
+        continue;
+      }
+
+      // Build up the wide value, and write it in place of the last write.
+      auto last_call = chain[i + window - 1].call;
+      auto first = &(chain[i]);
+      for (auto j = i; j < i + window; ++j) {
+        if (chain[j].offset < first->offset) {
+          first = &(chain[j]);
+        }
+      }
+
+      llvm::IRBuilder<> ir(last_call);
+      auto wide_type = llvm::Type::getIntNTy(
+          block.getContext(), tile_size * 8);
+      llvm::Value *wide_val = llvm::ConstantInt::get(wide_type, 0);
+      for (auto j = i; j < i + window; ++j) {
+        const auto shift = static_cast<uint64_t>(
+            chain[j].offset - first->offset) * 8;
+        llvm::Value *val = ir.CreateZExt(
+            chain[j].call->getArgOperand(2), wide_type);
+        if (shift) {
+          val = ir.CreateShl(val, shift);
+        }
+        wide_val = ir.CreateOr(wide_val, val);
+      }
+
+      auto write_func = module->getFunction(
+          "__remill_write_memory_" + std::to_string(tile_size * 8));
+      auto addr = TileAddress(ir, last_call->getArgOperand(1)->getType(),
+                              *first);
+      auto wide = ir.CreateCall(
+          write_func, {chain[i].call->getArgOperand(0), addr, wide_val});
+      last_call->replaceAllUsesWith(wide);
+
+      for (auto j = i + window; j > i; --j) {
+        chain[j - 1].call->eraseFromParent();
+      }
+
+      changed = true;
+      i += window;
+    }
+  }
+
+  return changed;
+}
+
+// Merge adjacent narrow reads and writes of memory into wider ones. This
+// assumes a little-endian target.
+static bool CoalesceMemoryAccesses(llvm::Function *func) {
+  llvm::DataLayout dl(func->getParent());
+  if (!dl.isLittleEndian()) {
+    return false;
+  }
+
+  auto changed = false;
+  for (auto &block : *func) {
+    std::unordered_map<llvm::Instruction *, size_t> order;
+    for (auto &inst : block) {
+      order[&inst] = order.size();
+    }
+    changed = CoalesceReads(block, order) || changed;
+    changed = CoalesceWrites(block) || changed;
+  }
+  return changed;
+}
+
+// Maximum number of times that we fold reads of read-only memory and then
+// re-optimize, e.g. to load a function pointer out of a vtable, whose address
+// was itself loaded out of read-only memory.
+static constexpr unsigned kMaxReadOnlyFoldingRounds = 4;
+
+// Replace reads of read-only memory at constant addresses with the values
+// read.
+static bool FoldReadOnlyMemoryReads(
+    llvm::Function *func,
+    const std::function<bool(uint64_t, uint8_t *)> &read_only_byte) {
+  llvm::DataLayout dl(func->getParent());
+  std::vector<llvm::CallInst *> folded;
+  for (auto &inst : llvm::instructions(func)) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    if (!call) {
+      continue;
+    }
+    const auto size = MemoryAccessSize(call->getCalledFunction(), false);
+    if (!size) {
+      continue;
+    }
+    const auto access = GetMemoryAccess(call, size);
+    if (access.base) {
+      continue;
+    }
+
+    const auto addr_bits = call->getArgOperand(1)->getType()->
+        getIntegerBitWidth();
+    const auto addr_mask = ~0ULL >> (64 - addr_bits);
+    const auto addr = static_cast<uint64_t>(access.offset);
+
+    uint64_t val = 0;
+    auto is_read_only = true;
+    for (auto i = 0U; i < size && is_read_only; ++i) {
+      uint8_t byte = 0;
+      is_read_only = read_only_byte((addr + i) & addr_mask, &byte);
+      const auto shift = dl.isLittleEndian() ? i : (size - i - 1);
+      val |= static_cast<uint64_t>(byte) << (shift * 8);
+    }
+    if (!is_read_only) {
+      continue;
+    }
+
+    auto int_val = llvm::ConstantInt::get(
+        llvm::Type::getIntNTy(func->getContext(), size * 8), val);
+    auto const_val = llvm::ConstantExpr::getBitCast(int_val, call->getType());
+    call->replaceAllUsesWith(const_val);
+    folded.push_back(call);
+  }
+
+  for (auto call : folded) {
+    call->eraseFromParent();
+  }
+  return !folded.empty();
+}
+
+// Returns `true` if `inst` is a `BarrierReorder`, i.e. an empty inline
+// assembly statement that clobbers memory. The floating point semantics
+// bracket their operations with these.
+static bool IsReorderBarrier(llvm::Instruction *inst) {
+  auto call = llvm::dyn_cast<llvm::CallInst>(inst);
+  if (!call || call->getNumArgOperands()) {
+    return false;
+  }
+  auto asm_val = llvm::dyn_cast<llvm::InlineAsm>(
+      call->getCalledValue()->stripPointerCasts());
+  return asm_val && asm_val->getAsmString().empty();
+}
+
+// Remove the floating point exception brackets from `func`, treating every
+// bracket as having observed no exceptions.
+//
+// The semantics accumulate the result of each bracket into sticky status
+// flags in the `State` structure, e.g. `state.sw.pe |= ...`, so the results
+// of the brackets are always used, and a trace can't prove on its own that
+// they are dead. Instead, this relies on the program never reading the status
+// flags. With the results replaced by zero, the sticky updates store back the
+// values that they loaded, which the optimizer removes.
+//
+// The reordering barriers are only emitted around bracketed operations, so
+// they are all removed, including those left behind by the optimizer having
+// already deleted the calls that they bracketed.
+static bool RemoveFPUExceptionChecks(llvm::Function *func,
+                                     llvm::Function *test_and_clear) {
+  std::vector<llvm::Instruction *> dead;
+  for (auto &inst : llvm::instructions(func)) {
+    if (IsReorderBarrier(&inst)) {
+      dead.push_back(&inst);
+    } else if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+      if (call->getCalledFunction() == test_and_clear) {
+        dead.push_back(call);
+      }
+    }
+  }
+
+  for (auto inst : dead) {
+    if (!inst->use_empty()) {
+      inst->replaceAllUsesWith(llvm::Constant::getNullValue(inst->getType()));
+    }
+    inst->eraseFromParent();
+  }
+  return !dead.empty();
+}
+
+// Cost budget of a callee trace that is inlined into its callers, with all
+// semantics already inlined into it. This is in the ballpark of a getter,
+// a `__x86.get_pc_thunk.*`, or a wrapper that calls another function.
+static constexpr unsigned kMaxInlinedTraceCost = 40;
+
+// Returns `true` if `ptr` points into the `State` structure `state`.
+static bool IsStatePointer(llvm::Value *ptr, llvm::Value *state) {
+  while (true) {
+    ptr = ptr->stripPointerCasts();
+    if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(ptr)) {
+      ptr = gep->getPointerOperand();
+    } else {
+      return ptr == state;
+    }
+  }
+}
+
+// Estimate the cost of inlining the lifted trace `func`. Loads and stores
+// of the `State` structure are free, as they usually become SSA values or
+// dead stores once the callee is part of its caller. Address arithmetic and
+// casts are free too. Calls are expensive, whether to memory access
+// intrinsics or to other lifted code. The returned cost doesn't include
+// the call, the program counter load and the return address check at the
+// call site, all of which inlining also exposes to the optimizer.
+static unsigned LiftedTraceInlineCost(llvm::Function *func) {
+  auto state = LoadStatePointer(func);
+  unsigned cost = 0;
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto load = llvm::dyn_cast<llvm::LoadInst>(&inst)) {
+      cost += IsStatePointer(load->getPointerOperand(), state) ? 0 : 1;
+
+    } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+      cost += IsStatePointer(store->getPointerOperand(), state) ? 0 : 1;
+
+    } else if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+      auto callee = call->getCalledFunction();
+      if (callee == func) {
+        return ~0U;  // Recursive.
+      } else if (callee && callee->isIntrinsic()) {
+        continue;  // E.g. debug info.
+      } else if (callee && (MemoryAccessSize(callee, false) ||
+                            MemoryAccessSize(callee, true))) {
+        cost += 2;
+      } else {
+        cost += 5;
+      }
+
+    } else if (!llvm::isa<llvm::GetElementPtrInst>(inst) &&
+               !llvm::isa<llvm::CastInst>(inst) &&
+               !llvm::isa<llvm::AllocaInst>(inst) &&
+               !llvm::isa<llvm::ReturnInst>(inst)) {
+      cost += 1;
+    }
+  }
+  return cost;
+}
+
+// Inline the small lifted traces in `traces` into the traces that call
+// them. Tail-calls, i.e. jumps between traces, are left alone. Returns the
+// set of traces that changed.
+static std::unordered_set<llvm::Function *> InlineSmallTraces(
+    const std::vector<llvm::Function *> &traces) {
+  std::unordered_map<llvm::Function *, unsigned> costs;
+  for (auto trace : traces) {
+    if (!trace->isDeclaration()) {
+      costs[trace] = LiftedTraceInlineCost(trace);
+    }
+  }
+
+  // Find all call sites up-front, so that the call sites in inlined code
+  // aren't inlined in turn. The optimizer may have marked calls with `tail`,
+  // so we look for the `ret` that follows a jump.
+  std::vector<llvm::CallInst *> calls;
+  for (auto trace : traces) {
+    for (auto &inst : llvm::instructions(trace)) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (!call || llvm::isa<llvm::ReturnInst>(call->getNextNode())) {
+        continue;
+      }
+      auto callee = call->getCalledFunction();
+      auto cost_it = costs.find(callee);
+      if (callee != trace && cost_it != costs.end() &&
+          cost_it->second <= kMaxInlinedTraceCost) {
+        calls.push_back(call);
+      }
+    }
+  }
+
+  std::unordered_set<llvm::Function *> changed;
+  for (auto call : calls) {
+    auto caller = call->getParent()->getParent();
+    llvm::InlineFunctionInfo info;
+    if (llvm::InlineFunction(call, info)) {
+      changed.insert(caller);
+    }
+  }
+
+  // The inlined callees still return to their callers through
+  // `__remill_function_return`, which now sits in the middle of the callers.
+  // Passes that treat it as leaving the function, e.g. dead store
+  // elimination, would ignore what the callers do after the calls, so
+  // replace those returns with the memory pointers that they return.
+  for (auto caller : changed) {
+    std::vector<llvm::CallInst *> inlined_returns;
+    for (auto &inst : llvm::instructions(caller)) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      auto callee = call ? call->getCalledFunction() : nullptr;
+      if (callee && callee->getName() == "__remill_function_return" &&
+          !llvm::isa<llvm::ReturnInst>(call->getNextNode())) {
+        inlined_returns.push_back(call);
+      }
+    }
+    for (auto call : inlined_returns) {
+      call->replaceAllUsesWith(call->getArgOperand(kMemoryPointerArgNum));
+      call->eraseFromParent();
+    }
+  }
+  return changed;
+}
+
+}  // namespace
 
 void OptimizeModule(llvm::Module *module,
                     std::function<llvm::Function *(void)> generator,
@@ -76,13 +800,106 @@ void OptimizeModule(llvm::Module *module,
   builder.populateFunctionPassManager(func_manager);
   builder.populateModulePassManager(module_manager);
   func_manager.doInitialization();
+  std::vector<llvm::Function *> traces;
   llvm::Function *func = nullptr;
   while (nullptr != (func = generator())) {
     func_manager.run(*func);
+    traces.push_back(func);
   }
   func_manager.doFinalization();
   module_manager.run(*module);
 
+  // Now that the semantics are inlined into the traces, remove the floating
+  // point exception brackets, and re-optimize the traces, now that the
+  // floating point operations are no longer pinned in place by the
+  // reordering barriers.
+  auto test_and_clear = module->getFunction(
+      "__remill_fpu_exception_test_and_clear");
+  if (guide.eliminate_fpu_exception_checks && test_and_clear) {
+    func_manager.doInitialization();
+    for (auto trace : traces) {
+      if (RemoveFPUExceptionChecks(trace, test_and_clear)) {
+        func_manager.run(*trace);
+      }
+    }
+    func_manager.doFinalization();
+  }
+
+  // Now that the semantics are inlined into the traces, we know which traces
+  // are small. Inline those into their callers, which lets dead store
+  // elimination (and everything else) see across the calls.
+  if (guide.inline_small_traces) {
+    func_manager.doInitialization();
+    for (auto trace : InlineSmallTraces(traces)) {
+      func_manager.run(*trace);
+    }
+    func_manager.doFinalization();
+  }
+
+  // Now that the semantics are inlined into the traces, cache the `State`
+  // slots in allocas, and then optimize the traces again, which will turn
+  // those allocas into SSA values, and expose lifted loops to the loop
+  // optimizations and vectorizers.
+  if (guide.promote_state_to_ssa) {
+    PromoteStateToSSA(module, bb_func, slots);
+    func_manager.doInitialization();
+    for (auto trace : traces) {
+      func_manager.run(*trace);
+    }
+    func_manager.doFinalization();
+    module_manager.run(*module);
+  }
+
+  // Fold reads of read-only memory into constants, and then re-optimize,
+  // which can expose more reads at constant addresses.
+  if (guide.read_only_byte) {
+    func_manager.doInitialization();
+    for (auto trace : traces) {
+      for (auto i = 0U; i < kMaxReadOnlyFoldingRounds; ++i) {
+        if (!FoldReadOnlyMemoryReads(trace, guide.read_only_byte)) {
+          break;
+        }
+        func_manager.run(*trace);
+      }
+    }
+    func_manager.doFinalization();
+  }
+
+  // Move spills and reloads on the guest stack into native stack frames,
+  // which SROA can then turn into SSA values.
+  if (guide.recover_stack_frames) {
+    RecoverStackFrames(module, bb_func, slots);
+    func_manager.doInitialization();
+    for (auto trace : traces) {
+      func_manager.run(*trace);
+    }
+    func_manager.doFinalization();
+  }
+
+  // Let memory reads skip over writes that don't alias them, then let GVN
+  // and LICM remove and hoist the now-redundant reads.
+  if (guide.disambiguate_memory_accesses) {
+    func_manager.doInitialization();
+    for (auto trace : traces) {
+      if (DisambiguateMemoryAccesses(trace)) {
+        func_manager.run(*trace);
+      }
+    }
+    func_manager.doFinalization();
+  }
+
+  // Merge adjacent narrow memory accesses, then clean up the shifts and
+  // truncations that split up the wider values.
+  if (guide.coalesce_memory_accesses) {
+    func_manager.doInitialization();
+    for (auto trace : traces) {
+      if (CoalesceMemoryAccesses(trace)) {
+        func_manager.run(*trace);
+      }
+    }
+    func_manager.doFinalization();
+  }
+
   if (guide.eliminate_dead_stores) {
     RemoveDeadStores(module, bb_func, slots);
   }
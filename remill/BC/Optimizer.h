@@ -36,6 +36,42 @@ struct OptimizationGuide {
   bool verify_input;
   bool verify_output;
   bool eliminate_dead_stores;
+
+  // Remove the `__remill_fpu_exception_test_and_clear` brackets (and their
+  // reordering barriers) around floating point operations, so that they can
+  // be folded and vectorized. This assumes that the lifted program never
+  // reads the floating point exception status flags, e.g. in `MXCSR` or
+  // `FPSR`, which are left unchanged.
+  bool eliminate_fpu_exception_checks;
+
+  // Inline small lifted traces into the traces that call them, using a cost
+  // model that treats accesses to the `State` structure as free. This lets
+  // the later passes, e.g. dead store elimination, work across these calls.
+  bool inline_small_traces;
+
+  // Cache registers in SSA values across each lifted trace, rather than
+  // loading and storing them through the `State` structure.
+  bool promote_state_to_ssa;
+
+  // Turn the guest stack frames of leaf functions into native stack frames,
+  // when pointers into those frames provably don't escape. This needs
+  // `promote_state_to_ssa` to be effective.
+  bool recover_stack_frames;
+
+  // Merge adjacent narrow memory reads or writes into wider ones, to reduce
+  // the number of calls to the memory access intrinsics.
+  bool coalesce_memory_accesses;
+
+  // Prove that memory accesses through the same base address with different
+  // displacements don't alias, so that memory reads can be forwarded from
+  // earlier writes, de-duplicated, and hoisted out of loops.
+  bool disambiguate_memory_accesses;
+
+  // Replace reads of memory at constant addresses with constants when every
+  // byte read is read-only, according to this callback, which returns `true`
+  // and fills in the byte's value if the byte is read-only. This is meant
+  // to be bound to `TraceManager::TryReadReadOnlyByte`.
+  std::function<bool(uint64_t, uint8_t *)> read_only_byte;
 };
 
 template <typename T>
@@ -0,0 +1,528 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/APInt.h>
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/Type.h>
+
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "remill/Arch/Arch.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/DeadStoreEliminator.h"
+#include "remill/BC/Signature.h"
+#include "remill/BC/Util.h"
+#include "remill/BC/Version.h"
+
+namespace remill {
+namespace {
+
+// Registers used by a calling convention that passes its arguments in
+// registers.
+struct CallingConvention {
+  std::vector<const char *> arguments;
+  std::vector<const char *> vector_arguments;
+  const char *return_value;
+  const char *vector_return_value;
+  const char *stack_pointer;
+
+  // Change in the stack pointer across a call, i.e. the size of the return
+  // address popped by the return instruction.
+  int64_t stack_delta;
+};
+
+static bool GetCallingConvention(const Arch *arch, CallingConvention *cc) {
+  switch (arch->DefaultCallingConv()) {
+    case llvm::CallingConv::X86_64_SysV:
+      *cc = {{"RDI", "RSI", "RDX", "RCX", "R8", "R9"},
+             {"XMM0", "XMM1", "XMM2", "XMM3", "XMM4", "XMM5", "XMM6", "XMM7"},
+             "RAX", "XMM0", "RSP", 8};
+      return true;
+
+    // Arguments are assigned to registers by their position, so that a
+    // floating point argument takes the place of an integer argument. Only
+    // integer arguments are recovered.
+    case llvm::CallingConv::Win64:
+      *cc = {{"RCX", "RDX", "R8", "R9"}, {}, "RAX", "XMM0", "RSP", 8};
+      return true;
+
+    default:
+      return false;  // E.g. x86 `cdecl` passes its arguments on the stack.
+  }
+}
+
+// The byte offsets of the live slots of the `State` structure, as attached
+// to a lifted function by `RemoveDeadStores`.
+using LiveOffsets = std::unordered_set<uint64_t>;
+
+static bool GetLiveOffsets(llvm::Function *func, const char *kind,
+                           LiveOffsets *offsets) {
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(3, 9)
+  (void) func;
+  (void) kind;
+  (void) offsets;
+  return false;
+#else
+  auto node = func->getMetadata(kind);
+  if (!node) {
+    return false;
+  }
+  for (const auto &op : node->operands()) {
+    auto md = llvm::dyn_cast<llvm::ConstantAsMetadata>(op);
+    auto offset = md ? llvm::dyn_cast<llvm::ConstantInt>(md->getValue())
+                     : nullptr;
+    if (!offset) {
+      return false;
+    }
+    offsets->insert(offset->getZExtValue());
+  }
+  return true;
+#endif
+}
+
+// Returns `true` if any of the slots that overlap with `reg` is live.
+static bool IsLive(const Register *reg, const std::vector<StateSlot> &slots,
+                   const LiveOffsets &live) {
+  for (auto i = reg->offset; i < (reg->offset + reg->size); ++i) {
+    if (i < slots.size() && live.count(slots[i].offset)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A load or store of the `State` structure at a constant offset.
+struct StateAccess {
+  llvm::Instruction *inst;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// All the ways that a lifted function uses its `State` structure. Escapes
+// are uses that we don't understand, e.g. calls to other lifted functions,
+// and that might read or write any register. Returning isn't an escape, as
+// the calling convention says which registers matter to the caller.
+struct StateUses {
+  std::vector<StateAccess> reads;
+  std::vector<StateAccess> writes;
+  std::vector<llvm::Instruction *> escapes;
+};
+
+// Returns `true` if `val` is a call that returns from the lifted function,
+// or that reports an error.
+static bool IsReturnOrError(llvm::Value *val) {
+  auto call = llvm::dyn_cast<llvm::CallInst>(val);
+  auto callee = call ? call->getCalledFunction() : nullptr;
+  return callee && (callee->getName() == "__remill_function_return" ||
+                    callee->getName() == "__remill_error");
+}
+
+static StateUses FindStateUses(llvm::Function *func) {
+  llvm::DataLayout dl(func->getParent());
+  StateUses uses;
+
+  std::vector<std::pair<llvm::Value *, uint64_t>> work_list;
+  work_list.emplace_back(LoadStatePointer(func), 0);
+
+  while (!work_list.empty()) {
+    const auto ptr = work_list.back().first;
+    const auto offset = work_list.back().second;
+    work_list.pop_back();
+
+    for (auto user : ptr->users()) {
+      if (auto load = llvm::dyn_cast<llvm::LoadInst>(user)) {
+        uses.reads.push_back(
+            {load, offset, dl.getTypeStoreSize(load->getType())});
+
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+        if (store->getPointerOperand() == ptr) {
+          const auto val_type = store->getValueOperand()->getType();
+          uses.writes.push_back(
+              {store, offset, dl.getTypeStoreSize(val_type)});
+        } else {
+          uses.escapes.push_back(store);
+        }
+
+      } else if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(user)) {
+        llvm::APInt gep_offset(dl.getPointerSizeInBits(0), 0);
+        if (gep->accumulateConstantOffset(dl, gep_offset) &&
+            !gep_offset.isNegative()) {
+          work_list.emplace_back(gep, offset + gep_offset.getZExtValue());
+        } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(gep)) {
+          uses.escapes.push_back(inst);
+        }
+
+      } else if (auto cast = llvm::dyn_cast<llvm::BitCastOperator>(user)) {
+        work_list.emplace_back(cast, offset);
+
+      } else if (IsReturnOrError(user)) {
+        continue;
+
+      } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) {
+        uses.escapes.push_back(inst);
+      }
+    }
+  }
+  return uses;
+}
+
+// Returns `true` if the access `a` overlaps with the register `reg`.
+static bool Overlaps(const StateAccess &a, const Register *reg) {
+  return a.offset < (reg->offset + reg->size) &&
+         reg->offset < (a.offset + a.size);
+}
+
+// Returns `true` if `a` comes before `b` in the same block.
+static bool ComesBefore(llvm::Instruction *a, llvm::Instruction *b) {
+  if (a->getParent() != b->getParent()) {
+    return false;
+  }
+  for (auto inst = a->getNextNode(); inst; inst = inst->getNextNode()) {
+    if (inst == b) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Try to express `val` as the entry value of the stack pointer plus a
+// constant. The entry value is a read in the entry block that comes before
+// any write to the stack pointer.
+static bool TryGetStackDelta(
+    llvm::Value *val,
+    const std::unordered_map<llvm::Value *, const StateAccess *> &sp_reads,
+    const std::vector<StateAccess> &sp_writes, int64_t *delta,
+    unsigned depth=0) {
+  if (depth > 8) {
+    return false;
+  }
+
+  auto read_it = sp_reads.find(val);
+  if (read_it != sp_reads.end()) {
+    auto load = read_it->second->inst;
+    auto block = load->getParent();
+    if (block != &(block->getParent()->getEntryBlock())) {
+      return false;
+    }
+    for (const auto &write : sp_writes) {
+      if (ComesBefore(write.inst, load)) {
+        return false;
+      }
+    }
+    *delta = 0;
+    return true;
+  }
+
+  auto binop = llvm::dyn_cast<llvm::BinaryOperator>(val);
+  if (!binop) {
+    return false;
+  }
+
+  auto rhs = llvm::dyn_cast<llvm::ConstantInt>(binop->getOperand(1));
+  auto lhs = binop->getOperand(0);
+  if (!rhs && llvm::Instruction::Add == binop->getOpcode()) {
+    rhs = llvm::dyn_cast<llvm::ConstantInt>(binop->getOperand(0));
+    lhs = binop->getOperand(1);
+  }
+  if (!rhs || !TryGetStackDelta(lhs, sp_reads, sp_writes, delta, depth + 1)) {
+    return false;
+  }
+
+  if (llvm::Instruction::Add == binop->getOpcode()) {
+    *delta += rhs->getSExtValue();
+    return true;
+  } else if (llvm::Instruction::Sub == binop->getOpcode()) {
+    *delta -= rhs->getSExtValue();
+    return true;
+  } else {
+    return false;
+  }
+}
+
+// Find the change in the stack pointer between the entry to `func` and its
+// returns. Every return must agree.
+static bool TryGetStackDelta(const StateUses &uses, const Register *sp,
+                             llvm::Function *func, int64_t *delta) {
+  std::unordered_map<llvm::Value *, const StateAccess *> sp_reads;
+  for (const auto &read : uses.reads) {
+    if (read.offset == sp->offset && read.size == sp->size) {
+      sp_reads[read.inst] = &read;
+    }
+  }
+
+  std::vector<StateAccess> sp_writes;
+  for (const auto &write : uses.writes) {
+    if (Overlaps(write, sp)) {
+      sp_writes.push_back(write);
+    }
+  }
+
+  auto found_return = false;
+  for (auto &block : *func) {
+    auto ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator());
+    auto call = ret ? llvm::dyn_cast_or_null<llvm::CallInst>(
+        ret->getPrevNode()) : nullptr;
+    auto callee = call ? call->getCalledFunction() : nullptr;
+    if (!callee || callee->getName() != "__remill_function_return") {
+      continue;  // E.g. a tail-call to another lifted function.
+    }
+
+    // Find the last write of the stack pointer before the return.
+    const StateAccess *last_write = nullptr;
+    for (const auto &write : sp_writes) {
+      if (write.inst->getParent() == &block &&
+          (!last_write || ComesBefore(last_write->inst, write.inst))) {
+        last_write = &write;
+      }
+    }
+
+    int64_t ret_delta = 0;
+    if (!last_write) {
+      if (!sp_writes.empty()) {
+        return false;
+      }
+    } else if (last_write->offset != sp->offset ||
+               last_write->size != sp->size ||
+               !TryGetStackDelta(
+                   llvm::cast<llvm::StoreInst>(
+                       last_write->inst)->getValueOperand(),
+                   sp_reads, sp_writes, &ret_delta)) {
+      return false;
+    }
+
+    if (found_return && ret_delta != *delta) {
+      return false;
+    }
+    found_return = true;
+    *delta = ret_delta;
+  }
+  return found_return;
+}
+
+// Find the argument registers named by `names` that are used, i.e. that are
+// read on entry, or that come before an argument register that is.
+static bool GetArguments(const Arch *arch,
+                         const std::vector<const char *> &names,
+                         bool enclosing, const std::vector<StateSlot> &slots,
+                         const LiveOffsets &reads,
+                         std::vector<const Register *> *arguments) {
+  size_t num_used = 0;
+  for (auto name : names) {
+    auto reg = arch->RegisterByName(name);
+    if (!reg) {
+      return false;
+    }
+    if (enclosing) {
+      reg = reg->EnclosingRegister();
+    }
+    arguments->push_back(reg);
+    if (IsLive(reg, slots, reads)) {
+      num_used = arguments->size();
+    }
+  }
+  arguments->resize(num_used);
+  return true;
+}
+
+}  // namespace
+
+// Recover the signature of a lifted function under the default calling
+// convention.
+bool RecoverFunctionSignature(const Arch *arch, llvm::Function *func,
+                              FunctionSignature *sig) {
+  CallingConvention cc = {};
+  if (func->isDeclaration() || !GetCallingConvention(arch, &cc)) {
+    return false;
+  }
+
+  const auto sp = arch->RegisterByName(cc.stack_pointer);
+  auto ret = arch->RegisterByName(cc.return_value);
+  const auto vector_ret = arch->RegisterByName(cc.vector_return_value);
+  if (!sp || !ret || !vector_ret) {
+    return false;
+  }
+  ret = ret->EnclosingRegister();
+
+  // Which registers matter has already been worked out by the dead store
+  // elimination, which also knows what the callers of `func` read after it
+  // returns. The live set on entry isn't used, because it also contains the
+  // registers that `func` leaves alone for its callers to read.
+  LiveOffsets reads;
+  LiveOffsets live_out;
+  if (!GetLiveOffsets(func, "remill.read_on_entry", &reads) ||
+      !GetLiveOffsets(func, "remill.live_out", &live_out)) {
+    return false;
+  }
+
+  const auto uses = FindStateUses(func);
+  if (!TryGetStackDelta(uses, sp->EnclosingRegister(), func,
+                        &(sig->stack_delta)) ||
+      sig->stack_delta != cc.stack_delta) {
+    return false;
+  }
+
+  const auto slots = StateSlots(func->getParent());
+  sig->arguments.clear();
+  sig->vector_arguments.clear();
+  if (!GetArguments(arch, cc.arguments, true, slots, reads,
+                    &(sig->arguments)) ||
+      !GetArguments(arch, cc.vector_arguments, false, slots, reads,
+                    &(sig->vector_arguments))) {
+    return false;
+  }
+
+  // A return value is defined by this function, or by a function that it
+  // calls, and is read by the callers of this function.
+  auto is_returned = [&] (const Register *reg) {
+    if (!IsLive(reg, slots, live_out)) {
+      return false;
+    }
+    return !uses.escapes.empty() ||
+           std::any_of(uses.writes.begin(), uses.writes.end(),
+                       [=] (const StateAccess &write) {
+                         return Overlaps(write, reg);
+                       });
+  };
+  sig->return_value = is_returned(ret) ? ret : nullptr;
+  sig->vector_return_value = is_returned(vector_ret) ? vector_ret : nullptr;
+  return true;
+}
+
+// Create a copy of `func` that takes its arguments and returns its return
+// value according to `sig`.
+llvm::Function *CreateNativeFunction(const Arch *arch, llvm::Function *func,
+                                     uint64_t pc,
+                                     const FunctionSignature &sig) {
+  auto module = func->getParent();
+  auto &context = module->getContext();
+  auto word_type = llvm::Type::getIntNTy(
+      context, static_cast<unsigned>(arch->address_size));
+
+  auto reg_type = [&] (const Register *reg) -> llvm::Type * {
+    if (reg->size == (arch->address_size / 8)) {
+      return word_type;
+    } else {
+      return llvm::VectorType::get(llvm::Type::getInt8Ty(context),
+                                   static_cast<unsigned>(reg->size));
+    }
+  };
+
+  std::vector<const Register *> arg_regs(sig.arguments);
+  arg_regs.insert(arg_regs.end(), sig.vector_arguments.begin(),
+                  sig.vector_arguments.end());
+
+  std::vector<const Register *> ret_regs;
+  if (sig.return_value) {
+    ret_regs.push_back(sig.return_value);
+  }
+  if (sig.vector_return_value) {
+    ret_regs.push_back(sig.vector_return_value);
+  }
+
+  std::vector<llvm::Type *> param_types;
+  for (auto reg : arg_regs) {
+    param_types.push_back(reg_type(reg));
+  }
+  param_types.push_back(StatePointerType(module));
+  param_types.push_back(MemoryPointerType(module));
+
+  std::vector<llvm::Type *> ret_types;
+  for (auto reg : ret_regs) {
+    ret_types.push_back(reg_type(reg));
+  }
+
+  llvm::Type *ret_type = llvm::Type::getVoidTy(context);
+  if (1 == ret_types.size()) {
+    ret_type = ret_types[0];
+  } else if (!ret_types.empty()) {
+    ret_type = llvm::StructType::get(context, ret_types);
+  }
+
+  auto native_func = llvm::Function::Create(
+      llvm::FunctionType::get(ret_type, param_types, false),
+      llvm::GlobalValue::ExternalLinkage, func->getName().str() + ".native",
+      module);
+  native_func->setCallingConv(arch->DefaultCallingConv());
+  native_func->addFnAttr(llvm::Attribute::NoUnwind);
+
+  std::vector<llvm::Value *> args;
+  for (auto &arg : native_func->args()) {
+    args.push_back(&arg);
+  }
+  const auto state = args[arg_regs.size()];
+  const auto memory = args[arg_regs.size() + 1];
+
+  llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", native_func));
+  auto state_bytes = ir.CreateBitCast(state, llvm::Type::getInt8PtrTy(context));
+  auto reg_ptr = [&] (const Register *reg) {
+    return ir.CreateBitCast(
+        ir.CreateConstInBoundsGEP1_64(state_bytes, reg->offset),
+        llvm::PointerType::get(reg_type(reg), 0));
+  };
+
+  for (size_t i = 0; i < arg_regs.size(); ++i) {
+    ir.CreateStore(args[i], reg_ptr(arg_regs[i]));
+  }
+
+  std::vector<llvm::Value *> lifted_args(kNumBlockArgs);
+  lifted_args[kStatePointerArgNum] = state;
+  lifted_args[kPCArgNum] = llvm::ConstantInt::get(word_type, pc);
+  lifted_args[kMemoryPointerArgNum] = memory;
+  auto call = ir.CreateCall(func, lifted_args);
+
+  if (ret_regs.empty()) {
+    ir.CreateRetVoid();
+  } else if (1 == ret_regs.size()) {
+    ir.CreateRet(ir.CreateLoad(reg_ptr(ret_regs[0])));
+  } else {
+    llvm::Value *ret_val = llvm::UndefValue::get(ret_type);
+    for (unsigned i = 0; i < ret_regs.size(); ++i) {
+      ret_val = ir.CreateInsertValue(
+          ret_val, ir.CreateLoad(reg_ptr(ret_regs[i])), i);
+    }
+    ir.CreateRet(ret_val);
+  }
+
+  // Specialize the copy of `func` to the arguments. Loads of the argument
+  // registers now read the stores above, and will be forwarded.
+  if (!func->isDeclaration()) {
+    llvm::InlineFunctionInfo info;
+    llvm::InlineFunction(call, info);
+  }
+  return native_func;
+}
+
+}  // namespace remill
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+class Function;
+}  // namespace llvm
+namespace remill {
+
+class Arch;
+struct Register;
+
+// The signature of a lifted function under the default calling convention
+// of the target architecture, i.e. `Arch::DefaultCallingConv`.
+struct FunctionSignature {
+  // Integer argument registers, in order.
+  std::vector<const Register *> arguments;
+
+  // Floating point and vector argument registers, in order.
+  std::vector<const Register *> vector_arguments;
+
+  // Integer return value register, or `nullptr` if the function doesn't
+  // return an integer.
+  const Register *return_value;
+
+  // Floating point or vector return value register, or `nullptr`.
+  const Register *vector_return_value;
+
+  // Change in the stack pointer, from the function's entry to its return.
+  int64_t stack_delta;
+};
+
+// Recover the signature of the lifted function `func`, using the live sets
+// that `RemoveDeadStores` attached to it. An argument register is used if
+// `func` reads it on entry, or if it reads a later argument register of the
+// same kind. A return value register is used if it is live when `func`
+// returns, and `func` writes to it, or calls code that might.
+//
+// Returns `false` if `func` has no live sets, if the calling convention
+// doesn't pass its arguments in registers, or if the stack delta of `func`
+// is unknown or doesn't match the calling convention, e.g. because the
+// callee pops its arguments. This works best after `PromoteStateToSSA`.
+bool RecoverFunctionSignature(const Arch *arch, llvm::Function *func,
+                              FunctionSignature *sig);
+
+// Create a function, named after the lifted function `func` with a
+// `.native` suffix, that takes its arguments and returns its return value
+// according to `sig`, and follows the default calling convention. Integer
+// registers are passed as machine words, and vector registers as vectors of
+// bytes. If the function returns both kinds of values, then it returns them
+// in a structure. The `State` and `Memory` pointers come last, so that the
+// arguments are in the right machine registers.
+//
+// The new function is a copy of `func` behind a thin adapter that moves
+// the arguments into the `State` structure, and that moves the return value
+// out of it. Once optimized, the arguments and return value stay in SSA
+// values. `pc` is the address of the lifted function.
+llvm::Function *CreateNativeFunction(const Arch *arch, llvm::Function *func,
+                                     uint64_t pc,
+                                     const FunctionSignature &sig);
+
+}  // namespace remill
@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #include <glog/logging.h>
+
+#include <atomic>
+#include <cassert>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/Triple.h>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include "remill/BC/Compat/BitcodeReaderWriter.h"
+#include "remill/BC/Compat/IRReader.h"
+#include "remill/BC/Compat/TargetLibraryInfo.h"
+
+#include "remill/BC/Lifter.h"
+#include "remill/BC/TieredCompiler.h"
+#include "remill/BC/Util.h"
+#include "remill/BC/Version.h"
+
+namespace remill {
+namespace {
+
+// Number of times that a trace must be entered before it is re-optimized,
+// unless told otherwise.
+static constexpr uint64_t kDefaultHotTraceThreshold = 1000;
+
+// Optimize the traces in `module`. The first tier only inlines the
+// semantics functions, which are all `always_inline`, and cleans up after
+// them. The second tier runs the same `-O3` pipeline as `OptimizeModule`,
+// but none of the passes over lifted code that `OptimizationGuide` enables,
+// e.g. dead store elimination. Those need the `State` structure and the
+// `__remill_basic_block` function, which extracted traces don't have.
+static void OptimizeTraceModule(llvm::Module *module, unsigned tier) {
+  llvm::legacy::FunctionPassManager func_manager(module);
+  llvm::legacy::PassManager module_manager;
+
+  auto TLI = new llvm::TargetLibraryInfoImpl(
+      llvm::Triple(module->getTargetTriple()));
+
+  TLI->disableAllFunctions();  // `-fno-builtin`.
+
+  llvm::PassManagerBuilder builder;
+  builder.SizeLevel = 0;
+  builder.LibraryInfo = TLI;  // Deleted by `llvm::~PassManagerBuilder`.
+  builder.DisableUnitAtATime = false;
+  builder.RerollLoops = false;
+
+  if (1 == tier) {
+    builder.OptLevel = 1;
+    builder.Inliner = llvm::createFunctionInliningPass(0);
+    builder.DisableUnrollLoops = true;
+    builder.SLPVectorize = false;
+    builder.LoopVectorize = false;
+  } else {
+    builder.OptLevel = 3;
+    builder.Inliner = llvm::createFunctionInliningPass(250);
+    builder.DisableUnrollLoops = false;  // Unroll loops!
+    builder.SLPVectorize = true;
+    builder.LoopVectorize = true;
+  }
+
+  builder.populateFunctionPassManager(func_manager);
+  builder.populateModulePassManager(module_manager);
+  func_manager.doInitialization();
+  for (auto &func : *module) {
+    if (!func.isDeclaration()) {
+      func_manager.run(func);
+    }
+  }
+  func_manager.doFinalization();
+  module_manager.run(*module);
+}
+
+// Add the definitions of `val`, and of everything that it uses, to
+// `defs`, except for lifted traces other than `trace`. The other traces, and
+// the things that are only declared, e.g. intrinsics, are added to `decls`.
+static void CollectDefinitions(
+    llvm::Value *val, llvm::Function *trace,
+    const std::unordered_map<std::string, uint64_t> &trace_addrs,
+    std::unordered_set<const llvm::GlobalValue *> &defs,
+    std::unordered_set<const llvm::GlobalValue *> &decls) {
+
+  std::vector<llvm::Value *> work_list = {val};
+  std::unordered_set<llvm::Value *> seen;
+  while (!work_list.empty()) {
+    auto curr = work_list.back();
+    work_list.pop_back();
+    if (!seen.insert(curr).second) {
+      continue;
+    }
+
+    if (auto func = llvm::dyn_cast<llvm::Function>(curr)) {
+      if (func->isDeclaration() ||
+          (func != trace && trace_addrs.count(func->getName().str()))) {
+        decls.insert(func);
+        continue;
+      }
+      defs.insert(func);
+      for (auto &block : *func) {
+        for (auto &inst : block) {
+          for (auto &op : inst.operands()) {
+            if (llvm::isa<llvm::Constant>(op.get())) {
+              work_list.push_back(op.get());
+            }
+          }
+        }
+      }
+
+    } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(curr)) {
+      if (var->hasInitializer()) {
+        defs.insert(var);
+        work_list.push_back(var->getInitializer());
+      } else {
+        decls.insert(var);
+      }
+
+    } else if (auto con = llvm::dyn_cast<llvm::Constant>(curr)) {
+      for (auto &op : con->operands()) {
+        work_list.push_back(op.get());
+      }
+    }
+  }
+}
+
+}  // namespace
+
+// The dispatch entry of a trace. Compiled code reads `code` and updates
+// `count` directly, by address.
+struct TieredCompiler::Entry {
+  std::atomic<NativeTrace> code;
+  std::atomic<uint64_t> count;
+  std::atomic<unsigned> tier;
+  bool is_queued;  // Guarded by `TieredCompiler::lock`.
+  uint64_t pc;
+  TieredCompiler *compiler;
+};
+
+// A serialized copy of a trace, waiting to be compiled.
+struct TieredCompiler::Job {
+  Entry *entry;
+  std::string name;
+  std::string bitcode;
+};
+
+TieredCompiler::TieredCompiler(InstructionLifter *inst_lifter_,
+                               TraceManager *manager_,
+                               CodeGenerator generator_,
+                               TieredCompilerOptions options_)
+    : manager(*manager_),
+      trace_lifter(new TraceLifter(inst_lifter_, manager_)),
+      generator(generator_),
+      options(options_),
+      stopping(false) {
+
+  if (!options.hot_trace_threshold) {
+    options.hot_trace_threshold = kDefaultHotTraceThreshold;
+  }
+  if (!options.num_threads) {
+    options.num_threads = 1;
+  }
+  for (auto i = 0U; i < options.num_threads; ++i) {
+    workers.emplace_back(&TieredCompiler::RunWorker, this);
+  }
+}
+
+TieredCompiler::~TieredCompiler(void) {
+  {
+    std::lock_guard<std::mutex> locker(queue_lock);
+    stopping = true;
+  }
+  queue_cond.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+NativeTrace TieredCompiler::Enter(uint64_t pc) {
+  Entry *entry = nullptr;
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    entry = GetOrCreateEntry(pc);
+  }
+  const auto count = entry->count.fetch_add(1) + 1;
+  const auto code = entry->code.load(std::memory_order_acquire);
+  if (!code || count == options.hot_trace_threshold) {
+    return EnterSlowPath(entry);
+  }
+  return code;
+}
+
+uint64_t TieredCompiler::ExecutionCount(uint64_t pc) {
+  std::lock_guard<std::mutex> locker(lock);
+  return GetOrCreateEntry(pc)->count.load();
+}
+
+unsigned TieredCompiler::Tier(uint64_t pc) {
+  std::lock_guard<std::mutex> locker(lock);
+  return GetOrCreateEntry(pc)->tier.load();
+}
+
+NativeTrace TieredCompiler::EnterSlowPath(Entry *entry) {
+  auto self = entry->compiler;
+  NativeTrace code = nullptr;
+  std::unique_ptr<Job> job;
+  bool is_hot = false;
+  {
+    std::lock_guard<std::mutex> locker(self->lock);
+    code = entry->code.load(std::memory_order_acquire);
+    if (entry->count.load() >= self->options.hot_trace_threshold &&
+        !entry->is_queued) {
+      entry->is_queued = true;
+      is_hot = true;
+    }
+    if (!code || is_hot) {
+      job = self->CreateJob(entry);
+    }
+  }
+
+  if (!code) {
+    code = self->CompileFirstTier(*job);
+  }
+  if (is_hot) {
+    self->QueueSecondTier(std::move(job));
+  }
+  return code;
+}
+
+TieredCompiler::Entry *TieredCompiler::GetOrCreateEntry(uint64_t pc) {
+  auto &entry = entries[pc];
+  if (!entry) {
+    entry.reset(new Entry);
+    entry->code.store(nullptr);
+    entry->count.store(0);
+    entry->tier.store(0);
+    entry->is_queued = false;
+    entry->pc = pc;
+    entry->compiler = this;
+  }
+  return entry.get();
+}
+
+// Return the lifted trace at `pc`, lifting it, and the traces that it
+// reaches, if needed.
+llvm::Function *TieredCompiler::GetOrLiftTrace(uint64_t pc) {
+  auto trace_it = traces.find(pc);
+  if (trace_it != traces.end()) {
+    return trace_it->second;
+  }
+
+  trace_lifter->Lift(pc, [this] (uint64_t addr, llvm::Function *func) {
+    traces[addr] = func;
+    trace_addrs[func->getName().str()] = addr;
+  });
+
+  // Lifted before we got here, e.g. by the user of the trace manager.
+  auto &trace = traces[pc];
+  if (!trace) {
+    trace = manager.GetLiftedTraceDefinition(pc);
+    assert(trace != nullptr);
+    // CHECK(trace != nullptr)
+    //     << "Could not lift the trace at " << std::hex << pc;
+    trace_addrs[trace->getName().str()] = pc;
+  }
+  return trace;
+}
+
+// Copy `trace`, and everything that it uses except for other traces, into
+// a new module in the same context. Only the collected values are copied or
+// declared, so this doesn't depend on the size of the semantics module.
+std::unique_ptr<llvm::Module> TieredCompiler::ExtractTrace(
+    llvm::Function *trace) {
+  std::unordered_set<const llvm::GlobalValue *> defs;
+  std::unordered_set<const llvm::GlobalValue *> decls;
+  CollectDefinitions(trace, trace, trace_addrs, defs, decls);
+
+  auto source_module = trace->getParent();
+  std::unique_ptr<llvm::Module> trace_module(
+      new llvm::Module(trace->getName(), trace->getContext()));
+  trace_module->setDataLayout(source_module->getDataLayout());
+  trace_module->setTargetTriple(source_module->getTargetTriple());
+
+  // Declare everything first, so that the copied definitions can refer to
+  // each other.
+  llvm::ValueToValueMapTy value_map;
+  auto declare = [&trace_module, &value_map] (const llvm::GlobalValue *val) {
+    if (auto func = llvm::dyn_cast<llvm::Function>(val)) {
+      auto func_copy = llvm::Function::Create(
+          func->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+          func->getName(), trace_module.get());
+      func_copy->copyAttributesFrom(func);
+      value_map[func] = func_copy;
+
+    } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(val)) {
+      auto var_copy = new llvm::GlobalVariable(
+          *trace_module, var->getType()->getElementType(), var->isConstant(),
+          llvm::GlobalValue::ExternalLinkage, nullptr, var->getName(),
+          nullptr, var->getThreadLocalMode(),
+          var->getType()->getAddressSpace());
+      var_copy->copyAttributesFrom(var);
+      value_map[var] = var_copy;
+    }
+  };
+  for (auto val : decls) {
+    declare(val);
+  }
+  for (auto val : defs) {
+    declare(val);
+  }
+
+  for (auto val : defs) {
+    if (auto func = llvm::dyn_cast<llvm::Function>(val)) {
+      auto func_copy = llvm::cast<llvm::Function>(value_map[func]);
+      auto arg_copy = func_copy->arg_begin();
+      for (auto &arg : func->args()) {
+        arg_copy->setName(arg.getName());
+        value_map[&arg] = &*arg_copy;
+        ++arg_copy;
+      }
+      llvm::SmallVector<llvm::ReturnInst *, 8> returns;
+      llvm::CloneFunctionInto(func_copy, func, value_map, true, returns);
+
+    } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(val)) {
+      auto var_copy = llvm::cast<llvm::GlobalVariable>(value_map[var]);
+      var_copy->setInitializer(
+          llvm::MapValue(var->getInitializer(), value_map));
+    }
+  }
+
+  // Only the trace is visible from the outside.
+  for (auto &func : *trace_module) {
+    if (!func.isDeclaration()) {
+      func.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+  for (auto &var : trace_module->globals()) {
+    if (var.hasInitializer()) {
+      var.setLinkage(llvm::GlobalValue::InternalLinkage);
+    } else {
+      var.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+  auto trace_copy = llvm::cast<llvm::Function>(value_map[trace]);
+  trace_copy->setLinkage(llvm::GlobalValue::ExternalLinkage);
+  trace_copy->setVisibility(llvm::GlobalValue::DefaultVisibility);
+
+  return trace_module;
+}
+
+// Make calls to lifted traces go through the callees' dispatch entries. The
+// callee's native code is loaded from its entry, and the callee's execution
+// counter is incremented. The slow path lifts and compiles the callee if it
+// has no native code yet, and queues it for re-optimization once it's hot.
+void TieredCompiler::RedirectTraceCalls(llvm::Module *trace_module) {
+  auto &context = trace_module->getContext();
+  auto i8_ptr_type = llvm::Type::getInt8PtrTy(context);
+  auto i64_type = llvm::Type::getInt64Ty(context);
+
+  auto error_func = trace_module->getFunction("__remill_error");
+
+  std::vector<std::pair<llvm::CallInst *, uint64_t>> calls;
+  for (auto &func : *trace_module) {
+    auto addr_it = trace_addrs.find(func.getName().str());
+    if (addr_it == trace_addrs.end()) {
+      continue;
+    }
+    for (auto caller : CallersOf(&func)) {
+      calls.emplace_back(caller, addr_it->second);
+    }
+  }
+
+  for (const auto &call_info : calls) {
+    auto call = call_info.first;
+    auto entry = GetOrCreateEntry(call_info.second);
+    auto code_type = call->getCalledValue()->getType();
+    if (!error_func) {
+      error_func = llvm::Function::Create(
+          call->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+          "__remill_error", trace_module);
+    }
+
+    llvm::IRBuilder<> ir(call);
+    auto count_ptr = ir.CreateIntToPtr(
+        llvm::ConstantInt::get(
+            i64_type, reinterpret_cast<uintptr_t>(&(entry->count))),
+        llvm::PointerType::get(i64_type, 0));
+    auto old_count = ir.CreateAtomicRMW(
+        llvm::AtomicRMWInst::Add, count_ptr,
+        llvm::ConstantInt::get(i64_type, 1),
+        llvm::AtomicOrdering::Monotonic);
+
+    auto code_ptr = ir.CreateIntToPtr(
+        llvm::ConstantInt::get(
+            i64_type, reinterpret_cast<uintptr_t>(&(entry->code))),
+        llvm::PointerType::get(code_type, 0));
+    auto code = ir.CreateLoad(code_ptr);
+    code->setAlignment(sizeof(NativeTrace));
+    code->setAtomic(llvm::AtomicOrdering::Acquire);
+
+    auto is_cold = ir.CreateICmpEQ(
+        code, llvm::Constant::getNullValue(code_type));
+    auto is_hot = ir.CreateICmpEQ(
+        old_count,
+        llvm::ConstantInt::get(i64_type, options.hot_trace_threshold - 1));
+    auto head_block = call->getParent();
+    auto slow_term = llvm::SplitBlockAndInsertIfThen(
+        ir.CreateOr(is_cold, is_hot), call, false);
+
+    ir.SetInsertPoint(slow_term);
+    llvm::Type *slow_path_param_types[] = {i8_ptr_type};
+    auto slow_path_type = llvm::FunctionType::get(
+        code_type, slow_path_param_types, false);
+    auto slow_path = ir.CreateIntToPtr(
+        llvm::ConstantInt::get(
+            i64_type, reinterpret_cast<uintptr_t>(
+                &TieredCompiler::EnterSlowPath)),
+        llvm::PointerType::get(slow_path_type, 0));
+    llvm::Value *slow_path_args[] = {
+        ir.CreateIntToPtr(
+            llvm::ConstantInt::get(
+                i64_type, reinterpret_cast<uintptr_t>(entry)),
+            i8_ptr_type)};
+    auto slow_code = ir.CreateCall(slow_path, slow_path_args);
+
+    // The callee couldn't be lifted or compiled, so fail the same way that
+    // lifted code does, instead of calling through a null pointer.
+    auto slow_callee = ir.CreateSelect(
+        ir.CreateICmpEQ(slow_code, llvm::Constant::getNullValue(code_type)),
+        llvm::ConstantExpr::getBitCast(error_func, code_type),
+        slow_code);
+
+    ir.SetInsertPoint(call);
+    auto callee = ir.CreatePHI(code_type, 2);
+    callee->addIncoming(code, head_block);
+    callee->addIncoming(slow_callee, slow_term->getParent());
+    call->setCalledFunction(callee);
+  }
+
+  // The other traces are no longer called directly.
+  std::vector<llvm::Function *> unused_decls;
+  for (auto &func : *trace_module) {
+    if (func.isDeclaration() && func.use_empty()) {
+      unused_decls.push_back(&func);
+    }
+  }
+  for (auto func : unused_decls) {
+    func->eraseFromParent();
+  }
+}
+
+// Copy the trace at `entry`, with its calls redirected, for compilation.
+// LLVM contexts aren't thread-safe, so the copy is serialized, and re-read
+// into a new context by `ReadJob`, which lets the copy be optimized and
+// compiled without holding `lock`. Only what the trace uses is copied, so
+// this is cheap compared to the compilation.
+std::unique_ptr<TieredCompiler::Job> TieredCompiler::CreateJob(Entry *entry) {
+  auto trace = GetOrLiftTrace(entry->pc);
+  auto trace_module = ExtractTrace(trace);
+  RedirectTraceCalls(trace_module.get());
+
+  std::unique_ptr<Job> job(new Job);
+  job->entry = entry;
+  job->name = trace->getName().str();
+  llvm::raw_string_ostream bitcode_stream(job->bitcode);
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(7, 0)
+  llvm::WriteBitcodeToFile(trace_module.get(), bitcode_stream);
+#else
+  llvm::WriteBitcodeToFile(*trace_module, bitcode_stream);
+#endif
+  bitcode_stream.flush();
+  return job;
+}
+
+std::unique_ptr<llvm::Module> TieredCompiler::ReadJob(
+    const Job &job, llvm::LLVMContext &context) {
+  llvm::SMDiagnostic error;
+  auto trace_module = llvm::parseIR(
+      llvm::MemoryBufferRef(job.bitcode, job.name), error, context);
+  if (!trace_module) {
+    // LOG(ERROR)
+    //     << "Unable to re-read trace " << job.name << ": "
+    //     << error.getMessage().str();
+  }
+  return trace_module;
+}
+
+NativeTrace TieredCompiler::CompileFirstTier(const Job &job) {
+  llvm::LLVMContext context;
+  auto trace_module = ReadJob(job, context);
+  if (!trace_module) {
+    return nullptr;
+  }
+
+  OptimizeTraceModule(trace_module.get(), 1);
+  auto code = generator(trace_module.get(), job.name);
+  if (!code) {
+    return nullptr;
+  }
+
+  // Another thread may have compiled the same trace meanwhile, possibly at
+  // the second tier.
+  std::lock_guard<std::mutex> locker(lock);
+  if (auto other_code = job.entry->code.load(std::memory_order_acquire)) {
+    return other_code;
+  }
+  job.entry->code.store(code, std::memory_order_release);
+  job.entry->tier.store(1);
+  return code;
+}
+
+// Hand the copy of a trace to the background threads.
+void TieredCompiler::QueueSecondTier(std::unique_ptr<Job> job) {
+  {
+    std::lock_guard<std::mutex> locker(queue_lock);
+    queue.push_back(std::move(job));
+  }
+  queue_cond.notify_one();
+}
+
+void TieredCompiler::RunWorker(void) {
+  while (true) {
+    std::unique_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> locker(queue_lock);
+      queue_cond.wait(locker, [this] (void) {
+        return stopping || !queue.empty();
+      });
+      if (stopping) {
+        return;
+      }
+      job = std::move(queue.front());
+      queue.pop_front();
+    }
+
+    llvm::LLVMContext context;
+    auto trace_module = ReadJob(*job, context);
+    if (!trace_module) {
+      continue;
+    }
+
+    OptimizeTraceModule(trace_module.get(), 2);
+
+    if (auto code = generator(trace_module.get(), job->name)) {
+      std::lock_guard<std::mutex> locker(lock);
+      job->entry->code.store(code, std::memory_order_release);
+      job->entry->tier.store(2);
+    }
+  }
+}
+
+}  // namespace remill
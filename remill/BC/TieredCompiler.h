@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Memory;
+
+namespace llvm {
+class Function;
+class LLVMContext;
+class Module;
+}  // namespace llvm
+namespace remill {
+
+class InstructionLifter;
+class TraceLifter;
+class TraceManager;
+
+// Native code of a lifted trace. It has the same signature as lifted traces,
+// i.e. `Memory *(State &, addr_t, Memory *)`.
+using NativeTrace = Memory *(*)(void *, uint64_t, Memory *);
+
+struct TieredCompilerOptions {
+  // Number of times that a trace must be entered before it is re-optimized
+  // at the second tier. Zero means `kDefaultHotTraceThreshold`.
+  uint64_t hot_trace_threshold;
+
+  // Number of background threads that re-optimize hot traces. Zero means
+  // one thread.
+  unsigned num_threads;
+};
+
+// Compiles lifted traces in two tiers, for use by a JIT or a dynamic binary
+// translator.
+//
+// The first tier lifts a trace the first time that it is entered, inlines
+// the semantics functions into it, and cleans it up with a minimal pipeline.
+// The second tier re-optimizes the trace with the full `-O3` pipeline, on a
+// background thread, once the trace has been entered often enough.
+//
+// Each trace has a dispatch entry, which holds the trace's execution counter
+// and a pointer to the trace's latest native code. Calls from one compiled
+// trace to another go through the callee's entry, which is updated
+// atomically when a better version of the callee is ready.
+//
+// Native code is generated by a user-provided callback, e.g. one that wraps
+// an in-process JIT. The generated code refers to the dispatch entries by
+// their addresses, so it has to run in the process of the compiler.
+class TieredCompiler {
+ public:
+  // Generate native code for the function named `name` in `module`, and
+  // return its address, or `nullptr` on failure. This is called on the
+  // threads that run compiled code, and on background threads, so it must
+  // be thread-safe. `module` has its own `llvm::LLVMContext`, and is
+  // destroyed after this returns. Calls to intrinsics in `module`, e.g.
+  // `__remill_read_memory_32`, must be bound to the user's implementations
+  // of those intrinsics.
+  using CodeGenerator = std::function<
+      NativeTrace(llvm::Module *, const std::string &)>;
+
+  TieredCompiler(InstructionLifter *inst_lifter_, TraceManager *manager_,
+                 CodeGenerator generator_,
+                 TieredCompilerOptions options_={});
+
+  // Stops the background threads. Pending re-optimizations are dropped.
+  ~TieredCompiler(void);
+
+  // Return the native code of the trace starting at `pc`, lifting and
+  // compiling the trace at the first tier if needed, or `nullptr` if the
+  // trace can't be compiled. This counts as one execution of the trace.
+  //
+  // Compiled code that calls a trace that can't be compiled calls
+  // `__remill_error` instead.
+  NativeTrace Enter(uint64_t pc);
+
+  // Number of times that the trace at `pc` was entered.
+  uint64_t ExecutionCount(uint64_t pc);
+
+  // Tier of the native code of the trace at `pc`, or zero if the trace
+  // hasn't been compiled yet.
+  unsigned Tier(uint64_t pc);
+
+ private:
+  TieredCompiler(void) = delete;
+
+  struct Entry;
+  struct Job;
+
+  // Called by `Enter`, and by compiled code, when the callee has no native
+  // code yet, or just became hot.
+  static NativeTrace EnterSlowPath(Entry *entry);
+
+  // The following methods must be called with `lock` held.
+  Entry *GetOrCreateEntry(uint64_t pc);
+  llvm::Function *GetOrLiftTrace(uint64_t pc);
+  std::unique_ptr<llvm::Module> ExtractTrace(llvm::Function *trace);
+  void RedirectTraceCalls(llvm::Module *trace_module);
+  std::unique_ptr<Job> CreateJob(Entry *entry);
+
+  // The following methods must be called without `lock` held.
+  static std::unique_ptr<llvm::Module> ReadJob(const Job &job,
+                                               llvm::LLVMContext &context);
+  NativeTrace CompileFirstTier(const Job &job);
+  void QueueSecondTier(std::unique_ptr<Job> job);
+
+  // Re-optimize queued traces.
+  void RunWorker(void);
+
+  TraceManager &manager;
+  std::unique_ptr<TraceLifter> trace_lifter;
+  const CodeGenerator generator;
+  TieredCompilerOptions options;
+
+  // Guards the lifting of traces, the module that holds them, and the
+  // dispatch entries.
+  std::mutex lock;
+
+  // Dispatch entries and lifted traces.
+  std::unordered_map<uint64_t, std::unique_ptr<Entry>> entries;
+  std::unordered_map<uint64_t, llvm::Function *> traces;
+  std::unordered_map<std::string, uint64_t> trace_addrs;
+
+  // Traces waiting to be re-optimized, and the threads that do it.
+  std::mutex queue_lock;
+  std::condition_variable queue_cond;
+  std::deque<std::unique_ptr<Job>> queue;
+  bool stopping;
+  std::vector<std::thread> workers;
+};
+
+}  // namespace remill
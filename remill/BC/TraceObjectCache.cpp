@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #include <glog/logging.h>
+
+#include <cassert>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Triple.h>
+
+#include <llvm/Config/llvm-config.h>
+
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Module.h>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include "remill/Arch/Arch.h"
+#include "remill/BC/TraceObjectCache.h"
+#include "remill/OS/FileSystem.h"
+
+namespace remill {
+namespace {
+
+static const char * const kObjectExtension = ".o";
+static const char * const kIndexFileName = "index";
+static const char * const kTempExtension = ".tmp";
+
+// Temporary files that are older than this, in seconds, were left behind by
+// writers that died. Younger ones might belong to writers that are still
+// running in other processes.
+static const uint64_t kStaleTempFileAge = 60 * 60;
+
+// Hash `val` as eight little-endian bytes, so that the fields of a key can't
+// run into each other.
+static void HashInt(llvm::MD5 &hash, uint64_t val) {
+  uint8_t bytes[8];
+  for (auto &byte : bytes) {
+    byte = static_cast<uint8_t>(val);
+    val >>= 8;
+  }
+  hash.update(llvm::ArrayRef<uint8_t>(bytes));
+}
+
+static void HashString(llvm::MD5 &hash, llvm::StringRef str) {
+  HashInt(hash, str.size());
+  hash.update(str);
+}
+
+// Keys are used as file names.
+static bool IsValidKey(const std::string &key) {
+  return !key.empty() && key.find_first_of("/\\.:") == std::string::npos;
+}
+
+static bool HasExtension(const std::string &name, const std::string &ext) {
+  return name.size() > ext.size() &&
+         !name.compare(name.size() - ext.size(), ext.size(), ext);
+}
+
+// Returns the number of seconds since the file at `path` was last modified,
+// or zero if that isn't known.
+static uint64_t FileAge(const std::string &path) {
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(path, status)) {
+    return 0;
+  }
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(4, 0)
+  const auto modified = static_cast<std::time_t>(
+      status.getLastModificationTime().toEpochTime());
+#else
+  const auto modified = std::chrono::system_clock::to_time_t(
+      status.getLastModificationTime());
+#endif
+  const auto now = std::time(nullptr);
+  return now > modified ? static_cast<uint64_t>(now - modified) : 0;
+}
+
+// Write `data` to `path`. The data is written to a uniquely named file next
+// to `path`, and then renamed, so that readers never see a partial file, and
+// so that concurrent writers, even in other processes, don't clobber each
+// other's files.
+static bool WriteFileAtomically(const std::string &path,
+                                llvm::StringRef data) {
+  int fd = -1;
+  llvm::SmallString<128> tmp_path;
+  if (llvm::sys::fs::createUniqueFile(
+          path + "-%%%%%%%%" + kTempExtension, fd, tmp_path)) {
+    // LOG(ERROR)
+    //     << "Unable to create a temporary file for " << path;
+    return false;
+  }
+
+  {
+    llvm::raw_fd_ostream file(fd, true /* shouldClose */);
+    file << data;
+    file.close();
+    if (file.has_error()) {
+      // LOG(ERROR)
+      //     << "Unable to write " << tmp_path.str().str();
+      file.clear_error();
+      RemoveFile(tmp_path.str().str());
+      return false;
+    }
+  }
+
+  if (!RenameFile(tmp_path.str().str(), path)) {
+    RemoveFile(tmp_path.str().str());
+    return false;
+  }
+  return true;
+}
+
+static std::string HashResult(llvm::MD5 &hash) {
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> str;
+  llvm::MD5::stringifyResult(result, str);
+  return str.str().str();
+}
+
+}  // namespace
+
+std::string TraceObjectKey(const Arch *arch,
+                           const llvm::TargetMachine *target_machine,
+                           uint64_t trace_pc,
+                           const std::string &trace_bytes,
+                           const std::string &semantics_version,
+                           unsigned opt_tier) {
+  llvm::MD5 hash;
+  HashString(hash, LLVM_VERSION_STRING);
+  HashString(hash, arch->Triple().str());
+  HashString(hash, arch->DataLayout().getStringRepresentation());
+  HashString(hash, semantics_version);
+  HashInt(hash, opt_tier);
+
+  // The same bitcode is compiled differently for other CPUs, or with other
+  // code generation options.
+  HashString(hash, target_machine->getTargetCPU());
+  HashString(hash, target_machine->getTargetFeatureString());
+  HashInt(hash, static_cast<uint64_t>(target_machine->getOptLevel()));
+  HashInt(hash, static_cast<uint64_t>(target_machine->getRelocationModel()));
+  HashInt(hash, static_cast<uint64_t>(target_machine->getCodeModel()));
+  const auto &options = target_machine->Options;
+  HashInt(hash, options.UnsafeFPMath);
+  HashInt(hash, options.NoInfsFPMath);
+  HashInt(hash, options.NoNaNsFPMath);
+  HashInt(hash, static_cast<uint64_t>(options.FloatABIType));
+  HashInt(hash, static_cast<uint64_t>(options.AllowFPOpFusion));
+
+  // Lifted code embeds the program counters of its instructions.
+  HashInt(hash, trace_pc);
+  HashString(hash, trace_bytes);
+  return HashResult(hash);
+}
+
+std::string SemanticsVersion(const std::string &path) {
+  auto maybe_buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+  assert(maybe_buffer);
+  // CHECK(maybe_buffer)
+  //     << "Unable to read semantics bitcode file " << path << ": "
+  //     << maybe_buffer.getError().message();
+
+  llvm::MD5 hash;
+  hash.update(maybe_buffer.get()->getBuffer());
+  return HashResult(hash);
+}
+
+TraceObjectCache::TraceObjectCache(const std::string &dir_,
+                                   uint64_t max_size_)
+    : dir(dir_),
+      max_size(max_size_),
+      size(0),
+      num_hits(0),
+      num_misses(0),
+      num_evictions(0) {
+  auto created = TryCreateDirectory(dir);
+  assert(created);
+  // CHECK(created)
+  //     << "Unable to create object cache directory " << dir;
+  (void) created;
+
+  std::lock_guard<std::mutex> locker(lock);
+  Load();
+}
+
+TraceObjectCache::~TraceObjectCache(void) {
+  Flush();
+}
+
+std::string TraceObjectCache::ObjectPath(const std::string &key) const {
+  assert(IsValidKey(key));
+  // CHECK(IsValidKey(key))
+  //     << "Invalid object cache key " << key;
+  return dir + PathSeparator() + key + kObjectExtension;
+}
+
+std::string TraceObjectCache::IndexPath(void) const {
+  return dir + PathSeparator() + kIndexFileName;
+}
+
+// Rebuild the list of cached objects. The saved order of use comes first;
+// objects that aren't in it, e.g. because the process that stored them
+// didn't exit cleanly, are treated as the least recently used. Old temporary
+// files left behind by such processes are removed.
+void TraceObjectCache::Load(void) {
+  auto add_object = [this] (const std::string &key) {
+    if (!IsValidKey(key) || object_index.count(key)) {
+      return;
+    }
+    auto path = ObjectPath(key);
+    if (!FileExists(path)) {
+      return;
+    }
+    Object object = {key, FileSize(path)};
+    object_index[key] = objects.insert(objects.end(), object);
+    size += object.size;
+  };
+
+  std::ifstream index(IndexPath());
+  std::string key;
+  while (std::getline(index, key)) {
+    if (!key.empty()) {
+      add_object(key);
+    }
+  }
+
+  const std::string ext = kObjectExtension;
+  std::vector<std::string> tmp_paths;
+  ForEachFileInDirectory(dir, [&] (const std::string &path) {
+    auto name_begin = path.find_last_of("/\\");
+    auto name = path.substr(
+        name_begin == std::string::npos ? 0 : name_begin + 1);
+    if (HasExtension(name, ext)) {
+      add_object(name.substr(0, name.size() - ext.size()));
+    } else if (HasExtension(name, kTempExtension) &&
+               FileAge(path) >= kStaleTempFileAge) {
+      tmp_paths.push_back(path);
+    }
+    return true;
+  });
+  for (const auto &tmp_path : tmp_paths) {
+    RemoveFile(tmp_path);
+  }
+
+  Evict();
+}
+
+void TraceObjectCache::Touch(ObjectList::iterator it) {
+  objects.splice(objects.begin(), objects, it);
+}
+
+// Remove least recently used objects until the cache fits in `max_size`. The
+// most recently used object is always kept.
+void TraceObjectCache::Evict(void) {
+  while (size > max_size && objects.size() > 1) {
+    const auto &object = objects.back();
+    RemoveFile(ObjectPath(object.key));
+    size -= object.size;
+    object_index.erase(object.key);
+    objects.pop_back();
+    num_evictions++;
+  }
+}
+
+void TraceObjectCache::Save(void) {
+  std::string index;
+  for (const auto &object : objects) {
+    index += object.key;
+    index += "\n";
+  }
+  WriteFileAtomically(IndexPath(), index);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> TraceObjectCache::Find(
+    const std::string &key) {
+  std::lock_guard<std::mutex> locker(lock);
+  auto index_it = object_index.find(key);
+  if (index_it == object_index.end()) {  // Also for invalid keys.
+    num_misses++;
+    return nullptr;
+  }
+
+  // Mapped, so that only the pages that the JIT reads are loaded.
+  auto it = index_it->second;
+  auto maybe_buffer = llvm::MemoryBuffer::getFile(ObjectPath(key), -1, false);
+  if (!maybe_buffer) {
+    // LOG(WARNING)
+    //     << "Unable to read cached object " << key << ": "
+    //     << maybe_buffer.getError().message();
+    size -= it->size;
+    objects.erase(it);
+    object_index.erase(index_it);
+    num_misses++;
+    return nullptr;
+  }
+
+  Touch(it);
+  num_hits++;
+  return std::move(maybe_buffer.get());
+}
+
+void TraceObjectCache::Store(const std::string &key, llvm::StringRef obj) {
+  if (!IsValidKey(key)) {
+    // LOG(WARNING)
+    //     << "Not caching object with invalid key " << key;
+    return;
+  }
+
+  std::lock_guard<std::mutex> locker(lock);
+  if (!WriteFileAtomically(ObjectPath(key), obj)) {
+    return;
+  }
+
+  auto index_it = object_index.find(key);
+  if (index_it != object_index.end()) {
+    size -= index_it->second->size;
+    objects.erase(index_it->second);
+  }
+
+  Object object = {key, obj.size()};
+  object_index[key] = objects.insert(objects.begin(), object);
+  size += object.size;
+  Evict();
+}
+
+void TraceObjectCache::Flush(void) {
+  std::lock_guard<std::mutex> locker(lock);
+  Save();
+}
+
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(3, 6)
+void TraceObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                            const llvm::MemoryBuffer *obj) {
+  Store(module->getModuleIdentifier(), obj->getBuffer());
+}
+
+llvm::MemoryBuffer *TraceObjectCache::getObject(const llvm::Module *module) {
+  return Find(module->getModuleIdentifier()).release();
+}
+#else
+void TraceObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                            llvm::MemoryBufferRef obj) {
+  Store(module->getModuleIdentifier(), obj.getBuffer());
+}
+
+std::unique_ptr<llvm::MemoryBuffer> TraceObjectCache::getObject(
+    const llvm::Module *module) {
+  return Find(module->getModuleIdentifier());
+}
+#endif
+
+uint64_t TraceObjectCache::NumHits(void) const {
+  return num_hits.load();
+}
+
+uint64_t TraceObjectCache::NumMisses(void) const {
+  return num_misses.load();
+}
+
+uint64_t TraceObjectCache::NumEvictions(void) const {
+  return num_evictions.load();
+}
+
+uint64_t TraceObjectCache::Size(void) {
+  std::lock_guard<std::mutex> locker(lock);
+  return size;
+}
+
+}  // namespace remill
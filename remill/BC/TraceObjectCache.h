@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "remill/BC/Version.h"
+
+namespace llvm {
+class Module;
+class TargetMachine;
+}  // namespace llvm
+namespace remill {
+
+class Arch;
+
+// Returns the cache key of the machine code of a lifted trace. `trace_bytes`
+// are the bytes of the instructions in the trace, and `semantics_version`
+// identifies the semantics that the trace was lifted with, e.g. the result
+// of `SemanticsVersion`. The key also covers the version of LLVM, and the
+// CPU, features and code generation options of `target_machine`, which
+// compiles the trace.
+std::string TraceObjectKey(const Arch *arch,
+                           const llvm::TargetMachine *target_machine,
+                           uint64_t trace_pc,
+                           const std::string &trace_bytes,
+                           const std::string &semantics_version,
+                           unsigned opt_tier);
+
+// Returns a hash of the contents of the semantics bitcode file at `path`.
+std::string SemanticsVersion(const std::string &path);
+
+// A persistent cache of the relocatable machine code of lifted traces, so
+// that a restarted JIT can skip code generation.
+//
+// Each object file is stored in `dir`, under its key. Cached objects are
+// memory-mapped when loaded. Temporary files that were left in `dir` long
+// ago, by processes that died while storing objects, are removed when the
+// cache is created; recent ones might still be in use by other processes.
+// Once the cached objects take more than `max_size` bytes, the least recently
+// used ones are evicted. The order of use is saved in `dir` by `Flush` and by
+// the destructor.
+//
+// The cache can be given to `llvm::ExecutionEngine::setObjectCache`. In that
+// case, the module identifier of each compiled module must be its key, e.g.
+// `module->setModuleIdentifier(TraceObjectKey(...))`.
+//
+// Only code that doesn't embed the addresses of objects in the compiling
+// process can be cached, e.g. not the code of `TieredCompiler`, which calls
+// other traces through their dispatch entries.
+class TraceObjectCache : public llvm::ObjectCache {
+ public:
+  TraceObjectCache(const std::string &dir_, uint64_t max_size_);
+
+  virtual ~TraceObjectCache(void);
+
+  // Returns the object file cached under `key`, or `nullptr` if there is
+  // none.
+  std::unique_ptr<llvm::MemoryBuffer> Find(const std::string &key);
+
+  // Cache the object file `obj` under `key`, possibly evicting other objects.
+  void Store(const std::string &key, llvm::StringRef obj);
+
+  // Save the order of use of the cached objects.
+  void Flush(void);
+
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(3, 6)
+  void notifyObjectCompiled(const llvm::Module *module,
+                            const llvm::MemoryBuffer *obj) override;
+
+  llvm::MemoryBuffer *getObject(const llvm::Module *module) override;
+#else
+  void notifyObjectCompiled(const llvm::Module *module,
+                            llvm::MemoryBufferRef obj) override;
+
+  std::unique_ptr<llvm::MemoryBuffer> getObject(
+      const llvm::Module *module) override;
+#endif
+
+  uint64_t NumHits(void) const;
+  uint64_t NumMisses(void) const;
+  uint64_t NumEvictions(void) const;
+
+  // Total size of the cached objects, in bytes.
+  uint64_t Size(void);
+
+  const std::string dir;
+  const uint64_t max_size;
+
+ private:
+  TraceObjectCache(void) = delete;
+
+  struct Object {
+    std::string key;
+    uint64_t size;
+  };
+
+  using ObjectList = std::list<Object>;
+
+  std::string ObjectPath(const std::string &key) const;
+  std::string IndexPath(void) const;
+
+  // The following methods must be called with `lock` held.
+  void Load(void);
+  void Touch(ObjectList::iterator it);
+  void Evict(void);
+  void Save(void);
+
+  std::mutex lock;
+
+  // Cached objects, from the most to the least recently used.
+  ObjectList objects;
+  std::unordered_map<std::string, ObjectList::iterator> object_index;
+  uint64_t size;
+
+  std::atomic<uint64_t> num_hits;
+  std::atomic<uint64_t> num_misses;
+  std::atomic<uint64_t> num_evictions;
+};
+
+}  // namespace remill
@@ -987,4 +987,43 @@ void MoveFunctionIntoModule(llvm::Function *func, llvm::Module *dest_module) {
   }
 }
 
+// Returns the size, in bytes, of an integer memory access intrinsic, or zero
+// if `func` is not one.
+unsigned IntegerMemoryAccessSize(llvm::Function *func, bool is_write) {
+  if (!func) {
+    return 0;
+  }
+  const auto name = func->getName().str();
+  const std::string prefix = is_write ? "__remill_write_memory_" :
+                                        "__remill_read_memory_";
+  if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix)) {
+    return 0;
+  }
+  const auto bits = name.substr(prefix.size());
+  if (bits == "8" || bits == "16" || bits == "32" || bits == "64") {
+    return static_cast<unsigned>(std::stoul(bits) / 8);
+  }
+  return 0;
+}
+
+// Returns the size, in bytes, of an integer or floating point memory access
+// intrinsic, or zero if `func` is not one.
+unsigned MemoryAccessSize(llvm::Function *func, bool is_write) {
+  if (auto size = IntegerMemoryAccessSize(func, is_write)) {
+    return size;
+  } else if (!func) {
+    return 0;
+  }
+  const auto name = func->getName().str();
+  const std::string prefix = is_write ? "__remill_write_memory_" :
+                                        "__remill_read_memory_";
+  if (name == prefix + "f32") {
+    return 4;
+  } else if (name == prefix + "f64") {
+    return 8;
+  } else {
+    return 0;
+  }
+}
+
 }  // namespace remill
@@ -212,4 +212,12 @@ std::string ModuleName(const std::unique_ptr<llvm::Module> &module);
 // Move a function from one module into another module.
 void MoveFunctionIntoModule(llvm::Function *func, llvm::Module *dest_module);
 
+// Returns the size, in bytes, of an integer memory access intrinsic, e.g.
+// `__remill_read_memory_32`, or zero if `func` is not one.
+unsigned IntegerMemoryAccessSize(llvm::Function *func, bool is_write);
+
+// Returns the size, in bytes, of an integer or floating point memory access
+// intrinsic, e.g. `__remill_write_memory_f64`, or zero if `func` is not one.
+unsigned MemoryAccessSize(llvm::Function *func, bool is_write);
+
 }  // namespace remill
@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// #include <glog/logging.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Instruction.h"
+#include "remill/BC/Lifter.h"
+#include "remill/Interp/Interpreter.h"
+
+namespace remill {
+namespace {
+
+// Maximum number of operands of an instruction.
+static constexpr size_t kMaxNumOperands = 16;
+
+// A variable in `State`, or in the scratch space.
+struct Location {
+  uint32_t offset;
+  uint32_t size;  // In bytes. Zero if there is no variable.
+  uint8_t in_state;
+};
+
+// One instruction of a decoded block.
+struct ThreadedInstruction {
+  InstructionHandler handler;
+  uint64_t pc;
+  uint64_t next_pc;
+  uint32_t first_slot;
+  uint32_t num_slots;
+};
+
+// Read the zero-extended value of the variable at `loc`. `bases` are the
+// scratch space and the `State` structure, in that order.
+static inline uint64_t ReadLocation(const Location &loc,
+                                    uint8_t * const *bases) {
+  uint64_t val = 0;
+  memcpy(&val, bases[loc.in_state] + loc.offset, loc.size);
+  return val;
+}
+
+}  // namespace
+
+// Produces the value of one operand of an instruction.
+struct Interpreter::Slot {
+  enum Kind : uint8_t {
+    kImmediate,  // `imm`.
+    kAddressOf,  // The address of `base`.
+    kValueOf,  // The value of `base`, converted to `arg_type`.
+    kAddress  // `base + index * scale + imm + segment`, masked by `mask`.
+  } kind;
+
+  char var_type;
+  char arg_type;
+  Location base;
+  Location index;
+  Location segment;
+  uint64_t imm;
+  uint64_t scale;
+  uint64_t mask;
+};
+
+// A decoded basic block.
+struct Interpreter::Block {
+  enum Exit {
+    kExitNext,  // Continue at the program counter in `State`.
+    kExitAsyncHyperCall,
+    kExitConditionalAsyncHyperCall,  // Depending on `BRANCH_TAKEN`.
+    kExitError,
+    kExitMissingCode,  // At `exit_pc`.
+    kExitUnsupported  // At `exit_pc`.
+  };
+
+  uint64_t begin;
+  uint64_t end;
+  Exit exit;
+  uint64_t exit_pc;
+  std::vector<ThreadedInstruction> insts;
+  std::vector<Slot> slots;
+};
+
+Interpreter::Interpreter(const Arch *arch_, TraceManager *manager_,
+                         const HandlerInfo *handlers_,
+                         const VariableInfo *variables_)
+    : arch(arch_),
+      manager(*manager_),
+      addr_mask(~0ULL >> (64UL - arch->address_size)),
+      pc_var(nullptr),
+      branch_taken_var(nullptr),
+      running_block(nullptr) {
+
+  for (auto handler = handlers_; handler->name; ++handler) {
+    handlers[handler->name] = handler;
+  }
+
+  uint64_t scratch_size = 0;
+  for (auto var = variables_; var->name; ++var) {
+    variables[var->name] = var;
+    if (!var->in_state) {
+      scratch_size = std::max<uint64_t>(scratch_size, var->offset + var->size);
+    }
+  }
+  scratch.resize((scratch_size + 7) / 8 + 1);
+
+  pc_var = FindVariable("PC");
+  assert(pc_var != nullptr && pc_var->in_state);
+  // CHECK(pc_var != nullptr && pc_var->in_state)
+  //     << "The program counter must be a register in `State`.";
+
+  branch_taken_var = FindVariable("BRANCH_TAKEN");
+}
+
+Interpreter::~Interpreter(void) {}
+
+const VariableInfo *Interpreter::FindVariable(const std::string &name) const {
+  auto var_it = variables.find(name);
+  if (var_it == variables.end()) {
+    return nullptr;
+  }
+  return var_it->second;
+}
+
+// Resolve `op` into a slot. Reads of the program counter are resolved to
+// `inst.pc`, which is the value that they would observe.
+bool Interpreter::TryResolveOperand(const Instruction &inst,
+                                    const Operand &op, char arg_type,
+                                    Slot *slot) const {
+  memset(slot, 0, sizeof(*slot));
+  slot->arg_type = arg_type;
+
+  auto get_location = [this] (const std::string &name, Location *loc) {
+    if (name.empty()) {
+      return true;
+    }
+    auto var = FindVariable(name);
+    if (!var || var->size > 8) {
+      return false;
+    }
+    loc->offset = var->offset;
+    loc->size = var->size;
+    loc->in_state = var->in_state;
+    return true;
+  };
+
+  switch (op.type) {
+    case Operand::kTypeRegister:
+      if ('p' == arg_type) {
+        auto var = FindVariable(op.reg.name);
+        if (!var) {
+          return false;
+        }
+        slot->kind = Slot::kAddressOf;
+        slot->base.offset = var->offset;
+        slot->base.in_state = var->in_state;
+        return true;
+
+      } else if ("PC" == op.reg.name) {
+        slot->kind = Slot::kImmediate;
+        slot->imm = inst.pc;
+        return true;
+
+      } else {
+        auto var = FindVariable(op.reg.name);
+        if (!var || 'v' == var->type || 'p' == var->type ||
+            !get_location(op.reg.name, &(slot->base))) {
+          return false;
+        }
+        slot->kind = Slot::kValueOf;
+        slot->var_type = var->type;
+        return true;
+      }
+
+    case Operand::kTypeImmediate:
+      slot->kind = Slot::kImmediate;
+      slot->imm = op.imm.val;
+      return 'p' != arg_type;
+
+    case Operand::kTypeAddress: {
+      const auto &addr = op.addr;
+      slot->kind = Slot::kAddress;
+      slot->imm = static_cast<uint64_t>(addr.displacement);
+      slot->scale = static_cast<uint64_t>(addr.scale);
+      slot->mask = addr_mask;
+      if (addr.address_size < arch->address_size) {
+        slot->mask = ~0ULL >> (64UL - addr.address_size);
+      }
+      if ("PC" == addr.base_reg.name) {
+        slot->imm += inst.pc;
+      } else if (!get_location(addr.base_reg.name, &(slot->base))) {
+        return false;
+      }
+      return 'p' != arg_type &&
+             get_location(addr.index_reg.name, &(slot->index)) &&
+             get_location(addr.segment_base_reg.name, &(slot->segment));
+    }
+
+    // E.g. AArch64 shifted and extended registers.
+    default:
+      return false;
+  }
+}
+
+// Decode the block starting at `pc` into threaded code. The block ends after
+// the first control-flow instruction, or before the first instruction that
+// can't be executed.
+const Interpreter::Block *Interpreter::GetOrDecodeBlock(uint64_t pc) {
+  auto &block = blocks[pc];
+  if (block) {
+    return block.get();
+  }
+
+  block.reset(new Block);
+  block->begin = pc;
+  block->end = pc;
+  block->exit = Block::kExitNext;
+  block->exit_pc = pc;
+
+  const auto max_inst_bytes = arch->MaxInstructionSize();
+  std::string inst_bytes;
+  Instruction inst;
+
+  for (auto inst_pc = pc; ; inst_pc = inst.next_pc) {
+    inst_bytes.clear();
+    for (uint64_t i = 0; i < max_inst_bytes; ++i) {
+      const auto byte_addr = (inst_pc + i) & addr_mask;
+      if (byte_addr < inst_pc) {
+        break;  // 32- or 64-bit address overflow.
+      }
+      uint8_t byte = 0;
+      if (!manager.TryReadExecutableByte(byte_addr, &byte)) {
+        break;
+      }
+      inst_bytes.push_back(static_cast<char>(byte));
+    }
+
+    block->exit_pc = inst_pc;
+    if (inst_bytes.empty()) {
+      block->exit = Block::kExitMissingCode;
+      break;
+    }
+
+    inst.Reset();
+    (void) arch->DecodeInstruction(inst_pc, inst_bytes, inst);
+
+    block->exit = Block::kExitUnsupported;
+    if (!inst.IsValid()) {
+      break;
+    }
+
+    auto handler_it = handlers.find(inst.function);
+    if (handler_it == handlers.end()) {
+      break;
+    }
+
+    const auto handler = handler_it->second;
+    const auto num_ops = inst.operands.size();
+    if (num_ops > kMaxNumOperands || num_ops != strlen(handler->arg_types)) {
+      break;
+    }
+
+    ThreadedInstruction threaded_inst = {};
+    threaded_inst.handler = handler->handler;
+    threaded_inst.pc = inst.pc;
+    threaded_inst.next_pc = inst.next_pc;
+    threaded_inst.first_slot = static_cast<uint32_t>(block->slots.size());
+    threaded_inst.num_slots = static_cast<uint32_t>(num_ops);
+
+    auto resolved = true;
+    for (size_t i = 0; resolved && i < num_ops; ++i) {
+      Slot slot;
+      resolved = TryResolveOperand(
+          inst, inst.operands[i], handler->arg_types[i], &slot);
+      block->slots.push_back(slot);
+    }
+
+    if (!resolved) {
+      block->slots.resize(threaded_inst.first_slot);
+      break;
+    }
+
+    block->insts.push_back(threaded_inst);
+    block->end = inst.next_pc;
+    block->exit = Block::kExitNext;
+
+    switch (inst.category) {
+      case Instruction::kCategoryNormal:
+      case Instruction::kCategoryNoOp:
+        continue;
+      case Instruction::kCategoryError:
+        block->exit = Block::kExitError;
+        break;
+      case Instruction::kCategoryAsyncHyperCall:
+        block->exit = Block::kExitAsyncHyperCall;
+        break;
+      case Instruction::kCategoryConditionalAsyncHyperCall:
+        block->exit = Block::kExitConditionalAsyncHyperCall;
+        break;
+      default:
+        break;
+    }
+    break;
+  }
+
+  return block.get();
+}
+
+InterpreterStatus Interpreter::Run(void *state, Memory **memory,
+                                   uint64_t max_insts) {
+  uint8_t * const bases[] = {
+      reinterpret_cast<uint8_t *>(scratch.data()),
+      reinterpret_cast<uint8_t *>(state)};
+
+  uint8_t * const pc_ptr = bases[1] + pc_var->offset;
+  auto write_pc = [=] (uint64_t pc) {
+    memcpy(pc_ptr, &pc, pc_var->size);
+  };
+
+  uint64_t args[kMaxNumOperands];
+  uint64_t num_insts = 0;
+
+  while (true) {
+    uint64_t pc = 0;
+    memcpy(&pc, pc_ptr, pc_var->size);
+
+    dead_blocks.clear();
+    const auto block = GetOrDecodeBlock(pc);
+    const auto slots = block->slots.data();
+    running_block = block;
+
+    auto stale = false;
+    for (const auto &inst : block->insts) {
+      if (num_insts >= max_insts) {
+        write_pc(inst.pc);
+        return kInterpreterStepLimit;
+      }
+
+      // The last instruction overwrote the code of this block, so the rest
+      // of it might be stale. The program counter is already at the next
+      // instruction.
+      if (!running_block) {
+        stale = true;
+        break;
+      }
+
+      for (uint32_t i = 0; i < inst.num_slots; ++i) {
+        const auto &slot = slots[inst.first_slot + i];
+        switch (slot.kind) {
+          case Slot::kImmediate:
+            args[i] = slot.imm;
+            break;
+
+          case Slot::kAddressOf:
+            args[i] = reinterpret_cast<uintptr_t>(
+                bases[slot.base.in_state] + slot.base.offset);
+            break;
+
+          case Slot::kValueOf:
+            args[i] = ReadLocation(slot.base, bases);
+            if ('f' == slot.var_type && 'd' == slot.arg_type) {
+              float f = 0;
+              double d = 0;
+              memcpy(&f, &(args[i]), sizeof(f));
+              d = f;
+              memcpy(&(args[i]), &d, sizeof(d));
+            } else if ('d' == slot.var_type && 'f' == slot.arg_type) {
+              double d = 0;
+              float f = 0;
+              memcpy(&d, &(args[i]), sizeof(d));
+              f = static_cast<float>(d);
+              args[i] = 0;
+              memcpy(&(args[i]), &f, sizeof(f));
+            }
+            break;
+
+          case Slot::kAddress:
+            args[i] = (ReadLocation(slot.base, bases) +
+                       ReadLocation(slot.index, bases) * slot.scale +
+                       slot.imm +
+                       ReadLocation(slot.segment, bases)) & slot.mask;
+            break;
+        }
+      }
+
+      // Control-flow instructions update the program counter in their
+      // semantics.
+      write_pc(inst.next_pc);
+      *memory = inst.handler(*memory, state, args);
+      num_insts++;
+    }
+
+    if (stale) {
+      continue;
+    }
+
+    switch (block->exit) {
+      case Block::kExitNext:
+        break;
+
+      case Block::kExitAsyncHyperCall:
+        return kInterpreterAsyncHyperCall;
+
+      case Block::kExitConditionalAsyncHyperCall:
+        if (branch_taken_var && bases[branch_taken_var->in_state][
+                branch_taken_var->offset]) {
+          return kInterpreterAsyncHyperCall;
+        }
+        break;
+
+      case Block::kExitError:
+        return kInterpreterError;
+
+      case Block::kExitMissingCode:
+        write_pc(block->exit_pc);
+        return kInterpreterMissingCode;
+
+      case Block::kExitUnsupported:
+        write_pc(block->exit_pc);
+        return kInterpreterUnsupportedInstruction;
+    }
+  }
+}
+
+// Forget the decoded blocks that overlap `[begin, end)`. The block being run
+// is kept alive until `Run` leaves it.
+void Interpreter::InvalidateCode(uint64_t begin, uint64_t end) {
+  for (auto block_it = blocks.begin(); block_it != blocks.end(); ) {
+    auto &block = block_it->second;
+    if (block->begin < end &&
+        std::max(block->end, block->exit_pc + 1) > begin) {
+      if (block.get() == running_block) {
+        running_block = nullptr;
+        dead_blocks.push_back(std::move(block));
+      }
+      block_it = blocks.erase(block_it);
+    } else {
+      ++block_it;
+    }
+  }
+}
+
+}  // namespace remill
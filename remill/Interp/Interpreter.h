@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Memory;
+
+namespace remill {
+
+class Arch;
+class Instruction;
+class Operand;
+class TraceManager;
+
+// An instruction semantics function, compiled ahead of time by
+// `remill-gen-handlers`. The operands of the instruction are passed in
+// `args`, one 64-bit slot per operand.
+using InstructionHandler = Memory *(*)(Memory *, void *, const uint64_t *);
+
+// Type codes of operands and of variables:
+//
+//    `p`:            Pointer, i.e. the address of a register.
+//    `b`, `h`, `w`:  8-, 16- and 32-bit integers.
+//    `q`:            64-bit integer.
+//    `f`, `d`:       32- and 64-bit floating point values.
+//    `v`:            Anything else, e.g. vectors. Variables of this type can
+//                    only be passed by address.
+
+// Describes the handler of one instruction, e.g. `ADD_GPRv_IMMz_32`.
+struct HandlerInfo {
+  const char *name;
+  InstructionHandler handler;
+  const char *arg_types;  // One type code per operand.
+};
+
+// Describes a variable of `__remill_basic_block` that instruction operands
+// can name, e.g. a register, or `BRANCH_TAKEN`.
+struct VariableInfo {
+  const char *name;
+  uint32_t offset;  // Byte offset in `State`, or in the scratch space.
+  uint32_t size;  // In bytes.
+  uint8_t in_state;
+  char type;  // Type code.
+};
+
+enum InterpreterStatus {
+  // Executed the maximum number of instructions.
+  kInterpreterStepLimit,
+
+  // Executed an instruction that asks for the help of the OS, e.g.
+  // `syscall`. The program counter is after the instruction.
+  kInterpreterAsyncHyperCall,
+
+  // Executed an instruction whose semantics raise an error.
+  kInterpreterError,
+
+  // The program counter is not in executable memory.
+  kInterpreterMissingCode,
+
+  // The program counter is at an instruction that can't be decoded, or that
+  // has no handler. The instruction can still be lifted.
+  kInterpreterUnsupportedInstruction
+};
+
+// Executes machine code without lifting it, by calling the ahead-of-time
+// compiled handlers of its instructions one after the other.
+//
+// Basic blocks are decoded once, into threaded code: an array of handlers,
+// each with the operands of its instruction resolved as far as possible,
+// e.g. to the offsets of registers in `State`. Nothing calls into LLVM at
+// run time, so the interpreter starts right away, and is cheap to use on
+// code that runs once.
+//
+// The handlers call the same intrinsics, e.g. `__remill_read_memory_32`, as
+// lifted code. The user of the interpreter provides them. Instructions run
+// one at a time, so atomic read-modify-write instructions aren't bracketed
+// by `__remill_atomic_begin` and `__remill_atomic_end`.
+class Interpreter {
+ public:
+  // The interpreter reads code through `manager_`. `handlers_` and
+  // `variables_` are null-terminated tables, normally
+  // `__remill_interp_handlers` and `__remill_interp_variables`.
+  Interpreter(const Arch *arch_, TraceManager *manager_,
+              const HandlerInfo *handlers_, const VariableInfo *variables_);
+
+  ~Interpreter(void);
+
+  // Execute up to `max_insts` instructions, starting at the program counter
+  // in `state`. Returns why the interpreter stopped. On return, the program
+  // counter in `state` is at the next instruction to execute, and `*memory`
+  // is the latest memory pointer.
+  InterpreterStatus Run(void *state, Memory **memory,
+                        uint64_t max_insts=~0ULL);
+
+  // Forget the decoded code that overlaps `[begin, end)`, e.g. because the
+  // program wrote to it. This can be called by the intrinsics that handlers
+  // call, while `Run` executes the code. In that case, `Run` continues at the
+  // instruction following the one that invalidated the code.
+  void InvalidateCode(uint64_t begin, uint64_t end);
+
+  const Arch * const arch;
+
+ private:
+  Interpreter(void) = delete;
+
+  struct Block;
+  struct Slot;
+
+  // Return the threaded code of the block starting at `pc`, decoding it if
+  // needed.
+  const Block *GetOrDecodeBlock(uint64_t pc);
+
+  // Resolve `op` into a slot that produces an argument of type `arg_type`.
+  bool TryResolveOperand(const Instruction &inst, const Operand &op,
+                         char arg_type, Slot *slot) const;
+
+  const VariableInfo *FindVariable(const std::string &name) const;
+
+  TraceManager &manager;
+  const uint64_t addr_mask;
+
+  std::unordered_map<std::string, const HandlerInfo *> handlers;
+  std::unordered_map<std::string, const VariableInfo *> variables;
+
+  // The `PC` and `BRANCH_TAKEN` variables, and the scratch space of the
+  // variables that aren't in `State`.
+  const VariableInfo *pc_var;
+  const VariableInfo *branch_taken_var;
+  std::vector<uint64_t> scratch;
+
+  // Decoded blocks, by their addresses.
+  std::unordered_map<uint64_t, std::unique_ptr<Block>> blocks;
+
+  // The block that `Run` is executing, or `nullptr` if it was invalidated.
+  // Invalidated blocks are only freed once `Run` is done with them.
+  const Block *running_block;
+  std::vector<std::unique_ptr<Block>> dead_blocks;
+};
+
+}  // namespace remill
+
+// Tables generated by `remill-gen-handlers`, and defined by the
+// `remill-handlers` library.
+extern "C" const remill::HandlerInfo __remill_interp_handlers[];
+extern "C" const remill::VariableInfo __remill_interp_variables[];
@@ -98,8 +98,8 @@ osx_build() {
 }
 
 common_build() {
-  if [ $# -ne 2 ] ; then
-    printf "Usage:\n\tcommon_build <os_version> <llvm_version>\n\nllvm_version: 35, 40, ...\n"
+  if [ $# -lt 2 ] || [ $# -gt 3 ] ; then
+    printf "Usage:\n\tcommon_build <os_version> <llvm_version> [cmake_options]\n\nllvm_version: 35, 40, ...\n"
     return 1
   fi
 
@@ -107,9 +107,10 @@ common_build() {
   local log_file=`mktemp`
   local os_version="$1"
   local llvm_version="$2"
+  local cmake_options="$3"
 
   printf "#\n"
-  printf "# Running CI tests for LLVM version ${llvm_version}...\n"
+  printf "# Running CI tests for LLVM version ${llvm_version} ${cmake_options}...\n"
   printf "#\n\n"
 
   printf " > Cleaning up the environment variables...\n"
@@ -194,7 +195,7 @@ common_build() {
     return 1
   fi
 
-  ( cd build && cmake -DCMAKE_VERBOSE_MAKEFILE=True .. ) > "${log_file}" 2>&1
+  ( cd build && cmake -DCMAKE_VERBOSE_MAKEFILE=True ${cmake_options} .. ) > "${log_file}" 2>&1
   if [ $? -ne 0 ] ; then
     printf " x Failed to generate the project. Error output follows:\n"
     printf "===\n"
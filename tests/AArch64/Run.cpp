@@ -17,6 +17,7 @@
 #define _XOPEN_SOURCE
 
 #include <cfenv>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
@@ -45,6 +46,11 @@
 DECLARE_string(arch);
 DECLARE_string(os);
 
+DEFINE_uint64(simd_throughput_iterations, 0,
+              "Number of times to run each Advanced SIMD test case when "
+              "comparing the throughput of native and lifted code. The "
+              "comparison is skipped if this is zero.");
+
 namespace {
 
 struct alignas(128) Stack {
@@ -284,6 +290,22 @@ Memory *__remill_async_hyper_call(AArch64State &, addr_t, Memory *) {
   abort();
 }
 
+static std::vector<addr_t> gShadowStack;
+
+Memory *__remill_shadow_stack_push(AArch64State &, addr_t ret_addr,
+                                   Memory *memory) {
+  gShadowStack.push_back(ret_addr);
+  return memory;
+}
+
+bool __remill_shadow_stack_pop(AArch64State &, addr_t ret_addr, Memory *) {
+  if (gShadowStack.empty() || gShadowStack.back() != ret_addr) {
+    return false;
+  }
+  gShadowStack.pop_back();
+  return true;
+}
+
 uint8_t __remill_undefined_8(void) {
   return 0;
 }
@@ -488,6 +510,65 @@ TEST_P(InstrTest, SemanticsMatchNative) {
   }
 }
 
+// Compare how long the native and lifted versions of an Advanced SIMD test
+// case take to execute. This is a rough measure of the quality of the code
+// that the SIMD semantics lift into, e.g. whether element-wise operations
+// turn into vector instructions or into one scalar operation per element.
+TEST_P(InstrTest, SIMDThroughput) {
+  auto info = GetParam();
+  if (!FLAGS_simd_throughput_iterations ||
+      (!strstr(info->test_name, "ASIMD") &&
+       !strstr(info->test_name, "ASISD"))) {
+    return;
+  }
+
+  if (sigsetjmp(gUnsupportedInstrBuf, true)) {
+    return;
+  }
+
+  const auto args = info->args_begin;
+  const auto num_iters = FLAGS_simd_throughput_iterations;
+  auto lifted_func = gTranslatedFuncs[info->test_begin];
+  auto lifted_state = reinterpret_cast<AArch64State *>(&gLiftedState);
+
+  gTestToRun = info->test_begin;
+  gStackSwitcher = &(gLiftedStack._redzone2[0]);
+
+  auto native_begin = std::chrono::steady_clock::now();
+  if (!sigsetjmp(gJmpBuf, true)) {
+    gInNativeTest = true;
+    for (uint64_t i = 0; i < num_iters; ++i) {
+      InvokeTestCase(args[0], args[1], args[2]);
+    }
+  } else {
+    return;
+  }
+  auto native_end = std::chrono::steady_clock::now();
+
+  auto lifted_begin = std::chrono::steady_clock::now();
+  if (!sigsetjmp(gJmpBuf, true)) {
+    std::fesetenv(FE_DFL_ENV);
+    gInNativeTest = false;
+    for (uint64_t i = 0; i < num_iters; ++i) {
+      lifted_state->gpr.pc.aword = static_cast<addr_t>(
+          info->test_begin + 4 + 4);
+      (void) lifted_func(*lifted_state, lifted_state->gpr.pc.aword, nullptr);
+    }
+  } else {
+    return;
+  }
+  auto lifted_end = std::chrono::steady_clock::now();
+
+  auto native_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      native_end - native_begin).count();
+  auto lifted_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      lifted_end - lifted_begin).count();
+
+  LOG(INFO)
+      << info->test_name << ": native " << (native_ns / num_iters)
+      << "ns/iter, lifted " << (lifted_ns / num_iters) << "ns/iter";
+}
+
 INSTANTIATE_TEST_CASE_P(
     GeneralInstrTest,
     InstrTest,
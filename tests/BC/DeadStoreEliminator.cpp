@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+
+#include "remill/BC/DeadStoreEliminator.h"
+
+#include "tests/BC/Lift.h"
+
+namespace {
+
+class DeadStoreTest : public test::LiftTest {
+ protected:
+  // Lift the trace at `addr`, as an internal function that nothing in the
+  // module calls, e.g. like a trace extracted into its own module to be
+  // compiled, and then remove its dead stores.
+  llvm::Function *LiftAndRemoveDeadStores(uint64_t addr) {
+    auto func = Lift(addr);
+    if (func) {
+      func->setLinkage(llvm::GlobalValue::InternalLinkage);
+      InlineSemantics(func);
+      RemoveDeadStores();
+    }
+    return func;
+  }
+
+  void RemoveDeadStores(void) {
+    remill::RemoveDeadStores(module.get(),
+                             remill::BasicBlockFunction(module.get()),
+                             remill::StateSlots(module.get()));
+  }
+};
+
+}  // namespace
+
+// The caller of a trace without callers in the module is unknown, so the
+// return value in `RAX` must survive.
+//
+// mov eax, 0x1234; ret
+TEST_F(DeadStoreTest, ReturnValueSurvives) {
+  manager.AddCode(0x1000, std::string("\xb8\x34\x12\x00\x00\xc3", 6));
+  auto func = LiftAndRemoveDeadStores(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountStoresOf(func, 0x1234));
+}
+
+// mov eax, 0x1234; mov eax, 0x5678; ret
+TEST_F(DeadStoreTest, OverwrittenValueDies) {
+  manager.AddCode(
+      0x1000, std::string("\xb8\x34\x12\x00\x00\xb8\x78\x56\x00\x00\xc3", 11));
+  auto func = LiftAndRemoveDeadStores(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountStoresOf(func, 0x1234));
+  EXPECT_EQ(1U, CountStoresOf(func, 0x5678));
+}
+
+// Every slot is live when returning to an unknown caller.
+TEST_F(DeadStoreTest, AnnotatesLiveOut) {
+  manager.AddCode(0x1000, std::string("\xb8\x34\x12\x00\x00\xc3", 6));
+  auto func = LiftAndRemoveDeadStores(0x1000);
+  ASSERT_NE(nullptr, func);
+
+  auto live_out = func->getMetadata("remill.live_out");
+  ASSERT_NE(nullptr, live_out);
+
+  auto num_slots = 0U;
+  const auto slots = remill::StateSlots(module.get());
+  for (uint64_t i = 0; i < slots.size(); ++i) {
+    if (slots[i].offset == i) {
+      num_slots++;
+    }
+  }
+  EXPECT_EQ(num_slots, live_out->getNumOperands());
+}
+
+// Only the registers that the function reads are read on entry, even though
+// every slot is live on entry.
+TEST_F(DeadStoreTest, AnnotatesReadsOnEntry) {
+  manager.AddCode(0x1000, "\x48\x89\xf8\xc3");  // mov rax, rdi; ret
+  auto func = LiftAndRemoveDeadStores(0x1000);
+  ASSERT_NE(nullptr, func);
+
+  auto reads = func->getMetadata("remill.read_on_entry");
+  ASSERT_NE(nullptr, reads);
+
+  std::vector<uint64_t> offsets;
+  for (const auto &op : reads->operands()) {
+    auto md = llvm::cast<llvm::ConstantAsMetadata>(op);
+    offsets.push_back(
+        llvm::cast<llvm::ConstantInt>(md->getValue())->getZExtValue());
+  }
+  auto is_read = [&offsets] (const remill::Register *reg) {
+    return offsets.end() != std::find(offsets.begin(), offsets.end(),
+                                      reg->offset);
+  };
+  EXPECT_TRUE(is_read(arch->RegisterByName("RDI")));
+  EXPECT_TRUE(is_read(arch->RegisterByName("RSP")));
+  EXPECT_FALSE(is_read(arch->RegisterByName("RSI")));
+  EXPECT_FALSE(is_read(arch->RegisterByName("RAX")));
+}
+
+// A call that is passed a pointer to a whole register, e.g. to `XMM0`, reads
+// every slot of that register, and not just its first one, so the store to
+// the upper half of `XMM0` before the call survives.
+TEST_F(DeadStoreTest, CallReadsWholeRegister) {
+  manager.AddCode(0x1000, "\xc3");  // ret
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  func->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+  auto xmm0 = arch->RegisterByName("XMM0");
+  ASSERT_NE(nullptr, xmm0);
+
+  auto &entry_block = func->getEntryBlock();
+  llvm::IRBuilder<> ir(&entry_block, entry_block.getFirstInsertionPt());
+  auto byte_ptr = ir.CreateBitCast(remill::LoadStatePointer(func),
+                                   llvm::Type::getInt8PtrTy(*context));
+  auto reg_type = llvm::ArrayType::get(ir.getInt8Ty(), xmm0->size);
+  auto reg_ptr = ir.CreateBitCast(
+      ir.CreateConstInBoundsGEP1_64(byte_ptr, xmm0->offset),
+      llvm::PointerType::get(reg_type, 0));
+  auto upper_ptr = ir.CreateBitCast(
+      ir.CreateConstInBoundsGEP1_64(byte_ptr, xmm0->offset + 8),
+      llvm::PointerType::get(ir.getInt64Ty(), 0));
+
+  llvm::Type *use_arg_types[] = {reg_ptr->getType()};
+  auto use_func = llvm::Function::Create(
+      llvm::FunctionType::get(ir.getVoidTy(), use_arg_types, false),
+      llvm::GlobalValue::ExternalLinkage, "use_xmm0", module.get());
+
+  ir.CreateStore(ir.getInt64(0x1234), upper_ptr);
+  ir.CreateCall(use_func, {reg_ptr});
+  ir.CreateStore(ir.getInt64(0x5678), upper_ptr);
+
+  RemoveDeadStores();
+  EXPECT_EQ(1U, CountStoresOf(func, 0x1234));
+  EXPECT_EQ(1U, CountStoresOf(func, 0x5678));
+}
+
+// Modules loaded from the same semantics file have the same identifier, but
+// what was learned about the functions of one says nothing about the other.
+//
+// mov eax, 0x1234; mov eax, 0x5678; ret
+TEST_F(DeadStoreTest, KeepsModulesApart) {
+  const std::string code(
+      "\xb8\x34\x12\x00\x00\xb8\x78\x56\x00\x00\xc3", 11);
+  manager.AddCode(0x1000, code);
+  ASSERT_NE(nullptr, LiftAndRemoveDeadStores(0x1000));
+
+  std::unique_ptr<llvm::Module> other_module(
+      remill::LoadArchSemantics(arch, context.get()));
+  ASSERT_EQ(module->getModuleIdentifier(),
+            other_module->getModuleIdentifier());
+
+  remill::IntrinsicTable other_intrinsics(other_module.get());
+  remill::InstructionLifter other_inst_lifter(arch, other_intrinsics);
+  test::TraceManager other_manager;
+  other_manager.AddCode(0x1000, code);
+  remill::TraceLifter trace_lifter(other_inst_lifter, other_manager);
+  ASSERT_TRUE(trace_lifter.Lift(0x1000));
+
+  auto func = other_manager.GetLiftedTraceDefinition(0x1000);
+  ASSERT_NE(nullptr, func);
+  func->setLinkage(llvm::GlobalValue::InternalLinkage);
+  InlineSemantics(func);
+  remill::RemoveDeadStores(other_module.get(),
+                           remill::BasicBlockFunction(other_module.get()),
+                           remill::StateSlots(other_module.get()));
+  remill::ForgetDeadStoreSummaries(other_module.get());
+
+  EXPECT_NE(nullptr, func->getMetadata("remill.live_in"));
+  EXPECT_EQ(0U, CountStoresOf(func, 0x1234));
+  EXPECT_EQ(1U, CountStoresOf(func, 0x5678));
+}
+
+// Dead store elimination on a large lifted function that shuffles values
+// between general purpose registers. This is also a benchmark: how long the
+// analysis took is recorded in the `dse_ms` property of the test, which is
+// in the XML report of `--gtest_output=xml`.
+TEST_F(DeadStoreTest, HandlesLargeFunctions) {
+  static const char * const kRegs[] = {
+      "RAX", "RBX", "RCX", "RDX", "RSI", "RDI"};
+  const auto num_regs = sizeof(kRegs) / sizeof(kRegs[0]);
+  const auto max_insts = 20000UL;
+
+  auto func = remill::DeclareLiftedFunction(module.get(), "sub_large");
+  remill::CloneBlockFunctionInto(func);
+
+  std::vector<llvm::Value *> reg_ptrs;
+  for (auto reg : kRegs) {
+    reg_ptrs.push_back(remill::FindVarInFunction(func, reg));
+  }
+
+  auto block = &(func->front());
+  auto num_insts = 0UL;
+  for (auto i = 0UL; num_insts < max_insts; ++i) {
+
+    // Split the function into blocks of a realistic size.
+    if (!(i % 16)) {
+      auto next_block = llvm::BasicBlock::Create(*context, "", func);
+      llvm::BranchInst::Create(next_block, block);
+      block = next_block;
+      num_insts += 1;
+    }
+
+    llvm::IRBuilder<> ir(block);
+    auto src = ir.CreateLoad(reg_ptrs[i % num_regs]);
+    auto val = ir.CreateAdd(src, llvm::ConstantInt::get(src->getType(), i));
+    ir.CreateStore(val, reg_ptrs[(i * 7 + 3) % num_regs]);
+    num_insts += 3;
+  }
+  remill::AddTerminatingTailCall(block, intrinsics.missing_block);
+
+  const auto start = std::chrono::steady_clock::now();
+  RemoveDeadStores();
+  const auto end = std::chrono::steady_clock::now();
+
+  auto num_remaining_insts = 0UL;
+  for (auto &func_block : *func) {
+    num_remaining_insts += func_block.size();
+  }
+
+  const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      end - start).count();
+  RecordProperty("num_insts", static_cast<int>(num_insts));
+  RecordProperty("num_remaining_insts", static_cast<int>(num_remaining_insts));
+  RecordProperty("dse_ms", static_cast<int>(ms));
+
+  EXPECT_NE(nullptr, func->getMetadata("remill.live_in"));
+  EXPECT_LE(num_remaining_insts, num_insts + 1);
+}
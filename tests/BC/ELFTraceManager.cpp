@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+
+#include <llvm/IR/Function.h>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Instruction.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/ELFTraceManager.h"
+
+#include "tests/BC/Lift.h"
+
+namespace {
+
+// Layout of the ELF fixtures. Everything is in one loadable segment, which is
+// loaded at `kLoadAddr`, so file offsets are addresses minus `kLoadAddr`.
+enum : uint64_t {
+  kLoadAddr = 0x10000,
+  kProgramHeadersOffset = 64,
+  kDynamicOffset = 0x100,
+  kSymTabOffset = 0x180,
+  kStrTabOffset = 0x1c0,
+  kRelaOffset = 0x1d0,
+  kCodeOffset = 0x200,
+  kStubOffset = 0x210,
+  kSlotOffset = 0x220,
+  kFileSize = 0x230,
+
+  kCodeAddr = kLoadAddr + kCodeOffset,
+  kStubAddr = kLoadAddr + kStubOffset,
+  kSlotAddr = kLoadAddr + kSlotOffset,
+
+  // The only slot comes after the three reserved words of `.got.plt`.
+  kGotPltAddr = kSlotAddr - 12,
+
+  // Layout of the statically linked ELF fixture. Its executable segment is
+  // right before its read-only segment, and its writable segment is further
+  // away, and is mostly `.bss`.
+  kSegmentedELFTextOffset = 0x200,
+  kSegmentedELFReadOnlyOffset = 0x210,
+  kSegmentedELFDataOffset = 0x220,
+  kSegmentedELFTextAddr = kLoadAddr + 0x200,
+  kSegmentedELFReadOnlyAddr = kLoadAddr + 0x210,
+  kSegmentedELFDataAddr = kLoadAddr + 0x1220,
+  kSegmentedELFBSSAddr = kSegmentedELFDataAddr + 0x8,
+  kSegmentedELFEndAddr = kSegmentedELFDataAddr + 0x18,
+  kSegmentedELFTextFill = 0x00,
+  kSegmentedELFReadOnlyFill = 0x40,
+  kSegmentedELFDataFill = 0x80,
+
+  kTypeExec = 2,
+  kTypeShared = 3,
+
+  kBindLocal = 0,
+  kBindGlobal = 1,
+  kTypeFunc = 2,
+  kTypeGNUIFunc = 10,
+  kVisibilityDefault = 0,
+  kVisibilityProtected = 3
+};
+
+// Builds a minimal amd64 or x86 ELF, whose only GOT slot is filled in by a
+// `R_X86_64_JUMP_SLOT` or `R_386_JMP_SLOT` relocation against the function
+// `foo`, which the ELF defines. The PLT stub at `kStubAddr` jumps through the
+// slot.
+class ELFBuilder {
+ public:
+  explicit ELFBuilder(unsigned word_size_=8)
+      : word_size(word_size_),
+        phentsize(8 == word_size_ ? 56 : 32),
+        bytes(kFileSize, 0) {}
+
+  std::string Build(uint64_t elf_type, uint64_t sym_bind, uint64_t sym_type,
+                    uint64_t sym_visibility) {
+    const auto is_64 = 8 == word_size;
+    const auto ws = word_size;
+
+    // ELF header.
+    Write(0, 4, 0x464c457f);  // "\x7fELF".
+    Write(4, 1, is_64 ? 2 : 1);  // 64- or 32-bit.
+    Write(5, 1, 1);  // Little-endian.
+    Write(6, 1, 1);  // Version.
+    Write(16, 2, elf_type);
+    Write(18, 2, is_64 ? 62 : 3);  // x86-64 or x86.
+    Write(20, 4, 1);
+    Write(24, ws, kCodeAddr);  // Entrypoint.
+    Write(24 + ws, ws, kProgramHeadersOffset);
+    Write(40 + 3 * (ws - 4), 2, is_64 ? 64 : 52);
+    Write(42 + 3 * (ws - 4), 2, phentsize);
+    Write(44 + 3 * (ws - 4), 2, 2);
+
+    // `PT_LOAD` of the whole file, readable, writable and executable, and
+    // `PT_DYNAMIC`.
+    const auto dyn_size = 7 * 2 * ws;
+    WriteProgramHeader(kProgramHeadersOffset, 1, 7, 0, kLoadAddr, kFileSize);
+    WriteProgramHeader(kProgramHeadersOffset + phentsize, 2, 6,
+                       kDynamicOffset, kLoadAddr + kDynamicOffset, dyn_size);
+
+    // Dynamic section.
+    uint64_t dyn = kDynamicOffset;
+    const uint64_t tags[][2] = {
+      {6, kLoadAddr + kSymTabOffset},  // `DT_SYMTAB`.
+      {5, kLoadAddr + kStrTabOffset},  // `DT_STRTAB`.
+      {3, kGotPltAddr},  // `DT_PLTGOT`.
+      {23, kLoadAddr + kRelaOffset},  // `DT_JMPREL`.
+      {2, is_64 ? 24U : 8U},  // `DT_PLTRELSZ`.
+      {20, is_64 ? 7U : 17U},  // `DT_PLTREL` is `DT_RELA` or `DT_REL`.
+    };
+    for (const auto &tag : tags) {
+      Write(dyn, ws, tag[0]);
+      Write(dyn + ws, ws, tag[1]);
+      dyn += 2 * ws;
+    }
+
+    // Symbol 1 is `foo`, which is the code at `kCodeAddr`.
+    if (is_64) {
+      uint64_t sym = kSymTabOffset + 24;
+      Write(sym, 4, 1);
+      Write(sym + 4, 1, (sym_bind << 4) | sym_type);
+      Write(sym + 5, 1, sym_visibility);
+      Write(sym + 6, 2, 1);
+      Write(sym + 8, 8, kCodeAddr);
+      Write(sym + 16, 8, 1);
+    } else {
+      uint64_t sym = kSymTabOffset + 16;
+      Write(sym, 4, 1);
+      Write(sym + 4, 4, kCodeAddr);
+      Write(sym + 8, 4, 1);
+      Write(sym + 12, 1, (sym_bind << 4) | sym_type);
+      Write(sym + 13, 1, sym_visibility);
+      Write(sym + 14, 2, 1);
+    }
+
+    bytes.replace(kStrTabOffset + 1, 3, "foo");
+
+    // `R_X86_64_JUMP_SLOT` or `R_386_JMP_SLOT` of the GOT slot against
+    // symbol 1.
+    Write(kRelaOffset, ws, kSlotAddr);
+    Write(kRelaOffset + ws, ws, is_64 ? ((1ULL << 32) | 7) : ((1U << 8) | 7));
+
+    bytes[kCodeOffset] = '\xc3';  // ret
+
+    // `jmp qword [rip + disp32]`, or `jmp dword [ebx + disp32]`.
+    Write(kStubOffset, 1, 0xff);
+    if (is_64) {
+      Write(kStubOffset + 1, 1, 0x25);
+      Write(kStubOffset + 2, 4, kSlotAddr - (kStubAddr + 6));
+    } else {
+      Write(kStubOffset + 1, 1, 0xa3);
+      Write(kStubOffset + 2, 4, kSlotAddr - kGotPltAddr);
+    }
+    return bytes;
+  }
+
+  // Builds a statically linked executable with the segments described by
+  // `kSegmentedELF*`. Byte `i` of each segment's file contents is the low
+  // byte of `i` plus the segment's `kSegmentedELF*Fill`.
+  std::string BuildSegments(void) {
+    const auto ws = word_size;
+    Write(0, 4, 0x464c457f);  // "\x7fELF".
+    Write(4, 1, 8 == ws ? 2 : 1);
+    Write(5, 1, 1);
+    Write(6, 1, 1);
+    Write(16, 2, kTypeExec);
+    Write(18, 2, 8 == ws ? 62 : 3);
+    Write(20, 4, 1);
+    Write(24, ws, kSegmentedELFTextAddr);
+    Write(24 + ws, ws, kProgramHeadersOffset);
+    Write(40 + 3 * (ws - 4), 2, 8 == ws ? 64 : 52);
+    Write(42 + 3 * (ws - 4), 2, phentsize);
+    Write(44 + 3 * (ws - 4), 2, 3);
+
+    const uint64_t segs[][6] = {
+      {5, kSegmentedELFTextOffset, kSegmentedELFTextAddr, 0x10, 0x10,
+       kSegmentedELFTextFill},
+      {4, kSegmentedELFReadOnlyOffset, kSegmentedELFReadOnlyAddr, 0x10, 0x10,
+       kSegmentedELFReadOnlyFill},
+      {6, kSegmentedELFDataOffset, kSegmentedELFDataAddr, 0x8, 0x18,
+       kSegmentedELFDataFill}};
+
+    uint64_t ph = kProgramHeadersOffset;
+    for (const auto &seg : segs) {
+      WriteProgramHeader(ph, 1, seg[0], seg[1], seg[2], seg[3], seg[4]);
+      for (uint64_t i = 0; i < seg[3]; ++i) {
+        Write(seg[1] + i, 1, seg[5] + i);
+      }
+      ph += phentsize;
+    }
+    return bytes;
+  }
+
+  void WriteProgramHeader(uint64_t ph, uint64_t type, uint64_t flags,
+                          uint64_t offset, uint64_t addr, uint64_t size) {
+    WriteProgramHeader(ph, type, flags, offset, addr, size, size);
+  }
+
+  void WriteProgramHeader(uint64_t ph, uint64_t type, uint64_t flags,
+                          uint64_t offset, uint64_t addr, uint64_t file_size,
+                          uint64_t mem_size) {
+    if (8 == word_size) {
+      Write(ph, 4, type);
+      Write(ph + 4, 4, flags);
+      Write(ph + 8, 8, offset);
+      Write(ph + 16, 8, addr);
+      Write(ph + 24, 8, addr);
+      Write(ph + 32, 8, file_size);
+      Write(ph + 40, 8, mem_size);
+      Write(ph + 48, 8, 0x1000);
+    } else {
+      Write(ph, 4, type);
+      Write(ph + 4, 4, offset);
+      Write(ph + 8, 4, addr);
+      Write(ph + 12, 4, addr);
+      Write(ph + 16, 4, file_size);
+      Write(ph + 20, 4, mem_size);
+      Write(ph + 24, 4, flags);
+      Write(ph + 28, 4, 0x1000);
+    }
+  }
+
+  void Write(uint64_t offset, unsigned size, uint64_t val) {
+    for (auto i = 0U; i < size; ++i) {
+      bytes[offset + i] = static_cast<char>(val >> (i * 8));
+    }
+  }
+
+  unsigned word_size;
+  uint64_t phentsize;
+  std::string bytes;
+};
+
+class ELFTraceManagerTest : public test::LiftTest {
+ protected:
+  void TearDown(void) override {
+    if (!path.empty()) {
+      llvm::sys::fs::remove(path);
+    }
+  }
+
+  // Write `bytes` to a temporary file, and open it as an ELF.
+  std::unique_ptr<remill::ELFTraceManager> Open(const std::string &bytes) {
+    int fd = -1;
+    llvm::SmallString<128> tmp_path;
+    if (llvm::sys::fs::createTemporaryFile("remill-test", "elf", fd,
+                                           tmp_path)) {
+      return nullptr;
+    }
+    path = tmp_path.str().str();
+    {
+      llvm::raw_fd_ostream file(fd, true);
+      file << bytes;
+    }
+    return remill::ELFTraceManager::Open(module.get(), path);
+  }
+
+  // Resolve `jmp [kSlotAddr]`.
+  static bool Resolve(remill::TraceManager *elf_manager, uint64_t *target_pc,
+                      llvm::Function **external_func) {
+    remill::Instruction inst;
+    inst.pc = kCodeAddr;
+    remill::Operand op;
+    op.type = remill::Operand::kTypeAddress;
+    op.addr.kind = remill::Operand::Address::kMemoryRead;
+    op.addr.displacement = static_cast<int64_t>(kSlotAddr);
+    inst.operands.push_back(op);
+    *target_pc = 0;
+    *external_func = nullptr;
+    return elf_manager->TryResolveIndirectTarget(inst, target_pc,
+                                                 external_func);
+  }
+
+  // Decode `inst_bytes` as x86 code at `kCodeAddr`, and resolve its target.
+  static bool ResolveX86(remill::TraceManager *elf_manager,
+                         const std::string &inst_bytes, uint64_t *target_pc,
+                         llvm::Function **external_func) {
+    auto x86 = remill::Arch::Get(remill::GetOSName(REMILL_OS),
+                                 remill::kArchX86);
+    remill::Instruction inst;
+    if (!x86->DecodeInstruction(kCodeAddr, inst_bytes, inst)) {
+      return false;
+    }
+    *target_pc = 0;
+    *external_func = nullptr;
+    return elf_manager->TryResolveIndirectTarget(inst, target_pc,
+                                                 external_func);
+  }
+
+  std::string path;
+};
+
+}  // namespace
+
+// The executable's own definition of `foo` is always the one in the slot.
+TEST_F(ELFTraceManagerTest, TrustsExecutableSymbols) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.Build(
+      kTypeExec, kBindGlobal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  ASSERT_TRUE(Resolve(elf_manager.get(), &target_pc, &external_func));
+  EXPECT_EQ(kCodeAddr, target_pc);
+  EXPECT_EQ(nullptr, external_func);
+
+  uint8_t byte = 0;
+  remill::TraceManager *base_manager = elf_manager.get();
+  EXPECT_TRUE(base_manager->TryReadDataByte(kSlotAddr, &byte));
+  EXPECT_EQ(static_cast<uint8_t>(kCodeAddr), byte);
+}
+
+// Another module can preempt the shared object's definition of `foo`, so a
+// call through the slot is a call to whatever `foo` is at run time.
+TEST_F(ELFTraceManagerTest, DoesNotTrustPreemptibleSymbols) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.Build(
+      kTypeShared, kBindGlobal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  ASSERT_TRUE(Resolve(elf_manager.get(), &target_pc, &external_func));
+  EXPECT_EQ(0U, target_pc);
+  ASSERT_NE(nullptr, external_func);
+  EXPECT_EQ("foo", external_func->getName().str());
+
+  uint8_t byte = 0;
+  remill::TraceManager *base_manager = elf_manager.get();
+  EXPECT_FALSE(base_manager->TryReadDataByte(kSlotAddr, &byte));
+  EXPECT_FALSE(base_manager->TryReadReadOnlyByte(kSlotAddr, &byte));
+}
+
+TEST_F(ELFTraceManagerTest, TrustsProtectedSymbols) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.Build(
+      kTypeShared, kBindGlobal, kTypeFunc, kVisibilityProtected));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  ASSERT_TRUE(Resolve(elf_manager.get(), &target_pc, &external_func));
+  EXPECT_EQ(kCodeAddr, target_pc);
+}
+
+TEST_F(ELFTraceManagerTest, TrustsLocalSymbols) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.Build(
+      kTypeShared, kBindLocal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  ASSERT_TRUE(Resolve(elf_manager.get(), &target_pc, &external_func));
+  EXPECT_EQ(kCodeAddr, target_pc);
+}
+
+// The slot of an IFUNC gets the function that the resolver picks, and not
+// the resolver.
+TEST_F(ELFTraceManagerTest, DoesNotTrustIFuncs) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.Build(
+      kTypeExec, kBindGlobal, kTypeGNUIFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  Resolve(elf_manager.get(), &target_pc, &external_func);
+  EXPECT_NE(kCodeAddr, target_pc);
+}
+
+// A call through the PLT stub of a preemptible function is a call to that
+// function.
+TEST_F(ELFTraceManagerTest, DeclaresFunctionsOfPLTStubs) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.Build(
+      kTypeShared, kBindGlobal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  auto func = base_manager->GetLiftedTraceDeclaration(kStubAddr);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ("foo", func->getName().str());
+  EXPECT_EQ(func, base_manager->GetLiftedTraceDefinition(kStubAddr));
+}
+
+// The stubs of functions defined in the ELF are lifted, and the jump in the
+// stub goes to the function.
+TEST_F(ELFTraceManagerTest, LiftsPLTStubsOfLocalFunctions) {
+  ELFBuilder builder;
+  const auto bytes = builder.Build(
+      kTypeExec, kBindGlobal, kTypeFunc, kVisibilityDefault);
+  auto elf_manager = Open(bytes);
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  EXPECT_EQ(nullptr, base_manager->GetLiftedTraceDefinition(kStubAddr));
+
+  remill::Instruction inst;
+  ASSERT_TRUE(arch->DecodeInstruction(
+      kStubAddr, bytes.substr(kStubOffset, 6), inst));
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  ASSERT_TRUE(base_manager->TryResolveIndirectTarget(
+      inst, &target_pc, &external_func));
+  EXPECT_EQ(kCodeAddr, target_pc);
+}
+
+// `jmp dword [slot]`, with the implicit `DS` segment.
+TEST_F(ELFTraceManagerTest, ResolvesAbsoluteSlotsOfX86) {
+  ELFBuilder builder(4);
+  auto elf_manager = Open(builder.Build(
+      kTypeExec, kBindGlobal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  ASSERT_TRUE(ResolveX86(elf_manager.get(), "\xff\x25\x20\x02\x01\x00",
+                         &target_pc, &external_func));
+  EXPECT_EQ(kCodeAddr, target_pc);
+  EXPECT_EQ(nullptr, external_func);
+}
+
+// `call dword [ebx + 12]` in position-independent code, where `ebx` holds the
+// address of `.got.plt`.
+TEST_F(ELFTraceManagerTest, ResolvesEBXRelativeSlotsOfX86) {
+  ELFBuilder builder(4);
+  auto elf_manager = Open(builder.Build(
+      kTypeShared, kBindGlobal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  ASSERT_TRUE(ResolveX86(elf_manager.get(), "\xff\x53\x0c",
+                         &target_pc, &external_func));
+  EXPECT_EQ(0U, target_pc);
+  ASSERT_NE(nullptr, external_func);
+  EXPECT_EQ("foo", external_func->getName().str());
+}
+
+// `jmp dword gs:[slot]` doesn't read the slot.
+TEST_F(ELFTraceManagerTest, DoesNotResolveSegmentedSlotsOfX86) {
+  ELFBuilder builder(4);
+  auto elf_manager = Open(builder.Build(
+      kTypeExec, kBindGlobal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  uint64_t target_pc = 0;
+  llvm::Function *external_func = nullptr;
+  EXPECT_FALSE(ResolveX86(elf_manager.get(),
+                          "\x65\xff\x25\x20\x02\x01\x00",
+                          &target_pc, &external_func));
+}
+
+// The position-independent PLT stubs of x86 jump through `ebx`.
+TEST_F(ELFTraceManagerTest, DeclaresFunctionsOfX86PLTStubs) {
+  ELFBuilder builder(4);
+  auto elf_manager = Open(builder.Build(
+      kTypeShared, kBindGlobal, kTypeFunc, kVisibilityDefault));
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  auto func = base_manager->GetLiftedTraceDeclaration(kStubAddr);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ("foo", func->getName().str());
+}
+
+TEST_F(ELFTraceManagerTest, ReadsReadOnlySegments) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.BuildSegments());
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  uint8_t byte = 0;
+  EXPECT_TRUE(base_manager->TryReadReadOnlyByte(
+      kSegmentedELFReadOnlyAddr + 3, &byte));
+  EXPECT_EQ(kSegmentedELFReadOnlyFill + 3, byte);
+  EXPECT_TRUE(base_manager->TryReadDataByte(
+      kSegmentedELFReadOnlyAddr + 4, &byte));
+  EXPECT_EQ(kSegmentedELFReadOnlyFill + 4, byte);
+  EXPECT_FALSE(base_manager->TryReadExecutableByte(
+      kSegmentedELFReadOnlyAddr + 4, &byte));
+}
+
+// Writable data can be read, but can't be assumed to be constant.
+TEST_F(ELFTraceManagerTest, DoesNotReadWritableDataAsReadOnly) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.BuildSegments());
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  uint8_t byte = 0;
+  EXPECT_TRUE(base_manager->TryReadDataByte(kSegmentedELFDataAddr + 1, &byte));
+  EXPECT_EQ(kSegmentedELFDataFill + 1, byte);
+  EXPECT_FALSE(base_manager->TryReadReadOnlyByte(
+      kSegmentedELFDataAddr + 1, &byte));
+}
+
+// The part of a segment past its file contents, e.g. `.bss`, reads as zero.
+TEST_F(ELFTraceManagerTest, ReadsBSSAsZero) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.BuildSegments());
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  uint8_t byte = 0xff;
+  EXPECT_TRUE(base_manager->TryReadDataByte(kSegmentedELFBSSAddr, &byte));
+  EXPECT_EQ(0, byte);
+  byte = 0xff;
+  EXPECT_TRUE(base_manager->TryReadDataByte(kSegmentedELFEndAddr - 1, &byte));
+  EXPECT_EQ(0, byte);
+  EXPECT_FALSE(base_manager->TryReadReadOnlyByte(kSegmentedELFBSSAddr, &byte));
+}
+
+TEST_F(ELFTraceManagerTest, DoesNotReadUnmappedBytes) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.BuildSegments());
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  const uint64_t addrs[] = {
+    0, kSegmentedELFTextAddr - 1, kSegmentedELFReadOnlyAddr + 0x10,
+    kSegmentedELFDataAddr - 1, kSegmentedELFEndAddr, ~0ULL};
+  for (auto addr : addrs) {
+    uint8_t byte = 0;
+    EXPECT_FALSE(base_manager->TryReadExecutableByte(addr, &byte)) << addr;
+    EXPECT_FALSE(base_manager->TryReadDataByte(addr, &byte)) << addr;
+    EXPECT_FALSE(base_manager->TryReadReadOnlyByte(addr, &byte)) << addr;
+  }
+}
+
+// Reads that alternate between adjacent segments, or that step off the end
+// of a segment, don't get the segment of the previous read.
+TEST_F(ELFTraceManagerTest, ReadsAcrossSegmentBoundaries) {
+  ELFBuilder builder;
+  auto elf_manager = Open(builder.BuildSegments());
+  ASSERT_NE(nullptr, elf_manager);
+
+  remill::TraceManager *base_manager = elf_manager.get();
+  const auto last_text_addr = kSegmentedELFReadOnlyAddr - 1;
+  uint8_t byte = 0;
+  for (auto i = 0; i < 2; ++i) {
+    EXPECT_TRUE(base_manager->TryReadExecutableByte(last_text_addr, &byte));
+    EXPECT_EQ(kSegmentedELFTextFill + 0xf, byte);
+    EXPECT_FALSE(base_manager->TryReadExecutableByte(
+        kSegmentedELFReadOnlyAddr, &byte));
+    EXPECT_TRUE(base_manager->TryReadDataByte(
+        kSegmentedELFReadOnlyAddr, &byte));
+    EXPECT_EQ(kSegmentedELFReadOnlyFill, byte);
+  }
+
+  EXPECT_TRUE(base_manager->TryReadDataByte(
+      kSegmentedELFReadOnlyAddr + 0xf, &byte));
+  EXPECT_FALSE(base_manager->TryReadDataByte(
+      kSegmentedELFReadOnlyAddr + 0x10, &byte));
+  EXPECT_TRUE(base_manager->TryReadDataByte(kSegmentedELFEndAddr - 1, &byte));
+  EXPECT_FALSE(base_manager->TryReadDataByte(kSegmentedELFEndAddr, &byte));
+}
+
+TEST_F(ELFTraceManagerTest, RejectsSmallProgramHeaders) {
+  ELFBuilder builder;
+  builder.phentsize = 16;
+  EXPECT_EQ(nullptr, Open(builder.Build(
+      kTypeExec, kBindGlobal, kTypeFunc, kVisibilityDefault)));
+}
+
+// The program headers would run past the end of the file.
+TEST_F(ELFTraceManagerTest, RejectsTruncatedFiles) {
+  ELFBuilder builder;
+  auto bytes = builder.Build(
+      kTypeExec, kBindGlobal, kTypeFunc, kVisibilityDefault);
+  bytes.resize(kProgramHeadersOffset + 60);
+  EXPECT_EQ(nullptr, Open(bytes));
+}
+
+// The program header offset is so big that adding the size of the program
+// headers to it wraps around.
+TEST_F(ELFTraceManagerTest, RejectsOverflowingProgramHeaders) {
+  ELFBuilder builder;
+  auto bytes = builder.Build(
+      kTypeExec, kBindGlobal, kTypeFunc, kVisibilityDefault);
+  ELFBuilder patcher;
+  patcher.bytes = bytes;
+  patcher.Write(32, 8, ~0ULL - 8);
+  EXPECT_EQ(nullptr, Open(patcher.bytes));
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Name.h"
+#include "remill/Interp/Interpreter.h"
+#include "remill/OS/OS.h"
+
+#include "tests/BC/Lift.h"
+
+namespace {
+
+// Called by `NopHandler` each time that it runs.
+static std::function<void(void)> gOnNop;
+
+static Memory *NopHandler(Memory *memory, void *, const uint64_t *) {
+  gOnNop();
+  return memory;
+}
+
+// Only `nop` can be executed. The program counter is the first eight bytes
+// of the `State` structure.
+static const remill::HandlerInfo kHandlers[] = {
+    {"NOP_90", NopHandler, ""},
+    {nullptr, nullptr, nullptr}};
+
+static const remill::VariableInfo kVariables[] = {
+    {"PC", 0, 8, 1, 'q'},
+    {nullptr, 0, 0, 0, 0}};
+
+class InterpreterTest : public ::testing::Test {
+ protected:
+  InterpreterTest(void)
+      : arch(remill::Arch::Get(remill::GetOSName(REMILL_OS),
+                               remill::kArchAMD64)),
+        interp(new remill::Interpreter(arch, &manager, kHandlers, kVariables)),
+        memory(nullptr),
+        num_nops(0) {
+    state[0] = 0x1000;
+    gOnNop = [this] (void) {
+      num_nops++;
+    };
+  }
+
+  void TearDown(void) override {
+    gOnNop = nullptr;
+  }
+
+  remill::InterpreterStatus Run(uint64_t max_insts=~0ULL) {
+    return interp->Run(state, &memory, max_insts);
+  }
+
+  const remill::Arch * const arch;
+  test::TraceManager manager;
+  std::unique_ptr<remill::Interpreter> interp;
+  uint64_t state[4];
+  Memory *memory;
+  unsigned num_nops;
+};
+
+}  // namespace
+
+TEST_F(InterpreterTest, RunsUntilMissingCode) {
+  manager.AddCode(0x1000, "\x90\x90\x90");
+  EXPECT_EQ(remill::kInterpreterMissingCode, Run());
+  EXPECT_EQ(3U, num_nops);
+  EXPECT_EQ(0x1003U, state[0]);
+}
+
+TEST_F(InterpreterTest, StopsAtStepLimit) {
+  manager.AddCode(0x1000, "\x90\x90\x90");
+  EXPECT_EQ(remill::kInterpreterStepLimit, Run(2));
+  EXPECT_EQ(2U, num_nops);
+  EXPECT_EQ(0x1002U, state[0]);
+
+  // The decoded block is reused.
+  EXPECT_EQ(remill::kInterpreterMissingCode, Run());
+  EXPECT_EQ(3U, num_nops);
+}
+
+TEST_F(InterpreterTest, StopsAtUnsupportedInstruction) {
+  manager.AddCode(0x1000, "\x90\x0f\x0b");  // nop; ud2
+  EXPECT_EQ(remill::kInterpreterUnsupportedInstruction, Run());
+  EXPECT_EQ(1U, num_nops);
+  EXPECT_EQ(0x1001U, state[0]);
+}
+
+// The first `nop` overwrites the rest of its own block, which stops being
+// run, and is decoded again.
+TEST_F(InterpreterTest, RunsOverwrittenCode) {
+  manager.AddCode(0x1000, "\x90\x90\x90");
+  gOnNop = [this] (void) {
+    if (!num_nops++) {
+      manager.AddCode(0x1001, "\x0f\x0b");  // ud2
+      interp->InvalidateCode(0x1001, 0x1003);
+    }
+  };
+  EXPECT_EQ(remill::kInterpreterUnsupportedInstruction, Run());
+  EXPECT_EQ(1U, num_nops);
+  EXPECT_EQ(0x1001U, state[0]);
+}
+
+// Invalidated code is decoded again the next time that it runs.
+TEST_F(InterpreterTest, DecodesInvalidatedCodeAgain) {
+  manager.AddCode(0x1000, "\x90");
+  EXPECT_EQ(remill::kInterpreterMissingCode, Run());
+
+  manager.AddCode(0x1000, "\x0f\x0b");  // ud2
+  interp->InvalidateCode(0x1000, 0x1001);
+  state[0] = 0x1000;
+  EXPECT_EQ(remill::kInterpreterUnsupportedInstruction, Run());
+  EXPECT_EQ(1U, num_nops);
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/DeadStoreEliminator.h"
+#include "remill/BC/IntrinsicTable.h"
+#include "remill/BC/Lifter.h"
+#include "remill/BC/Util.h"
+#include "remill/OS/OS.h"
+
+namespace test {
+
+// Serves code from a map of bytes, and remembers lifted traces.
+class TraceManager : public remill::TraceManager {
+ public:
+  virtual ~TraceManager(void) = default;
+
+  void SetLiftedTraceDefinition(
+      uint64_t addr, llvm::Function *lifted_func) override {
+    traces[addr] = lifted_func;
+  }
+
+  llvm::Function *GetLiftedTraceDeclaration(uint64_t addr) override {
+    auto trace_it = traces.find(addr);
+    if (trace_it != traces.end()) {
+      return trace_it->second;
+    } else {
+      return nullptr;
+    }
+  }
+
+  llvm::Function *GetLiftedTraceDefinition(uint64_t addr) override {
+    return GetLiftedTraceDeclaration(addr);
+  }
+
+  bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override {
+    auto byte_it = memory.find(addr);
+    if (byte_it != memory.end()) {
+      *byte = byte_it->second;
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  bool TryGetFunctionBounds(uint64_t addr, uint64_t *begin,
+                            uint64_t *end) override {
+    for (const auto &func : function_ends) {
+      if (func.first <= addr && addr < func.second) {
+        *begin = func.first;
+        *end = func.second;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool TryReadReadOnlyByte(uint64_t addr, uint8_t *byte) override {
+    auto byte_it = read_only_memory.find(addr);
+    if (byte_it != read_only_memory.end()) {
+      *byte = byte_it->second;
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  // Place the machine code `bytes` at address `addr`.
+  void AddCode(uint64_t addr, const std::string &bytes) {
+    for (auto byte : bytes) {
+      memory[addr++] = static_cast<uint8_t>(byte);
+    }
+  }
+
+  // Place the read-only data `bytes` at address `addr`.
+  void AddReadOnlyData(uint64_t addr, const std::string &bytes) {
+    for (auto byte : bytes) {
+      read_only_memory[addr++] = static_cast<uint8_t>(byte);
+    }
+  }
+
+ public:
+  std::unordered_map<uint64_t, uint8_t> memory;
+  std::unordered_map<uint64_t, uint8_t> read_only_memory;
+
+  // End addresses of the known functions, by their begin addresses.
+  std::map<uint64_t, uint64_t> function_ends;
+  std::unordered_map<uint64_t, llvm::Function *> traces;
+};
+
+// Lifts amd64 machine code into a fresh copy of the amd64 semantics.
+class LiftTest : public ::testing::Test {
+ protected:
+  LiftTest(void)
+      : context(new llvm::LLVMContext),
+        arch(remill::Arch::Get(remill::GetOSName(REMILL_OS),
+                               remill::kArchAMD64)),
+        module(remill::LoadArchSemantics(arch, context.get())),
+        intrinsics(module.get()),
+        inst_lifter(arch, intrinsics) {}
+
+  ~LiftTest(void) {
+    remill::ForgetDeadStoreSummaries(module.get());
+  }
+
+  // Lift the trace at `addr`, and return its definition, or `nullptr`.
+  llvm::Function *Lift(uint64_t addr) {
+    remill::TraceLifter trace_lifter(inst_lifter, manager);
+    if (!trace_lifter.Lift(addr)) {
+      return nullptr;
+    }
+    return manager.GetLiftedTraceDefinition(addr);
+  }
+
+  // Inline the semantics functions called by the lifted trace `func`, so
+  // that its accesses to the `State` structure are visible to the passes
+  // that work on lifted code, without otherwise optimizing it.
+  static void InlineSemantics(llvm::Function *func) {
+    std::vector<llvm::CallInst *> calls;
+    for (auto &block : *func) {
+      for (auto &inst : block) {
+        auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+        auto callee = call ? call->getCalledFunction() : nullptr;
+        if (callee && !callee->isDeclaration() &&
+            callee->getFunctionType() != func->getFunctionType()) {
+          calls.push_back(call);
+        }
+      }
+    }
+    for (auto call : calls) {
+      llvm::InlineFunctionInfo info;
+      llvm::InlineFunction(call, info);
+    }
+  }
+
+  // Returns the number of instructions in `func` for which `pred` is true.
+  static unsigned CountInstructions(
+      llvm::Function *func,
+      std::function<bool(llvm::Instruction &)> pred) {
+    auto count = 0U;
+    for (auto &block : *func) {
+      for (auto &inst : block) {
+        if (pred(inst)) {
+          count++;
+        }
+      }
+    }
+    return count;
+  }
+
+  // Returns the number of stores of the integer `val` in `func`, possibly
+  // extended or truncated.
+  static unsigned CountStoresOf(llvm::Function *func, uint64_t val) {
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+      if (!store) {
+        return false;
+      }
+      auto stored_val = store->getValueOperand();
+      if (auto cast = llvm::dyn_cast<llvm::CastInst>(stored_val)) {
+        stored_val = cast->getOperand(0);
+      }
+      auto const_val = llvm::dyn_cast<llvm::ConstantInt>(stored_val);
+      return const_val && val == const_val->getZExtValue();
+    });
+  }
+
+  std::unique_ptr<llvm::LLVMContext> context;
+  const remill::Arch * const arch;
+  std::unique_ptr<llvm::Module> module;
+  remill::IntrinsicTable intrinsics;
+  remill::InstructionLifter inst_lifter;
+  TraceManager manager;
+};
+
+}  // namespace test
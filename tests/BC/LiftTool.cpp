@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+// Tests of `remill-lift`, which run the tool that the build made. The path to
+// the tool is only known when the tool is built along with the tests.
+#ifdef REMILL_LIFT_PATH
+
+namespace {
+
+class LiftToolTest : public ::testing::Test {
+ protected:
+  void TearDown(void) override {
+    for (const auto &path : paths) {
+      llvm::sys::fs::remove(path);
+    }
+  }
+
+  // Create a temporary file holding `contents`, and return its path.
+  std::string CreateFile(const std::string &suffix,
+                         const std::string &contents) {
+    int fd = -1;
+    llvm::SmallString<128> tmp_path;
+    if (llvm::sys::fs::createTemporaryFile("remill-lift-test", suffix, fd,
+                                           tmp_path)) {
+      return "";
+    }
+    paths.push_back(tmp_path.str().str());
+    llvm::raw_fd_ostream file(fd, true);
+    file << contents;
+    return paths.back();
+  }
+
+  // Run `remill-lift` on amd64 code with `args`, and return `true` if it
+  // succeeds. The lifted IR is put into `ir`.
+  bool Run(const std::string &args) {
+    const auto ir_path = CreateFile("ll", "");
+    std::stringstream cmd;
+    cmd << "\"" << REMILL_LIFT_PATH << "\" --arch amd64 --os linux"
+        << " --ir_out \"" << ir_path << "\" " << args << " 2>/dev/null";
+    if (std::system(cmd.str().c_str())) {
+      return false;
+    }
+    std::ifstream file(ir_path);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    ir = ss.str();
+    return true;
+  }
+
+  bool HasFunction(const std::string &name) const {
+    return std::string::npos != ir.find("@" + name + "(");
+  }
+
+  std::vector<std::string> paths;
+  std::string ir;
+};
+
+}  // namespace
+
+// ret; ret
+TEST_F(LiftToolTest, LiftsEveryEntry) {
+  ASSERT_TRUE(Run("--address 0x1000 --bytes c3c3 "
+                  "--entry_addresses 1000,0x1001"));
+  EXPECT_TRUE(HasFunction("sub_1000"));
+  EXPECT_TRUE(HasFunction("sub_1001"));
+}
+
+// Only the entries in the list are lifted, and not `--address`.
+TEST_F(LiftToolTest, LiftsEntriesFromList) {
+  const auto list = CreateFile("txt", "# Entries\n\n  1001\n");
+  ASSERT_TRUE(Run("--address=0x1000 --bytes=c3c3 --entry_list \"" +
+                  list + "\""));
+  EXPECT_FALSE(HasFunction("sub_1000"));
+  EXPECT_TRUE(HasFunction("sub_1001"));
+}
+
+TEST_F(LiftToolTest, RejectsInvalidEntries) {
+  const auto list = CreateFile("txt", "1001\nnot_an_address\n");
+  EXPECT_FALSE(Run("--bytes c3 --entry_list \"" + list + "\""));
+  EXPECT_FALSE(Run("--bytes c3 --entry_addresses 0,zz"));
+}
+
+// nop; nop; ret; int3, of which only the `ret` is lifted, at `--address`.
+TEST_F(LiftToolTest, LiftsSliceOfBinaryFile) {
+  const auto binary = CreateFile("bin", "\x90\x90\xc3\xcc");
+  ASSERT_TRUE(Run("--binary_file \"" + binary + "\" --offset 2 --size 1 "
+                  "--address 0x2000"));
+  EXPECT_TRUE(HasFunction("sub_2000"));
+}
+
+TEST_F(LiftToolTest, RejectsOutOfBoundsSlices) {
+  const auto binary = CreateFile("bin", "\x90\x90\xc3\xcc");
+  EXPECT_FALSE(Run("--binary_file \"" + binary + "\" --offset 5"));
+  EXPECT_FALSE(Run("--binary_file \"" + binary + "\" --offset 2 --size 3"));
+}
+
+TEST_F(LiftToolTest, RejectsConflictingInputs) {
+  const auto binary = CreateFile("bin", "\xc3");
+  EXPECT_FALSE(Run("--bytes c3 --binary_file \"" + binary + "\""));
+  EXPECT_FALSE(Run("--bytes c3 --offset 1"));
+  EXPECT_FALSE(Run(""));
+}
+
+// mov rax, rdi; ret
+TEST_F(LiftToolTest, CreatesNativeFunctions) {
+  ASSERT_TRUE(Run("--bytes 4889f8c3 --native_functions"));
+  EXPECT_TRUE(HasFunction("sub_0"));
+  EXPECT_TRUE(HasFunction("sub_0.native"));
+
+  ASSERT_TRUE(Run("--bytes 4889f8c3 --nonative_functions"));
+  EXPECT_FALSE(HasFunction("sub_0.native"));
+}
+
+TEST_F(LiftToolTest, RejectsUnknownFlags) {
+  EXPECT_FALSE(Run("--bytes c3 --no_such_flag"));
+  EXPECT_FALSE(Run("--bytes c3 --native_functions=maybe"));
+  EXPECT_FALSE(Run("--bytes c3 --address"));
+  EXPECT_FALSE(Run("--bytes c3 stray"));
+}
+
+#endif  // REMILL_LIFT_PATH
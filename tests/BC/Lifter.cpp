@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Type.h>
+
+#include "remill/BC/ABI.h"
+
+#include "tests/BC/Lift.h"
+
+extern bool FLAGS_fuse_compare_and_branch;
+// DECLARE_bool(fuse_compare_and_branch);
+
+namespace {
+
+class FusionTest : public test::LiftTest {
+ protected:
+  void SetUp(void) override {
+    FLAGS_fuse_compare_and_branch = true;
+  }
+
+  void TearDown(void) override {
+    FLAGS_fuse_compare_and_branch = false;
+  }
+
+  // Returns the number of `pred` comparisons of 32-bit values in `func`.
+  static unsigned CountCompares(llvm::Function *func,
+                                llvm::CmpInst::Predicate pred) {
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto cmp = llvm::dyn_cast<llvm::ICmpInst>(&inst);
+      return cmp && pred == cmp->getPredicate() &&
+             cmp->getOperand(0)->getType()->isIntegerTy(32);
+    });
+  }
+
+  // Returns the number of conditional branches in `func` whose condition is
+  // a `pred` comparison of 32-bit values.
+  static unsigned CountFusedBranches(llvm::Function *func,
+                                     llvm::CmpInst::Predicate pred) {
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto br = llvm::dyn_cast<llvm::BranchInst>(&inst);
+      if (!br || !br->isConditional()) {
+        return false;
+      }
+      auto cmp = llvm::dyn_cast<llvm::ICmpInst>(br->getCondition());
+      return cmp && pred == cmp->getPredicate() &&
+             cmp->getOperand(0)->getType()->isIntegerTy(32);
+    });
+  }
+};
+
+}  // namespace
+
+// cmp eax, ebx; jz +2; ret; ret; ret
+TEST_F(FusionTest, CompareAndBranch) {
+  manager.AddCode(0x1000, "\x39\xd8\x74\x02\xc3\xc3\xc3\xc3");
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountFusedBranches(func, llvm::CmpInst::ICMP_EQ));
+}
+
+// test eax, eax; js +2; ret; ret; ret
+TEST_F(FusionTest, TestAndBranch) {
+  manager.AddCode(0x1000, "\x85\xc0\x78\x02\xc3\xc3\xc3\xc3");
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountFusedBranches(func, llvm::CmpInst::ICMP_SLT));
+}
+
+// sub eax, ebx; jb +2; ret; ret; ret
+TEST_F(FusionTest, SubtractAndBranch) {
+  manager.AddCode(0x1000, "\x29\xd8\x72\x02\xc3\xc3\xc3\xc3");
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountFusedBranches(func, llvm::CmpInst::ICMP_ULT));
+}
+
+// cmp eax, ebx; setz cl; ret
+TEST_F(FusionTest, CompareAndSet) {
+  manager.AddCode(0x1000, std::string("\x39\xd8\x0f\x94\xc1\xc3", 6));
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountCompares(func, llvm::CmpInst::ICMP_EQ));
+  EXPECT_EQ(1U, CountInstructions(func, [] (llvm::Instruction &inst) {
+    auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+    if (!store) {
+      return false;
+    }
+    auto ext = llvm::dyn_cast<llvm::ZExtInst>(store->getValueOperand());
+    return ext && llvm::isa<llvm::ICmpInst>(ext->getOperand(0));
+  }));
+}
+
+// cmp eax, ebx; cmovz ecx, edx; ret
+TEST_F(FusionTest, CompareAndMove) {
+  manager.AddCode(0x1000, std::string("\x39\xd8\x0f\x44\xca\xc3", 6));
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountInstructions(func, [] (llvm::Instruction &inst) {
+    auto select = llvm::dyn_cast<llvm::SelectInst>(&inst);
+    return select && llvm::isa<llvm::ICmpInst>(select->getCondition());
+  }));
+}
+
+// The parity flag can't be computed from the compared values, so the pair is
+// lifted as two separate instructions.
+//
+// cmp eax, ebx; jp +2; ret; ret; ret
+TEST_F(FusionTest, UnsupportedConditionIsNotFused) {
+  manager.AddCode(0x1000, "\x39\xd8\x7a\x02\xc3\xc3\xc3\xc3");
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountInstructions(func, [] (llvm::Instruction &inst) {
+    auto cmp = llvm::dyn_cast<llvm::ICmpInst>(&inst);
+    return cmp && cmp->getOperand(0)->getType()->isIntegerTy(32);
+  }));
+  EXPECT_EQ(1U, CountInstructions(func, [] (llvm::Instruction &inst) {
+    auto br = llvm::dyn_cast<llvm::BranchInst>(&inst);
+    return br && br->isConditional();
+  }));
+}
+
+// The trace at `0x3002` starts at the `SETcc` of a fused pair, which was
+// lifted earlier. The earlier trace calls the new trace after only the `CMP`.
+//
+// cmp eax, ebx; setz cl; ret
+TEST_F(FusionTest, SplitsTracesAtFusedInstructions) {
+  manager.AddCode(0x3000, std::string("\x39\xd8\x0f\x94\xc1\xc3", 6));
+  remill::TraceLifter trace_lifter(inst_lifter, manager);
+  ASSERT_TRUE(trace_lifter.Lift(0x3000));
+  ASSERT_TRUE(trace_lifter.Lift(0x3002));
+  EXPECT_EQ(0.0, trace_lifter.DuplicatedInstructionRatio());
+
+  auto func = manager.traces[0x3000];
+  auto split_func = manager.traces[0x3002];
+  ASSERT_NE(nullptr, func);
+  ASSERT_NE(nullptr, split_func);
+  EXPECT_EQ(0U, CountCompares(func, llvm::CmpInst::ICMP_EQ));
+  EXPECT_EQ(1U, CountInstructions(func, [=] (llvm::Instruction &inst) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    return call && split_func == call->getCalledFunction();
+  }));
+
+  // Only the semantics of the `CMP` are left of the fused pair.
+  EXPECT_EQ(1U, CountInstructions(func, [=] (llvm::Instruction &inst) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    auto callee = call ? call->getCalledFunction() : nullptr;
+    return callee && split_func != callee &&
+           !callee->getName().startswith("__remill_");
+  }));
+}
+
+extern bool FLAGS_lazy_program_counter;
+// DECLARE_bool(lazy_program_counter);
+
+namespace {
+
+class ProgramCounterTest : public test::LiftTest {
+ protected:
+  void TearDown(void) override {
+    FLAGS_lazy_program_counter = false;
+  }
+
+  // Returns the number of stores to the program counter in `func`.
+  static unsigned CountProgramCounterStores(llvm::Function *func) {
+    auto pc_ptr = remill::LoadProgramCounterRef(&(func->front()));
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+      return store && pc_ptr == store->getPointerOperand();
+    });
+  }
+};
+
+}  // namespace
+
+// mov eax, ebx; add eax, ecx; ret
+static const char kNoObserverCode[] = "\x89\xd8\x01\xc8\xc3";
+
+TEST_F(ProgramCounterTest, EagerUpdates) {
+  manager.AddCode(0x1000, kNoObserverCode);
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(3U, CountProgramCounterStores(func));
+}
+
+// Neither the `MOV` nor the `ADD` observe the program counter, so it is only
+// stored before the `RET`, as a constant.
+TEST_F(ProgramCounterTest, LazyUpdates) {
+  FLAGS_lazy_program_counter = true;
+  manager.AddCode(0x1000, kNoObserverCode);
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountProgramCounterStores(func));
+
+  auto pc_ptr = remill::LoadProgramCounterRef(&(func->front()));
+  EXPECT_EQ(1U, CountInstructions(func, [=] (llvm::Instruction &inst) {
+    auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+    if (!store || pc_ptr != store->getPointerOperand()) {
+      return false;
+    }
+    auto pc = llvm::dyn_cast<llvm::ConstantInt>(store->getValueOperand());
+    return pc && 0x1005 == pc->getZExtValue();
+  }));
+}
+
+extern bool FLAGS_recover_jump_tables;
+// DECLARE_bool(recover_jump_tables);
+
+namespace {
+
+class JumpTableTest : public test::LiftTest {
+ protected:
+  void SetUp(void) override {
+    // cmp eax, 2; ja 0x1020; jmp [rax * 8 + 0x2000]
+    manager.AddCode(
+        0x1000, std::string("\x83\xf8\x02\x77\x1b\xff\x24\xc5\x00\x20\x00\x00",
+                            12));
+    manager.AddCode(0x1010, "\xc3\xc3\xc3");  // Cases.
+    manager.AddCode(0x1020, "\xc3");  // Default.
+
+    // Table of three absolute targets.
+    manager.AddCode(0x2000, std::string("\x10\x10\x00\x00\x00\x00\x00\x00"
+                                        "\x11\x10\x00\x00\x00\x00\x00\x00"
+                                        "\x12\x10\x00\x00\x00\x00\x00\x00",
+                                        24));
+  }
+
+  void TearDown(void) override {
+    FLAGS_recover_jump_tables = false;
+  }
+
+  // Returns the program counters of the cases of the switch in `func`.
+  static std::vector<uint64_t> SwitchCases(llvm::Function *func) {
+    std::vector<uint64_t> cases;
+    for (auto &block : *func) {
+      if (auto switch_inst = llvm::dyn_cast<llvm::SwitchInst>(
+              block.getTerminator())) {
+        for (auto case_it : switch_inst->cases()) {
+          cases.push_back(case_it.getCaseValue()->getZExtValue());
+        }
+      }
+    }
+    std::sort(cases.begin(), cases.end());
+    return cases;
+  }
+};
+
+}  // namespace
+
+TEST_F(JumpTableTest, JumpsThroughDispatcher) {
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_TRUE(SwitchCases(func).empty());
+}
+
+// The `ja` bounds the index to `[0, 2]`, so the table has three entries.
+TEST_F(JumpTableTest, RecoversAbsoluteTable) {
+  FLAGS_recover_jump_tables = true;
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  std::vector<uint64_t> expected = {0x1010, 0x1011, 0x1012};
+  EXPECT_EQ(expected, SwitchCases(func));
+}
+
+namespace {
+
+class FunctionLiftTest : public test::LiftTest {
+ protected:
+  void SetUp(void) override {
+    manager.AddCode(0x1000, "\xeb\x0e");  // jmp 0x1010
+    manager.AddCode(0x1010, "\xc3");  // ret
+  }
+
+  // Returns the number of calls in `func` to `callee`.
+  static unsigned CountCallsTo(llvm::Function *func, llvm::Function *callee) {
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      return call && callee == call->getCalledFunction();
+    });
+  }
+};
+
+}  // namespace
+
+// Without function bounds, the jump goes to the trace that was already lifted
+// at its target.
+TEST_F(FunctionLiftTest, TailCallsExistingTraces) {
+  auto target = Lift(0x1010);
+  ASSERT_NE(nullptr, target);
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountCallsTo(func, target));
+}
+
+// The jump stays in the function, even though its target is the head of an
+// existing trace.
+TEST_F(FunctionLiftTest, KeepsFunctionInOneTrace) {
+  manager.function_ends[0x1000] = 0x1011;
+  auto target = Lift(0x1010);
+  ASSERT_NE(nullptr, target);
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountCallsTo(func, target));
+}
+
+extern bool FLAGS_shadow_return_stack;
+// DECLARE_bool(shadow_return_stack);
+
+extern bool FLAGS_assume_well_behaved_returns;
+// DECLARE_bool(assume_well_behaved_returns);
+
+namespace {
+
+class ShadowStackTest : public test::LiftTest {
+ protected:
+  void SetUp(void) override {
+    FLAGS_shadow_return_stack = true;
+    FLAGS_assume_well_behaved_returns = true;
+
+    // call 0x1010; ret
+    manager.AddCode(0x1000, std::string("\xe8\x0b\x00\x00\x00\xc3", 6));
+    manager.AddCode(0x1010, "\xc3");  // ret
+  }
+
+  void TearDown(void) override {
+    FLAGS_shadow_return_stack = false;
+    FLAGS_assume_well_behaved_returns = false;
+  }
+
+  // Returns the number of tail calls in `func` to `callee`.
+  static unsigned CountTailCallsTo(llvm::Function *func,
+                                   llvm::Function *callee) {
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      return call && callee == call->getCalledFunction() &&
+             llvm::isa<llvm::ReturnInst>(call->getNextNode());
+    });
+  }
+};
+
+}  // namespace
+
+// The call pushes the address that it returns to.
+TEST_F(ShadowStackTest, PushesReturnAddress) {
+  auto func = Lift(0x1000);
+  ASSERT_NE(nullptr, func);
+  auto push = intrinsics.shadow_stack_push;
+  EXPECT_EQ(1U, CountInstructions(func, [=] (llvm::Instruction &inst) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    if (!call || push != call->getCalledFunction()) {
+      return false;
+    }
+    auto pc = llvm::dyn_cast<llvm::ConstantInt>(
+        call->getArgOperand(remill::kPCArgNum));
+    return pc && 0x1005 == pc->getZExtValue();
+  }));
+}
+
+// The return only goes back to its caller if the shadow stack agrees on where
+// it returns to; otherwise it jumps there.
+TEST_F(ShadowStackTest, RedirectsMismatchedReturns) {
+  ASSERT_NE(nullptr, Lift(0x1000));
+  auto func = manager.traces[0x1010];
+  ASSERT_NE(nullptr, func);
+
+  auto pop = intrinsics.shadow_stack_pop;
+  EXPECT_EQ(1U, CountInstructions(func, [=] (llvm::Instruction &inst) {
+    auto br = llvm::dyn_cast<llvm::BranchInst>(&inst);
+    if (!br || !br->isConditional()) {
+      return false;
+    }
+    auto cmp = llvm::dyn_cast<llvm::ICmpInst>(br->getCondition());
+    auto call = cmp ? llvm::dyn_cast<llvm::CallInst>(cmp->getOperand(0))
+                    : nullptr;
+    return call && pop == call->getCalledFunction();
+  }));
+  EXPECT_EQ(1U, CountTailCallsTo(func, intrinsics.function_return));
+  EXPECT_EQ(1U, CountTailCallsTo(func, intrinsics.jump));
+}
+
+namespace {
+
+class TraceSplitTest : public test::LiftTest {
+ protected:
+  void SetUp(void) override {
+    // call 0x1010; nop; ret
+    manager.AddCode(0x1000, std::string("\xe8\x0b\x00\x00\x00\x90\xc3", 7));
+    // call 0x1005; ret
+    manager.AddCode(0x1010, "\xe8\xf0\xff\xff\xff\xc3");
+  }
+};
+
+}  // namespace
+
+// The trace at `0x1005` starts in the middle of the trace at `0x1000`, which
+// is lifted first. The trace at `0x1000` is split before anyone sees it.
+TEST_F(TraceSplitTest, SplitsBeforeHandingOutTraces) {
+  remill::TraceLifter trace_lifter(inst_lifter, manager);
+  std::vector<uint64_t> lifted_addrs;
+  auto num_split_calls = 0U;
+  ASSERT_TRUE(trace_lifter.Lift(
+      0x1000, [&] (uint64_t addr, llvm::Function *func) {
+        lifted_addrs.push_back(addr);
+        if (0x1000 != addr) {
+          return;
+        }
+        auto split_func = module->getFunction(manager.TraceName(0x1005));
+        num_split_calls = CountInstructions(
+            func, [=] (llvm::Instruction &inst) {
+              auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+              return call && split_func &&
+                     split_func == call->getCalledFunction();
+            });
+      }));
+
+  std::sort(lifted_addrs.begin(), lifted_addrs.end());
+  std::vector<uint64_t> expected = {0x1000, 0x1005, 0x1010};
+  EXPECT_EQ(expected, lifted_addrs);
+  EXPECT_EQ(1U, num_split_calls);
+  EXPECT_EQ(0.0, trace_lifter.DuplicatedInstructionRatio());
+}
+
+// The trace at `0x2001` is lifted by a later call to `Lift` than the trace
+// at `0x2000`, which is split anyway, and handed out again.
+TEST_F(TraceSplitTest, SplitsTracesOfEarlierLifts) {
+  manager.AddCode(0x2000, "\x90\x90\xc3");  // nop; nop; ret
+  remill::TraceLifter trace_lifter(inst_lifter, manager);
+  ASSERT_TRUE(trace_lifter.Lift(0x2000));
+
+  std::vector<uint64_t> lifted_addrs;
+  ASSERT_TRUE(trace_lifter.Lift(
+      0x2001, [&] (uint64_t addr, llvm::Function *) {
+        lifted_addrs.push_back(addr);
+      }));
+
+  std::sort(lifted_addrs.begin(), lifted_addrs.end());
+  std::vector<uint64_t> expected = {0x2000, 0x2001};
+  EXPECT_EQ(expected, lifted_addrs);
+  EXPECT_EQ(0.0, trace_lifter.DuplicatedInstructionRatio());
+
+  auto split_func = manager.traces[0x2001];
+  EXPECT_EQ(1U, CountInstructions(
+      manager.traces[0x2000], [=] (llvm::Instruction &inst) {
+        auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+        return call && split_func == call->getCalledFunction();
+      }));
+}
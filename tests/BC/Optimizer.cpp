@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <llvm/Analysis/LoopInfo.h>
+
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Instructions.h>
+
+#include "remill/BC/Optimizer.h"
+
+#include "tests/BC/Lift.h"
+
+namespace {
+
+class OptimizerTest : public test::LiftTest {
+ protected:
+  // Lift the trace at `addr`, and optimize all lifted traces.
+  llvm::Function *LiftAndOptimize(uint64_t addr,
+                                  remill::OptimizationGuide guide) {
+    auto func = Lift(addr);
+    if (func) {
+      remill::OptimizeModule(module.get(), manager.traces, guide);
+    }
+    return func;
+  }
+
+  // Add `code` at `0x1000`, then lift the trace there, and optimize all
+  // lifted traces. `code` may contain zero bytes.
+  template <size_t kSize>
+  llvm::Function *OptimizeCode(const char (&code)[kSize],
+                               remill::OptimizationGuide guide) {
+    manager.AddCode(0x1000, std::string(code, kSize - 1));
+    return LiftAndOptimize(0x1000, guide);
+  }
+
+  // A guide that folds reads of the read-only memory of `manager`.
+  remill::OptimizationGuide ReadOnlyMemoryGuide(void) {
+    remill::OptimizationGuide guide = {};
+    guide.read_only_byte = [this] (uint64_t addr, uint8_t *byte) {
+      return manager.TryReadReadOnlyByte(addr, byte);
+    };
+    return guide;
+  }
+
+  // Returns `true` if `val` is computed, without going through memory, from
+  // a value for which `pred` returns `true`.
+  static bool IsComputedFrom(llvm::Value *val,
+                             const std::function<bool(llvm::Value *)> &pred) {
+    std::vector<llvm::Value *> work_list = {val};
+    std::unordered_set<llvm::Value *> seen;
+    while (!work_list.empty()) {
+      auto curr = work_list.back();
+      work_list.pop_back();
+      if (!seen.insert(curr).second) {
+        continue;
+      } else if (pred(curr)) {
+        return true;
+      }
+      auto inst = llvm::dyn_cast<llvm::Instruction>(curr);
+      if (inst && !llvm::isa<llvm::CallInst>(inst) &&
+          !llvm::isa<llvm::LoadInst>(inst)) {
+        for (auto &op : inst->operands()) {
+          work_list.push_back(op.get());
+        }
+      }
+    }
+    return false;
+  }
+
+  // Returns the number of stores in `func` of values computed from the
+  // results of calls to the function named `name`.
+  static unsigned CountStoresOfCallResults(llvm::Function *func,
+                                           const char *name) {
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+      return store && IsComputedFrom(
+          store->getValueOperand(), [=] (llvm::Value *val) {
+            auto call = llvm::dyn_cast<llvm::CallInst>(val);
+            auto callee = call ? call->getCalledFunction() : nullptr;
+            return callee && callee->getName() == name;
+          });
+    });
+  }
+
+  // Returns the number of calls in `func` to the function named `name`.
+  static unsigned CountCalls(llvm::Function *func, const char *name) {
+    return CountInstructions(func, [=] (llvm::Instruction &inst) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      auto callee = call ? call->getCalledFunction() : nullptr;
+      return callee && callee->getName() == name;
+    });
+  }
+
+  // Returns the number of stores in the loops of `func`.
+  static unsigned CountStoresInLoops(llvm::Function *func) {
+    llvm::DominatorTree dt(*func);
+    llvm::LoopInfo loops(dt);
+    return CountInstructions(func, [&loops] (llvm::Instruction &inst) {
+      return llvm::isa<llvm::StoreInst>(&inst) &&
+             loops.getLoopFor(inst.getParent());
+    });
+  }
+
+  // Returns the number of stores after the loops of `func` of values that
+  // are computed in the loops, i.e. of the loops' live-out values.
+  static unsigned CountLiveOutStores(llvm::Function *func) {
+    llvm::DominatorTree dt(*func);
+    llvm::LoopInfo loops(dt);
+    return CountInstructions(func, [&loops] (llvm::Instruction &inst) {
+      auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+      return store && !loops.getLoopFor(inst.getParent()) && IsComputedFrom(
+          store->getValueOperand(), [&loops] (llvm::Value *val) {
+            auto val_inst = llvm::dyn_cast<llvm::Instruction>(val);
+            return val_inst && loops.getLoopFor(val_inst->getParent());
+          });
+    });
+  }
+
+  // Returns the number of calls in the loops of `func` to the function named
+  // `name`.
+  static unsigned CountCallsInLoops(llvm::Function *func, const char *name) {
+    llvm::DominatorTree dt(*func);
+    llvm::LoopInfo loops(dt);
+    return CountInstructions(func, [&loops, name] (llvm::Instruction &inst) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      auto callee = call ? call->getCalledFunction() : nullptr;
+      return callee && callee->getName() == name &&
+             loops.getLoopFor(inst.getParent());
+    });
+  }
+
+  // Returns the number of inline assembly statements in `func`.
+  static unsigned CountInlineAsm(llvm::Function *func) {
+    return CountInstructions(func, [] (llvm::Instruction &inst) {
+      auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      return call && llvm::isa<llvm::InlineAsm>(
+          call->getCalledValue()->stripPointerCasts());
+    });
+  }
+};
+
+}  // namespace
+
+// fabs; ret
+static const char kFloatCode[] = "\xd9\xe1\xc3";
+
+TEST_F(OptimizerTest, KeepsFPUExceptionChecks) {
+  remill::OptimizationGuide guide = {};
+  auto func = OptimizeCode(kFloatCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_LT(0U, CountCalls(func, "__remill_fpu_exception_test_and_clear"));
+  EXPECT_LT(0U, CountInlineAsm(func));
+}
+
+// The brackets and both of their reordering barriers are removed, even
+// though the results of the brackets were used by the sticky status flags.
+TEST_F(OptimizerTest, RemovesFPUExceptionChecks) {
+  remill::OptimizationGuide guide = {};
+  guide.eliminate_fpu_exception_checks = true;
+  auto func = OptimizeCode(kFloatCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountCalls(func, "__remill_fpu_exception_test_and_clear"));
+  EXPECT_EQ(0U, CountInlineAsm(func));
+}
+
+// .L: add eax, 1; cmp eax, ebx; jne .L; ret
+static const char kIntegerLoopCode[] =
+    "\x05\x01\x00\x00\x00\x39\xd8\x75\xf7\xc3";
+
+// .L: addsd xmm0, xmm1; dec ecx; jnz .L; ret
+static const char kFloatLoopCode[] =
+    "\xf2\x0f\x58\xc1\xff\xc9\x75\xf8\xc3";
+
+// The registers of the loop, including the partially read `EAX`, live in
+// SSA values, and are only written back to the `State` structure on exit.
+TEST_F(OptimizerTest, PromotesIntegerRegistersInLoops) {
+  remill::OptimizationGuide guide = {};
+  guide.promote_state_to_ssa = true;
+  auto func = OptimizeCode(kIntegerLoopCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountStoresInLoops(func));
+
+  // At least `EAX` and the flags of the `CMP` are live out of the loop.
+  EXPECT_LE(2U, CountLiveOutStores(func));
+}
+
+// Stores to non-integer slots, e.g. of `XMM0`, are full-sized accesses, and
+// don't keep their slots from being promoted.
+TEST_F(OptimizerTest, PromotesFloatRegistersInLoops) {
+  remill::OptimizationGuide guide = {};
+  guide.promote_state_to_ssa = true;
+  auto func = OptimizeCode(kFloatLoopCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountStoresInLoops(func));
+
+  // At least `XMM0` and `ECX` are live out of the loop.
+  EXPECT_LE(2U, CountLiveOutStores(func));
+}
+
+// movzx eax, byte [rdi]; movzx ecx, byte [rdi + 1]; ret
+static const char kByteReadsCode[] = "\x0f\xb6\x07\x0f\xb6\x4f\x01\xc3";
+
+// mov [rdi], al; mov [rdi + 1], cl; ret
+static const char kByteWritesCode[] = "\x88\x07\x88\x4f\x01\xc3";
+
+TEST_F(OptimizerTest, KeepsNarrowMemoryAccesses) {
+  remill::OptimizationGuide guide = {};
+  auto func = OptimizeCode(kByteReadsCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(2U, CountCalls(func, "__remill_read_memory_8"));
+  EXPECT_EQ(0U, CountCalls(func, "__remill_read_memory_16"));
+}
+
+TEST_F(OptimizerTest, CoalescesAdjacentReads) {
+  remill::OptimizationGuide guide = {};
+  guide.coalesce_memory_accesses = true;
+  auto func = OptimizeCode(kByteReadsCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountCalls(func, "__remill_read_memory_8"));
+  EXPECT_EQ(1U, CountCalls(func, "__remill_read_memory_16"));
+
+  // Both `EAX` and `ECX` get their values from the wide read.
+  EXPECT_EQ(2U, CountStoresOfCallResults(func, "__remill_read_memory_16"));
+}
+
+TEST_F(OptimizerTest, CoalescesAdjacentWrites) {
+  remill::OptimizationGuide guide = {};
+  guide.coalesce_memory_accesses = true;
+  auto func = OptimizeCode(kByteWritesCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountCalls(func, "__remill_write_memory_8"));
+  EXPECT_EQ(1U, CountCalls(func, "__remill_write_memory_16"));
+
+  // The wide write combines the values of `AL` and `CL`.
+  auto num_loads = 0U;
+  EXPECT_EQ(1U, CountInstructions(func, [&] (llvm::Instruction &inst) {
+    auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+    auto callee = call ? call->getCalledFunction() : nullptr;
+    if (!callee || callee->getName() != "__remill_write_memory_16") {
+      return false;
+    }
+    IsComputedFrom(call->getArgOperand(2), [&] (llvm::Value *val) {
+      num_loads += llvm::isa<llvm::LoadInst>(val) ? 1 : 0;
+      return false;
+    });
+    return true;
+  }));
+  EXPECT_EQ(2U, num_loads);
+}
+
+// .L: mov eax, [rdi]; mov [rdi + 8], ecx; dec edx; jnz .L; ret
+static const char kInvariantBaseLoopCode[] =
+    "\x8b\x07\x89\x4f\x08\xff\xca\x75\xf7\xc3";
+
+// .L: mov eax, [rdi]; mov [rdi + 8], ecx; add rdi, 8; dec edx; jnz .L; ret
+static const char kVariantBaseLoopCode[] =
+    "\x8b\x07\x89\x4f\x08\x48\x83\xc7\x08\xff\xca\x75\xf3\xc3";
+
+// The write never aliases the read, because `RDI` doesn't change in the loop,
+// so the read can be hoisted out of the loop.
+TEST_F(OptimizerTest, HoistsReadsPastNonAliasingWrites) {
+  remill::OptimizationGuide guide = {};
+  guide.promote_state_to_ssa = true;
+  guide.disambiguate_memory_accesses = true;
+  auto func = OptimizeCode(kInvariantBaseLoopCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountCallsInLoops(func, "__remill_read_memory_32"));
+}
+
+// The write of one iteration is read by the next one, even though the read
+// and the write are at different displacements from the same SSA value of
+// `RDI`, so the read must stay in the loop.
+TEST_F(OptimizerTest, KeepsReadsOfEarlierIterationsWrites) {
+  remill::OptimizationGuide guide = {};
+  guide.promote_state_to_ssa = true;
+  guide.disambiguate_memory_accesses = true;
+  auto func = OptimizeCode(kVariantBaseLoopCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountCallsInLoops(func, "__remill_read_memory_32"));
+}
+
+// sub rsp, 8; mov [rsp], edi; mov eax, [rsp]; add rsp, 8; ret
+static const char kLeafFrameCode[] =
+    "\x48\x83\xec\x08\x89\x3c\x24\x8b\x04\x24\x48\x83\xc4\x08\xc3";
+
+// lea rax, [rsp - 8]; mov [rsp - 8], edi; ret
+static const char kEscapingFrameCode[] =
+    "\x48\x8d\x44\x24\xf8\x89\x7c\x24\xf8\xc3";
+
+TEST_F(OptimizerTest, RecoversLeafStackFrames) {
+  remill::OptimizationGuide guide = {};
+  guide.promote_state_to_ssa = true;
+  guide.recover_stack_frames = true;
+  auto func = OptimizeCode(kLeafFrameCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountCalls(func, "__remill_write_memory_32"));
+  EXPECT_EQ(0U, CountCalls(func, "__remill_read_memory_32"));
+}
+
+// A pointer into the frame is returned in `RAX`, so the caller can still
+// read the frame after the function returns.
+TEST_F(OptimizerTest, KeepsEscapingStackFrames) {
+  remill::OptimizationGuide guide = {};
+  guide.promote_state_to_ssa = true;
+  guide.recover_stack_frames = true;
+  auto func = OptimizeCode(kEscapingFrameCode, guide);
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountCalls(func, "__remill_write_memory_32"));
+}
+
+// mov eax, [0x2000]; ret
+static const char kConstantAddressReadCode[] =
+    "\x8b\x04\x25\x00\x20\x00\x00\xc3";
+
+TEST_F(OptimizerTest, KeepsReadsOfWritableMemory) {
+  auto func = OptimizeCode(kConstantAddressReadCode, ReadOnlyMemoryGuide());
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(1U, CountCalls(func, "__remill_read_memory_32"));
+}
+
+TEST_F(OptimizerTest, FoldsReadsOfReadOnlyMemory) {
+  manager.AddReadOnlyData(0x2000, "\x11\x22\x33\x44");
+  auto func = OptimizeCode(kConstantAddressReadCode, ReadOnlyMemoryGuide());
+  ASSERT_NE(nullptr, func);
+  EXPECT_EQ(0U, CountCalls(func, "__remill_read_memory_32"));
+  EXPECT_EQ(1U, CountInstructions(func, [] (llvm::Instruction &inst) {
+    auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+    auto val = store ? llvm::dyn_cast<llvm::ConstantInt>(
+        store->getValueOperand()) : nullptr;
+    return val && 0x44332211 == val->getZExtValue();
+  }));
+}
+
+// call 0x1010; mov eax, edx; ret
+static const char kCallerCode[] = "\xe8\x0b\x00\x00\x00\x89\xd0\xc3";
+
+// mov edx, 1; ret
+static const char kSmallCalleeCode[] = "\xba\x01\x00\x00\x00\xc3";
+
+TEST_F(OptimizerTest, KeepsCallsToSmallTraces) {
+  manager.AddCode(0x1010, std::string(kSmallCalleeCode,
+                                      sizeof(kSmallCalleeCode) - 1));
+  remill::OptimizationGuide guide = {};
+  auto func = OptimizeCode(kCallerCode, guide);
+  ASSERT_NE(nullptr, func);
+  ASSERT_TRUE(manager.traces.count(0x1010));
+  const auto callee_name = manager.traces[0x1010]->getName().str();
+  EXPECT_EQ(1U, CountCalls(func, callee_name.c_str()));
+}
+
+// The inlined callee no longer returns in the middle of its caller, so the
+// callee's write of `EDX` reaches the caller's read of `EDX`, and survives
+// dead store elimination.
+TEST_F(OptimizerTest, InlinesSmallTraces) {
+  manager.AddCode(0x1010, std::string(kSmallCalleeCode,
+                                      sizeof(kSmallCalleeCode) - 1));
+  remill::OptimizationGuide guide = {};
+  guide.inline_small_traces = true;
+  guide.eliminate_dead_stores = true;
+  auto func = OptimizeCode(kCallerCode, guide);
+  ASSERT_NE(nullptr, func);
+  ASSERT_TRUE(manager.traces.count(0x1010));
+  const auto callee_name = manager.traces[0x1010]->getName().str();
+  EXPECT_EQ(0U, CountCalls(func, callee_name.c_str()));
+  EXPECT_EQ(1U, CountCalls(func, "__remill_function_return"));
+
+  // One store of `1` to `EDX`, and one to `EAX`, which is forwarded from it.
+  EXPECT_EQ(2U, CountStoresOf(func, 1));
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include <llvm/IR/CallingConv.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Type.h>
+
+#include "remill/BC/Optimizer.h"
+#include "remill/BC/Signature.h"
+
+#include "tests/BC/Lift.h"
+
+namespace {
+
+class SignatureTest : public test::LiftTest {
+ protected:
+  void SetUp(void) override {
+    is_sysv = llvm::CallingConv::X86_64_SysV == arch->DefaultCallingConv();
+  }
+
+  // Lift the code `bytes` as a function at `0x1000`, remove its dead stores,
+  // and recover its signature.
+  bool RecoverSignature(const std::string &bytes,
+                        remill::FunctionSignature *sig,
+                        bool eliminate_dead_stores=true) {
+    manager.AddCode(0x1000, bytes);
+    auto func = Lift(0x1000);
+    if (!func) {
+      return false;
+    }
+    remill::OptimizationGuide guide = {};
+    guide.eliminate_dead_stores = eliminate_dead_stores;
+    remill::OptimizeModule(module.get(), manager.traces, guide);
+    return remill::RecoverFunctionSignature(arch, func, sig);
+  }
+
+  // Returns the names of the registers `regs`.
+  static std::vector<std::string> Names(
+      const std::vector<const remill::Register *> &regs) {
+    std::vector<std::string> names;
+    for (auto reg : regs) {
+      names.push_back(reg->name);
+    }
+    return names;
+  }
+
+  bool is_sysv;
+};
+
+}  // namespace
+
+// mov rax, rdi; ret
+static const char kIdentityCode[] = "\x48\x89\xf8\xc3";
+
+TEST_F(SignatureTest, RecoversIntegerArguments) {
+  if (!is_sysv) {
+    return;
+  }
+  remill::FunctionSignature sig = {};
+  ASSERT_TRUE(RecoverSignature(kIdentityCode, &sig));
+  EXPECT_EQ(std::vector<std::string>({"RDI"}), Names(sig.arguments));
+  EXPECT_TRUE(sig.vector_arguments.empty());
+  ASSERT_NE(nullptr, sig.return_value);
+  EXPECT_EQ("RAX", sig.return_value->name);
+  EXPECT_EQ(nullptr, sig.vector_return_value);
+  EXPECT_EQ(8, sig.stack_delta);
+}
+
+// The first argument isn't read, but the second one can only be passed
+// along with it.
+TEST_F(SignatureTest, KeepsEarlierArguments) {
+  if (!is_sysv) {
+    return;
+  }
+  remill::FunctionSignature sig = {};
+  ASSERT_TRUE(RecoverSignature("\x48\x89\xf0\xc3", &sig));  // mov rax, rsi
+  EXPECT_EQ(std::vector<std::string>({"RDI", "RSI"}), Names(sig.arguments));
+}
+
+// addsd xmm0, xmm1; ret
+TEST_F(SignatureTest, RecoversVectorArguments) {
+  if (!is_sysv) {
+    return;
+  }
+  remill::FunctionSignature sig = {};
+  ASSERT_TRUE(RecoverSignature("\xf2\x0f\x58\xc1\xc3", &sig));
+  EXPECT_TRUE(sig.arguments.empty());
+  EXPECT_EQ(std::vector<std::string>({"XMM0", "XMM1"}),
+            Names(sig.vector_arguments));
+  EXPECT_EQ(nullptr, sig.return_value);
+  ASSERT_NE(nullptr, sig.vector_return_value);
+  EXPECT_EQ("XMM0", sig.vector_return_value->name);
+}
+
+// Without the live sets of the dead store elimination, there is nothing to
+// go on.
+TEST_F(SignatureTest, NeedsLiveSets) {
+  remill::FunctionSignature sig = {};
+  EXPECT_FALSE(RecoverSignature(kIdentityCode, &sig, false));
+}
+
+TEST_F(SignatureTest, CreatesNativeFunction) {
+  if (!is_sysv) {
+    return;
+  }
+  remill::FunctionSignature sig = {};
+  ASSERT_TRUE(RecoverSignature(kIdentityCode, &sig));
+  auto native_func = remill::CreateNativeFunction(
+      arch, manager.traces[0x1000], 0x1000, sig);
+  ASSERT_NE(nullptr, native_func);
+
+  // The argument comes before the `State` and `Memory` pointers.
+  auto func_type = native_func->getFunctionType();
+  ASSERT_EQ(3U, func_type->getNumParams());
+  EXPECT_TRUE(func_type->getParamType(0)->isIntegerTy(64));
+  EXPECT_TRUE(func_type->getReturnType()->isIntegerTy(64));
+  EXPECT_EQ(llvm::CallingConv::X86_64_SysV, native_func->getCallingConv());
+}
+
+// Vector registers are passed as vectors, and both kinds of return values
+// are returned together.
+TEST_F(SignatureTest, CreatesNativeVectorFunction) {
+  if (!is_sysv) {
+    return;
+  }
+  remill::FunctionSignature sig = {};
+  ASSERT_TRUE(RecoverSignature(kIdentityCode, &sig));
+  sig.vector_arguments.push_back(arch->RegisterByName("XMM0"));
+  sig.vector_return_value = arch->RegisterByName("XMM0");
+  auto native_func = remill::CreateNativeFunction(
+      arch, manager.traces[0x1000], 0x1000, sig);
+  ASSERT_NE(nullptr, native_func);
+
+  auto func_type = native_func->getFunctionType();
+  ASSERT_EQ(4U, func_type->getNumParams());
+  EXPECT_TRUE(func_type->getParamType(0)->isIntegerTy(64));
+  EXPECT_TRUE(func_type->getParamType(1)->isVectorTy());
+  auto ret_type = llvm::dyn_cast<llvm::StructType>(
+      func_type->getReturnType());
+  ASSERT_NE(nullptr, ret_type);
+  ASSERT_EQ(2U, ret_type->getNumElements());
+  EXPECT_TRUE(ret_type->getElementType(0)->isIntegerTy(64));
+  EXPECT_TRUE(ret_type->getElementType(1)->isVectorTy());
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include "remill/BC/TieredCompiler.h"
+
+#include "tests/BC/Lift.h"
+
+namespace {
+
+// Stands in for generated code. It is never called.
+static Memory *StubTrace(void *, uint64_t, Memory *memory) {
+  return memory;
+}
+
+// What the stub code generator was given.
+struct Generated {
+  std::string name;
+  bool has_own_context;  // Not the context of the lifted traces.
+  bool calls_error;  // Has a failure exit for its callees.
+  unsigned num_funcs;
+  std::vector<std::string> declared_funcs;
+};
+
+class TieredCompilerTest : public test::LiftTest {
+ protected:
+  void TearDown(void) override {
+    compiler.reset();
+  }
+
+  // Start compiling with a stub code generator that fails for the traces
+  // named in `failing`.
+  void Start(uint64_t hot_trace_threshold,
+             std::vector<std::string> failing={}) {
+    remill::TieredCompilerOptions options = {};
+    options.hot_trace_threshold = hot_trace_threshold;
+    compiler.reset(new remill::TieredCompiler(
+        &inst_lifter, &manager,
+        [=] (llvm::Module *trace_module, const std::string &name) {
+          Generate(trace_module, name);
+          for (const auto &failing_name : failing) {
+            if (name == failing_name) {
+              return static_cast<remill::NativeTrace>(nullptr);
+            }
+          }
+          return &StubTrace;
+        },
+        options));
+  }
+
+  void Generate(llvm::Module *trace_module, const std::string &name) {
+    Generated gen = {};
+    gen.name = name;
+    gen.has_own_context = &(trace_module->getContext()) != context.get();
+    for (auto &func : *trace_module) {
+      gen.num_funcs++;
+      if (func.isDeclaration()) {
+        gen.declared_funcs.push_back(func.getName().str());
+      }
+      if (func.getName() == "__remill_error") {
+        gen.calls_error = !func.use_empty();
+      }
+    }
+    std::lock_guard<std::mutex> locker(lock);
+    generated.push_back(gen);
+  }
+
+  // Wait for the background threads to re-optimize the trace at `pc`.
+  bool WaitForSecondTier(uint64_t pc) {
+    for (auto i = 0; i < 10000; ++i) {
+      if (2 == compiler->Tier(pc)) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+  }
+
+  std::vector<Generated> Generations(void) {
+    std::lock_guard<std::mutex> locker(lock);
+    return generated;
+  }
+
+  std::unique_ptr<remill::TieredCompiler> compiler;
+
+  std::mutex lock;
+  std::vector<Generated> generated;
+};
+
+}  // namespace
+
+TEST_F(TieredCompilerTest, CompilesFirstTierOnEntry) {
+  manager.AddCode(0x1000, "\xc3");  // ret
+  Start(1000);
+  EXPECT_EQ(0U, compiler->Tier(0x1000));
+  EXPECT_EQ(&StubTrace, compiler->Enter(0x1000));
+  EXPECT_EQ(&StubTrace, compiler->Enter(0x1000));
+  EXPECT_EQ(2U, compiler->ExecutionCount(0x1000));
+  EXPECT_EQ(1U, compiler->Tier(0x1000));
+
+  // Compiled once, in a module with only what the trace uses.
+  auto gens = Generations();
+  ASSERT_EQ(1U, gens.size());
+  EXPECT_EQ(manager.traces[0x1000]->getName().str(), gens[0].name);
+  EXPECT_TRUE(gens[0].has_own_context);
+  EXPECT_LT(gens[0].num_funcs, module->size());
+}
+
+TEST_F(TieredCompilerTest, ReoptimizesHotTraces) {
+  manager.AddCode(0x1000, "\xc3");  // ret
+  Start(3);
+  for (auto i = 0; i < 3; ++i) {
+    EXPECT_EQ(&StubTrace, compiler->Enter(0x1000));
+  }
+  ASSERT_TRUE(WaitForSecondTier(0x1000));
+  EXPECT_EQ(3U, compiler->ExecutionCount(0x1000));
+
+  // Queued only once, even though it stays hot.
+  compiler->Enter(0x1000);
+  auto gens = Generations();
+  ASSERT_EQ(2U, gens.size());
+  EXPECT_TRUE(gens[0].has_own_context);
+  EXPECT_TRUE(gens[1].has_own_context);
+  EXPECT_EQ(gens[0].name, gens[1].name);
+}
+
+// Calls to other traces go through their dispatch entries, with a failure
+// exit for callees that can't be compiled, and not to the callees directly.
+TEST_F(TieredCompilerTest, RedirectsTraceCalls) {
+  manager.AddCode(0x1000, std::string("\xe8\x0b\x00\x00\x00\xc3", 6));
+  manager.AddCode(0x1010, "\xc3");  // ret
+  Start(1000);
+  EXPECT_EQ(&StubTrace, compiler->Enter(0x1000));
+
+  auto gens = Generations();
+  ASSERT_EQ(1U, gens.size());
+  ASSERT_EQ(1U, manager.traces.count(0x1010));
+  const auto callee_name = manager.traces[0x1010]->getName().str();
+  for (const auto &name : gens[0].declared_funcs) {
+    EXPECT_NE(callee_name, name);
+  }
+  EXPECT_TRUE(gens[0].calls_error);
+
+  // The callee wasn't entered yet.
+  EXPECT_EQ(0U, compiler->ExecutionCount(0x1010));
+  EXPECT_EQ(0U, compiler->Tier(0x1010));
+}
+
+TEST_F(TieredCompilerTest, ReportsFailedCompilation) {
+  manager.AddCode(0x1000, "\xc3");  // ret
+  remill::TraceLifter(inst_lifter, manager).Lift(0x1000);
+  ASSERT_EQ(1U, manager.traces.count(0x1000));
+  Start(1000, {manager.traces[0x1000]->getName().str()});
+
+  EXPECT_EQ(nullptr, compiler->Enter(0x1000));
+  EXPECT_EQ(0U, compiler->Tier(0x1000));
+
+  // Tried again the next time.
+  EXPECT_EQ(nullptr, compiler->Enter(0x1000));
+  EXPECT_EQ(2U, Generations().size());
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <utime.h>
+
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallString.h>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "remill/BC/TraceObjectCache.h"
+#include "remill/OS/FileSystem.h"
+
+namespace {
+
+class TraceObjectCacheTest : public ::testing::Test {
+ protected:
+  void SetUp(void) override {
+    llvm::SmallString<128> path;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("remill-cache", path));
+    dir = path.str().str();
+  }
+
+  void TearDown(void) override {
+    std::vector<std::string> paths;
+    remill::ForEachFileInDirectory(dir, [&paths] (const std::string &path) {
+      paths.push_back(path);
+      return true;
+    });
+    for (const auto &path : paths) {
+      remill::RemoveFile(path);
+    }
+    llvm::sys::fs::remove(dir);
+  }
+
+  // Returns the contents of the object cached under `key`, or an empty
+  // string if there is none.
+  static std::string Find(remill::TraceObjectCache &cache,
+                          const std::string &key) {
+    auto obj = cache.Find(key);
+    return obj ? obj->getBuffer().str() : "";
+  }
+
+  std::string dir;
+};
+
+}  // namespace
+
+TEST_F(TraceObjectCacheTest, CountsHitsAndMisses) {
+  remill::TraceObjectCache cache(dir, 1024);
+  EXPECT_EQ("", Find(cache, "a"));
+  cache.Store("a", "1234");
+  EXPECT_EQ("1234", Find(cache, "a"));
+  EXPECT_EQ("", Find(cache, "../a"));  // Invalid keys always miss.
+  EXPECT_EQ(1U, cache.NumHits());
+  EXPECT_EQ(2U, cache.NumMisses());
+  EXPECT_EQ(4U, cache.Size());
+}
+
+TEST_F(TraceObjectCacheTest, EvictsLeastRecentlyUsed) {
+  remill::TraceObjectCache cache(dir, 8);
+  cache.Store("a", "1234");
+  cache.Store("b", "5678");
+  EXPECT_EQ("1234", Find(cache, "a"));
+  cache.Store("c", "abcd");
+
+  EXPECT_EQ(1U, cache.NumEvictions());
+  EXPECT_EQ(8U, cache.Size());
+  EXPECT_EQ("", Find(cache, "b"));
+  EXPECT_EQ("1234", Find(cache, "a"));
+  EXPECT_EQ("abcd", Find(cache, "c"));
+}
+
+// Replacing an object doesn't count its old size.
+TEST_F(TraceObjectCacheTest, ReplacesObjects) {
+  remill::TraceObjectCache cache(dir, 1024);
+  cache.Store("a", "1234");
+  cache.Store("a", "56");
+  EXPECT_EQ("56", Find(cache, "a"));
+  EXPECT_EQ(2U, cache.Size());
+}
+
+// The order of use survives a restart, and decides what is evicted when the
+// cache shrinks.
+TEST_F(TraceObjectCacheTest, ReloadsIndex) {
+  {
+    remill::TraceObjectCache cache(dir, 1024);
+    cache.Store("a", "1234");
+    cache.Store("b", "5678");
+    cache.Store("c", "abcd");
+    EXPECT_EQ("1234", Find(cache, "a"));
+  }
+
+  remill::TraceObjectCache cache(dir, 8);
+  EXPECT_EQ(1U, cache.NumEvictions());
+  EXPECT_EQ(8U, cache.Size());
+  EXPECT_EQ("", Find(cache, "b"));
+  EXPECT_EQ("1234", Find(cache, "a"));
+  EXPECT_EQ("abcd", Find(cache, "c"));
+}
+
+// Objects that aren't in the saved index are still found.
+TEST_F(TraceObjectCacheTest, ReloadsObjectsMissingFromIndex) {
+  {
+    remill::TraceObjectCache cache(dir, 1024);
+    cache.Store("a", "1234");
+  }
+  std::ofstream(dir + remill::PathSeparator() + "b.o") << "5678";
+
+  remill::TraceObjectCache cache(dir, 1024);
+  EXPECT_EQ(8U, cache.Size());
+  EXPECT_EQ("5678", Find(cache, "b"));
+}
+
+// Old temporary files, of writers that died, are removed, and don't count
+// towards the size of the cache.
+TEST_F(TraceObjectCacheTest, RemovesStaleTemporaryFiles) {
+  auto tmp_path = dir + remill::PathSeparator() + "a.o-12345678.tmp";
+  std::ofstream(tmp_path) << "1234";
+  ASSERT_TRUE(remill::FileExists(tmp_path));
+
+  struct utimbuf times = {};
+  times.actime = std::time(nullptr) - 2 * 60 * 60;
+  times.modtime = times.actime;
+  ASSERT_EQ(0, utime(tmp_path.c_str(), &times));
+
+  remill::TraceObjectCache cache(dir, 1024);
+  EXPECT_FALSE(remill::FileExists(tmp_path));
+  EXPECT_EQ(0U, cache.Size());
+  EXPECT_EQ("", Find(cache, "a"));
+}
+
+// New temporary files might belong to writers in other processes.
+TEST_F(TraceObjectCacheTest, KeepsRecentTemporaryFiles) {
+  auto tmp_path = dir + remill::PathSeparator() + "a.o-12345678.tmp";
+  std::ofstream(tmp_path) << "1234";
+
+  remill::TraceObjectCache cache(dir, 1024);
+  EXPECT_TRUE(remill::FileExists(tmp_path));
+  EXPECT_EQ(0U, cache.Size());
+  EXPECT_EQ("", Find(cache, "a"));
+}
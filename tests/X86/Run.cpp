@@ -123,6 +123,11 @@ uintptr_t gTestToRun = 0;
 // the same stack.
 uint8_t *gStackSwitcher = nullptr;
 
+#if LAZY_ARITH_FLAGS
+// Defined in the semantics, and compiled into the lifted tests.
+void __remill_materialize_flags(X86State &);
+#endif  // LAZY_ARITH_FLAGS
+
 // We need to capture the native flags state, and so we need a `PUSHFQ`.
 // Unfortunately, this will be done on the 'recording' stack (`gStack`) in
 // the native execution, and no corresponding operation like this is done in
@@ -395,6 +400,22 @@ Memory *__remill_async_hyper_call(X86State &, addr_t, Memory *) {
   abort();
 }
 
+static std::vector<addr_t> gShadowStack;
+
+Memory *__remill_shadow_stack_push(X86State &, addr_t ret_addr,
+                                   Memory *memory) {
+  gShadowStack.push_back(ret_addr);
+  return memory;
+}
+
+bool __remill_shadow_stack_pop(X86State &, addr_t ret_addr, Memory *) {
+  if (gShadowStack.empty() || gShadowStack.back() != ret_addr) {
+    return false;
+  }
+  gShadowStack.pop_back();
+  return true;
+}
+
 uint8_t __remill_undefined_8(void) {
   return 0;
 }
@@ -706,6 +727,14 @@ static void RunWithFlags(const test::TestInfo *info,
   native_state->gpr.rip.aword = 0;
 #endif
 
+#if LAZY_ARITH_FLAGS
+  // The lifted code may have left the flags of its last arithmetic
+  // instruction deferred.
+  __remill_materialize_flags(*lifted_state);
+  memset(&(native_state->flag_thunk), 0, sizeof(native_state->flag_thunk));
+  memset(&(lifted_state->flag_thunk), 0, sizeof(lifted_state->flag_thunk));
+#endif  // LAZY_ARITH_FLAGS
+
   // Copy the aflags state back into the rflags state.
   lifted_state->rflag.cf = lifted_state->aflag.cf;
   lifted_state->rflag.pf = lifted_state->aflag.pf;
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2018 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// #include <gflags/gflags.h>
+// #include <glog/logging.h>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+
+// DEFINE_string(bc_out, "", "Path to file where the handlers bitcode should "
+//                           "be saved.");
+std::string FLAGS_bc_out = "";
+
+namespace {
+
+// Type code of a value that is passed to a handler, or that is stored in a
+// variable of `__remill_basic_block`. These are the codes documented in
+// `remill/Interp/Interpreter.h`.
+static char TypeCode(llvm::Type *type) {
+  if (type->isPointerTy()) {
+    return 'p';
+  } else if (type->isFloatTy()) {
+    return 'f';
+  } else if (type->isDoubleTy()) {
+    return 'd';
+  } else if (auto int_type = llvm::dyn_cast<llvm::IntegerType>(type)) {
+    switch (int_type->getBitWidth()) {
+      case 8: return 'b';
+      case 16: return 'h';
+      case 32: return 'w';
+      case 64: return 'q';
+      default: return 'v';
+    }
+  } else {
+    return 'v';
+  }
+}
+
+// LLVM on AArch64 and on amd64 Windows converts things like `RnW<uint64_t>`,
+// which is a struct containing a `uint64_t *`, into a `uintptr_t` when they
+// are being passed as arguments.
+static llvm::Type *IntendedArgumentType(llvm::Argument *arg) {
+  for (auto user : arg->users()) {
+    if (auto cast_inst = llvm::dyn_cast<llvm::IntToPtrInst>(user)) {
+      return cast_inst->getType();
+    }
+  }
+  return arg->getType();
+}
+
+// Convert the 64-bit operand `val` into a value of type `type`. Returns
+// `nullptr` if operands of this type can't be passed in 64 bits.
+static llvm::Value *ConvertOperand(llvm::IRBuilder<> &ir, llvm::Value *val,
+                                   llvm::Type *type) {
+  auto &context = type->getContext();
+  if (type->isPointerTy()) {
+    return ir.CreateIntToPtr(val, type);
+
+  } else if (type->isFloatTy()) {
+    return ir.CreateBitCast(
+        ir.CreateTrunc(val, llvm::Type::getInt32Ty(context)), type);
+
+  } else if (type->isDoubleTy()) {
+    return ir.CreateBitCast(val, type);
+
+  } else if (auto int_type = llvm::dyn_cast<llvm::IntegerType>(type)) {
+    if (int_type->getBitWidth() < 64) {
+      return ir.CreateTrunc(val, type);
+    } else if (int_type->getBitWidth() == 64) {
+      return val;
+    }
+  }
+
+  return nullptr;
+}
+
+// Create a handler for the semantics function `sem`. The handler has the
+// uniform type `Memory *(Memory *, State *, const uint64_t *)`, and unpacks
+// the operands of `sem` from its third argument. Returns `nullptr` if some
+// operand of `sem` doesn't fit into 64 bits.
+static llvm::Function *CreateHandler(llvm::Function *sem,
+                                     std::string *arg_types) {
+  auto module = sem->getParent();
+  auto &context = module->getContext();
+  auto mem_ptr_type = remill::MemoryPointerType(module);
+  auto state_ptr_type = remill::StatePointerType(module);
+  auto ops_type = llvm::Type::getInt64PtrTy(context);
+
+  llvm::Type *param_types[] = {mem_ptr_type, state_ptr_type, ops_type};
+  auto handler_type = llvm::FunctionType::get(
+      mem_ptr_type, param_types, false);
+
+  auto handler = llvm::Function::Create(
+      handler_type, llvm::GlobalValue::InternalLinkage,
+      sem->getName() + ".handler", module);
+
+  auto block = llvm::BasicBlock::Create(context, "", handler);
+  llvm::IRBuilder<> ir(block);
+
+  auto sem_type = sem->getFunctionType();
+  std::vector<llvm::Value *> args;
+  args.push_back(remill::NthArgument(handler, 0));
+  args.push_back(ir.CreateBitCast(remill::NthArgument(handler, 1),
+                                  sem_type->getParamType(1)));
+
+  auto ops = remill::NthArgument(handler, 2);
+  arg_types->clear();
+
+  for (unsigned i = 2; i < sem_type->getNumParams(); ++i) {
+    auto param_type = sem_type->getParamType(i);
+    auto op = ir.CreateLoad(ir.CreateConstGEP1_32(ops, i - 2));
+    auto arg = ConvertOperand(ir, op, param_type);
+    if (!arg) {
+      handler->eraseFromParent();
+      return nullptr;
+    }
+    args.push_back(arg);
+    arg_types->push_back(TypeCode(IntendedArgumentType(
+        remill::NthArgument(sem, i))));
+  }
+
+  auto ret = ir.CreateCall(sem, args);
+  ir.CreateRet(ir.CreateBitCast(ret, mem_ptr_type));
+  return handler;
+}
+
+// Create a private string constant, and return a pointer to its first
+// character.
+static llvm::Constant *CreateString(llvm::Module *module,
+                                    const std::string &str) {
+  auto &context = module->getContext();
+  auto init = llvm::ConstantDataArray::getString(context, str, true);
+  auto var = new llvm::GlobalVariable(
+      *module, init->getType(), true, llvm::GlobalValue::PrivateLinkage,
+      init);
+  return llvm::ConstantExpr::getBitCast(
+      var, llvm::Type::getInt8PtrTy(context));
+}
+
+// Define an external, null-terminated table named `name`.
+static void CreateTable(llvm::Module *module, llvm::StructType *entry_type,
+                        std::vector<llvm::Constant *> &entries,
+                        const std::string &name) {
+  entries.push_back(llvm::Constant::getNullValue(entry_type));
+  auto table_type = llvm::ArrayType::get(entry_type, entries.size());
+  new llvm::GlobalVariable(
+      *module, table_type, true, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantArray::get(table_type, entries), name);
+}
+
+}  // namespace
+
+// Generates the instruction handlers, and the tables describing them, that
+// `remill::Interpreter` uses to execute code without lifting it. The output
+// bitcode is meant to be compiled into a native library, e.g. with
+// `clang -O3 -c`, when remill is built.
+int main(int argc, char *argv[]) {
+  // google::ParseCommandLineFlags(&argc, &argv, true);
+  // google::InitGoogleLogging(argv[0]);
+
+  // The command-line flags aren't parsed for us, so handle the one that the
+  // build passes to this tool.
+  for (auto i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const std::string flag = "--bc_out";
+    if (arg == flag && (i + 1) < argc) {
+      FLAGS_bc_out = argv[++i];
+    } else if (!arg.compare(0, flag.size() + 1, flag + "=")) {
+      FLAGS_bc_out = arg.substr(flag.size() + 1);
+    } else {
+      std::cerr << "Unrecognized argument " << arg << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (FLAGS_bc_out.empty()) {
+    std::cerr
+        << "Please specify an output bitcode file to --bc_out." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module(remill::LoadTargetSemantics(&context));
+  auto arch = remill::GetTargetArch();
+
+  auto i8_ptr_type = llvm::Type::getInt8PtrTy(context);
+  auto i32_type = llvm::Type::getInt32Ty(context);
+  auto i8_type = llvm::Type::getInt8Ty(context);
+
+  // Keep only the things that the handlers use.
+  for (auto used_name : {"llvm.used", "llvm.compiler.used"}) {
+    if (auto used = module->getGlobalVariable(used_name)) {
+      used->eraseFromParent();
+    }
+  }
+  for (auto &func : *module) {
+    if (!func.isDeclaration()) {
+      func.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+  for (auto &var : module->globals()) {
+    if (!var.isDeclaration()) {
+      var.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+
+  // Create one handler per semantics function, and describe it once per
+  // instruction that uses it.
+  llvm::Type *handler_info_fields[] = {i8_ptr_type, i8_ptr_type, i8_ptr_type};
+  auto handler_info_type = llvm::StructType::create(
+      context, handler_info_fields, "HandlerInfo");
+  std::vector<llvm::Constant *> handler_infos;
+  std::unordered_map<llvm::Function *, std::pair<llvm::Constant *,
+                                                 llvm::Constant *>> handlers;
+  std::vector<std::pair<std::string, llvm::Function *>> isels;
+
+  remill::ForEachISel(
+      module.get(), [&] (llvm::GlobalVariable *isel, llvm::Function *sem) {
+        if (sem && isel->getName().startswith("ISEL_")) {
+          isels.emplace_back(isel->getName().substr(5).str(), sem);
+        }
+      });
+
+  std::sort(isels.begin(), isels.end());
+
+  for (const auto &isel : isels) {
+    auto sem = isel.second;
+    auto handler_it = handlers.find(sem);
+    if (handler_it == handlers.end()) {
+      std::string arg_types;
+      llvm::Constant *handler = CreateHandler(sem, &arg_types);
+      llvm::Constant *types = nullptr;
+      if (handler) {
+        handler = llvm::ConstantExpr::getBitCast(handler, i8_ptr_type);
+        types = CreateString(module.get(), arg_types);
+      } else {
+        std::cerr
+            << "Not creating a handler for " << isel.first << " because "
+            << "some of its operands don't fit into 64 bits." << std::endl;
+      }
+      handler_it = handlers.emplace(
+          sem, std::make_pair(handler, types)).first;
+    }
+    if (!handler_it->second.first) {
+      continue;
+    }
+    llvm::Constant *fields[] = {CreateString(module.get(), isel.first),
+                                handler_it->second.first,
+                                handler_it->second.second};
+    handler_infos.push_back(
+        llvm::ConstantStruct::get(handler_info_type, fields));
+  }
+
+  CreateTable(module.get(), handler_info_type, handler_infos,
+              "__remill_interp_handlers");
+
+  // Describe the variables of `__remill_basic_block` that operands can name.
+  // Registers live in the `State` structure, and the other variables, e.g.
+  // `BRANCH_TAKEN`, live in the interpreter's scratch space.
+  llvm::Type *var_info_fields[] = {
+      i8_ptr_type, i32_type, i32_type, i8_type, i8_type};
+  auto var_info_type = llvm::StructType::create(
+      context, var_info_fields, "VariableInfo");
+  std::vector<llvm::Constant *> var_infos;
+  const llvm::DataLayout dl(module.get());
+  uint64_t scratch_size = 0;
+
+  for (auto &block : *remill::BasicBlockFunction(module.get())) {
+    for (auto &inst : block) {
+      auto ptr_type = llvm::dyn_cast<llvm::PointerType>(inst.getType());
+      if (!inst.hasName() || !ptr_type ||
+          !ptr_type->getElementType()->isSized()) {
+        continue;
+      }
+
+      auto name = inst.getName().str();
+      auto type = ptr_type->getElementType();
+      auto size = dl.getTypeAllocSize(type);
+      uint64_t offset = 0;
+      uint8_t in_state = 1;
+
+      if (auto reg = arch->RegisterByName(name)) {
+        offset = reg->offset;
+      } else if (llvm::isa<llvm::AllocaInst>(&inst)) {
+        const auto align = std::min<uint64_t>(16, size);
+        scratch_size = (scratch_size + align - 1) / align * align;
+        offset = scratch_size;
+        scratch_size += size;
+        in_state = 0;
+      } else {
+        continue;
+      }
+
+      llvm::Constant *fields[] = {
+          CreateString(module.get(), name),
+          llvm::ConstantInt::get(i32_type, offset),
+          llvm::ConstantInt::get(i32_type, size),
+          llvm::ConstantInt::get(i8_type, in_state),
+          llvm::ConstantInt::get(i8_type, TypeCode(type))};
+      var_infos.push_back(llvm::ConstantStruct::get(var_info_type, fields));
+    }
+  }
+
+  CreateTable(module.get(), var_info_type, var_infos,
+              "__remill_interp_variables");
+
+  if (!remill::StoreModuleToFile(module.get(), FLAGS_bc_out, true)) {
+    std::cerr
+        << "Could not save handlers bitcode to " << FLAGS_bc_out << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
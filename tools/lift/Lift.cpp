@@ -24,6 +24,7 @@
 #include <sstream>
 #include <string>
 #include <system_error>
+#include <vector>
 
 // #include <gflags/gflags.h>
 // #include <glog/logging.h>
@@ -36,6 +37,7 @@
 #include <llvm/IR/Type.h>
 
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <remill/Arch/Arch.h>
@@ -44,6 +46,7 @@
 #include <remill/BC/IntrinsicTable.h>
 #include <remill/BC/Lifter.h>
 #include <remill/BC/Optimizer.h>
+#include <remill/BC/Signature.h>
 #include <remill/BC/Util.h>
 #include <remill/OS/OS.h>
 
@@ -56,21 +59,199 @@ uint64_t FLAGS_address = 0;
 //                                 "Defaults to the value of --address.");
 uint64_t FLAGS_entry_address = 0;
 
+// DEFINE_string(entry_addresses, "", "Comma-separated list of hexadecimal "
+//                                    "addresses of additional entrypoints.");
+std::string FLAGS_entry_addresses = "";
+
+// DEFINE_string(entry_list, "", "Path to a file containing the hexadecimal "
+//                               "addresses of additional entrypoints, one "
+//                               "per line.");
+std::string FLAGS_entry_list = "";
+
 // DEFINE_string(bytes, "", "Hex-encoded byte string to lift.");
 std::string FLAGS_bytes = "";
 
+// DEFINE_string(binary_file, "", "Path to a file containing the raw bytes to "
+//                                "lift. Alternative to --bytes.");
+std::string FLAGS_binary_file = "";
+
+// DEFINE_uint64(offset, 0, "Offset of the first byte in --binary_file to "
+//                          "lift. This byte is located at --address.");
+uint64_t FLAGS_offset = 0;
+
+// DEFINE_uint64(size, 0, "Number of bytes in --binary_file to lift. Defaults "
+//                        "to everything after --offset.");
+uint64_t FLAGS_size = 0;
+
+// DEFINE_bool(native_functions, false,
+//             "Also create a `.native` version of each lifted function whose "
+//             "signature can be recovered, which takes its arguments and "
+//             "returns its return value using the default calling convention "
+//             "of the target architecture.");
+bool FLAGS_native_functions = false;
+
+// DEFINE_bool(print_duplication, false,
+//             "Print the fraction of lifted instructions that were lifted "
+//             "into more than one trace.");
+bool FLAGS_print_duplication = false;
+
+// DEFINE_bool(eliminate_fpu_exception_checks, false,
+//             "Assume that the lifted code never reads the floating point "
+//             "exception status flags, and optimize floating point code "
+//             "accordingly.");
+bool FLAGS_eliminate_fpu_exception_checks = false;
+
+// DEFINE_bool(inline_small_traces, false,
+//             "Inline small lifted traces into the traces that call them.");
+bool FLAGS_inline_small_traces = false;
+
+// DEFINE_bool(promote_state_to_ssa, false,
+//             "Cache registers in SSA values across each lifted trace.");
+bool FLAGS_promote_state_to_ssa = false;
+
+// DEFINE_bool(recover_stack_frames, false,
+//             "Turn the guest stack frames of leaf functions into native "
+//             "stack frames. Needs --promote_state_to_ssa.");
+bool FLAGS_recover_stack_frames = false;
+
+// DEFINE_bool(coalesce_memory_accesses, false,
+//             "Merge adjacent narrow memory accesses into wider ones.");
+bool FLAGS_coalesce_memory_accesses = false;
+
+// DEFINE_bool(disambiguate_memory_accesses, false,
+//             "Forward and hoist memory reads past writes that provably "
+//             "don't alias them.");
+bool FLAGS_disambiguate_memory_accesses = false;
+
+// DEFINE_bool(read_only_input, false,
+//             "Treat the input bytes as read-only memory, and fold reads of "
+//             "them into constants.");
+bool FLAGS_read_only_input = false;
+
 // DEFINE_string(ir_out, "", "Path to file where the LLVM IR should be saved.");
 // DEFINE_string(bc_out, "", "Path to file where the LLVM bitcode should be "
 //                           "saved.");
 std::string FLAGS_ir_out = "";
 std::string FLAGS_bc_out = "";
 
-using Memory = std::map<uint64_t, uint8_t>;
+extern std::string FLAGS_arch;
+extern std::string FLAGS_os;
+// DECLARE_string(arch);
+// DECLARE_string(os);
+
+// The command-line flags aren't parsed for us, so parse them here. Flags are
+// passed as `--name value` or `--name=value`. Boolean flags can also be passed
+// as `--name` or `--noname`.
+static bool ParseCommandLine(int argc, char *argv[]) {
+  const std::map<std::string, std::string *> string_flags = {
+    {"arch", &FLAGS_arch},
+    {"os", &FLAGS_os},
+    {"entry_addresses", &FLAGS_entry_addresses},
+    {"entry_list", &FLAGS_entry_list},
+    {"bytes", &FLAGS_bytes},
+    {"binary_file", &FLAGS_binary_file},
+    {"ir_out", &FLAGS_ir_out},
+    {"bc_out", &FLAGS_bc_out},
+  };
+
+  const std::map<std::string, uint64_t *> uint64_flags = {
+    {"address", &FLAGS_address},
+    {"entry_address", &FLAGS_entry_address},
+    {"offset", &FLAGS_offset},
+    {"size", &FLAGS_size},
+  };
+
+  const std::map<std::string, bool *> bool_flags = {
+    {"native_functions", &FLAGS_native_functions},
+    {"print_duplication", &FLAGS_print_duplication},
+    {"eliminate_fpu_exception_checks", &FLAGS_eliminate_fpu_exception_checks},
+    {"inline_small_traces", &FLAGS_inline_small_traces},
+    {"promote_state_to_ssa", &FLAGS_promote_state_to_ssa},
+    {"recover_stack_frames", &FLAGS_recover_stack_frames},
+    {"coalesce_memory_accesses", &FLAGS_coalesce_memory_accesses},
+    {"disambiguate_memory_accesses", &FLAGS_disambiguate_memory_accesses},
+    {"read_only_input", &FLAGS_read_only_input},
+  };
+
+  for (auto i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.size() <= 2 || arg.compare(0, 2, "--")) {
+      std::cerr << "Unrecognized argument " << arg << std::endl;
+      return false;
+    }
+
+    auto name = arg.substr(2);
+    std::string val;
+    const auto eq_pos = name.find('=');
+    const auto has_val = std::string::npos != eq_pos;
+    if (has_val) {
+      val = name.substr(eq_pos + 1);
+      name.resize(eq_pos);
+    }
+
+    auto bool_it = bool_flags.find(name);
+    if (bool_it != bool_flags.end()) {
+      if (!has_val || "true" == val || "1" == val) {
+        *(bool_it->second) = true;
+      } else if ("false" == val || "0" == val) {
+        *(bool_it->second) = false;
+      } else {
+        std::cerr
+            << "Invalid value '" << val << "' passed to --" << name << "."
+            << std::endl;
+        return false;
+      }
+      continue;
+    }
+
+    if (!has_val && !name.compare(0, 2, "no")) {
+      bool_it = bool_flags.find(name.substr(2));
+      if (bool_it != bool_flags.end()) {
+        *(bool_it->second) = false;
+        continue;
+      }
+    }
+
+    auto string_it = string_flags.find(name);
+    auto uint64_it = uint64_flags.find(name);
+    if (string_it == string_flags.end() && uint64_it == uint64_flags.end()) {
+      std::cerr << "Unrecognized argument " << arg << std::endl;
+      return false;
+    }
+
+    if (!has_val) {
+      if ((i + 1) >= argc) {
+        std::cerr << "Missing value for --" << name << "." << std::endl;
+        return false;
+      }
+      val = argv[++i];
+    }
+
+    if (string_it != string_flags.end()) {
+      *(string_it->second) = val;
+      continue;
+    }
+
+    // Like `gflags`, accept decimal, or hexadecimal with a leading `0x`.
+    char *parsed_to = nullptr;
+    *(uint64_it->second) = strtoull(val.c_str(), &parsed_to, 0);
+    if (val.empty() || parsed_to != &(val.c_str()[val.size()])) {
+      std::cerr
+          << "Invalid value '" << val << "' passed to --" << name << "."
+          << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Contiguous bytes to lift, starting at `--address`.
+using Memory = std::unique_ptr<llvm::MemoryBuffer>;
 
-// Unhexlify the data passed to `--bytes`, and fill in `memory` with each
-// such byte.
-static Memory UnhexlifyInputBytes(uint64_t addr_mask) {
-  Memory memory;
+// Unhexlify the data passed to `--bytes` into a buffer.
+static Memory UnhexlifyInputBytes(void) {
+  std::string bytes;
+  bytes.reserve(FLAGS_bytes.size() / 2);
 
   for (size_t i = 0; i < FLAGS_bytes.size(); i += 2) {
     char nibbles[] = {FLAGS_bytes[i], FLAGS_bytes[i + 1], '\0'};
@@ -84,36 +265,114 @@ static Memory UnhexlifyInputBytes(uint64_t addr_mask) {
       exit(EXIT_FAILURE);
     }
 
-    auto byte_addr = FLAGS_address + (i / 2);
-    auto masked_addr = byte_addr & addr_mask;
+    bytes.push_back(static_cast<char>(byte_val));
+  }
+
+  return Memory(llvm::MemoryBuffer::getMemBufferCopy(bytes, "bytes"));
+}
+
+// Map the bytes of `--binary_file` that are selected by `--offset` and
+// `--size` into memory.
+static Memory MapInputFile(void) {
+  uint64_t file_size = 0;
+  if (auto ec = llvm::sys::fs::file_size(FLAGS_binary_file, file_size)) {
+    std::cerr
+        << "Could not open " << FLAGS_binary_file << " passed to "
+        << "--binary_file: " << ec.message() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (FLAGS_offset > file_size ||
+      FLAGS_size > (file_size - FLAGS_offset)) {
+    std::cerr
+        << "Values passed to --offset and --size are out of bounds of "
+        << FLAGS_binary_file << ", which is " << file_size << " bytes long."
+        << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (!FLAGS_size) {
+    FLAGS_size = file_size - FLAGS_offset;
+  }
+
+  auto maybe_buffer = llvm::MemoryBuffer::getFileSlice(
+      FLAGS_binary_file, FLAGS_size, FLAGS_offset);
+  if (!maybe_buffer) {
+    std::cerr
+        << "Could not map " << FLAGS_binary_file << " passed to "
+        << "--binary_file: " << maybe_buffer.getError().message() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  return std::move(maybe_buffer.get());
+}
+
+// Parse a hexadecimal address, with or without a leading `0x`.
+static bool ParseAddress(const std::string &str, uint64_t *addr) {
+  char *parsed_to = nullptr;
+  *addr = strtoull(str.c_str(), &parsed_to, 16);
+  return !str.empty() && parsed_to == &(str.c_str()[str.size()]);
+}
+
+// Collect the entrypoints from `--entry_address`, `--entry_addresses`, and
+// `--entry_list`.
+static std::vector<uint64_t> GetEntryAddresses(void) {
+  std::vector<uint64_t> entries;
+  if (FLAGS_entry_address) {
+    entries.push_back(FLAGS_entry_address);
+  }
 
-    // Make sure that if a really big number is specified for `--address`,
-    // that we don't accidentally wrap around and start filling out low
-    // byte addresses.
-    if (masked_addr < byte_addr) {
+  std::stringstream ss(FLAGS_entry_addresses);
+  for (std::string str; std::getline(ss, str, ',');) {
+    uint64_t addr = 0;
+    if (!ParseAddress(str, &addr)) {
       std::cerr
-          << "Too many bytes specified to --bytes, would result "
-          << "in a 32-bit overflow.";
+          << "Invalid address '" << str << "' passed to --entry_addresses."
+          << std::endl;
       exit(EXIT_FAILURE);
+    }
+    entries.push_back(addr);
+  }
 
-    } else if (masked_addr < FLAGS_address) {
+  if (!FLAGS_entry_list.empty()) {
+    std::ifstream file(FLAGS_entry_list);
+    if (!file) {
       std::cerr
-          << "Too many bytes specified to --bytes, would result "
-          << "in a 64-bit overflow.";
+          << "Could not open " << FLAGS_entry_list << " passed to "
+          << "--entry_list." << std::endl;
       exit(EXIT_FAILURE);
     }
 
-    memory[byte_addr] = static_cast<uint8_t>(byte_val);
+    // Blank lines, and lines starting with `#`, are ignored.
+    for (std::string line; std::getline(file, line);) {
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      line.erase(0, line.find_first_not_of(" \t"));
+      if (line.empty() || '#' == line[0]) {
+        continue;
+      }
+
+      uint64_t addr = 0;
+      if (!ParseAddress(line, &addr)) {
+        std::cerr
+            << "Invalid address '" << line << "' in " << FLAGS_entry_list
+            << " passed to --entry_list." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      entries.push_back(addr);
+    }
   }
 
-  return memory;
+  if (entries.empty()) {
+    entries.push_back(FLAGS_address);
+  }
+  return entries;
 }
 
 class SimpleTraceManager : public remill::TraceManager {
  public:
   virtual ~SimpleTraceManager(void) = default;
 
-  explicit SimpleTraceManager(Memory &memory_)
+  explicit SimpleTraceManager(const llvm::MemoryBuffer &memory_)
       : memory(memory_) {}
 
  protected:
@@ -151,17 +410,23 @@ class SimpleTraceManager : public remill::TraceManager {
   // at address `addr` is executable and readable, and updates the byte
   // pointed to by `byte` with the read value.
   bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override {
-    auto byte_it = memory.find(addr);
-    if (byte_it != memory.end()) {
-      *byte = byte_it->second;
+    const auto offset = addr - FLAGS_address;
+    if (addr >= FLAGS_address && offset < memory.getBufferSize()) {
+      *byte = static_cast<uint8_t>(memory.getBufferStart()[offset]);
       return true;
     } else {
       return false;
     }
   }
 
+  // Try to read a byte of read-only memory. The input bytes are read-only
+  // if `--read_only_input` is set.
+  bool TryReadReadOnlyByte(uint64_t addr, uint8_t *byte) override {
+    return FLAGS_read_only_input && TryReadExecutableByte(addr, byte);
+  }
+
  public:
-  Memory &memory;
+  const llvm::MemoryBuffer &memory;
   std::unordered_map<uint64_t, llvm::Function *> traces;
 };
 
@@ -169,9 +434,14 @@ int main(int argc, char *argv[]) {
   // google::ParseCommandLineFlags(&argc, &argv, true);
   // google::InitGoogleLogging(argv[0]);
 
-  if (FLAGS_bytes.empty()) {
+  if (!ParseCommandLine(argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  if (FLAGS_bytes.empty() == FLAGS_binary_file.empty()) {
     std::cerr
-        << "Please specify a sequence of hex bytes to --bytes." << std::endl;
+        << "Please specify either a sequence of hex bytes to --bytes, or a "
+        << "file to --binary_file." << std::endl;
     return EXIT_FAILURE;
   }
 
@@ -181,11 +451,14 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  if (!FLAGS_entry_address) {
-    FLAGS_entry_address = FLAGS_address;
+  if ((FLAGS_offset || FLAGS_size) && FLAGS_binary_file.empty()) {
+    std::cerr
+        << "The --offset and --size options only apply to --binary_file."
+        << std::endl;
+    return EXIT_FAILURE;
   }
 
-  // Make sure `--address` and `--entry_address` are in-bounds for the target
+  // Make sure `--address` and the entrypoints are in-bounds for the target
   // architecture's address size.
   auto arch = remill::GetTargetArch();
   const uint64_t addr_mask = ~0ULL >> (64UL - arch->address_size);
@@ -197,33 +470,93 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  if (FLAGS_entry_address != (FLAGS_entry_address & addr_mask)) {
-    std::cerr
-        << "Value " << std::hex << FLAGS_entry_address
-        << " passed to --entry_address does not fit into 32-bits. Did mean"
-        << " to specify a 64-bit architecture to --arch?" << std::endl;
-    return EXIT_FAILURE;
+  const auto entries = GetEntryAddresses();
+  for (auto entry : entries) {
+    if (entry != (entry & addr_mask)) {
+      std::cerr
+          << "Entry address " << std::hex << entry
+          << " does not fit into 32-bits. Did mean"
+          << " to specify a 64-bit architecture to --arch?" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  Memory memory = FLAGS_bytes.empty() ? MapInputFile() : UnhexlifyInputBytes();
+
+  // Make sure that if a really big number is specified for `--address`,
+  // that we don't accidentally wrap around and start reading bytes at low
+  // addresses.
+  const uint64_t memory_size = memory->getBufferSize();
+  if (memory_size) {
+    const auto last_addr = FLAGS_address + (memory_size - 1);
+    if (last_addr < FLAGS_address) {
+      std::cerr
+          << "Too many bytes specified to lift, would result "
+          << "in a 64-bit overflow." << std::endl;
+      return EXIT_FAILURE;
+
+    } else if (last_addr != (last_addr & addr_mask)) {
+      std::cerr
+          << "Too many bytes specified to lift, would result "
+          << "in a 32-bit overflow." << std::endl;
+      return EXIT_FAILURE;
+    }
   }
 
   llvm::LLVMContext context;
   std::unique_ptr<llvm::Module> module(remill::LoadTargetSemantics(&context));
 
-  Memory memory = UnhexlifyInputBytes(addr_mask);
-  SimpleTraceManager manager(memory);
+  SimpleTraceManager manager(*memory);
   remill::IntrinsicTable intrinsics(module);
   remill::InstructionLifter inst_lifter(arch, intrinsics);
   remill::TraceLifter trace_lifter(inst_lifter, manager);
 
-  // Lift all discoverable traces starting from `--entry_address` into
-  // `module`.
-  trace_lifter.Lift(FLAGS_entry_address);
+  // Lift all discoverable traces starting from each entrypoint into
+  // `module`. Traces that are reachable from several entrypoints are only
+  // lifted once.
+  for (auto entry : entries) {
+    trace_lifter.Lift(entry);
+  }
+
+  if (FLAGS_print_duplication) {
+    std::cerr
+        << "Duplicated instruction ratio: "
+        << trace_lifter.DuplicatedInstructionRatio() << std::endl;
+  }
 
   // Optimize the module, but with a particular focus on only the functions
   // that we actually lifted.
   remill::OptimizationGuide guide = {};
   guide.eliminate_dead_stores = true;
+  guide.eliminate_fpu_exception_checks = FLAGS_eliminate_fpu_exception_checks;
+  guide.inline_small_traces = FLAGS_inline_small_traces;
+  guide.promote_state_to_ssa = FLAGS_promote_state_to_ssa;
+  guide.recover_stack_frames = FLAGS_recover_stack_frames;
+  guide.coalesce_memory_accesses = FLAGS_coalesce_memory_accesses;
+  guide.disambiguate_memory_accesses = FLAGS_disambiguate_memory_accesses;
+  if (FLAGS_read_only_input) {
+    remill::TraceManager *base_manager = &manager;
+    guide.read_only_byte = [base_manager] (uint64_t addr, uint8_t *byte) {
+      return base_manager->TryReadReadOnlyByte(addr, byte);
+    };
+  }
   remill::OptimizeModule(module, manager.traces, guide);
 
+  // Create native entrypoints for the lifted functions, and optimize them,
+  // which turns their arguments and return values into SSA values.
+  std::vector<llvm::Function *> native_funcs;
+  if (FLAGS_native_functions) {
+    for (auto &lifted_entry : manager.traces) {
+      remill::FunctionSignature sig = {};
+      if (remill::RecoverFunctionSignature(
+              arch, lifted_entry.second, &sig)) {
+        native_funcs.push_back(remill::CreateNativeFunction(
+            arch, lifted_entry.second, lifted_entry.first, sig));
+      }
+    }
+    remill::OptimizeModule(module, native_funcs);
+  }
+
   // Create a new module in which we will move all the lifted functions. Prepare
   // the module for code of this architecture, i.e. set the data layout, triple,
   // etc.
@@ -237,6 +570,9 @@ int main(int argc, char *argv[]) {
   for (auto &lifted_entry : manager.traces) {
     remill::MoveFunctionIntoModule(lifted_entry.second, &dest_module);
   }
+  for (auto native_func : native_funcs) {
+    remill::MoveFunctionIntoModule(native_func, &dest_module);
+  }
 
   int ret = EXIT_SUCCESS;
 